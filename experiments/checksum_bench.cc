@@ -0,0 +1,199 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright  
+ *     notice, this list of conditions and the following disclaimer in the 
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE   
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  Internet checksum benchmark.
+ *
+ *  Links against GXemul's src/net/net_checksum.o (so build GXemul first).
+ *  First checks that all checksum implementations which the host supports
+ *  give the same results as the old 16-bit loop (copied below), for all
+ *  lengths up to 2048 bytes and different alignments. Then measures the
+ *  time per packet for typical packet sizes.
+ *
+ *  Usage:  ./checksum_bench [megabytes per size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <inttypes.h>
+
+#include "net.h"
+
+
+static const char *impls[] = { "generic", "sse2", "avx2", "neon", NULL };
+static const int sizes[] = { 20, 64, 576, 1460, 1500, 9000, 0 };
+
+/*  Keeps the compiler from optimizing away the benchmark loops:  */
+static volatile uint32_t sink;
+
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+/*
+ *  The checksum loop used by net_ip_checksum() before net_checksum.c, with
+ *  the checksum field (here at offset 0) skipped. For odd lengths, the last
+ *  byte is padded with zero, like net_ip_tcp_checksum() did.
+ */
+static uint16_t old_checksum(unsigned char *buf, int len)
+{
+	int i;
+	uint32_t sum = 0;
+
+	for (i=0; i<len; i+=2)
+		if (i != 0) {
+			uint16_t w = (buf[i] << 8) +
+			    (i + 1 < len? buf[i+1] : 0);
+			sum += w;
+			while (sum > 65535) {
+				int to_add = sum >> 16;
+				sum = (sum & 0xffff) + to_add;
+			}
+		}
+
+	return sum ^ 0xffff;
+}
+
+
+static uint16_t new_checksum(unsigned char *buf, int len)
+{
+	/*  The field at offset 0 is skipped, as above:  */
+	return net_checksum_finish(net_checksum_partial(buf + 2, len - 2, 0));
+}
+
+
+static void verify(unsigned char *buf)
+{
+	int ofs, len, i;
+
+	for (i=0; i<4096 + 16; i++)
+		buf[i] = random();
+
+	/*  All ones, to test the carries:  */
+	memset(buf + 4096 + 16, 0xff, 2048 + 16);
+
+	for (ofs=0; ofs<16; ofs++)
+		for (len=2; len<=2048; len++) {
+			unsigned char *p = buf + ofs;
+			if (new_checksum(p, len) != old_checksum(p, len)) {
+				printf("%s: mismatch at offset %i, length %i\n",
+				    net_checksum_name(), ofs, len);
+				exit(1);
+			}
+			p = buf + 4096 + 16 + ofs;
+			if (new_checksum(p, len) != old_checksum(p, len)) {
+				printf("%s: mismatch for all ones, length %i\n",
+				    net_checksum_name(), len);
+				exit(1);
+			}
+		}
+}
+
+
+static void verify_adjust(unsigned char *buf)
+{
+	int i;
+
+	for (i=0; i<100000; i++) {
+		int len = 40 + random() % 1460;
+		int ofs = 2 + ((random() % (len - 6)) & ~1);
+		unsigned char old_word[4], csum[2];
+		uint16_t c;
+
+		buf[random() % len] = random();
+		c = new_checksum(buf, len);
+		csum[0] = c >> 8; csum[1] = c;
+
+		memcpy(old_word, buf + ofs, 4);
+		buf[ofs + (random() & 3)] = random();
+		net_checksum_adjust(csum, old_word, buf + ofs, 4);
+
+		c = new_checksum(buf, len);
+		if (csum[0] != (c >> 8) || csum[1] != (c & 0xff)) {
+			printf("net_checksum_adjust() mismatch\n");
+			exit(1);
+		}
+	}
+}
+
+
+static double bench(uint16_t (*f)(unsigned char *, int),
+	unsigned char *buf, int size, int64_t total)
+{
+	uint16_t (*volatile fp)(unsigned char *, int) = f;
+	int64_t n = total / size, i;
+	uint32_t x = 0;
+	double t0 = now();
+
+	for (i=0; i<n; i++) {
+		buf[2] = i;
+		x += fp(buf, size);
+	}
+	sink = x;
+
+	return (now() - t0) / n * 1e9;
+}
+
+
+int main(int argc, char *argv[])
+{
+	unsigned char *buf = (unsigned char *) malloc(8192);
+	int64_t total = (argc > 1? atoi(argv[1]) : 200) * 1048576LL;
+	int i, j;
+
+	verify_adjust(buf);
+
+	for (i=0; impls[i] != NULL; i++)
+		if (net_checksum_use(impls[i]))
+			verify(buf);
+
+	printf("%-8s", "bytes");
+	printf("%14s", "old loop");
+	for (i=0; impls[i] != NULL; i++)
+		if (net_checksum_use(impls[i]))
+			printf("%14s", impls[i]);
+	printf("\n");
+
+	for (j=0; sizes[j] != 0; j++) {
+		printf("%-8i", sizes[j]);
+		printf("%11.1f ns", bench(old_checksum, buf + 1, sizes[j],
+		    total / 4));
+		for (i=0; impls[i] != NULL; i++)
+			if (net_checksum_use(impls[i]))
+				printf("%11.1f ns", bench(new_checksum,
+				    buf + 1, sizes[j], total));
+		printf("\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,215 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright  
+ *     notice, this list of conditions and the following disclaimer in the 
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE   
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *
+ *  Memory mapped device lookup benchmark.
+ *
+ *  Compares the old way of finding a device in MEMORY_RW (try the last
+ *  accessed device, then binary search) with the direct-mapped device page
+ *  index. The access pattern alternates between a few devices (as when a
+ *  guest OS polls an interrupt controller, a timer, and a serial port), with
+ *  some accesses falling into the gaps between devices.
+ *
+ *  Usage:  ./device_lookup_bench [n_devices [n_iterations]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <inttypes.h>
+
+
+struct device {
+	uint64_t	baseaddr;
+	uint64_t	endaddr;
+};
+
+#define	INDEX_BITS	10
+#define	N_INDEX		(1 << INDEX_BITS)
+#define	INDEX_NONE	(-1)
+#define	INDEX_MULTIPLE	(-2)
+#define	PAGE_SHIFT	12
+
+struct index_entry {
+	uint64_t	page;
+	int		device;
+	int		partial;
+};
+
+static struct device *devices;
+static int n_devices;
+static int last_accessed_device;
+static struct index_entry index_table[N_INDEX];
+
+
+static int lookup_old(uint64_t paddr)
+{
+	int start = 0, end = n_devices - 1;
+	int i = last_accessed_device;
+
+	do {
+		if (paddr >= devices[i].baseaddr && paddr < devices[i].endaddr) {
+			last_accessed_device = i;
+			return i;
+		}
+		if (paddr < devices[i].baseaddr)
+			end = i - 1;
+		if (paddr >= devices[i].endaddr)
+			start = i + 1;
+		i = (start + end) >> 1;
+	} while (start <= end);
+
+	return -1;
+}
+
+
+static int find_first(uint64_t addr)
+{
+	int start = 0, end = n_devices;
+
+	while (start < end) {
+		int i = (start + end) >> 1;
+		if (devices[i].endaddr <= addr)
+			start = i + 1;
+		else
+			end = i;
+	}
+
+	return start;
+}
+
+
+static int lookup_index(uint64_t paddr)
+{
+	uint64_t page = paddr >> PAGE_SHIFT;
+	struct index_entry *e = &index_table[page & (N_INDEX - 1)];
+	int i;
+
+	if (e->page != page) {
+		uint64_t first = page << PAGE_SHIFT;
+		uint64_t last = first | ((1 << PAGE_SHIFT) - 1);
+
+		i = find_first(first);
+		e->page = page;
+		if (i >= n_devices || devices[i].baseaddr > last) {
+			e->device = INDEX_NONE;
+			e->partial = 0;
+		} else if (i + 1 < n_devices && devices[i+1].baseaddr <= last) {
+			e->device = INDEX_MULTIPLE;
+			e->partial = 1;
+		} else {
+			e->device = i;
+			e->partial = devices[i].baseaddr > first ||
+			    devices[i].endaddr - 1 < last;
+		}
+	}
+
+	i = e->device;
+	if (i == INDEX_MULTIPLE) {
+		i = find_first(paddr);
+		if (i >= n_devices || paddr < devices[i].baseaddr)
+			i = -1;
+	} else if (i >= 0 && e->partial && (paddr < devices[i].baseaddr
+	    || paddr >= devices[i].endaddr))
+		i = -1;
+
+	return i;
+}
+
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int i, n_iterations = 50000000, n_addrs = 8;
+	uint64_t addrs[8];
+	double t0, t_old, t_index;
+	long long sum_old = 0, sum_index = 0;
+
+	n_devices = argc > 1? atoi(argv[1]) : 40;
+	if (argc > 2)
+		n_iterations = atoi(argv[2]);
+	if (n_devices < 4) {
+		fprintf(stderr, "at least 4 devices are needed\n");
+		exit(1);
+	}
+
+	/*  Devices of 0x100 bytes each, spaced 64 KB apart:  */
+	devices = malloc(sizeof(struct device) * n_devices);
+	if (devices == NULL) {
+		perror("malloc");
+		exit(1);
+	}
+	for (i=0; i<n_devices; i++) {
+		devices[i].baseaddr = 0x1f000000ULL + i * 0x10000ULL;
+		devices[i].endaddr = devices[i].baseaddr + 0x100;
+	}
+
+	for (i=0; i<N_INDEX; i++)
+		index_table[i].page = (uint64_t) -1;
+
+	addrs[0] = devices[1].baseaddr + 0x10;
+	addrs[1] = devices[n_devices - 2].baseaddr + 0x20;
+	addrs[2] = devices[n_devices / 2].baseaddr + 0x30;
+	addrs[3] = devices[1].baseaddr + 0x14;
+	addrs[4] = devices[0].baseaddr + 0x1000;	/*  gap  */
+	addrs[5] = devices[n_devices - 1].baseaddr + 0x04;
+	addrs[6] = devices[n_devices / 3].baseaddr + 0x200;	/*  gap  */
+	addrs[7] = devices[n_devices / 2].baseaddr + 0x34;
+
+	t0 = now();
+	for (i=0; i<n_iterations; i++)
+		sum_old += lookup_old(addrs[i & (n_addrs - 1)]);
+	t_old = now() - t0;
+
+	t0 = now();
+	for (i=0; i<n_iterations; i++)
+		sum_index += lookup_index(addrs[i & (n_addrs - 1)]);
+	t_index = now() - t0;
+
+	if (sum_old != sum_index) {
+		fprintf(stderr, "MISMATCH: %lli vs %lli\n", sum_old, sum_index);
+		exit(1);
+	}
+
+	printf("%i devices, %i lookups:\n", n_devices, n_iterations);
+	printf("  last accessed + binary search: %.3f s (%.2f ns/lookup)\n",
+	    t_old, t_old * 1e9 / n_iterations);
+	printf("  device page index:             %.3f s (%.2f ns/lookup)\n",
+	    t_index, t_index * 1e9 / n_iterations);
+
+	return 0;
+}
+
@@ -0,0 +1,381 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright  
+ *     notice, this list of conditions and the following disclaimer in the 
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE   
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *
+ *  Converts a raw disk image, optionally with overlays on top of it, into a
+ *  GXD disk image (see src/include/diskimage_gxd.h). Clusters which are all
+ *  zeroes are not stored at all, and the others are compressed if that
+ *  saves at least 1/8 of the space.
+ *
+ *  With -b, only the clusters which differ from a raw backing image are
+ *  stored, and the GXD image refers to the backing image for the rest. This
+ *  way, many slightly different installs can share one large base image.
+ *  The backing file name is stored as given (or as set with -B). Relative
+ *  names are relative to the directory of the GXD image.
+ *
+ *  Usage:  ./gxdconvert [options] rawimage gxdimage
+ *
+ *	-b file		only store clusters which differ from this raw image
+ *	-B name		backing file name to store in the image (default: the
+ *			name given with -b)
+ *	-c bits		cluster size is 2^bits bytes (default 16)
+ *	-n		don't compress
+ *	-o overlay	add an overlay (with an overlay.map file), like the
+ *			V disk image prefix in the emulator; may be repeated
+ *
+ *  Example:
+ *
+ *	./gxdconvert netbsd-base.img netbsd-base.gxd
+ *	./gxdconvert -b netbsd-base.img -B netbsd-base.gxd \
+ *		-o netbsd-test1.img netbsd-base.img netbsd-test1.gxd
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "../src/include/diskimage_gxd.h"
+#include "../src/include/lz4_block.h"
+
+
+#define	OVERLAY_BLOCK_SIZE	512
+#define	MAX_OVERLAYS		16
+
+struct overlay {
+	int		fd;
+	unsigned char	*bitmap;
+	size_t		bitmap_len;
+};
+
+static struct overlay overlays[MAX_OVERLAYS];
+static int n_overlays = 0;
+
+
+static void put32(unsigned char *p, uint32_t x)
+{
+	p[0] = x; p[1] = x >> 8; p[2] = x >> 16; p[3] = x >> 24;
+}
+
+static void put64(unsigned char *p, uint64_t x)
+{
+	put32(p, x);
+	put32(p + 4, x >> 32);
+}
+
+
+static void write_or_die(int fd, unsigned char *buf, size_t len, off_t ofs)
+{
+	if (pwrite(fd, buf, len, ofs) != (ssize_t) len) {
+		perror("pwrite");
+		exit(1);
+	}
+}
+
+
+/*
+ *  read_raw():
+ *
+ *  Reads from a raw file. Anything beyond the end of the file reads as
+ *  zeroes.
+ */
+static void read_raw(int fd, unsigned char *buf, size_t len, off_t ofs)
+{
+	ssize_t res = pread(fd, buf, len, ofs);
+
+	if (res < 0) {
+		perror("pread");
+		exit(1);
+	}
+
+	memset(buf + res, 0, len - res);
+}
+
+
+/*
+ *  add_overlay():
+ *
+ *  Opens an overlay and reads its bitmap (basename.map).
+ */
+static void add_overlay(const char *basename)
+{
+	struct overlay *o = &overlays[n_overlays];
+	char *mapname = malloc(strlen(basename) + 5);
+	struct stat st;
+	int fd;
+
+	if (n_overlays >= MAX_OVERLAYS) {
+		fprintf(stderr, "too many overlays\n");
+		exit(1);
+	}
+
+	sprintf(mapname, "%s.map", basename);
+
+	o->fd = open(basename, O_RDONLY);
+	fd = open(mapname, O_RDONLY);
+	if (o->fd < 0 || fd < 0 || fstat(fd, &st) != 0) {
+		perror(o->fd < 0? basename : mapname);
+		exit(1);
+	}
+
+	o->bitmap_len = st.st_size;
+	o->bitmap = malloc(o->bitmap_len + 1);
+	read_raw(fd, o->bitmap, o->bitmap_len, 0);
+	close(fd);
+	free(mapname);
+
+	n_overlays ++;
+}
+
+
+/*
+ *  read_disk():
+ *
+ *  Reads from the disk as the emulator would see it: the raw image, with
+ *  blocks from overlays on top (the last overlay which has a block wins).
+ */
+static void read_disk(int fd, unsigned char *buf, size_t len, off_t ofs)
+{
+	off_t block;
+	int i;
+
+	read_raw(fd, buf, len, ofs);
+
+	for (block = ofs / OVERLAY_BLOCK_SIZE;
+	    block < (off_t) ((ofs + len) / OVERLAY_BLOCK_SIZE); block ++) {
+		for (i = n_overlays - 1; i >= 0; i--) {
+			struct overlay *o = &overlays[i];
+			if ((size_t)(block / 8) < o->bitmap_len &&
+			    o->bitmap[block / 8] & (1 << (block & 7))) {
+				read_raw(o->fd, buf + block * OVERLAY_BLOCK_SIZE
+				    - ofs, OVERLAY_BLOCK_SIZE,
+				    block * OVERLAY_BLOCK_SIZE);
+				break;
+			}
+		}
+	}
+}
+
+
+static int is_zero(const unsigned char *buf, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++)
+		if (buf[i] != 0)
+			return 0;
+
+	return 1;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int ch, fd_in, fd_out, fd_backing = -1, compress = 1;
+	int cluster_bits = GXD_DEFAULT_CLUSTER_BITS, l2_bits = GXD_DEFAULT_L2_BITS;
+	const char *backing_file = NULL, *backing_name = NULL;
+	unsigned char hdr[GXD_HEADER_SIZE], *cluster, *backing_cluster;
+	unsigned char *cbuf, *l1, *l2;
+	uint64_t size, n_clusters, cluster_nr, l2_offset = 0;
+	uint64_t n_stored = 0, n_compressed = 0, n_zero = 0;
+	uint32_t l1_entries, l2_entries;
+	size_t cluster_size, l2_len;
+	off_t file_end;
+	struct stat st;
+
+	while ((ch = getopt(argc, argv, "b:B:c:no:")) != -1) {
+		switch (ch) {
+		case 'b':
+			backing_file = optarg;
+			break;
+		case 'B':
+			backing_name = optarg;
+			break;
+		case 'c':
+			cluster_bits = atoi(optarg);
+			break;
+		case 'n':
+			compress = 0;
+			break;
+		case 'o':
+			add_overlay(optarg);
+			break;
+		default:
+			argc = 0;
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 2 || cluster_bits < GXD_MIN_CLUSTER_BITS ||
+	    cluster_bits > GXD_MAX_CLUSTER_BITS) {
+		fprintf(stderr, "usage: gxdconvert [-b backing] [-B name]"
+		    " [-c cluster_bits] [-n] [-o overlay ...] rawimage"
+		    " gxdimage\n");
+		fprintf(stderr, "cluster_bits must be between %i and %i.\n",
+		    GXD_MIN_CLUSTER_BITS, GXD_MAX_CLUSTER_BITS);
+		exit(1);
+	}
+
+	if (backing_name == NULL)
+		backing_name = backing_file;
+	if (backing_name != NULL && strlen(backing_name) > GXD_MAX_BACKING_LEN) {
+		fprintf(stderr, "backing file name too long\n");
+		exit(1);
+	}
+
+	fd_in = open(argv[0], O_RDONLY);
+	if (fd_in < 0 || fstat(fd_in, &st) != 0) {
+		perror(argv[0]);
+		exit(1);
+	}
+	size = st.st_size;
+
+	if (backing_file != NULL) {
+		fd_backing = open(backing_file, O_RDONLY);
+		if (fd_backing < 0) {
+			perror(backing_file);
+			exit(1);
+		}
+	}
+
+	fd_out = open(argv[1], O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd_out < 0) {
+		perror(argv[1]);
+		exit(1);
+	}
+
+	cluster_size = (size_t)1 << cluster_bits;
+	l2_entries = 1 << l2_bits;
+	l2_len = GXD_L2_ENTRY_SIZE * l2_entries;
+	n_clusters = (size + cluster_size - 1) >> cluster_bits;
+	l1_entries = (n_clusters + l2_entries - 1) >> l2_bits;
+
+	cluster = malloc(cluster_size);
+	backing_cluster = malloc(cluster_size);
+	cbuf = malloc(cluster_size);
+	l1 = calloc(l1_entries + 1, 8);
+	l2 = malloc(l2_len);
+
+	/*  The header and the L1 table come first:  */
+	file_end = GXD_HEADER_SIZE + 8 * (off_t) l1_entries;
+
+	for (cluster_nr = 0; cluster_nr < n_clusters; cluster_nr ++) {
+		uint32_t l2_index = cluster_nr & (l2_entries - 1);
+		unsigned char *entry = l2 + l2_index * GXD_L2_ENTRY_SIZE;
+		off_t ofs = cluster_nr << cluster_bits;
+		size_t clen = 0;
+
+		if (l2_index == 0) {
+			memset(l2, 0, l2_len);
+			l2_offset = 0;
+		}
+
+		read_disk(fd_in, cluster, cluster_size, ofs);
+		if (fd_backing >= 0) {
+			read_raw(fd_backing, backing_cluster, cluster_size, ofs);
+			if (memcmp(cluster, backing_cluster, cluster_size) == 0)
+				goto next;
+		}
+
+		if (is_zero(cluster, cluster_size)) {
+			if (fd_backing < 0)
+				goto next;
+			put32(entry + GXD_L2E_FLAGS, GXD_FLAG_ZERO);
+			n_zero ++;
+		} else {
+			if (compress)
+				clen = lz4_block_compress(cluster,
+				    cluster_size, cbuf,
+				    cluster_size - cluster_size / 8);
+
+			put64(entry + GXD_L2E_OFFSET, file_end);
+			put32(entry + GXD_L2E_CSIZE, clen);
+			if (clen > 0) {
+				write_or_die(fd_out, cbuf, clen, file_end);
+				file_end += clen;
+				n_compressed ++;
+			} else {
+				write_or_die(fd_out, cluster, cluster_size,
+				    file_end);
+				file_end += cluster_size;
+			}
+		}
+
+		n_stored ++;
+
+		/*  Reserve space for the L2 table (written when full):  */
+		if (l2_offset == 0) {
+			l2_offset = file_end;
+			file_end += l2_len;
+			put64(l1 + 8 * (cluster_nr >> l2_bits), l2_offset);
+		}
+
+next:
+		if (l2_offset != 0 && (l2_index == l2_entries - 1 ||
+		    cluster_nr == n_clusters - 1))
+			write_or_die(fd_out, l2, l2_len, l2_offset);
+	}
+
+	memset(hdr, 0, sizeof(hdr));
+	memcpy(hdr + GXD_HDR_MAGIC, GXD_MAGIC, GXD_MAGIC_LEN);
+	put32(hdr + GXD_HDR_VERSION, GXD_VERSION);
+	put32(hdr + GXD_HDR_CLUSTER_BITS, cluster_bits);
+	put64(hdr + GXD_HDR_SIZE, size);
+	put64(hdr + GXD_HDR_L1_OFFSET, GXD_HEADER_SIZE);
+	put32(hdr + GXD_HDR_L1_ENTRIES, l1_entries);
+	put32(hdr + GXD_HDR_L2_BITS, l2_bits);
+	put32(hdr + GXD_HDR_COMPRESSION, compress? GXD_COMPRESSION_LZ :
+	    GXD_COMPRESSION_NONE);
+	if (backing_name != NULL) {
+		put32(hdr + GXD_HDR_BACKING_LEN, strlen(backing_name));
+		memcpy(hdr + GXD_HDR_BACKING_NAME, backing_name,
+		    strlen(backing_name));
+	}
+
+	write_or_die(fd_out, hdr, GXD_HEADER_SIZE, 0);
+	write_or_die(fd_out, l1, 8 * (size_t) l1_entries, GXD_HEADER_SIZE);
+	if (ftruncate(fd_out, file_end) != 0) {
+		perror(argv[1]);
+		exit(1);
+	}
+	close(fd_out);
+
+	printf("%llu clusters of %llu bytes: %llu stored (%llu compressed,"
+	    " %llu zero)\n%llu bytes -> %llu bytes\n",
+	    (unsigned long long) n_clusters, (unsigned long long) cluster_size,
+	    (unsigned long long) n_stored, (unsigned long long) n_compressed,
+	    (unsigned long long) n_zero, (unsigned long long) size,
+	    (unsigned long long) file_end);
+
+	return 0;
+}
+
@@ -0,0 +1,256 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright  
+ *     notice, this list of conditions and the following disclaimer in the 
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE   
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *
+ *  MIPS TLB lookup benchmark.
+ *
+ *  Compares the linear TLB scan which translate_v2p used to do (starting at
+ *  the last written entry, and decoding each entry's page mask on the way)
+ *  with the VPN/ASID hashed index (struct mips_tlb_index). The TLB is filled
+ *  like it would be by a forking workload: several processes (ASIDs) using
+ *  the same user space virtual pages, plus a few global kernel entries.
+ *
+ *  Usage:  ./mips_tlb_lookup_bench [n_tlbs [n_iterations]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <inttypes.h>
+
+
+#define	ENTRYHI_VPN2_MASK	0x000000ffffffe000ULL
+#define	ENTRYHI_ASID		0xff
+#define	TLB_G			(1 << 12)
+#define	PAGEMASK_MASK		0x01ffe000
+#define	PAGEMASK_SHIFT		13
+
+#define	MAX_ENTRIES		64
+#define	N_BUCKETS		64
+#define	HASH(vpn,asid)		(((vpn) + ((asid) ^ ((asid) >> 6)) * 37) \
+				    & (N_BUCKETS - 1))
+
+#ifdef __GNUC__
+#define	FIRST_BIT(x)		__builtin_ctzll(x)
+#else
+static int FIRST_BIT(uint64_t x)
+{
+	int i = 0;
+	while (!(x & 1)) {
+		x >>= 1;
+		i ++;
+	}
+	return i;
+}
+#endif
+
+struct tlb {
+	uint64_t	hi;
+	uint64_t	mask;
+};
+
+static struct tlb tlbs[MAX_ENTRIES];
+static int n_tlbs;
+static int last_written_tlb_index;
+
+static uint64_t by_asid[N_BUCKETS];
+static uint64_t global[N_BUCKETS];
+static int n_vpn_shifts;
+static int vpn_shifts[32];
+
+
+static int match(int i, uint64_t vaddr, uint64_t asid)
+{
+	uint64_t pmask = tlbs[i].mask & PAGEMASK_MASK;
+	int pageshift;
+
+	if (pmask == 0)
+		pageshift = PAGEMASK_SHIFT - 1;
+	else {
+		switch (pmask | ((1 << PAGEMASK_SHIFT) - 1)) {
+		case 0x0007fff:	pageshift = 14; break;
+		case 0x001ffff:	pageshift = 16; break;
+		case 0x007ffff:	pageshift = 18; break;
+		case 0x01fffff:	pageshift = 20; break;
+		case 0x07fffff:	pageshift = 22; break;
+		case 0x1ffffff:	pageshift = 24; break;
+		default:	pageshift = 12;
+		}
+	}
+
+	return ((tlbs[i].hi & ENTRYHI_VPN2_MASK) >> (pageshift + 1)) ==
+	    ((vaddr & ENTRYHI_VPN2_MASK) >> (pageshift + 1)) &&
+	    ((tlbs[i].hi & ENTRYHI_ASID) == asid || (tlbs[i].hi & TLB_G));
+}
+
+
+static int lookup_scan(uint64_t vaddr, uint64_t asid)
+{
+	int i = last_written_tlb_index;
+	int i_end = i == 0? n_tlbs-1 : i - 1;
+
+	for (;;) {
+		if (match(i, vaddr, asid))
+			return i;
+		if (i == i_end)
+			return -1;
+		i ++;
+		if (i == n_tlbs)
+			i = 0;
+	}
+}
+
+
+static int lookup_index(uint64_t vaddr, uint64_t asid)
+{
+	uint64_t candidates = 0;
+	int i;
+
+	for (i = 0; i < n_vpn_shifts; i++) {
+		uint64_t vpn = vaddr >> vpn_shifts[i];
+		candidates |= global[HASH(vpn, 0)];
+		candidates |= by_asid[HASH(vpn, asid)];
+	}
+
+	while (candidates != 0) {
+		i = FIRST_BIT(candidates);
+		if (match(i, vaddr, asid))
+			return i;
+		candidates &= candidates - 1;
+	}
+
+	return -1;
+}
+
+
+static void add_to_index(int i)
+{
+	int vpn_shift = 13, is_global = tlbs[i].hi & TLB_G? 1 : 0;
+	uint64_t m = tlbs[i].mask | 0x1fff;
+
+	while (m > ((uint64_t)1 << vpn_shift) - 1)
+		vpn_shift += 2;
+
+	if (is_global)
+		global[HASH(tlbs[i].hi >> vpn_shift, 0)] |= (uint64_t)1 << i;
+	else
+		by_asid[HASH(tlbs[i].hi >> vpn_shift, tlbs[i].hi &
+		    ENTRYHI_ASID)] |= (uint64_t)1 << i;
+
+	for (i = 0; i < n_vpn_shifts; i++)
+		if (vpn_shifts[i] == vpn_shift)
+			return;
+	vpn_shifts[n_vpn_shifts++] = vpn_shift;
+}
+
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+int main(int argc, char *argv[])
+{
+	int i, n_iterations = 20000000, n_global = 4, n_asids = 8;
+	uint64_t vaddrs[256], asids[256];
+	double t0, t_scan, t_index;
+	long long sum_scan = 0, sum_index = 0;
+
+	n_tlbs = argc > 1? atoi(argv[1]) : 48;
+	if (argc > 2)
+		n_iterations = atoi(argv[2]);
+	if (n_tlbs < n_global + 1 || n_tlbs > MAX_ENTRIES) {
+		fprintf(stderr, "n_tlbs must be between %i and %i\n",
+		    n_global + 1, MAX_ENTRIES);
+		exit(1);
+	}
+
+	/*  A few global kernel entries with 16 MB pages:  */
+	for (i=0; i<n_global; i++) {
+		tlbs[i].hi = (0xc0000000ULL + i * 0x2000000ULL) | TLB_G;
+		tlbs[i].mask = 0x1ffe000;
+	}
+
+	/*  The rest are user pages, the same few pages in each process:  */
+	for (i=n_global; i<n_tlbs; i++) {
+		int asid = 1 + (i % n_asids);
+		int page = (i - n_global) / n_asids;
+		tlbs[i].hi = 0x400000ULL + page * 0x2000ULL + asid;
+		tlbs[i].mask = 0;
+	}
+
+	for (i=0; i<n_tlbs; i++)
+		add_to_index(i);
+	last_written_tlb_index = n_tlbs / 2;
+
+	/*  Mostly hits in the current process, some kernel accesses and
+	    some misses:  */
+	srandom(1);
+	for (i=0; i<256; i++) {
+		int asid = 1 + (i / 32) % n_asids;
+		switch (random() % 8) {
+		case 0:	vaddrs[i] = 0xc0000000ULL + (random() % n_global)
+			    * 0x2000000ULL + (random() & 0xffffff);
+			break;
+		case 1:	vaddrs[i] = 0x10000000ULL + (random() & 0xfffff000);
+			break;
+		default:vaddrs[i] = 0x400000ULL + (random() % ((n_tlbs -
+			    n_global) / n_asids + 1)) * 0x2000ULL;
+		}
+		asids[i] = asid;
+	}
+
+	t0 = now();
+	for (i=0; i<n_iterations; i++)
+		sum_scan += lookup_scan(vaddrs[i & 255], asids[i & 255]);
+	t_scan = now() - t0;
+
+	t0 = now();
+	for (i=0; i<n_iterations; i++)
+		sum_index += lookup_index(vaddrs[i & 255], asids[i & 255]);
+	t_index = now() - t0;
+
+	if (sum_scan != sum_index) {
+		fprintf(stderr, "MISMATCH: %lli vs %lli\n", sum_scan,
+		    sum_index);
+		exit(1);
+	}
+
+	printf("%i TLB entries, %i lookups:\n", n_tlbs, n_iterations);
+	printf("  linear scan:    %.3f s (%.2f ns/lookup)\n",
+	    t_scan, t_scan * 1e9 / n_iterations);
+	printf("  hashed index:   %.3f s (%.2f ns/lookup)\n",
+	    t_index, t_index * 1e9 / n_iterations);
+
+	return 0;
+}
+
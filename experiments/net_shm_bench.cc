@@ -0,0 +1,272 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright  
+ *     notice, this list of conditions and the following disclaimer in the 
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE   
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  Distributed network benchmark.
+ *
+ *  Links against GXemul's network objects (so build GXemul first). Two
+ *  processes are connected to each other like two emulators with
+ *  local_port() and add_remote("localhost:port") in their configuration
+ *  files. The sender's NIC sends frames to one of the receiver's two NICs,
+ *  with at most WINDOW frames outstanding, and the receiver acknowledges
+ *  them with frames of its own. The receiver checks that the frames arrive
+ *  in order, and that its other NIC does not see them.
+ *
+ *  Usage:  ./net_shm_bench [-u] [nframes [framesize]]
+ *
+ *  -u makes the processes hide their shared memory rings from each other,
+ *  so that the frames are sent as UDP datagrams instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <inttypes.h>
+
+#include "net.h"
+
+
+/*  Stubs for what the network code uses from the rest of GXemul:  */
+void debug(const char *fmt, ...) { }
+void fatal(const char *fmt, ...) { }
+void debug_indentation(int diff) { }
+
+
+#define	WINDOW		64
+#define	ACK_EVERY	16
+#define	ETHERTYPE_BENCH	0x88b5
+
+static unsigned char sender_mac[6] = { 0x10, 0x20, 0x30, 0x00, 0x00, 0x10 };
+static unsigned char receiver_mac[6] = { 0x10, 0x20, 0x30, 0x00, 0x00, 0x20 };
+static unsigned char other_mac[6] = { 0x10, 0x20, 0x30, 0x00, 0x00, 0x22 };
+
+static int nic, other_nic;	/*  only their addresses are used  */
+
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+static void send_frame(struct net *net, unsigned char *dst,
+	unsigned char *src, uint32_t value, int len)
+{
+	unsigned char p[1600];
+
+	memset(p, 0, len);
+	memcpy(p, dst, 6);
+	memcpy(p + 6, src, 6);
+	p[12] = ETHERTYPE_BENCH >> 8; p[13] = ETHERTYPE_BENCH & 0xff;
+	memcpy(p + 14, &value, sizeof(value));
+	p[len - 1] = value;
+
+	net_ethernet_tx(net, &nic, p, len);
+}
+
+
+/*
+ *  Returns the next frame's value, or -1 if no frame has arrived.
+ */
+static int64_t receive_frame(struct net *net, void *extra, int len)
+{
+	unsigned char *p;
+	uint32_t value;
+	int plen;
+
+	if (!net_ethernet_rx(net, extra, &p, &plen))
+		return -1;
+
+	memcpy(&value, p + 14, sizeof(value));
+	if (plen != len || (unsigned char) value != p[len - 1]) {
+		fprintf(stderr, "corrupt frame (%i bytes)\n", plen);
+		exit(1);
+	}
+
+	net_ethernet_packet_free(p);
+	return value;
+}
+
+
+static struct net *init(int local_port, int remote_port, int udp)
+{
+	char remote[40], name[40], *remotes[1] = { remote };
+	struct net *net;
+
+	snprintf(remote, sizeof(remote), "localhost:%i", remote_port);
+	net = net_init(NULL, 0, NET_DEFAULT_IPV4_MASK, NET_DEFAULT_IPV4_LEN,
+	    remotes, 1, local_port, NULL);
+
+	if (udp) {
+		snprintf(name, sizeof(name), "/gxemul-net-%i", local_port);
+		shm_unlink(name);
+	}
+
+	return net;
+}
+
+
+static void receiver(int port, uint32_t nframes, int len, int udp,
+	int ready_fd)
+{
+	struct net *net = init(port + 1, port, udp);
+	uint32_t expected = 0;
+	int64_t value;
+	int other = 0, progress;
+	double last_progress = now();
+
+	net_add_nic(net, &nic, receiver_mac);
+	net_add_nic(net, &other_nic, other_mac);
+
+	if (write(ready_fd, "", 1) != 1)
+		exit(1);
+
+	while (expected < nframes) {
+		progress = 0;
+		net_ethernet_rx_avail(net, &nic);
+		while ((value = receive_frame(net, &nic, len)) >= 0) {
+			if (value != expected) {
+				fprintf(stderr, "frame %u arrived, expected "
+				    "%u\n", (uint32_t) value, expected);
+				exit(1);
+			}
+			expected ++;
+			if (expected % ACK_EVERY == 0 || expected == nframes)
+				send_frame(net, sender_mac, receiver_mac,
+				    expected, 60);
+			last_progress = now();
+			progress = 1;
+		}
+
+		/*  Let the other process run, if there is only one CPU:  */
+		if (!progress)
+			sched_yield();
+
+		while (receive_frame(net, &other_nic, len) >= 0)
+			other ++;
+
+		if (now() - last_progress > 5.0) {
+			fprintf(stderr, "receiver: stuck at frame %u\n",
+			    expected);
+			exit(1);
+		}
+	}
+
+	if (other != 0) {
+		fprintf(stderr, "the other NIC saw %i frames\n", other);
+		exit(1);
+	}
+
+	exit(0);
+}
+
+
+int main(int argc, char *argv[])
+{
+	int udp = 0, len = 1514, port = 15400 + getpid() % 1000;
+	uint32_t nframes = 200000, sent = 0, acked = 0;
+	int ready[2], status;
+	double t0, t, last_progress;
+	struct net *net;
+	char c;
+	pid_t pid;
+
+	if (argc > 1 && !strcmp(argv[1], "-u")) {
+		udp = 1;
+		argc --; argv ++;
+	}
+	if (argc > 1)
+		nframes = atoi(argv[1]);
+	if (argc > 2)
+		len = atoi(argv[2]);
+	if (len < 60 || len > 1514 || nframes < 1) {
+		fprintf(stderr, "usage: %s [-u] [nframes [framesize]]\n",
+		    argv[0]);
+		exit(1);
+	}
+
+	if (pipe(ready) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+
+	pid = fork();
+	if (pid == 0)
+		receiver(port, nframes, len, udp, ready[1]);
+
+	net = init(port, port + 1, udp);
+	net_add_nic(net, &nic, sender_mac);
+	if (read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "the receiver did not start\n");
+		exit(1);
+	}
+
+	t0 = last_progress = now();
+	while (acked < nframes) {
+		int64_t value;
+		int progress = 0;
+
+		while (sent < nframes && sent - acked < WINDOW)
+			send_frame(net, receiver_mac, sender_mac, sent++, len);
+
+		net_ethernet_rx_avail(net, &nic);
+		while ((value = receive_frame(net, &nic, 60)) >= 0) {
+			acked = value;
+			last_progress = now();
+			progress = 1;
+		}
+
+		if (!progress)
+			sched_yield();
+
+		if (now() - last_progress > 5.0) {
+			fprintf(stderr, "sender: stuck at frame %u\n", acked);
+			kill(pid, SIGTERM);
+			exit(1);
+		}
+	}
+	t = now() - t0;
+
+	waitpid(pid, &status, 0);
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		exit(1);
+
+	printf("%s: %u frames of %i bytes in %.3f s: %.0f frames/s, "
+	    "%.1f MB/s\n", udp? "udp" : "shared memory", nframes, len, t,
+	    nframes / t, (double) nframes * len / t / 1048576.0);
+
+	return 0;
+}
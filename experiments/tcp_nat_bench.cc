@@ -0,0 +1,358 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright  
+ *     notice, this list of conditions and the following disclaimer in the 
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE   
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  TCP NAT loopback throughput benchmark.
+ *
+ *  Links against GXemul's network objects (so build GXemul first), and
+ *  plays the role of a guest OS on the emulated network: it connects
+ *  through the NAT gateway to a TCP server on 127.0.0.1, and measures the
+ *  throughput of a download (the server sends data, which is checked) and
+ *  of an upload (to a sink which counts what it receives). The "guest"
+ *  acknowledges the received segments once per poll, like a guest OS which
+ *  handles all pending packets on each NIC interrupt.
+ *
+ *  Usage:  ./tcp_nat_bench [megabytes]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <inttypes.h>
+
+#include "net.h"
+
+
+/*  Stubs for what the network code uses from the rest of GXemul:  */
+void debug(const char *fmt, ...) { }
+void fatal(const char *fmt, ...) { }
+void debug_indentation(int diff) { }
+
+
+static unsigned char guest_mac[6] = { 0x10, 0x20, 0x30, 0x00, 0x00, 0x10 };
+static unsigned char gateway_mac[6] = { 0x60, 0x50, 0x40, 0x30, 0x20, 0x10 };
+static unsigned char guest_ip[4] = { 10, 0, 0, 1 };
+static unsigned char server_ip[4] = { 127, 0, 0, 1 };
+
+static struct net *net;
+static int nic;			/*  only its address is used  */
+
+static int listen_socket, server_port;
+static size_t total_bytes;
+static volatile size_t sink_bytes;
+static volatile int sink_done;
+
+
+struct guest_tcp {
+	int		port;
+	uint32_t	snd_una, snd_nxt, snd_wnd;
+	uint32_t	rcv_nxt;
+	int		established, fin_received, fin_acked;
+	size_t		received;
+	int		corrupt;
+};
+
+
+static double now(void)
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+
+static void guest_send(struct guest_tcp *t, int flags, uint32_t seq,
+	const unsigned char *data, int len)
+{
+	unsigned char p[1600];
+	int optlen = (flags & NET_TCP_SYN)? 20 : 0;
+	int tcp_len = 20 + optlen + len, ip_len = 20 + tcp_len;
+
+	memset(p, 0, 54 + optlen);
+	memcpy(p, gateway_mac, 6);
+	memcpy(p + 6, guest_mac, 6);
+	p[12] = 0x08; p[13] = 0x00;
+
+	p[14] = 0x45;
+	p[16] = ip_len >> 8; p[17] = ip_len;
+	p[22] = 64; p[23] = 6;
+	memcpy(p + 26, guest_ip, 4);
+	memcpy(p + 30, server_ip, 4);
+	net_ip_checksum(p + 14, 10, 20);
+
+	p[34] = t->port >> 8; p[35] = t->port;
+	p[36] = server_port >> 8; p[37] = server_port;
+	p[38] = seq >> 24; p[39] = seq >> 16; p[40] = seq >> 8; p[41] = seq;
+	p[42] = t->rcv_nxt >> 24; p[43] = t->rcv_nxt >> 16;
+	p[44] = t->rcv_nxt >> 8; p[45] = t->rcv_nxt;
+	p[46] = (20 + optlen) / 4 * 0x10;
+	p[47] = flags;
+	p[48] = 0xff; p[49] = 0xff;	/*  window, scaled by 4  */
+
+	if (flags & NET_TCP_SYN) {
+		/*  MSS 1460, window scale 2, timestamps:  */
+		static const unsigned char opts[12] = { 2, 4, 0x05, 0xb4,
+		    1, 3, 3, 2, 1, 1, 8, 10 };
+		memcpy(p + 54, opts, 12);
+	}
+
+	memcpy(p + 54 + optlen, data, len);
+	net_ip_tcp_checksum(p + 34, 16, tcp_len, p + 26, p + 30, 0);
+
+	net_ethernet_tx(net, &nic, p, 14 + ip_len);
+}
+
+
+/*
+ *  Handles all packets which are available for the guest. Returns 1 if
+ *  anything arrived.
+ */
+static int guest_poll(struct guest_tcp *t, size_t *verify_ofs)
+{
+	unsigned char *p;
+	int len, got = 0, ack_needed = 0;
+
+	if (!net_ethernet_rx_avail(net, &nic))
+		return 0;
+
+	while (net_ethernet_rx(net, &nic, &p, &len)) {
+		int data_offset = 34 + (p[46] >> 4) * 4, flags = p[47];
+		int dlen = 14 + ((p[16] << 8) + p[17]) - data_offset;
+		uint32_t seq = (p[38] << 24) + (p[39] << 16) +
+		    (p[40] << 8) + p[41];
+		uint32_t ack = (p[42] << 24) + (p[43] << 16) +
+		    (p[44] << 8) + p[45];
+
+		got = 1;
+
+		if (p[12] != 0x08 || p[23] != 6 ||
+		    (p[36] << 8) + p[37] != t->port) {
+			net_ethernet_packet_free(p);
+			continue;
+		}
+
+		if (flags & NET_TCP_SYN) {
+			t->rcv_nxt = seq + 1;
+			t->snd_una = ack;
+			t->established = 1;
+			ack_needed = 1;
+		} else if (flags & NET_TCP_RST) {
+			fprintf(stderr, "connection reset\n");
+			exit(1);
+		}
+
+		if (flags & NET_TCP_ACK) {
+			if ((int32_t)(ack - t->snd_una) > 0)
+				t->snd_una = ack;
+			t->snd_wnd = (p[48] << 8) + p[49];
+		}
+
+		if (dlen > 0 || (flags & NET_TCP_FIN)) {
+			if (seq == t->rcv_nxt) {
+				unsigned char *d = p + data_offset;
+				int i;
+				for (i=0; i<dlen && verify_ofs != NULL; i++)
+					if (d[i] != (unsigned char)
+					    ((*verify_ofs) ++ * 7))
+						t->corrupt = 1;
+				t->rcv_nxt += dlen;
+				t->received += dlen;
+				if (flags & NET_TCP_FIN) {
+					t->rcv_nxt ++;
+					t->fin_received = 1;
+				}
+			}
+			ack_needed = 1;
+		}
+
+		net_ethernet_packet_free(p);
+	}
+
+	if (ack_needed)
+		guest_send(t, NET_TCP_ACK, t->snd_nxt, NULL, 0);
+
+	return got;
+}
+
+
+static void guest_connect(struct guest_tcp *t, int port)
+{
+	memset(t, 0, sizeof(*t));
+	t->port = port;
+	t->snd_una = 1000;
+	t->snd_nxt = 1001;
+
+	guest_send(t, NET_TCP_SYN, 1000, NULL, 0);
+	while (!t->established)
+		guest_poll(t, NULL);
+}
+
+
+static void *source_thread(void *arg)
+{
+	unsigned char buf[65536];
+	size_t sent = 0;
+	int s = accept(listen_socket, NULL, NULL);
+
+	while (sent < total_bytes) {
+		size_t i, n = total_bytes - sent;
+		ssize_t res;
+
+		if (n > sizeof(buf))
+			n = sizeof(buf);
+		for (i=0; i<n; i++)
+			buf[i] = (sent + i) * 7;
+		res = write(s, buf, n);
+		if (res <= 0)
+			break;
+		sent += res;
+	}
+
+	close(s);
+	return NULL;
+}
+
+
+static void *sink_thread(void *arg)
+{
+	unsigned char buf[65536];
+	int s = accept(listen_socket, NULL, NULL);
+	ssize_t res;
+
+	while ((res = read(s, buf, sizeof(buf))) > 0)
+		sink_bytes += res;
+
+	close(s);
+	sink_done = 1;
+	return NULL;
+}
+
+
+static void download(void)
+{
+	struct guest_tcp t;
+	pthread_t thread;
+	size_t verify_ofs = 0;
+	double t0, t1;
+
+	pthread_create(&thread, NULL, source_thread, NULL);
+
+	t0 = now();
+	guest_connect(&t, 40000);
+	while (!t.fin_received)
+		guest_poll(&t, &verify_ofs);
+
+	/*  Close our side too:  */
+	guest_send(&t, NET_TCP_FIN | NET_TCP_ACK, t.snd_nxt ++, NULL, 0);
+	while (t.snd_una != t.snd_nxt)
+		guest_poll(&t, NULL);
+	t1 = now();
+
+	pthread_join(thread, NULL);
+
+	printf("download: %zu bytes in %.3f s, %.1f MB/s%s\n", t.received,
+	    t1 - t0, t.received / (t1 - t0) / 1048576,
+	    t.received != total_bytes || t.corrupt? "  (CORRUPT!)" : "");
+}
+
+
+static void upload(void)
+{
+	struct guest_tcp t;
+	pthread_t thread;
+	unsigned char buf[1460];
+	size_t ofs = 0;
+	double t0, t1;
+
+	pthread_create(&thread, NULL, sink_thread, NULL);
+
+	t0 = now();
+	guest_connect(&t, 40001);
+
+	while (ofs < total_bytes || t.snd_una != t.snd_nxt) {
+		/*  Send as much as the gateway's window allows:  */
+		while (ofs < total_bytes &&
+		    t.snd_nxt - t.snd_una + sizeof(buf) <= t.snd_wnd) {
+			size_t i, n = total_bytes - ofs;
+			if (n > sizeof(buf))
+				n = sizeof(buf);
+			for (i=0; i<n; i++)
+				buf[i] = ofs + i;
+			guest_send(&t, NET_TCP_ACK | NET_TCP_PSH, t.snd_nxt,
+			    buf, n);
+			t.snd_nxt += n;
+			ofs += n;
+		}
+
+		guest_poll(&t, NULL);
+	}
+
+	guest_send(&t, NET_TCP_FIN | NET_TCP_ACK, t.snd_nxt ++, NULL, 0);
+	while (!t.fin_received || t.snd_una != t.snd_nxt)
+		guest_poll(&t, NULL);
+	t1 = now();
+
+	pthread_join(thread, NULL);
+
+	printf("upload:   %zu bytes in %.3f s, %.1f MB/s%s\n",
+	    (size_t) sink_bytes, t1 - t0, sink_bytes / (t1 - t0) / 1048576,
+	    sink_bytes != total_bytes? "  (LOST DATA!)" : "");
+}
+
+
+int main(int argc, char *argv[])
+{
+	struct sockaddr_in si;
+	socklen_t si_len = sizeof(si);
+
+	total_bytes = (argc > 1? atoi(argv[1]) : 64) * 1048576;
+
+	listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+	memset(&si, 0, sizeof(si));
+	si.sin_family = AF_INET;
+	si.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listen_socket, (struct sockaddr *)&si, sizeof(si)) < 0 ||
+	    listen(listen_socket, 1) < 0) {
+		perror("bind");
+		exit(1);
+	}
+	getsockname(listen_socket, (struct sockaddr *)&si, &si_len);
+	server_port = ntohs(si.sin_port);
+
+	net = net_init(NULL, NET_INIT_FLAG_GATEWAY, NET_DEFAULT_IPV4_MASK,
+	    NET_DEFAULT_IPV4_LEN, NULL, 0, 0, NULL);
+	net_add_nic(net, &nic, guest_mac);
+
+	download();
+	upload();
+
+	return 0;
+}
@@ -308,6 +308,33 @@ bool MainbusComponent::WriteData(const uint64_t& data, Endianness endianness)
 }
 
 
+uint8_t* MainbusComponent::LookupHostPage(uint64_t address, uint64_t length,
+	bool forWrite)
+{
+	if (!MakeSureMemoryMapExists())
+		return NULL;
+
+	for (size_t i=0; i<m_memoryMap.size(); ++i) {
+		MemoryMapEntry& mmEntry = m_memoryMap[i];
+
+		if (address >= mmEntry.base &&
+		    address < mmEntry.base + mmEntry.size) {
+			// The whole range must be within the same component,
+			// and addresses must map 1:1 to the component's
+			// addresses.
+			if (address + length > mmEntry.base + mmEntry.size ||
+			    mmEntry.addrMul != 1)
+				return NULL;
+
+			return mmEntry.addressDataBus->LookupHostPage(
+			    address - mmEntry.base, length, forWrite);
+		}
+	}
+
+	return NULL;
+}
+
+
 /*****************************************************************************/
 
 
@@ -518,6 +545,40 @@ static void Test_MainbusComponent_Simple_With_AddrMul()
 	    "written to it yet! [3]", dataByte, 0);
 }
 
+static void Test_MainbusComponent_LookupHostPage()
+{
+	refcount_ptr<Component> mainbus =
+	    ComponentFactory::CreateComponent("mainbus");
+	refcount_ptr<Component> ram0 =
+	    ComponentFactory::CreateComponent("ram");
+
+	mainbus->AddChild(ram0);
+	ram0->SetVariableValue("memoryMappedSize", "0x2000");
+	ram0->SetVariableValue("memoryMappedBase", "0x1000");
+
+	AddressDataBus* bus = mainbus->AsAddressDataBus();
+
+	uint8_t* host = bus->LookupHostPage(0x2000, 0x1000, true);
+	UnitTest::Assert("host page should be available", host != NULL);
+
+	host[4] = 42;
+	uint8_t dataByte = 0;
+	bus->AddressSelect(0x2004);	// offset 0x1004 of ram0
+	bus->ReadData(dataByte);
+	UnitTest::Assert("host page and bus mismatch?", dataByte, 42);
+
+	UnitTest::Assert("unmapped range should not be available",
+	    bus->LookupHostPage(0x0, 0x1000, false) == NULL);
+	UnitTest::Assert("range partially outside of ram0 should not be "
+	    "available", bus->LookupHostPage(0x2800, 0x1000, false) == NULL);
+
+	ram0->SetVariableValue("memoryMappedAddrMul", "2");
+	mainbus->FlushCachedState();
+
+	UnitTest::Assert("range with addrMul != 1 should not be available",
+	    bus->LookupHostPage(0x1000, 0x100, false) == NULL);
+}
+
 static void Test_MainbusComponent_PreRunCheck()
 {
 	GXemul gxemul;
@@ -552,6 +613,7 @@ UNITTESTS(MainbusComponent)
 	UNITTEST(Test_MainbusComponent_Remapping);
 	UNITTEST(Test_MainbusComponent_Multiple_NonOverlapping);
 	UNITTEST(Test_MainbusComponent_Simple_With_AddrMul);
+	UNITTEST(Test_MainbusComponent_LookupHostPage);
 
 	// TODO: Write outside of mapped space
 	// TODO: Write PARTIALLY outside of mapped space!!! e.g. 64-bit
@@ -64,6 +64,8 @@ CPUComponent::CPUComponent(const string& className, const string& cpuArchitectur
 	AddVariable("showFunctionTraceReturn", &m_showFunctionTraceReturn);
 	AddVariable("functionCallTraceDepth", &m_functionCallTraceDepth);
 	AddVariable("nrOfTracedFunctionCalls", &m_nrOfTracedFunctionCalls);
+
+	InvalidateHostPageTLB();
 }
 
 
@@ -92,6 +94,8 @@ void CPUComponent::ResetState()
 
 	m_symbolRegistry.Clear();
 
+	InvalidateHostPageTLB();
+
 	Component::ResetState();
 }
 
@@ -436,6 +440,8 @@ void CPUComponent::FlushCachedStateForComponent()
 {
 	m_addressDataBus = NULL;
 
+	InvalidateHostPageTLB();
+
 	Component::FlushCachedStateForComponent();
 }
 
@@ -503,6 +509,50 @@ bool CPUComponent::LookupAddressDataBus(GXemul* gxemul)
 }
 
 
+void CPUComponent::InvalidateHostPageTLB()
+{
+	for (size_t i=0; i<CPU_HOSTPAGE_TLB_NENTRIES; ++i) {
+		m_hostPageTLB[i].vpage = 0;
+		m_hostPageTLB[i].hostPage = NULL;
+		m_hostPageTLB[i].writable = false;
+	}
+}
+
+
+uint8_t* CPUComponent::FillHostPageTLB(uint64_t vaddr, bool forWrite)
+{
+	// Emulated pages smaller than the host page TLB's pages cannot be
+	// represented in the TLB.
+	if (m_pageSize != 0 && m_pageSize < CPU_HOSTPAGE_SIZE)
+		return NULL;
+
+	if (!LookupAddressDataBus())
+		return NULL;
+
+	uint64_t paddr;
+	bool writable;
+	if (!VirtualToPhysical(vaddr, paddr, writable))
+		return NULL;
+
+	if (forWrite && !writable)
+		return NULL;
+
+	uint64_t offset = vaddr & (CPU_HOSTPAGE_SIZE - 1);
+	uint8_t* hostPage = m_addressDataBus->LookupHostPage(paddr - offset,
+	    CPU_HOSTPAGE_SIZE, forWrite);
+	if (hostPage == NULL)
+		return NULL;
+
+	HostPageTLBEntry& entry = m_hostPageTLB[(vaddr >>
+	    CPU_HOSTPAGE_TLB_SHIFT) & (CPU_HOSTPAGE_TLB_NENTRIES - 1)];
+	entry.vpage = vaddr >> CPU_HOSTPAGE_TLB_SHIFT;
+	entry.hostPage = hostPage;
+	entry.writable = forWrite;
+
+	return hostPage + offset;
+}
+
+
 void CPUComponent::ShowRegisters(GXemul* gxemul, const vector<string>& arguments) const
 {
 	gxemul->GetUI()->ShowDebugMessage("The registers method has not yet "
@@ -518,6 +568,9 @@ void CPUComponent::AddressSelect(uint64_t address)
 
 bool CPUComponent::ReadData(uint8_t& data, Endianness endianness)
 {
+	if (ReadDataDirect(m_addressSelect, data, endianness))
+		return true;
+
 	if (!LookupAddressDataBus())
 		return false;
 
@@ -534,6 +587,9 @@ bool CPUComponent::ReadData(uint16_t& data, Endianness endianness)
 {
 	assert((m_addressSelect & 1) == 0);
 
+	if (ReadDataDirect(m_addressSelect, data, endianness))
+		return true;
+
 	if (!LookupAddressDataBus())
 		return false;
 
@@ -550,6 +606,9 @@ bool CPUComponent::ReadData(uint32_t& data, Endianness endianness)
 {
 	assert((m_addressSelect & 3) == 0);
 
+	if (ReadDataDirect(m_addressSelect, data, endianness))
+		return true;
+
 	if (!LookupAddressDataBus())
 		return false;
 
@@ -566,6 +625,9 @@ bool CPUComponent::ReadData(uint64_t& data, Endianness endianness)
 {
 	assert((m_addressSelect & 7) == 0);
 
+	if (ReadDataDirect(m_addressSelect, data, endianness))
+		return true;
+
 	if (!LookupAddressDataBus())
 		return false;
 
@@ -580,6 +642,9 @@ bool CPUComponent::ReadData(uint64_t& data, Endianness endianness)
 
 bool CPUComponent::WriteData(const uint8_t& data, Endianness endianness)
 {
+	if (WriteDataDirect(m_addressSelect, data, endianness))
+		return true;
+
 	if (!LookupAddressDataBus())
 		return false;
 
@@ -596,6 +661,9 @@ bool CPUComponent::WriteData(const uint16_t& data, Endianness endianness)
 {
 	assert((m_addressSelect & 1) == 0);
 
+	if (WriteDataDirect(m_addressSelect, data, endianness))
+		return true;
+
 	if (!LookupAddressDataBus())
 		return false;
 
@@ -612,6 +680,9 @@ bool CPUComponent::WriteData(const uint32_t& data, Endianness endianness)
 {
 	assert((m_addressSelect & 3) == 0);
 
+	if (WriteDataDirect(m_addressSelect, data, endianness))
+		return true;
+
 	if (!LookupAddressDataBus())
 		return false;
 
@@ -628,6 +699,9 @@ bool CPUComponent::WriteData(const uint64_t& data, Endianness endianness)
 {
 	assert((m_addressSelect & 7) == 0);
 
+	if (WriteDataDirect(m_addressSelect, data, endianness))
+		return true;
+
 	if (!LookupAddressDataBus())
 		return false;
 
@@ -1648,7 +1648,6 @@ template<bool store, typename T, bool doubleword, bool regofs, bool scaled, bool
 {
 	DYNTRANS_INSTR_HEAD(M88K_CPUComponent)
 
-	// TODO: fast lookups
 	// TODO: usr access
 
 	// TODO: place in M88K's "ongoing memory transaction" registers!
@@ -1663,17 +1662,25 @@ template<bool store, typename T, bool doubleword, bool regofs, bool scaled, bool
 		return;
 	}
 
-	cpu->AddressSelect(addr);
+	Endianness endianness = cpu->m_isBigEndian? BigEndian : LittleEndian;
 
+	// Loads and stores to host page TLB hits go directly to host memory.
+	// Everything else goes via AddressSelect and ReadData/WriteData.
 	if (store) {
 		T data = REG32(ic->arg[0]);
-		if (!cpu->WriteData(data, cpu->m_isBigEndian? BigEndian : LittleEndian)) {
-			// TODO: failed to access memory was probably an exception. Handle this!
+		if (!cpu->WriteDataDirect(addr, data, endianness)) {
+			cpu->AddressSelect(addr);
+			if (!cpu->WriteData(data, endianness)) {
+				// TODO: failed to access memory was probably an exception. Handle this!
+			}
 		}
 	} else {
 		T data;
-		if (!cpu->ReadData(data, cpu->m_isBigEndian? BigEndian : LittleEndian)) {
-			// TODO: failed to access memory was probably an exception. Handle this!
+		if (!cpu->ReadDataDirect(addr, data, endianness)) {
+			cpu->AddressSelect(addr);
+			if (!cpu->ReadData(data, endianness)) {
+				// TODO: failed to access memory was probably an exception. Handle this!
+			}
 		}
 
 		if (signedLoad) {
@@ -1688,17 +1695,22 @@ template<bool store, typename T, bool doubleword, bool regofs, bool scaled, bool
 
 	// Special handling of second word in a double-word read or write:
 	if (doubleword) {
+		uint32_t addr2 = addr + sizeof(uint32_t);
 		if (store) {
 			uint32_t data2 = (* (((uint32_t*)(ic->arg[0].p)) + 1) );
-			cpu->AddressSelect(addr + sizeof(uint32_t));
-			if (!cpu->WriteData(data2, cpu->m_isBigEndian? BigEndian : LittleEndian)) {
-				// TODO: failed to access memory was probably an exception. Handle this!
+			if (!cpu->WriteDataDirect(addr2, data2, endianness)) {
+				cpu->AddressSelect(addr2);
+				if (!cpu->WriteData(data2, endianness)) {
+					// TODO: failed to access memory was probably an exception. Handle this!
+				}
 			}
 		} else {
 			uint32_t data2;
-			cpu->AddressSelect(addr + sizeof(uint32_t));
-			if (!cpu->ReadData(data2, cpu->m_isBigEndian? BigEndian : LittleEndian)) {
-				// TODO: failed to access memory was probably an exception. Handle this!
+			if (!cpu->ReadDataDirect(addr2, data2, endianness)) {
+				cpu->AddressSelect(addr2);
+				if (!cpu->ReadData(data2, endianness)) {
+					// TODO: failed to access memory was probably an exception. Handle this!
+				}
 			}
 
 			(* (((uint32_t*)(ic->arg[0].p)) + 1) ) = data2;
@@ -2619,6 +2631,68 @@ static void Test_M88K_CPUComponent_Execute_Basic()
 	UnitTest::Assert("r30 should have been modified again", cpu->GetVariable("r30")->ToInteger(), 1111 + 0x10);
 }
 
+static void Test_M88K_CPUComponent_Execute_LoadStore()
+{
+	GXemul gxemul;
+	gxemul.GetCommandInterpreter().RunCommand("add testm88k");
+
+	refcount_ptr<Component> cpu = gxemul.GetRootComponent()->LookupPath("root.machine0.mainbus0.cpu0");
+	UnitTest::Assert("huh? no cpu?", !cpu.IsNULL());
+	refcount_ptr<Component> ram = gxemul.GetRootComponent()->LookupPath("root.machine0.mainbus0.ram0");
+	UnitTest::Assert("huh? no ram?", !ram.IsNULL());
+
+	AddressDataBus* bus = cpu->AsAddressDataBus();
+	AddressDataBus* rambus = ram->AsAddressDataBus();
+
+	// st r30, r31, 0x10
+	uint32_t data32 = 0x27df0010;
+	bus->AddressSelect(48);
+	bus->WriteData(data32, BigEndian);
+
+	// ld r29, r31, 0x10
+	data32 = 0x17bf0010;
+	bus->AddressSelect(52);
+	bus->WriteData(data32, BigEndian);
+
+	cpu->SetVariableValue("pc", "48");
+	cpu->SetVariableValue("r29", "0");
+	cpu->SetVariableValue("r30", "0x12345678");
+	cpu->SetVariableValue("r31", "0x1000");
+
+	gxemul.SetRunState(GXemul::Running);
+	gxemul.Execute(2);
+
+	UnitTest::Assert("r29 should have been loaded", cpu->GetVariable("r29")->ToInteger(), 0x12345678);
+
+	// The stored word should be visible to other users of the RAM.
+	data32 = 0;
+	rambus->AddressSelect(0x1010);
+	rambus->ReadData(data32, BigEndian);
+	UnitTest::Assert("store did not reach ram?", data32, 0x12345678);
+
+	// Writes which do not go via the cpu should be visible to loads.
+	data32 = 0x11223344;
+	rambus->AddressSelect(0x1010);
+	rambus->WriteData(data32, BigEndian);
+
+	cpu->SetVariableValue("pc", "52");
+	gxemul.Execute(1);
+
+	UnitTest::Assert("r29 should have been loaded again", cpu->GetVariable("r29")->ToInteger(), 0x11223344);
+
+	// Stores to write-protected memory should not have any effect.
+	ram->SetVariableValue("writeProtect", "true");
+	gxemul.GetRootComponent()->FlushCachedState();
+
+	cpu->SetVariableValue("pc", "48");
+	gxemul.Execute(1);
+
+	data32 = 0;
+	rambus->AddressSelect(0x1010);
+	rambus->ReadData(data32, BigEndian);
+	UnitTest::Assert("store to writeprotected ram had effect?", data32, 0x11223344);
+}
+
 static void Test_M88K_CPUComponent_Execute_DelayBranchWithValidInstruction()
 {
 	GXemul gxemul;
@@ -2878,6 +2952,7 @@ UNITTESTS(M88K_CPUComponent)
 
 	// Dyntrans execution:
 	UNITTEST(Test_M88K_CPUComponent_Execute_Basic);
+	UNITTEST(Test_M88K_CPUComponent_Execute_LoadStore);
 	UNITTEST(Test_M88K_CPUComponent_Execute_DelayBranchWithValidInstruction);
 	UNITTEST(Test_M88K_CPUComponent_Execute_DelayBranchWithValidInstruction_SingleStepping);
 	UNITTEST(Test_M88K_CPUComponent_Execute_DelayBranchWithValidInstruction_RunTwoTimes);
@@ -1150,8 +1150,6 @@ template<bool store, typename addressType, typename T, bool signedLoad> void MIP
 {
 	DYNTRANS_INSTR_HEAD(MIPS_CPUComponent)
 
-	// TODO: fast lookups
-
 	uint64_t addr;
 
 	if (sizeof(addressType) == sizeof(uint64_t))
@@ -1167,17 +1165,25 @@ template<bool store, typename addressType, typename T, bool signedLoad> void MIP
 		return;
 	}
 
-	cpu->AddressSelect(addr);
+	Endianness endianness = cpu->m_isBigEndian? BigEndian : LittleEndian;
 
+	// Loads and stores to host page TLB hits go directly to host memory.
+	// Everything else goes via AddressSelect and ReadData/WriteData.
 	if (store) {
 		T data = REG64(ic->arg[0]);
-		if (!cpu->WriteData(data, cpu->m_isBigEndian? BigEndian : LittleEndian)) {
-			// TODO: failed to access memory was probably an exception. Handle this!
+		if (!cpu->WriteDataDirect(addr, data, endianness)) {
+			cpu->AddressSelect(addr);
+			if (!cpu->WriteData(data, endianness)) {
+				// TODO: failed to access memory was probably an exception. Handle this!
+			}
 		}
 	} else {
 		T data;
-		if (!cpu->ReadData(data, cpu->m_isBigEndian? BigEndian : LittleEndian)) {
-			// TODO: failed to access memory was probably an exception. Handle this!
+		if (!cpu->ReadDataDirect(addr, data, endianness)) {
+			cpu->AddressSelect(addr);
+			if (!cpu->ReadData(data, endianness)) {
+				// TODO: failed to access memory was probably an exception. Handle this!
+			}
 		}
 
 		if (signedLoad) {
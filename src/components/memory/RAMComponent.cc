@@ -25,6 +25,7 @@
  *  SUCH DAMAGE.
  */
 
+#include <algorithm>
 #include <iomanip>
 #include <assert.h>
 #include <sys/mman.h>
@@ -33,16 +34,21 @@
 #include "GXemul.h"
 
 
+size_t RAMComponent::s_totalAllocatedMemory = 0;
+
+
 RAMComponent::RAMComponent(const string& visibleClassName)
 	: MemoryMappedComponent("ram", visibleClassName)
-	, m_blockSizeShift(22)		// 22 = 4 MB per block
+	, m_blockSizeShift(16)		// 16 = 64 KB per block
 	, m_blockSize(1 << m_blockSizeShift)
 	, m_dataHandler(*this)
 	, m_writeProtected(false)
 	, m_lastDumpAddr(0)
 	, m_addressSelect(0)
 	, m_selectedHostMemoryBlock(NULL)
+	, m_selectedWritableBlock(NULL)
 	, m_selectedOffsetWithinBlock(0)
+	, m_dirtyTracking(false)
 {
 	AddVariable("writeProtect", &m_writeProtected);
 	AddVariable("lastDumpAddr", &m_lastDumpAddr);
@@ -56,14 +62,176 @@ RAMComponent::~RAMComponent()
 }
 
 
+RAMComponent::MemoryBlock::MemoryBlock(size_t blockSize)
+	: size(blockSize)
+{
+	data = mmap(NULL, size, PROT_WRITE | PROT_READ,
+	    MAP_ANON | MAP_PRIVATE, -1, 0);
+
+	if (data == MAP_FAILED || data == NULL) {
+		std::cerr << "RAMComponent::AllocateBlock: Could not allocate "
+		    << size << " bytes. Aborting.\n";
+		throw std::exception();
+	}
+
+	s_totalAllocatedMemory += size;
+}
+
+
+RAMComponent::MemoryBlock::~MemoryBlock()
+{
+	munmap(data, size);
+	s_totalAllocatedMemory -= size;
+}
+
+
 void RAMComponent::ReleaseAllBlocks()
 {
-	for (size_t i=0; i<m_memoryBlocks.size(); ++i) {
-		if (m_memoryBlocks[i] != NULL) {
-			munmap(m_memoryBlocks[i], m_blockSize);
-			m_memoryBlocks[i] = NULL;
+	// Everything which was not zero before is changed.
+	if (m_dirtyTracking)
+		for (size_t i=0; i<m_memoryBlocks.size(); ++i)
+			if (!m_memoryBlocks[i].IsNULL())
+				MarkDirty(i << m_blockSizeShift, m_blockSize);
+
+	m_memoryBlocks.clear();
+
+	m_selectedHostMemoryBlock = NULL;
+	m_selectedWritableBlock = NULL;
+}
+
+
+void RAMComponent::ShareBlocksWith(RAMComponent& other)
+{
+	if (&other == this)
+		return;
+
+	// Blocks which are not the same as before are changed.
+	if (m_dirtyTracking) {
+		size_t n = std::max(m_memoryBlocks.size(),
+		    other.m_memoryBlocks.size());
+		for (size_t i=0; i<n; ++i) {
+			const MemoryBlock* a = i < m_memoryBlocks.size()?
+			    (const MemoryBlock*) m_memoryBlocks[i] : NULL;
+			const MemoryBlock* b = i < other.m_memoryBlocks.size()?
+			    (const MemoryBlock*) other.m_memoryBlocks[i] : NULL;
+			if (a != b)
+				MarkDirty(i << m_blockSizeShift, m_blockSize);
 		}
 	}
+
+	m_memoryBlocks = other.m_memoryBlocks;
+
+	// Refresh the cached host block pointers. None of the blocks are
+	// writable anymore, in either component, until they have been copied.
+	AddressSelect(m_addressSelect);
+	other.AddressSelect(other.m_addressSelect);
+
+	// Host pages which were looked up for writing (e.g. by a CPU's host
+	// page TLB) must not be written to directly anymore.
+	other.FlushCachedStateOfTree();
+}
+
+
+void RAMComponent::FlushCachedStateOfTree()
+{
+	Component* root = this;
+	while (root->GetParent() != NULL)
+		root = root->GetParent();
+
+	root->FlushCachedState();
+}
+
+
+void RAMComponent::StartDirtyPageTracking()
+{
+	m_dirtyTracking = true;
+	m_dirtyBitmap.clear();
+	m_dirtyWords.clear();
+
+	// Writable host pages must be looked up again, and marked as dirty
+	// at that time.
+	FlushCachedStateOfTree();
+}
+
+
+void RAMComponent::StopDirtyPageTracking()
+{
+	m_dirtyTracking = false;
+	m_dirtyBitmap.clear();
+	m_dirtyWords.clear();
+}
+
+
+void RAMComponent::MarkDirty(uint64_t address, uint64_t length)
+{
+	uint64_t firstPage = address / DirtyPageSize;
+	uint64_t lastPage = (address + length - 1) / DirtyPageSize;
+
+	for (uint64_t page = firstPage; page <= lastPage; ++page) {
+		size_t word = page / 64;
+		uint64_t bit = (uint64_t)1 << (page & 63);
+
+		if (word >= m_dirtyBitmap.size())
+			m_dirtyBitmap.resize(word + 1);
+
+		if (m_dirtyBitmap[word] == 0)
+			m_dirtyWords.push_back(word);
+
+		m_dirtyBitmap[word] |= bit;
+	}
+}
+
+
+void RAMComponent::FetchAndClearDirtyPages(vector<uint64_t>& pages)
+{
+	pages.clear();
+
+	if (m_dirtyWords.empty())
+		return;
+
+	for (size_t i=0; i<m_dirtyWords.size(); ++i) {
+		size_t word = m_dirtyWords[i];
+		uint64_t bits = m_dirtyBitmap[word];
+
+		for (size_t j=0; bits != 0; ++j, bits >>= 1)
+			if (bits & 1)
+				pages.push_back((word * 64 + j) * DirtyPageSize);
+
+		m_dirtyBitmap[word] = 0;
+	}
+
+	m_dirtyWords.clear();
+
+	// The pages are clean again. Host pages which were looked up for
+	// writing must be looked up again, so that the next write to each
+	// of them is noticed.
+	FlushCachedStateOfTree();
+}
+
+
+size_t RAMComponent::GetTotalAllocatedMemory()
+{
+	return s_totalAllocatedMemory;
+}
+
+
+size_t RAMComponent::GetAllocatedMemory(const refcount_ptr<Component>& component)
+{
+	size_t total = 0;
+
+	if (component->GetClassName() == "ram") {
+		const RAMComponent* ram =
+		    (const RAMComponent*) (const Component*) component;
+		for (size_t i=0; i<ram->m_memoryBlocks.size(); ++i)
+			if (!ram->m_memoryBlocks[i].IsNULL())
+				total += ram->m_blockSize;
+	}
+
+	const Components& children = component->GetChildren();
+	for (size_t i=0; i<children.size(); ++i)
+		total += GetAllocatedMemory(children[i]);
+
+	return total;
 }
 
 
@@ -208,38 +376,94 @@ void RAMComponent::AddressSelect(uint64_t address)
 	m_addressSelect = address;
 
 	uint64_t blockNr = address >> m_blockSizeShift;
+	const MemoryBlock* block = NULL;
 
-	if (blockNr+1 > m_memoryBlocks.size())
+	if (blockNr < m_memoryBlocks.size())
+		block = m_memoryBlocks[blockNr];
+
+	if (block == NULL) {
 		m_selectedHostMemoryBlock = NULL;
-	else
-		m_selectedHostMemoryBlock = m_memoryBlocks[blockNr];
+		m_selectedWritableBlock = NULL;
+	} else {
+		m_selectedHostMemoryBlock = block->data;
+		m_selectedWritableBlock =
+		    block->get_refcount() == 1? block->data : NULL;
+	}
 
 	m_selectedOffsetWithinBlock = address & (m_blockSize-1);
 }
 
 
-void* RAMComponent::AllocateBlock()
+void* RAMComponent::AllocateBlock(uint64_t blockNr)
 {
-	void * p = mmap(NULL, m_blockSize, PROT_WRITE | PROT_READ,
-	    MAP_ANON | MAP_PRIVATE, -1, 0);
+	if (blockNr+1 > m_memoryBlocks.size())
+		m_memoryBlocks.resize(blockNr + 1);
 
-	if (p == MAP_FAILED || p == NULL) {
-		std::cerr << "RAMComponent::AllocateBlock: Could not allocate "
-		    << m_blockSize << " bytes. Aborting.\n";
-		throw std::exception();
-	}
+	// The block may already have been allocated, e.g. via LookupHostPage,
+	// after the current address was selected.
+	if (!m_memoryBlocks[blockNr].IsNULL() &&
+	    m_memoryBlocks[blockNr]->get_refcount() == 1)
+		return m_memoryBlocks[blockNr]->data;
 
-	uint64_t blockNr = m_addressSelect >> m_blockSizeShift;
+	refcount_ptr<MemoryBlock> oldBlock = m_memoryBlocks[blockNr];
 
-	if (blockNr+1 > m_memoryBlocks.size())
-		m_memoryBlocks.resize(blockNr + 1);
+	m_memoryBlocks[blockNr] = new MemoryBlock(m_blockSize);
+	void* p = m_memoryBlocks[blockNr]->data;
+
+	if (!oldBlock.IsNULL()) {
+		// The block is shared with a clone. The clone keeps the
+		// original, and this component continues with a copy.
+		memcpy(p, oldBlock->data, m_blockSize);
 
-	m_memoryBlocks[blockNr] = p;
+		// Host pointers into the original block (e.g. in a CPU's
+		// host page TLB) must not be used by this component's tree
+		// anymore.
+		FlushCachedStateOfTree();
+	}
 
 	return p;
 }
 
 
+uint8_t* RAMComponent::LookupHostPage(uint64_t address, uint64_t length,
+	bool forWrite)
+{
+	uint64_t offsetWithinBlock = address & (m_blockSize-1);
+
+	// Ranges which cross a block boundary are not contiguous in host
+	// memory.
+	if (offsetWithinBlock + length > m_blockSize)
+		return NULL;
+
+	if (forWrite && m_writeProtected)
+		return NULL;
+
+	uint64_t blockNr = address >> m_blockSizeShift;
+	void* block = NULL;
+	if (blockNr < m_memoryBlocks.size() && !m_memoryBlocks[blockNr].IsNULL() &&
+	    (!forWrite || m_memoryBlocks[blockNr]->get_refcount() == 1))
+		block = m_memoryBlocks[blockNr]->data;
+
+	// Note: The block is allocated even if it is only going to be read
+	// from. Anonymous mmap memory reads as zeroes, just like unallocated
+	// blocks do, and all-zero rows are skipped when serializing.
+	if (block == NULL) {
+		block = AllocateBlock(blockNr);
+
+		// Refresh the cached host block pointers, in case the
+		// selected block was the one allocated or copied.
+		AddressSelect(m_addressSelect);
+	}
+
+	// The caller may write to the page without going through
+	// WriteData(), so the page is considered dirty from now on.
+	if (forWrite && m_dirtyTracking)
+		MarkDirty(address, length);
+
+	return (uint8_t*)block + offsetWithinBlock;
+}
+
+
 bool RAMComponent::ReadData(uint8_t& data, Endianness endianness)
 {
 	if (m_selectedHostMemoryBlock == NULL)
@@ -314,10 +538,14 @@ bool RAMComponent::WriteData(const uint8_t& data, Endianness endianness)
 	if (m_writeProtected)
 		return false;
 
-	if (m_selectedHostMemoryBlock == NULL)
-		m_selectedHostMemoryBlock = AllocateBlock();
+	if (m_dirtyTracking)
+		MarkDirty(m_addressSelect, sizeof(data));
+
+	if (m_selectedWritableBlock == NULL)
+		m_selectedWritableBlock = m_selectedHostMemoryBlock =
+		    AllocateBlock(m_addressSelect >> m_blockSizeShift);
 
-	(((uint8_t*)m_selectedHostMemoryBlock)
+	(((uint8_t*)m_selectedWritableBlock)
 	    [m_selectedOffsetWithinBlock]) = data;
 
 	return true;
@@ -331,8 +559,12 @@ bool RAMComponent::WriteData(const uint16_t& data, Endianness endianness)
 	if (m_writeProtected)
 		return false;
 
-	if (m_selectedHostMemoryBlock == NULL)
-		m_selectedHostMemoryBlock = AllocateBlock();
+	if (m_dirtyTracking)
+		MarkDirty(m_addressSelect, sizeof(data));
+
+	if (m_selectedWritableBlock == NULL)
+		m_selectedWritableBlock = m_selectedHostMemoryBlock =
+		    AllocateBlock(m_addressSelect >> m_blockSizeShift);
 
 	uint16_t d;
 	if (endianness == BigEndian)
@@ -340,7 +572,7 @@ bool RAMComponent::WriteData(const uint16_t& data, Endianness endianness)
 	else
 		d = LE16_TO_HOST(data);
 
-	(((uint16_t*)m_selectedHostMemoryBlock)
+	(((uint16_t*)m_selectedWritableBlock)
 	    [m_selectedOffsetWithinBlock >> 1]) = d;
 
 	return true;
@@ -354,8 +586,12 @@ bool RAMComponent::WriteData(const uint32_t& data, Endianness endianness)
 	if (m_writeProtected)
 		return false;
 
-	if (m_selectedHostMemoryBlock == NULL)
-		m_selectedHostMemoryBlock = AllocateBlock();
+	if (m_dirtyTracking)
+		MarkDirty(m_addressSelect, sizeof(data));
+
+	if (m_selectedWritableBlock == NULL)
+		m_selectedWritableBlock = m_selectedHostMemoryBlock =
+		    AllocateBlock(m_addressSelect >> m_blockSizeShift);
 
 	uint32_t d;
 	if (endianness == BigEndian)
@@ -363,7 +599,7 @@ bool RAMComponent::WriteData(const uint32_t& data, Endianness endianness)
 	else
 		d = LE32_TO_HOST(data);
 
-	(((uint32_t*)m_selectedHostMemoryBlock)
+	(((uint32_t*)m_selectedWritableBlock)
 	    [m_selectedOffsetWithinBlock >> 2]) = d;
 
 	return true;
@@ -377,8 +613,12 @@ bool RAMComponent::WriteData(const uint64_t& data, Endianness endianness)
 	if (m_writeProtected)
 		return false;
 
-	if (m_selectedHostMemoryBlock == NULL)
-		m_selectedHostMemoryBlock = AllocateBlock();
+	if (m_dirtyTracking)
+		MarkDirty(m_addressSelect, sizeof(data));
+
+	if (m_selectedWritableBlock == NULL)
+		m_selectedWritableBlock = m_selectedHostMemoryBlock =
+		    AllocateBlock(m_addressSelect >> m_blockSizeShift);
 
 	uint64_t d;
 	if (endianness == BigEndian)
@@ -386,7 +626,7 @@ bool RAMComponent::WriteData(const uint64_t& data, Endianness endianness)
 	else
 		d = LE64_TO_HOST(data);
 
-	(((uint64_t*)m_selectedHostMemoryBlock)
+	(((uint64_t*)m_selectedWritableBlock)
 	    [m_selectedOffsetWithinBlock >> 3]) = d;
 
 	return true;
@@ -560,6 +800,44 @@ static void Test_RAMComponent_WriteProtect()
 	UnitTest::Assert("16-bit read", data16_a, 0x5678);
 }
 
+static void Test_RAMComponent_LookupHostPage()
+{
+	refcount_ptr<Component> ram = ComponentFactory::CreateComponent("ram");
+	AddressDataBus* bus = ram->AsAddressDataBus();
+
+	uint8_t* host = bus->LookupHostPage(0x1000, 0x1000, true);
+	UnitTest::Assert("host page should be available", host != NULL);
+
+	host[0x10] = 0x12;
+	host[0x11] = 0x34;
+	uint16_t data16 = 0;
+	bus->AddressSelect(0x1010);
+	bus->ReadData(data16, BigEndian);
+	UnitTest::Assert("write via host page not visible?", data16, 0x1234);
+
+	uint8_t data8 = 99;
+	bus->AddressSelect(0x1fff);
+	bus->WriteData(data8, BigEndian);
+	UnitTest::Assert("write via bus not visible?", host[0xfff], 99);
+
+	// Allocating a block via LookupHostPage after the address was selected
+	// must not result in the block being allocated twice.
+	bus->AddressSelect(0x400010);
+	uint8_t* host2 = bus->LookupHostPage(0x400000, 0x1000, true);
+	data8 = 7;
+	bus->WriteData(data8, BigEndian);
+	UnitTest::Assert("block allocated twice?", host2[0x10], 7);
+
+	UnitTest::Assert("range crossing a block boundary should not be "
+	    "available", bus->LookupHostPage(0x3ff800, 0x1000, false) == NULL);
+
+	ram->SetVariableValue("writeProtect", "true");
+	UnitTest::Assert("writeprotected page should not be writable",
+	    bus->LookupHostPage(0x1000, 0x1000, true) == NULL);
+	UnitTest::Assert("writeprotected page should still be readable",
+	    bus->LookupHostPage(0x1000, 0x1000, false) == host);
+}
+
 static void Test_RAMComponent_ClearOnReset()
 {
 	refcount_ptr<Component> ram = ComponentFactory::CreateComponent("ram");
@@ -585,6 +863,7 @@ static void Test_RAMComponent_ClearOnReset()
 static void Test_RAMComponent_Clone()
 {
 	refcount_ptr<Component> ram = ComponentFactory::CreateComponent("ram");
+	ram->SetVariableValue("memoryMappedSize", "0x1000");
 	AddressDataBus* bus = ram->AsAddressDataBus();
 
 	uint32_t data32 = 0x89abcdef;
@@ -611,6 +890,125 @@ static void Test_RAMComponent_Clone()
 	UnitTest::Assert("16-bit read", data16_a, 0x3412);
 }
 
+static void Test_RAMComponent_CopyOnWrite()
+{
+	const size_t blockSize = 65536;
+
+	refcount_ptr<Component> ram = ComponentFactory::CreateComponent("ram");
+	AddressDataBus* bus = ram->AsAddressDataBus();
+
+	// Two blocks: one written via the bus, one via a host page.
+	uint32_t data32 = 0x11111111;
+	bus->AddressSelect(0x100);
+	bus->WriteData(data32, BigEndian);
+	uint8_t* host = bus->LookupHostPage(0x20000, 0x1000, true);
+
+	size_t before = RAMComponent::GetTotalAllocatedMemory();
+	refcount_ptr<Component> clone = ram->Clone();
+	AddressDataBus* cloneBus = clone->AsAddressDataBus();
+
+	UnitTest::Assert("cloning should not copy any blocks",
+	    RAMComponent::GetTotalAllocatedMemory() - before, 0);
+	UnitTest::Assert("the clone should reference the same blocks",
+	    RAMComponent::GetAllocatedMemory(clone), 2 * blockSize);
+	UnitTest::Assert("shared block should be readable",
+	    cloneBus->LookupHostPage(0x20000, 0x1000, false) == host);
+
+	// Writing to the original (with the address already selected before
+	// the clone was made) should make a private copy of the block:
+	data32 = 0x22222222;
+	bus->WriteData(data32, BigEndian);
+	UnitTest::Assert("the block should have been copied",
+	    RAMComponent::GetTotalAllocatedMemory() - before, blockSize);
+
+	data32 = 0;
+	cloneBus->AddressSelect(0x100);
+	cloneBus->ReadData(data32, BigEndian);
+	UnitTest::Assert("the clone should not see the write", data32, 0x11111111);
+
+	data32 = 0x33333333;
+	cloneBus->WriteData(data32, BigEndian);
+	UnitTest::Assert("the clone's block is not shared anymore",
+	    RAMComponent::GetTotalAllocatedMemory() - before, blockSize);
+
+	data32 = 0;
+	bus->AddressSelect(0x100);
+	bus->ReadData(data32, BigEndian);
+	UnitTest::Assert("the original should not see the clone's write",
+	    data32, 0x22222222);
+
+	// Writable host pages are also copied before being handed out:
+	uint8_t* host2 = bus->LookupHostPage(0x20000, 0x1000, true);
+	UnitTest::Assert("page should have been copied", host2 != host);
+	UnitTest::Assert("the second block should have been copied",
+	    RAMComponent::GetTotalAllocatedMemory() - before, 2 * blockSize);
+	host2[0] = 42;
+	UnitTest::Assert("the clone should not see writes via host pages",
+	    cloneBus->LookupHostPage(0x20000, 0x1000, false)[0], 0);
+
+	clone = NULL;
+	ram = NULL;
+	UnitTest::Assert("all blocks should have been released",
+	    before - RAMComponent::GetTotalAllocatedMemory(), 2 * blockSize);
+}
+
+static void Test_RAMComponent_DirtyPages()
+{
+	refcount_ptr<Component> ram = ComponentFactory::CreateComponent("ram");
+	RAMComponent* ramComponent = (RAMComponent*) (Component*) ram;
+	AddressDataBus* bus = ram->AsAddressDataBus();
+	vector<uint64_t> pages;
+
+	uint32_t data32 = 0x12345678;
+	bus->AddressSelect(0x2000);
+	bus->WriteData(data32, BigEndian);
+	ramComponent->FetchAndClearDirtyPages(pages);
+	UnitTest::Assert("no tracking, no dirty pages", pages.size(), 0);
+
+	ramComponent->StartDirtyPageTracking();
+
+	uint8_t* host = bus->LookupHostPage(0x5000, 0x1000, false);
+	UnitTest::Assert("host page should be available", host != NULL);
+	ramComponent->FetchAndClearDirtyPages(pages);
+	UnitTest::Assert("lookup for reading should not dirty the page",
+	    pages.size(), 0);
+
+	bus->AddressSelect(0x2000);
+	bus->WriteData(data32, BigEndian);
+	bus->AddressSelect(0x2ffc);
+	bus->WriteData(data32, BigEndian);
+	host = bus->LookupHostPage(0x123000, 0x1000, true);
+	host[0] = 42;
+
+	ramComponent->FetchAndClearDirtyPages(pages);
+	UnitTest::Assert("nr of dirty pages", pages.size(), 2);
+	std::sort(pages.begin(), pages.end());
+	UnitTest::Assert("first dirty page", pages[0], 0x2000);
+	UnitTest::Assert("second dirty page", pages[1], 0x123000);
+
+	ramComponent->FetchAndClearDirtyPages(pages);
+	UnitTest::Assert("pages should have been cleared", pages.size(), 0);
+
+	// A write via the bus after clearing dirties the page again:
+	bus->AddressSelect(0x123008);
+	bus->WriteData(data32, BigEndian);
+	ramComponent->FetchAndClearDirtyPages(pages);
+	UnitTest::Assert("page should be dirty again", pages.size(), 1);
+	UnitTest::Assert("dirty again page", pages[0], 0x123000);
+
+	// Resetting the RAM changes all non-zero pages:
+	ram->Reset();
+	ramComponent->FetchAndClearDirtyPages(pages);
+	UnitTest::Assert("reset should dirty all allocated blocks",
+	    pages.size() > 0);
+
+	ramComponent->StopDirtyPageTracking();
+	bus->AddressSelect(0x2000);
+	bus->WriteData(data32, BigEndian);
+	ramComponent->FetchAndClearDirtyPages(pages);
+	UnitTest::Assert("tracking stopped", pages.size(), 0);
+}
+
 static void Test_RAMComponent_ManualSerialization()
 {
 	refcount_ptr<Component> ram = ComponentFactory::CreateComponent("ram");
@@ -645,6 +1043,83 @@ static void Test_RAMComponent_ManualSerialization()
 	UnitTest::Assert("16-bit read", data16_a, 0x3512);
 }
 
+static void Test_RAMComponent_BinarySerialization()
+{
+	refcount_ptr<Component> ram = ComponentFactory::CreateComponent("ram");
+	ram->SetVariableValue("memoryMappedSize", "0x20000000");
+	AddressDataBus* bus = ram->AsAddressDataBus();
+
+	// A few bytes in two different host blocks, one of them crossing
+	// a 4 KB page boundary, and a larger compressible area:
+	uint32_t data32 = 0x89abcde5;
+	bus->AddressSelect(0x1ffe);
+	bus->WriteData(data32, BigEndian);
+	bus->AddressSelect(0x12345670);
+	bus->WriteData(data32, LittleEndian);
+	for (uint64_t a = 0x100000; a < 0x120000; a += 4) {
+		uint32_t v = a & 0xff0;
+		bus->AddressSelect(a);
+		bus->WriteData(v, BigEndian);
+	}
+
+	SerializationContext context;
+	context.SetBinary(true);
+	context.SetCompress(true);
+	stringstream ss;
+	ram->Serialize(ss, context);
+
+	UnitTest::Assert("zero pages should be elided, and data compressed",
+	    ss.str().length() < 32768);
+
+	stringstream messages;
+	refcount_ptr<Component> ram2 = Component::Deserialize(messages, ss);
+	UnitTest::Assert("deserialization failed", ram2.IsNULL() == false);
+	bus = ram2->AsAddressDataBus();
+
+	data32 = 0;
+	bus->AddressSelect(0x1ffe);
+	bus->ReadData(data32, BigEndian);
+	UnitTest::Assert("across page boundary", data32, 0x89abcde5);
+
+	data32 = 0;
+	bus->AddressSelect(0x12345670);
+	bus->ReadData(data32, LittleEndian);
+	UnitTest::Assert("high address", data32, 0x89abcde5);
+
+	data32 = 0;
+	bus->AddressSelect(0x11fff0);
+	bus->ReadData(data32, BigEndian);
+	UnitTest::Assert("compressed area", data32, 0xff0);
+
+	data32 = 0x1234;
+	bus->AddressSelect(0x200000);
+	bus->ReadData(data32, BigEndian);
+	UnitTest::Assert("elided zeroes", data32, 0);
+}
+
+static void Test_RAMComponent_BinarySerialization_OutOfRange()
+{
+	refcount_ptr<Component> ram = ComponentFactory::CreateComponent("ram");
+	ram->SetVariableValue("memoryMappedSize", "0x10000");
+	AddressDataBus* bus = ram->AsAddressDataBus();
+
+	// The RAM component itself does not check its size, so this
+	// results in a file with data outside of the RAM:
+	uint32_t data32 = 0x12345678;
+	bus->AddressSelect(0x7fff0000);
+	bus->WriteData(data32, BigEndian);
+
+	SerializationContext context;
+	context.SetBinary(true);
+	stringstream ss;
+	ram->Serialize(ss, context);
+
+	stringstream messages;
+	refcount_ptr<Component> ram2 = Component::Deserialize(messages, ss);
+	UnitTest::Assert("data beyond the RAM size should be rejected",
+	    ram2.IsNULL() == true);
+}
+
 static void Test_RAMComponent_Methods_Reexecutableness()
 {
 	refcount_ptr<Component> ram = ComponentFactory::CreateComponent("ram");
@@ -664,9 +1139,14 @@ UNITTESTS(RAMComponent)
 	UNITTEST(Test_RAMComponent_WriteThenRead);
 	UNITTEST(Test_RAMComponent_WriteThenRead_ReverseEndianness);
 	UNITTEST(Test_RAMComponent_WriteProtect);
+	UNITTEST(Test_RAMComponent_LookupHostPage);
 	UNITTEST(Test_RAMComponent_ClearOnReset);
 	UNITTEST(Test_RAMComponent_Clone);
+	UNITTEST(Test_RAMComponent_CopyOnWrite);
+	UNITTEST(Test_RAMComponent_DirtyPages);
 	UNITTEST(Test_RAMComponent_ManualSerialization);
+	UNITTEST(Test_RAMComponent_BinarySerialization);
+	UNITTEST(Test_RAMComponent_BinarySerialization_OutOfRange);
 	UNITTEST(Test_RAMComponent_Methods_Reexecutableness);
 }
 
@@ -1070,6 +1070,98 @@ static void Test_DummyComponent_Execute_Continuous_ThreeComponentsDifferentSpeed
 	}	
 }
 
+static void Test_DummyComponent_Execute_Continuous_ChangesBetweenRuns()
+{
+	GXemul gxemul;
+	gxemul.GetRootComponent()->AddChild(new DummyComponentWithCounter);
+	gxemul.GetRootComponent()->AddChild(new DummyComponentWithCounter);
+
+	refcount_ptr<Component> counterA = gxemul.GetRootComponent()->GetChildren()[0];
+	refcount_ptr<Component> counterB = gxemul.GetRootComponent()->GetChildren()[1];
+
+	counterA->SetVariableValue("counter", "0");
+	counterB->SetVariableValue("counter", "0");
+
+	gxemul.SetRunState(GXemul::Running);
+	gxemul.Execute(100);
+
+	UnitTest::Assert("counter A should be 100",
+	    counterA->GetVariable("counter")->ToInteger(), 100);
+	UnitTest::Assert("counter B should be 100",
+	    counterB->GetVariable("counter")->ToInteger(), 100);
+
+	// Changing a frequency between runs should be taken into account.
+	// (B is now the fastest component, and A's 100 steps correspond to
+	// step 200, so A should not execute at all.)
+	counterB->SetVariableValue("frequency", "2e6");
+	gxemul.Execute(100);
+
+	UnitTest::Assert("counter A should still be 100",
+	    counterA->GetVariable("counter")->ToInteger(), 100);
+	UnitTest::Assert("counter B should now be 200",
+	    counterB->GetVariable("counter")->ToInteger(), 200);
+
+	// ... and so should removing a component:
+	gxemul.GetRootComponent()->RemoveChild(counterA);
+	gxemul.Execute(100);
+
+	UnitTest::Assert("counter A should not have executed",
+	    counterA->GetVariable("counter")->ToInteger(), 100);
+	UnitTest::Assert("counter B should now be 300",
+	    counterB->GetVariable("counter")->ToInteger(), 300);
+}
+
+static void Test_DummyComponent_Execute_Sloppy_ThreeComponentsDifferentSpeed()
+{
+	GXemul gxemul;
+	stringstream os;
+	gxemul.GetRootComponent()->AddChild(new DummyComponentWithCounter(&os, 'A'));
+	gxemul.GetRootComponent()->AddChild(new DummyComponentWithCounter(&os, 'B'));
+	gxemul.GetRootComponent()->AddChild(new DummyComponentWithCounter(&os, 'C'));
+
+	gxemul.GetRootComponent()->SetVariableValue("accuracy", "\"sloppy\"");
+
+	refcount_ptr<Component> counterA = gxemul.GetRootComponent()->GetChildren()[0];
+	refcount_ptr<Component> counterB = gxemul.GetRootComponent()->GetChildren()[1];
+	refcount_ptr<Component> counterC = gxemul.GetRootComponent()->GetChildren()[2];
+
+	counterA->SetVariableValue("counter", "0");
+	counterB->SetVariableValue("counter", "0");
+	counterC->SetVariableValue("counter", "0");
+
+	counterA->SetVariableValue("frequency", "1");
+	counterB->SetVariableValue("frequency", "100");
+	counterC->SetVariableValue("frequency", "10");
+
+	gxemul.SetRunState(GXemul::Running);
+	gxemul.Execute(25000);
+
+	int n = gxemul.GetStep();
+	UnitTest::Assert("all steps should have been executed", n, 25000);
+
+	// Between quanta, the components should be in sync, just as in
+	// cycle accurate mode:
+	UnitTest::Assert("counter A should now be n / 100",
+	    counterA->GetVariable("counter")->ToInteger(), n / 100);
+	UnitTest::Assert("counter B should now be n",
+	    counterB->GetVariable("counter")->ToInteger(), n);
+	UnitTest::Assert("counter C should now be n / 10",
+	    counterC->GetVariable("counter")->ToInteger(), n / 10);
+
+	// ... but within a quantum, the fastest component runs uninterrupted:
+	UnitTest::Assert("B should run a large quantum first",
+	    os.str().substr(0, 10001), string(10000, 'B') + "A");
+
+	// Single-stepping afterwards should continue from where the sloppy
+	// execution left off:
+	gxemul.SetRunState(GXemul::SingleStepping);
+	gxemul.Execute();
+
+	UnitTest::Assert("step should have increased", gxemul.GetStep(), n + 1);
+	UnitTest::Assert("counter B should have increased",
+	    counterB->GetVariable("counter")->ToInteger(), n + 1);
+}
+
 /*
 static void Test_DummyComponent_Execute_Continuous_ThreeComponentsDifferentSpeedWeird2()
 {
@@ -1183,6 +1275,8 @@ UNITTESTS(DummyComponent)
 	UNITTEST(Test_DummyComponent_Execute_Continuous_TwoComponentsDifferentSpeed);
 	UNITTEST(Test_DummyComponent_Execute_Continuous_ThreeComponentsDifferentSpeed);
 	UNITTEST(Test_DummyComponent_Execute_Continuous_ThreeComponentsDifferentSpeedWeird);
+	UNITTEST(Test_DummyComponent_Execute_Continuous_ChangesBetweenRuns);
+	UNITTEST(Test_DummyComponent_Execute_Sloppy_ThreeComponentsDifferentSpeed);
 // TODO: This currently fails!
 //	UNITTEST(Test_DummyComponent_Execute_Continuous_ThreeComponentsDifferentSpeedWeird2);
 }
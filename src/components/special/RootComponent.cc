@@ -58,6 +58,17 @@ void RootComponent::SetOwner(GXemul* owner)
 }
 
 
+void RootComponent::FlushCachedStateForComponent()
+{
+	// Variables may have been changed without going via
+	// SetVariableValue, so GXemul's execution plan cannot be trusted.
+	if (m_gxemul != NULL)
+		m_gxemul->InvalidateExecutionPlan();
+
+	Component::FlushCachedStateForComponent();
+}
+
+
 bool RootComponent::CheckVariableWrite(StateVariable& var, const string& oldValue)
 {
 	UI* ui = GetUI();
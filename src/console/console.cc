@@ -57,10 +57,13 @@
  *  to the handle of the correct port on that controller.
  *
  *
- *  NOTE: The code in this module is mostly non-reentrant.
+ *  NOTE: The code in this module is mostly non-reentrant. The character
+ *  input/output functions used by devices are serialized by console_lock,
+ *  since machines may run on separate host threads.
  */
 
 #include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -103,6 +106,9 @@ static int console_mouse_buttons;	/*  left=4, middle=2, right=1  */
 
 static int allow_slaves = 0;
 
+/*  Recursive; initialized by console_init():  */
+static pthread_mutex_t console_lock;
+
 struct console_handle {
 	int		in_use;
 	int		in_use_for_input;
@@ -283,7 +289,7 @@ static int d_avail(int d)
 	FD_SET(d, &rfds);
 	tv.tv_sec = 0;
 	tv.tv_usec = 0;
-	return select(d+1, &rfds, NULL, NULL, &tv);
+	return select(d+1, &rfds, NULL, NULL, &tv) > 0;
 }
 
 
@@ -295,6 +301,8 @@ static int d_avail(int d)
  */
 void console_makeavail(int handle, char ch)
 {
+	pthread_mutex_lock(&console_lock);
+
 	console_handles[handle].fifo[
 	    console_handles[handle].fifo_head] = ch;
 	console_handles[handle].fifo_head = (
@@ -303,6 +311,8 @@ void console_makeavail(int handle, char ch)
 	if (console_handles[handle].fifo_head ==
 	    console_handles[handle].fifo_tail)
 		fatal("[ WARNING: console fifo overrun, handle %i ]\n", handle);
+
+	pthread_mutex_unlock(&console_lock);
 }
 
 
@@ -344,6 +354,10 @@ static int console_room_left_in_fifo(int handle)
  */
 int console_charavail(int handle)
 {
+	int n;
+
+	pthread_mutex_lock(&console_lock);
+
 	while (console_stdin_avail(handle)) {
 		unsigned char ch[100];		/* = getchar(); */
 		ssize_t len;
@@ -361,6 +375,8 @@ int console_charavail(int handle)
 			d = console_handles[handle].r_descriptor;
 
 		len = read(d, ch, sizeof(ch));
+		if (len <= 0)
+			break;
 
 		for (i=0; i<len; i++) {
 			/*  printf("[ %i: %i ]\n", i, ch[i]);  */
@@ -376,7 +392,10 @@ int console_charavail(int handle)
 		}
 	}
 
-	return CONSOLE_FIFO_LEN - console_room_left_in_fifo(handle);
+	n = CONSOLE_FIFO_LEN - console_room_left_in_fifo(handle);
+
+	pthread_mutex_unlock(&console_lock);
+	return n;
 }
 
 
@@ -389,13 +408,18 @@ int console_readchar(int handle)
 {
 	int ch;
 
-	if (!console_charavail(handle))
+	pthread_mutex_lock(&console_lock);
+
+	if (!console_charavail(handle)) {
+		pthread_mutex_unlock(&console_lock);
 		return -1;
+	}
 
 	ch = console_handles[handle].fifo[console_handles[handle].fifo_tail];
 	console_handles[handle].fifo_tail ++;
 	console_handles[handle].fifo_tail %= CONSOLE_FIFO_LEN;
 
+	pthread_mutex_unlock(&console_lock);
 	return ch;
 }
 
@@ -409,6 +433,8 @@ void console_putchar(int handle, int ch)
 {
 	char buf[1];
 
+	pthread_mutex_lock(&console_lock);
+
 	if (!console_handles[handle].in_use_for_input &&
 	    !console_handles[handle].outputonly)
 		console_change_inputability(handle, 1);
@@ -423,12 +449,14 @@ void console_putchar(int handle, int ch)
 		else
 			console_stdout_pending = 1;
 
+		pthread_mutex_unlock(&console_lock);
 		return;
 	}
 
 	if (!console_handles[handle].in_use) {
 		printf("[ console_putchar(): handle %i not in"
 		    " use! ]\n", handle);
+		pthread_mutex_unlock(&console_lock);
 		return;
 		}
 
@@ -439,6 +467,8 @@ void console_putchar(int handle, int ch)
 	buf[0] = ch;
 	if (write(console_handles[handle].w_descriptor, buf, 1) != 1)
 		perror("error writing to console handle");
+
+	pthread_mutex_unlock(&console_lock);
 }
 
 
@@ -449,10 +479,14 @@ void console_putchar(int handle, int ch)
  */
 void console_flush(void)
 {
+	pthread_mutex_lock(&console_lock);
+
 	if (console_stdout_pending)
 		fflush(stdout);
 
 	console_stdout_pending = 0;
+
+	pthread_mutex_unlock(&console_lock);
 }
 
 
@@ -957,6 +991,12 @@ void console_init(void)
 {
 	int handle;
 	struct console_handle *chp;
+	pthread_mutexattr_t attr;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&console_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
 
 	console_settings = settings_new();
 
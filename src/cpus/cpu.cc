@@ -94,6 +94,15 @@ struct cpu *cpu_new(struct memory *mem, struct machine *machine,
 	    SETTINGS_FORMAT_STRING, (void *) &cpu->name);
 	settings_add(cpu->settings, "running", 0, SETTINGS_TYPE_UINT8,
 	    SETTINGS_FORMAT_YESNO, (void *) &cpu->running);
+	settings_add(cpu->settings, "tc_hits", 0, SETTINGS_TYPE_UINT64,
+	    SETTINGS_FORMAT_DECIMAL, (void *) &cpu->translation_cache_hits);
+	settings_add(cpu->settings, "tc_misses", 0, SETTINGS_TYPE_UINT64,
+	    SETTINGS_FORMAT_DECIMAL, (void *) &cpu->translation_cache_misses);
+	settings_add(cpu->settings, "tc_evictions", 0, SETTINGS_TYPE_UINT64,
+	    SETTINGS_FORMAT_DECIMAL,
+	    (void *) &cpu->translation_cache_evictions);
+	settings_add(cpu->settings, "tc_resets", 0, SETTINGS_TYPE_UINT64,
+	    SETTINGS_FORMAT_DECIMAL, (void *) &cpu->translation_cache_resets);
 
 	cpu_create_or_reset_tc(cpu);
 
@@ -292,6 +301,8 @@ void cpu_create_or_reset_tc(struct cpu *cpu)
 
 	if (cpu->translation_cache == NULL)
 		cpu->translation_cache = (unsigned char *) zeroed_alloc(s);
+	else
+		cpu->translation_cache_resets ++;
 
 	/*  Create an empty table at the beginning of the translation cache:  */
 	memset(cpu->translation_cache, 0, sizeof(uint32_t)
@@ -299,6 +310,7 @@ void cpu_create_or_reset_tc(struct cpu *cpu)
 
 	cpu->translation_cache_cur_ofs =
 	    N_BASE_TABLE_ENTRIES * sizeof(uint32_t);
+	cpu->translation_cache_mru_ofs = cpu->translation_cache_lru_ofs = 0;
 
 	/*
 	 *  There might be other translation pointers that still point to
@@ -367,7 +379,7 @@ void cpu_list_available_types(void)
  */
 void cpu_run_deinit(struct machine *machine)
 {
-	int te;
+	int i;
 
 	/*
 	 *  Two last ticks of every hardware device.  This will allow e.g.
@@ -376,16 +388,22 @@ void cpu_run_deinit(struct machine *machine)
 	 *  TODO: This should be refactored when redesigning the mainbus
 	 *        concepts!
 	 */
-        for (te=0; te<machine->tick_functions.n_entries; te++) {
-		machine->tick_functions.f[te](machine->cpus[0],
-		    machine->tick_functions.extra[te]);
-		machine->tick_functions.f[te](machine->cpus[0],
-		    machine->tick_functions.extra[te]);
-	}
+	machine_events_tick_all(machine, machine->cpus[0]);
+	machine_events_tick_all(machine, machine->cpus[0]);
 
 	if (machine->show_nr_of_instructions)
 		cpu_show_cycles(machine, 1);
 
+	for (i=0; i<machine->ncpus; i++) {
+		struct cpu *cpu = machine->cpus[i];
+		debug("cpu%i: translation cache: %" PRIu64" hits, %" PRIu64
+		    " misses, %" PRIu64" evictions, %" PRIu64" resets\n",
+		    cpu->cpu_id, cpu->translation_cache_hits,
+		    cpu->translation_cache_misses,
+		    cpu->translation_cache_evictions,
+		    cpu->translation_cache_resets);
+	}
+
 	fflush(stdout);
 }
 
@@ -561,19 +561,164 @@ void DYNTRANS_FUNCTION_TRACE_DEF(struct cpu *cpu, int n_args)
 
 
 #ifdef DYNTRANS_TC_ALLOCATE_DEFAULT_PAGE_DEF
+/*
+ *  XXX_tc_lru_unlink():
+ *
+ *  Remove a physpage from the translation cache's LRU list.
+ */
+static void DYNTRANS_TC_LRU_UNLINK(struct cpu *cpu,
+	struct DYNTRANS_TC_PHYSPAGE *ppp)
+{
+	if (ppp->lru_prev_ofs != 0)
+		((struct DYNTRANS_TC_PHYSPAGE *)(cpu->translation_cache +
+		    ppp->lru_prev_ofs))->lru_next_ofs = ppp->lru_next_ofs;
+	else
+		cpu->translation_cache_mru_ofs = ppp->lru_next_ofs;
+
+	if (ppp->lru_next_ofs != 0)
+		((struct DYNTRANS_TC_PHYSPAGE *)(cpu->translation_cache +
+		    ppp->lru_next_ofs))->lru_prev_ofs = ppp->lru_prev_ofs;
+	else
+		cpu->translation_cache_lru_ofs = ppp->lru_prev_ofs;
+
+	ppp->lru_prev_ofs = ppp->lru_next_ofs = 0;
+}
+
+
+/*
+ *  XXX_tc_touch_page():
+ *
+ *  Move a physpage (at offset physpage_ofs in the translation cache) to the
+ *  most recently used end of the LRU list.
+ */
+static void DYNTRANS_TC_TOUCH(struct cpu *cpu, uint32_t physpage_ofs)
+{
+	struct DYNTRANS_TC_PHYSPAGE *ppp = (struct DYNTRANS_TC_PHYSPAGE *)
+	    (cpu->translation_cache + physpage_ofs);
+
+	ppp->referenced = 0;
+
+	if (cpu->translation_cache_mru_ofs == physpage_ofs)
+		return;
+
+	/*  Pages not yet in the list have no neighbours, and are not MRU:  */
+	if (ppp->lru_prev_ofs != 0)
+		DYNTRANS_TC_LRU_UNLINK(cpu, ppp);
+
+	ppp->lru_next_ofs = cpu->translation_cache_mru_ofs;
+	if (ppp->lru_next_ofs != 0)
+		((struct DYNTRANS_TC_PHYSPAGE *)(cpu->translation_cache +
+		    ppp->lru_next_ofs))->lru_prev_ofs = physpage_ofs;
+	else
+		cpu->translation_cache_lru_ofs = physpage_ofs;
+
+	cpu->translation_cache_mru_ofs = physpage_ofs;
+}
+
+
+/*
+ *  XXX_tc_evict_lru_page():
+ *
+ *  Evict the least recently used physpage from the translation cache, and
+ *  return its offset so that the slot can be reused. Pages that have been
+ *  referenced via the quick lookup path, and the page which is currently
+ *  executing, are moved to the front of the list instead (a second chance).
+ *
+ *  Returns 0 if there was no page which could be evicted.
+ */
+static uint32_t DYNTRANS_TC_EVICT(struct cpu *cpu)
+{
+	struct DYNTRANS_TC_PHYSPAGE *ppp;
+	uint32_t physpage_ofs, *physpage_entryp;
+	int pagenr, table_index;
+
+	if (cpu->invalidate_code_translation == NULL)
+		return 0;
+
+	for (;;) {
+		physpage_ofs = cpu->translation_cache_lru_ofs;
+		if (physpage_ofs == 0 ||
+		    physpage_ofs == cpu->translation_cache_mru_ofs)
+			return 0;
+
+		ppp = (struct DYNTRANS_TC_PHYSPAGE *)
+		    (cpu->translation_cache + physpage_ofs);
+
+		if (!ppp->referenced &&
+		    &ppp->ics[0] != cpu->cd.DYNTRANS_ARCH.cur_ic_page)
+			break;
+
+		DYNTRANS_TC_TOUCH(cpu, physpage_ofs);
+	}
+
+	/*
+	 *  Remove all pointers to the page from the virtual to physpage
+	 *  tables. This must be done while the page is still in its chain,
+	 *  since invalidate_code_translation looks it up there.
+	 */
+	cpu->invalidate_code_translation(cpu, ppp->physaddr, INVALIDATE_PADDR);
+
+	/*  Unlink the page from its physical page chain:  */
+	pagenr = DYNTRANS_ADDR_TO_PAGENR(ppp->physaddr);
+	table_index = PAGENR_TO_TABLE_INDEX(pagenr);
+
+	physpage_entryp = &(((uint32_t *)cpu->translation_cache)[table_index]);
+	while (*physpage_entryp != physpage_ofs)
+		physpage_entryp = &((struct DYNTRANS_TC_PHYSPAGE *)
+		    (cpu->translation_cache + *physpage_entryp))->next_ofs;
+
+	*physpage_entryp = ppp->next_ofs;
+
+	DYNTRANS_TC_LRU_UNLINK(cpu, ppp);
+
+	cpu->translation_cache_evictions ++;
+
+	return physpage_ofs;
+}
+
+
 /*
  *  XXX_tc_allocate_default_page():
  *
- *  Create a default page (with just pointers to instr(to_be_translated)
- *  at cpu->translation_cache_cur_ofs.
+ *  Create a default page (with just pointers to instr(to_be_translated),
+ *  and return its offset within the translation cache. The page is taken
+ *  from cpu->translation_cache_cur_ofs, or if the cache is full, from the
+ *  least recently used page (which is then evicted).
+ *
+ *  The new page is placed first in the LRU list, but is not inserted into
+ *  any physical page chain; that is up to the caller.
  */
-static void DYNTRANS_TC_ALLOCATE_DEFAULT_PAGE_DEF(struct cpu *cpu,
+static uint32_t DYNTRANS_TC_ALLOCATE_DEFAULT_PAGE_DEF(struct cpu *cpu,
 	uint64_t physaddr)
 { 
 	struct DYNTRANS_TC_PHYSPAGE *ppp;
+	uint32_t physpage_ofs = 0;
+
+	if (cpu->translation_cache_cur_ofs >= dyntrans_cache_size) {
+		physpage_ofs = DYNTRANS_TC_EVICT(cpu);
+
+		/*  Nothing to evict? Then start over from scratch.  */
+		if (physpage_ofs == 0) {
+#ifdef UNSTABLE_DEVEL
+			fatal("[ dyntrans: resetting the translation cache ]\n");
+#endif
+			cpu_create_or_reset_tc(cpu);
+		}
+	}
+
+	if (physpage_ofs == 0) {
+		physpage_ofs = cpu->translation_cache_cur_ofs;
+
+		cpu->translation_cache_cur_ofs +=
+		    sizeof(struct DYNTRANS_TC_PHYSPAGE);
+
+		cpu->translation_cache_cur_ofs --;
+		cpu->translation_cache_cur_ofs |= 63;
+		cpu->translation_cache_cur_ofs ++;
+	}
 
 	ppp = (struct DYNTRANS_TC_PHYSPAGE *)(cpu->translation_cache
-	    + cpu->translation_cache_cur_ofs);
+	    + physpage_ofs);
 
 	/*  Copy the entire template page first:  */
 	memcpy(ppp, cpu->cd.DYNTRANS_ARCH.physpage_template, sizeof(
@@ -581,11 +726,9 @@ static void DYNTRANS_TC_ALLOCATE_DEFAULT_PAGE_DEF(struct cpu *cpu,
 
 	ppp->physaddr = physaddr & ~(DYNTRANS_PAGESIZE - 1);
 
-	cpu->translation_cache_cur_ofs += sizeof(struct DYNTRANS_TC_PHYSPAGE);
+	DYNTRANS_TC_TOUCH(cpu, physpage_ofs);
 
-	cpu->translation_cache_cur_ofs --;
-	cpu->translation_cache_cur_ofs |= 63;
-	cpu->translation_cache_cur_ofs ++;
+	return physpage_ofs;
 }
 #endif	/*  DYNTRANS_TC_ALLOCATE_DEFAULT_PAGE_DEF  */
 
@@ -730,13 +873,6 @@ void DYNTRANS_PC_TO_POINTERS_GENERIC(struct cpu *cpu)
 		}
 	}
 
-	if (cpu->translation_cache_cur_ofs >= dyntrans_cache_size) {
-#ifdef UNSTABLE_DEVEL
-		fatal("[ dyntrans: resetting the translation cache ]\n");
-#endif
-		cpu_create_or_reset_tc(cpu);
-	}
-
 	pagenr = DYNTRANS_ADDR_TO_PAGENR(physaddr);
 	table_index = PAGENR_TO_TABLE_INDEX(pagenr);
 
@@ -763,26 +899,28 @@ void DYNTRANS_PC_TO_POINTERS_GENERIC(struct cpu *cpu)
 	 *  the chain.
 	 */
 	if (physpage_ofs == 0) {
-		uint32_t previous_first_page_in_chain;
-
 		/*  fatal("CREATING page %lli (physaddr 0x%" PRIx64"), table "
 		    "index %i\n", (long long)pagenr, (uint64_t)physaddr,
 		    (int)table_index);  */
 
-		previous_first_page_in_chain = *physpage_entryp;
-
-		/*  Insert the new page first in the chain:  */
-		*physpage_entryp = physpage_ofs =
-		    cpu->translation_cache_cur_ofs;
-
 		/*  Allocate a default page, with to_be_translated entries:  */
-		DYNTRANS_TC_ALLOCATE(cpu, physaddr);
+		physpage_ofs = DYNTRANS_TC_ALLOCATE(cpu, physaddr);
 
 		ppp = (struct DYNTRANS_TC_PHYSPAGE *)(cpu->translation_cache
 		    + physpage_ofs);
 
-		/*  Point to the other pages in the same chain:  */
-		ppp->next_ofs = previous_first_page_in_chain;
+		/*
+		 *  Insert the new page first in the chain. (The allocation
+		 *  may have evicted a page from this chain, or reset the
+		 *  whole cache, so the chain head must be read here.)
+		 */
+		ppp->next_ofs = *physpage_entryp;
+		*physpage_entryp = physpage_ofs;
+
+		cpu->translation_cache_misses ++;
+	} else {
+		DYNTRANS_TC_TOUCH(cpu, physpage_ofs);
+		cpu->translation_cache_hits ++;
 	}
 
 	/*  Here, ppp points to a valid physical page struct.  */
@@ -803,6 +941,11 @@ void DYNTRANS_PC_TO_POINTERS_GENERIC(struct cpu *cpu)
 	if (ppp->translations_bitmap == 0) {
 		cpu->invalidate_translation_caches(cpu, physaddr,
 		    JUST_MARK_AS_NON_WRITABLE | INVALIDATE_PADDR);
+
+		/*  Other CPUs must not write to the page directly either:  */
+		if (cpu->machine->smp != NULL)
+			machine_smp_note_paddr(cpu, physaddr,
+			    SMP_NOTE_CODE_PAGE);
 	}
 
 	cpu->cd.DYNTRANS_ARCH.cur_ic_page = &ppp->ics[0];
@@ -868,6 +1011,7 @@ void DYNTRANS_PC_TO_POINTERS_FUNC(struct cpu *cpu)
 
 	/*  Quick return path:  */
 have_it:
+	ppp->referenced = 1;
 	cpu->cd.DYNTRANS_ARCH.cur_ic_page = &ppp->ics[0];
 	cpu->cd.DYNTRANS_ARCH.next_ic = cpu->cd.DYNTRANS_ARCH.cur_ic_page +
 	    DYNTRANS_PC_TO_IC_ENTRY(cached_pc);
@@ -926,6 +1070,8 @@ void DYNTRANS_INIT_TABLES(struct cpu *cpu)
 	ppp->next_ofs = 0;
 	ppp->translations_bitmap = 0;
 	ppp->translation_ranges_ofs = 0;
+	ppp->lru_prev_ofs = ppp->lru_next_ofs = 0;
+	ppp->referenced = 0;
 	/*  ppp->physaddr is filled in by the page allocator  */
 
 	for (i=0; i<DYNTRANS_IC_ENTRIES_PER_PAGE; i++)
@@ -38,6 +38,7 @@
 #include "../../config.h"
 
 #include "arcbios.h"
+#include "checkpoint.h"
 #include "cop0.h"
 #include "cpu.h"
 #include "cpu_mips.h"
@@ -135,6 +136,7 @@ int mips_cpu_new(struct cpu *cpu, struct memory *mem, struct machine *machine,
 	}
 
 	cpu->instruction_has_delayslot = mips_cpu_instruction_has_delayslot;
+	cpu->checkpoint = mips_cpu_checkpoint;
 
 	if (cpu_id == 0)
 		debug("%s", cpu->cd.mips.cpu_type.name);
@@ -437,6 +439,37 @@ void mips_cpu_list_available_types(void)
 }
 
 
+/*
+ *  mips_cpu_checkpoint():
+ *
+ *  Saves or restores the MIPS specific parts of a CPU's state.
+ */
+void mips_cpu_checkpoint(struct cpu *cpu, struct checkpoint *ckpt)
+{
+	CHECKPOINT_ARRAY(ckpt, cpu->cd.mips.gpr, N_MIPS_GPRS);
+	CHECKPOINT_VAR(ckpt, cpu->cd.mips.hi);
+	CHECKPOINT_VAR(ckpt, cpu->cd.mips.lo);
+
+	CHECKPOINT_ARRAY(ckpt, cpu->cd.mips.gpr_quadhi, N_MIPS_GPRS);
+	CHECKPOINT_VAR(ckpt, cpu->cd.mips.hi1);
+	CHECKPOINT_VAR(ckpt, cpu->cd.mips.lo1);
+	CHECKPOINT_VAR(ckpt, cpu->cd.mips.r5900_sa);
+
+	CHECKPOINT_VAR(ckpt, cpu->cd.mips.cop0_config_select1);
+	CHECKPOINT_VAR(ckpt, cpu->cd.mips.last_written_tlb_index);
+
+	CHECKPOINT_VAR(ckpt, cpu->cd.mips.compare_register_set);
+	CHECKPOINT_VAR(ckpt, cpu->cd.mips.compare_interrupts_pending);
+	CHECKPOINT_VAR(ckpt, cpu->cd.mips.count_register_read_count);
+
+	CHECKPOINT_VAR(ckpt, cpu->cd.mips.rmw);
+	CHECKPOINT_VAR(ckpt, cpu->cd.mips.rmw_len);
+	CHECKPOINT_VAR(ckpt, cpu->cd.mips.rmw_addr);
+
+	mips_coproc_checkpoint(cpu, ckpt);
+}
+
+
 /*
  *  mips_cpu_instruction_has_delayslot():
  *
@@ -33,6 +33,7 @@
 #include <string.h>
 #include <math.h>
 
+#include "checkpoint.h"
 #include "cop0.h"
 #include "cpu.h"
 #include "cpu_mips.h"
@@ -348,6 +349,113 @@ static void initialize_cop1(struct cpu *cpu, struct mips_coproc *c)
 }
 
 
+/*
+ *  tlb_index_update():
+ *
+ *  Re-hashes TLB entry entrynr of coprocessor 0 (cp) into the TLB lookup
+ *  index. Must be called whenever a TLB entry has been written.
+ */
+static void tlb_index_update(struct cpu *cpu, struct mips_coproc *cp,
+	int entrynr)
+{
+	struct mips_tlb_index *ti = cp->tlb_index;
+	struct mips_tlb *tlb = &cp->tlbs[entrynr];
+	uint64_t bit = (uint64_t)1 << entrynr, asid;
+	int vpn_shift, is_global, b;
+
+	if (ti == NULL)
+		return;
+
+	/*  Remove the old entry:  */
+	ti->unindexed &= ~bit;
+	vpn_shift = ti->vpn_shift[entrynr];
+	if (vpn_shift >= 0) {
+		b = ti->bucket[entrynr];
+		if (ti->is_global[entrynr])
+			ti->global[b] &= ~bit;
+		else
+			ti->by_asid[b] &= ~bit;
+		if (--ti->n_with_vpn_shift[vpn_shift] == 0) {
+			for (b=0; ti->vpn_shifts[b] != vpn_shift; b++)
+				;
+			ti->vpn_shifts[b] = ti->vpn_shifts[--ti->n_vpn_shifts];
+		}
+	}
+
+	/*  Figure out VPN shift, ASID and global bit of the new entry:  */
+	if (cpu->cd.mips.cpu_type.mmu_model == MMU3K) {
+		vpn_shift = 12;
+		asid = tlb->hi & R2K3K_ENTRYHI_ASID_MASK;
+		is_global = tlb->lo0 & R2K3K_ENTRYLO_G? 1 : 0;
+	} else {
+		int pagemask_mask = PAGEMASK_MASK;
+		int pagemask_shift = PAGEMASK_SHIFT;
+		uint64_t pmask;
+
+		if (cpu->cd.mips.cpu_type.rev == MIPS_R4100) {
+			pagemask_mask = PAGEMASK_MASK_R4100;
+			pagemask_shift = PAGEMASK_SHIFT_R4100;
+		}
+
+		/*  Same page sizes as in memory_mips_v2p.cc:  */
+		pmask = (tlb->mask & pagemask_mask) |
+		    ((1 << pagemask_shift) - 1);
+		vpn_shift = -1;
+		for (b = pagemask_shift - 1; b <= 26; b += 2)
+			if (pmask == ((uint64_t)1 << (b + 1)) - 1)
+				vpn_shift = b + 1;
+
+		asid = tlb->hi & ENTRYHI_ASID;
+
+		/*  (Either of these may be used, depending on CPU type.)  */
+		is_global = (tlb->hi & TLB_G) ||
+		    (tlb->lo0 & tlb->lo1 & ENTRYLO_G);
+	}
+
+	ti->vpn_shift[entrynr] = vpn_shift;
+	if (vpn_shift < 0) {
+		ti->unindexed |= bit;
+		return;
+	}
+
+	b = MIPS_TLB_INDEX_HASH(tlb->hi >> vpn_shift, is_global? 0 : asid);
+	ti->bucket[entrynr] = b;
+	ti->is_global[entrynr] = is_global;
+	if (is_global)
+		ti->global[b] |= bit;
+	else
+		ti->by_asid[b] |= bit;
+
+	if (ti->n_with_vpn_shift[vpn_shift]++ == 0)
+		ti->vpn_shifts[ti->n_vpn_shifts++] = vpn_shift;
+}
+
+
+/*
+ *  mips_coproc_tlb_index_candidates():
+ *
+ *  Returns a bitmask of the TLB entries which may contain a translation for
+ *  vaddr with the given ASID (which should be masked the same way as in the
+ *  EntryHi register). Entries not in the returned mask are guaranteed not to
+ *  match, but entries in the mask still need to be checked.
+ */
+uint64_t mips_coproc_tlb_index_candidates(struct mips_coproc *cp,
+	uint64_t vaddr, uint64_t asid)
+{
+	struct mips_tlb_index *ti = cp->tlb_index;
+	uint64_t candidates = ti->unindexed;
+	int i;
+
+	for (i=0; i<ti->n_vpn_shifts; i++) {
+		uint64_t vpn = vaddr >> ti->vpn_shifts[i];
+		candidates |= ti->global[MIPS_TLB_INDEX_HASH(vpn, 0)];
+		candidates |= ti->by_asid[MIPS_TLB_INDEX_HASH(vpn, asid)];
+	}
+
+	return candidates;
+}
+
+
 /*
  *  mips_coproc_new():
  *
@@ -366,6 +474,21 @@ struct mips_coproc *mips_coproc_new(struct cpu *cpu, int coproc_nr)
 		c->nr_of_tlbs = cpu->cd.mips.cpu_type.nr_of_tlb_entries;
 		c->tlbs = (struct mips_tlb *) zeroed_alloc(c->nr_of_tlbs * sizeof(struct mips_tlb));
 
+		/*  The R8000 MMU is not really emulated; it uses plain scans.  */
+		if (c->nr_of_tlbs <= MIPS_TLB_INDEX_MAX_ENTRIES &&
+		    cpu->cd.mips.cpu_type.mmu_model != MMU8K) {
+			int i;
+
+			CHECK_ALLOCATION(c->tlb_index = (struct mips_tlb_index *)
+			    malloc(sizeof(struct mips_tlb_index)));
+			memset(c->tlb_index, 0, sizeof(struct mips_tlb_index));
+			memset(c->tlb_index->vpn_shift, -1,
+			    sizeof(c->tlb_index->vpn_shift));
+
+			for (i=0; i<c->nr_of_tlbs; i++)
+				tlb_index_update(cpu, c, i);
+		}
+
 		/*
 		 *  Start with nothing in the status register. This makes sure
 		 *  that we are running in kernel mode with all interrupts
@@ -429,6 +552,62 @@ static void mips_timer_tick(struct timer *timer, void *extra)
 }
 
 
+/*
+ *  mips_coproc_checkpoint():
+ *
+ *  Saves or restores the coprocessor registers, the TLB, and the frequency
+ *  of the count/compare timer. After a restore, the TLB lookup index is
+ *  rebuilt.
+ */
+void mips_coproc_checkpoint(struct cpu *cpu, struct checkpoint *ckpt)
+{
+	struct mips_coproc *cp0 = cpu->cd.mips.coproc[0];
+	uint64_t hz_bits;
+	double hz = 0.0;
+	int cpnr, i;
+
+	for (cpnr = 0; cpnr < N_MIPS_COPROCS; cpnr ++) {
+		struct mips_coproc *cp = cpu->cd.mips.coproc[cpnr];
+
+		if (cp == NULL)
+			continue;
+
+		CHECKPOINT_ARRAY(ckpt, cp->reg, N_MIPS_COPROC_REGS);
+		CHECKPOINT_ARRAY(ckpt, cp->fcr, N_MIPS_FCRS);
+	}
+
+	for (i = 0; i < cp0->nr_of_tlbs; i++) {
+		CHECKPOINT_VAR(ckpt, cp0->tlbs[i].hi);
+		CHECKPOINT_VAR(ckpt, cp0->tlbs[i].lo0);
+		CHECKPOINT_VAR(ckpt, cp0->tlbs[i].lo1);
+		CHECKPOINT_VAR(ckpt, cp0->tlbs[i].mask);
+	}
+
+	if (cpu->cd.mips.timer != NULL)
+		hz = timer_get_frequency(cpu->cd.mips.timer);
+
+	memcpy(&hz_bits, &hz, sizeof(hz_bits));
+	CHECKPOINT_VAR(ckpt, hz_bits);
+	memcpy(&hz, &hz_bits, sizeof(hz));
+
+	if (!ckpt->restoring)
+		return;
+
+	for (i = 0; i < cp0->nr_of_tlbs; i++)
+		tlb_index_update(cpu, cp0, i);
+
+	if (hz > 0) {
+		if (cpu->cd.mips.timer == NULL)
+			cpu->cd.mips.timer = timer_add(hz, mips_timer_tick, cpu);
+		else
+			timer_update_frequency(cpu->cd.mips.timer, hz);
+	} else if (cpu->cd.mips.timer != NULL) {
+		timer_remove(cpu->cd.mips.timer);
+		cpu->cd.mips.timer = NULL;
+	}
+}
+
+
 /*
  *  mips_coproc_tlb_set_entry():
  *
@@ -497,6 +676,8 @@ void mips_coproc_tlb_set_entry(struct cpu *cpu, int entrynr, int size,
 		    ((cachealgo1 << ENTRYLO_C_SHIFT) & ENTRYLO_C_MASK);
 		/*  TODO: R4100, 1KB pages etc  */
 	}
+
+	tlb_index_update(cpu, cpu->cd.mips.coproc[0], entrynr);
 }
 
 
@@ -1490,7 +1671,7 @@ void coproc_tlbpr(struct cpu *cpu, int readflag)
 {
 	struct mips_coproc *cp = cpu->cd.mips.coproc[0];
 	int i, found, g_bit;
-	uint64_t vpn2, xmask;
+	uint64_t vpn2, xmask, candidates;
 
 	/*  Read:  */
 	if (readflag) {
@@ -1541,10 +1722,20 @@ void coproc_tlbpr(struct cpu *cpu, int readflag)
 	}
 
 	/*  Probe:  */
+	candidates = (uint64_t) -1;
+	if (cp->tlb_index != NULL)
+		candidates = mips_coproc_tlb_index_candidates(cp,
+		    cp->reg[COP0_ENTRYHI], cp->reg[COP0_ENTRYHI] &
+		    (cpu->cd.mips.cpu_type.mmu_model == MMU3K?
+		    R2K3K_ENTRYHI_ASID_MASK : ENTRYHI_ASID));
+
 	if (cpu->cd.mips.cpu_type.mmu_model == MMU3K) {
 		vpn2 = cp->reg[COP0_ENTRYHI] & R2K3K_ENTRYHI_VPN_MASK;
 		found = -1;
-		for (i=0; i<cp->nr_of_tlbs; i++)
+		for (i=0; i<cp->nr_of_tlbs; i++) {
+			if (i < MIPS_TLB_INDEX_MAX_ENTRIES &&
+			    !((candidates >> i) & 1))
+				continue;
 			if ( ((cp->tlbs[i].hi & R2K3K_ENTRYHI_ASID_MASK) ==
 			    (cp->reg[COP0_ENTRYHI] & R2K3K_ENTRYHI_ASID_MASK))
 			    || cp->tlbs[i].lo0 & R2K3K_ENTRYLO_G)
@@ -1553,6 +1744,7 @@ void coproc_tlbpr(struct cpu *cpu, int readflag)
 					found = i;
 					break;
 				}
+		}
 	} else {
 		/*  R4000 and R10000:  */
 		if (cpu->cd.mips.cpu_type.mmu_model == MMU10K)
@@ -1566,6 +1758,11 @@ void coproc_tlbpr(struct cpu *cpu, int readflag)
 		found = -1;
 		for (i=0; i<cp->nr_of_tlbs; i++) {
 			int gbit = cp->tlbs[i].hi & TLB_G;
+
+			if (i < MIPS_TLB_INDEX_MAX_ENTRIES &&
+			    !((candidates >> i) & 1))
+				continue;
+
 			if (cpu->cd.mips.cpu_type.rev == MIPS_R4100)
 				gbit = (cp->tlbs[i].lo0 & ENTRYLO_G) &&
 				    (cp->tlbs[i].lo1 & ENTRYLO_G);
@@ -1795,6 +1992,7 @@ void coproc_tlbwri(struct cpu *cpu, int randomflag)
 
 		/*  Set new last_written_tlb_index hint:  */
 		cpu->cd.mips.last_written_tlb_index = index;
+		tlb_index_update(cpu, cp, index);
 
 		if (cp->reg[COP0_STATUS] & MIPS1_ISOL_CACHES) {
 			fatal("Wow! Interesting case; tlbw* while caches"
@@ -1805,11 +2003,13 @@ void coproc_tlbwri(struct cpu *cpu, int randomflag)
 		}
 
 		/*  If we have a memblock (host page) for the physical
-		    page, then add a translation for it immediately:  */
+		    page, then add a translation for it immediately. (Clean
+		    pages are read-only, if dirty page tracking is used.)  */
 		if (memblock != NULL &&
 		    cp->reg[COP0_ENTRYLO0] & R2K3K_ENTRYLO_V)
 			cpu->update_translation_table(cpu, vaddr, memblock,
-			    wf, paddr);
+			    wf && memory_dirty_write_ok(cpu->mem, paddr,
+			    0x1000), paddr);
 	} else {
 		/*  R4000 etc.:  */
 		unsigned char *memblock = NULL;
@@ -1931,15 +2131,18 @@ void coproc_tlbwri(struct cpu *cpu, int randomflag)
 			memblock = memory_paddr_to_hostaddr(cpu->mem, paddr0, 0);
 			if (memblock != NULL && cp->reg[COP0_ENTRYLO0] & ENTRYLO_V)
 				cpu->update_translation_table(cpu, vaddr0, memblock,
-				    wf0, paddr0);
+				    wf0 && memory_dirty_write_ok(cpu->mem, paddr0,
+				    psize), paddr0);
 			memblock = memory_paddr_to_hostaddr(cpu->mem, paddr1, 0);
 			if (memblock != NULL && cp->reg[COP0_ENTRYLO1] & ENTRYLO_V)
 				cpu->update_translation_table(cpu, vaddr1, memblock,
-				    wf1, paddr1);
+				    wf1 && memory_dirty_write_ok(cpu->mem, paddr1,
+				    psize), paddr1);
 		}
 
 		/*  Set new last_written_tlb_index hint:  */
 		cpu->cd.mips.last_written_tlb_index = index;
+		tlb_index_update(cpu, cp, index);
 	}
 }
 
@@ -2402,15 +2402,23 @@ X(ll)
 		exit(1);
 	}
 
+	/*  The load and the reservation must be atomic with respect to
+	    sc on other CPUs, which clears matching reservations:  */
+	MACHINE_SMP_LOCK(cpu->machine);
+
 	if (!cpu->memory_rw(cpu, cpu->mem, addr, word,
 	    sizeof(word), MEM_READ, CACHE_DATA)) {
 		/*  An exception occurred.  */
+		MACHINE_SMP_UNLOCK(cpu->machine);
 		return;
 	}
 
 	cpu->cd.mips.rmw = 1;
 	cpu->cd.mips.rmw_addr = addr;
 	cpu->cd.mips.rmw_len = sizeof(word);
+
+	MACHINE_SMP_UNLOCK(cpu->machine);
+
 	if (cpu->cd.mips.cpu_type.exc_model != MMU10K)
 		cpu->cd.mips.coproc[0]->reg[COP0_LLADDR] =
 		    (addr >> 4) & 0xffffffffULL;
@@ -2440,15 +2448,23 @@ X(lld)
 		exit(1);
 	}
 
+	/*  The load and the reservation must be atomic with respect to
+	    sc on other CPUs, which clears matching reservations:  */
+	MACHINE_SMP_LOCK(cpu->machine);
+
 	if (!cpu->memory_rw(cpu, cpu->mem, addr, word,
 	    sizeof(word), MEM_READ, CACHE_DATA)) {
 		/*  An exception occurred.  */
+		MACHINE_SMP_UNLOCK(cpu->machine);
 		return;
 	}
 
 	cpu->cd.mips.rmw = 1;
 	cpu->cd.mips.rmw_addr = addr;
 	cpu->cd.mips.rmw_len = sizeof(word);
+
+	MACHINE_SMP_UNLOCK(cpu->machine);
+
 	if (cpu->cd.mips.cpu_type.exc_model != MMU10K)
 		cpu->cd.mips.coproc[0]->reg[COP0_LLADDR] =
 		    (addr >> 4) & 0xffffffffULL;
@@ -2489,18 +2505,24 @@ X(sc)
 		word[3]=r; word[2]=r>>8; word[1]=r>>16; word[0]=r>>24;
 	}
 
+	/*  The check, store, and invalidation must be atomic when other
+	    CPUs run on other host threads:  */
+	MACHINE_SMP_LOCK(cpu->machine);
+
 	/*  If rmw is 0, then the store failed.  (This cache-line was written
 	    to by someone else.)  */
 	if (cpu->cd.mips.rmw == 0 || (MODE_int_t)cpu->cd.mips.rmw_addr != addr
 	    || cpu->cd.mips.rmw_len != sizeof(word)) {
 		reg(ic->arg[0]) = 0;
 		cpu->cd.mips.rmw = 0;
+		MACHINE_SMP_UNLOCK(cpu->machine);
 		return;
 	}
 
 	if (!cpu->memory_rw(cpu, cpu->mem, addr, word,
 	    sizeof(word), MEM_WRITE, CACHE_DATA)) {
 		/*  An exception occurred.  */
+		MACHINE_SMP_UNLOCK(cpu->machine);
 		return;
 	}
 
@@ -2519,6 +2541,8 @@ X(sc)
 		}
 	}
 
+	MACHINE_SMP_UNLOCK(cpu->machine);
+
 	reg(ic->arg[0]) = 1;
 	cpu->cd.mips.rmw = 0;
 }
@@ -2549,18 +2573,24 @@ X(scd)
 		word[3]=r>>32; word[2]=r>>40; word[1]=r>>48; word[0]=r>>56;
 	}
 
+	/*  The check, store, and invalidation must be atomic when other
+	    CPUs run on other host threads:  */
+	MACHINE_SMP_LOCK(cpu->machine);
+
 	/*  If rmw is 0, then the store failed.  (This cache-line was written
 	    to by someone else.)  */
 	if (cpu->cd.mips.rmw == 0 || (MODE_int_t)cpu->cd.mips.rmw_addr != addr
 	    || cpu->cd.mips.rmw_len != sizeof(word)) {
 		reg(ic->arg[0]) = 0;
 		cpu->cd.mips.rmw = 0;
+		MACHINE_SMP_UNLOCK(cpu->machine);
 		return;
 	}
 
 	if (!cpu->memory_rw(cpu, cpu->mem, addr, word,
 	    sizeof(word), MEM_WRITE, CACHE_DATA)) {
 		/*  An exception occurred.  */
+		MACHINE_SMP_UNLOCK(cpu->machine);
 		return;
 	}
 
@@ -2579,6 +2609,8 @@ X(scd)
 		}
 	}
 
+	MACHINE_SMP_UNLOCK(cpu->machine);
+
 	reg(ic->arg[0]) = 1;
 	cpu->cd.mips.rmw = 0;
 }
@@ -1323,11 +1323,13 @@ X(llsc)
 		    Register Field 0 are set to 0b001, otherwise, they are
 		    set to 0b000. The SO bit of the XER is copied to to bit
 		    4 of Condition Register Field 0.  */
+		MACHINE_SMP_LOCK(cpu->machine);
 		if (!cpu->cd.ppc.ll_bit || cpu->cd.ppc.ll_addr != addr) {
 			cpu->cd.ppc.cr &= 0x0fffffff;
 			if (old_so)
 				cpu->cd.ppc.cr |= 0x10000000;
 			cpu->cd.ppc.ll_bit = 0;
+			MACHINE_SMP_UNLOCK(cpu->machine);
 			return;
 		}
 
@@ -1352,6 +1354,7 @@ X(llsc)
 		/*  Clear _all_ CPUs' ll_bits:  */
 		for (i=0; i<cpu->machine->ncpus; i++)
 			cpu->machine->cpus[i]->cd.ppc.ll_bit = 0;
+		MACHINE_SMP_UNLOCK(cpu->machine);
 	}
 }
 
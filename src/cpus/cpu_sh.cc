@@ -39,6 +39,7 @@
 #include <ctype.h>
 #include <unistd.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "device.h"
 #include "float_emul.h"
@@ -102,6 +103,7 @@ int sh_cpu_new(struct cpu *cpu, struct memory *mem, struct machine *machine,
 	}
 
 	cpu->instruction_has_delayslot = sh_cpu_instruction_has_delayslot;
+	cpu->checkpoint = sh_cpu_checkpoint;
 
 	cpu->translate_v2p = sh_translate_v2p;
 
@@ -387,6 +389,78 @@ void sh_cpu_dumpinfo(struct cpu *cpu)
 }
 
 
+/*
+ *  sh_cpu_checkpoint():
+ *
+ *  Saves or restores the SH specific parts of a CPU's state. (The on-chip
+ *  peripherals which are emulated by dev_sh4 are not included.)
+ */
+void sh_cpu_checkpoint(struct cpu *cpu, struct checkpoint *ckpt)
+{
+	struct sh_cpu *sh = &cpu->cd.sh;
+
+	CHECKPOINT_ARRAY(ckpt, sh->r, SH_N_GPRS);
+	CHECKPOINT_ARRAY(ckpt, sh->r_bank, SH_N_GPRS_BANKED);
+	CHECKPOINT_ARRAY(ckpt, sh->fr, SH_N_FPRS);
+	CHECKPOINT_ARRAY(ckpt, sh->xf, SH_N_FPRS);
+
+	CHECKPOINT_VAR(ckpt, sh->mach);
+	CHECKPOINT_VAR(ckpt, sh->macl);
+	CHECKPOINT_VAR(ckpt, sh->pr);
+	CHECKPOINT_VAR(ckpt, sh->fpscr);
+	CHECKPOINT_VAR(ckpt, sh->fpul);
+	CHECKPOINT_VAR(ckpt, sh->sr);
+	CHECKPOINT_VAR(ckpt, sh->ssr);
+	CHECKPOINT_VAR(ckpt, sh->spc);
+	CHECKPOINT_VAR(ckpt, sh->gbr);
+	CHECKPOINT_VAR(ckpt, sh->vbr);
+	CHECKPOINT_VAR(ckpt, sh->sgr);
+	CHECKPOINT_VAR(ckpt, sh->dbr);
+
+	CHECKPOINT_VAR(ckpt, sh->ccr);
+	CHECKPOINT_VAR(ckpt, sh->qacr0);
+	CHECKPOINT_VAR(ckpt, sh->qacr1);
+
+	CHECKPOINT_VAR(ckpt, sh->pteh);
+	CHECKPOINT_VAR(ckpt, sh->ptel);
+	CHECKPOINT_VAR(ckpt, sh->ptea);
+	CHECKPOINT_VAR(ckpt, sh->ttb);
+	CHECKPOINT_VAR(ckpt, sh->tea);
+	CHECKPOINT_VAR(ckpt, sh->mmucr);
+	CHECKPOINT_ARRAY(ckpt, sh->itlb_hi, SH_N_ITLB_ENTRIES);
+	CHECKPOINT_ARRAY(ckpt, sh->itlb_lo, SH_N_ITLB_ENTRIES);
+	CHECKPOINT_ARRAY(ckpt, sh->utlb_hi, SH_N_UTLB_ENTRIES);
+	CHECKPOINT_ARRAY(ckpt, sh->utlb_lo, SH_N_UTLB_ENTRIES);
+
+	CHECKPOINT_VAR(ckpt, sh->tra);
+	CHECKPOINT_VAR(ckpt, sh->expevt);
+	CHECKPOINT_VAR(ckpt, sh->intevt);
+
+	CHECKPOINT_VAR(ckpt, sh->intc_ipra);
+	CHECKPOINT_VAR(ckpt, sh->intc_iprb);
+	CHECKPOINT_VAR(ckpt, sh->intc_iprc);
+	CHECKPOINT_VAR(ckpt, sh->intc_iprd);
+	CHECKPOINT_VAR(ckpt, sh->intc_intpri00);
+	CHECKPOINT_VAR(ckpt, sh->intc_intpri04);
+	CHECKPOINT_VAR(ckpt, sh->intc_intpri08);
+	CHECKPOINT_VAR(ckpt, sh->intc_intpri0c);
+	CHECKPOINT_VAR(ckpt, sh->intc_intreq00);
+	CHECKPOINT_VAR(ckpt, sh->intc_intreq04);
+	CHECKPOINT_VAR(ckpt, sh->intc_intmsk00);
+	CHECKPOINT_VAR(ckpt, sh->intc_intmsk04);
+	CHECKPOINT_ARRAY(ckpt, sh->int_prio_and_pending,
+	    sizeof(sh->int_prio_and_pending));
+	CHECKPOINT_VAR(ckpt, sh->int_to_assert);
+	CHECKPOINT_VAR(ckpt, sh->int_level);
+
+	CHECKPOINT_ARRAY(ckpt, sh->dmac_sar, N_SH4_DMA_CHANNELS);
+	CHECKPOINT_ARRAY(ckpt, sh->dmac_dar, N_SH4_DMA_CHANNELS);
+	CHECKPOINT_ARRAY(ckpt, sh->dmac_tcr, N_SH4_DMA_CHANNELS);
+	CHECKPOINT_ARRAY(ckpt, sh->dmac_chcr, N_SH4_DMA_CHANNELS);
+	CHECKPOINT_VAR(ckpt, sh->dmaor);
+}
+
+
 /*
  *  sh_cpu_instruction_has_delayslot():
  *
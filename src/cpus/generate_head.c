@@ -107,6 +107,12 @@ int main(int argc, char *argv[])
 	    uppercase(a));
 	printf("#define DYNTRANS_TC_ALLOCATE "
 	    "%s_tc_allocate_default_page\n", a);
+	printf("#define DYNTRANS_TC_EVICT "
+	    "%s_tc_evict_lru_page\n", a);
+	printf("#define DYNTRANS_TC_TOUCH "
+	    "%s_tc_touch_page\n", a);
+	printf("#define DYNTRANS_TC_LRU_UNLINK "
+	    "%s_tc_lru_unlink\n", a);
 	printf("#define DYNTRANS_TC_PHYSPAGE %s_tc_physpage\n", a);
 	printf("#define DYNTRANS_PC_TO_POINTERS %s_pc_to_pointers\n", a);
 	printf("#define DYNTRANS_PC_TO_POINTERS_GENERIC "
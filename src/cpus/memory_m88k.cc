@@ -91,6 +91,8 @@ void m8820x_mark_page_as_modified(struct cpu *cpu,
 	else
 		page_descriptor = BE32_TO_HOST(page_descriptor);
 	page_base[page_nr] = page_descriptor;
+	memory_mark_dirty(cpu->mem, (seg_descriptor & 0xfffff000)
+	    + page_nr * sizeof(uint32_t), sizeof(uint32_t));
 }
 
 
@@ -363,6 +365,8 @@ int m88k_translate_v2p(struct cpu *cpu, uint64_t vaddr64,
 			tmp = BE32_TO_HOST(tmp);
 
 		page_base[page_nr] = tmp;
+		memory_mark_dirty(cpu->mem, (seg_descriptor & 0xfffff000)
+		    + page_nr * sizeof(uint32_t), sizeof(uint32_t));
 	}
 
 	/*  Now finally return with the translated page address:  */
@@ -249,13 +249,22 @@ int TRANSLATE_ADDRESS(struct cpu *cpu, uint64_t vaddr,
 		int g_bit, v_bit, d_bit;
 		uint64_t cached_hi, cached_lo0;
 		uint64_t entry_vpn2 = 0, entry_asid, pfn;
-		int i_end;
-
-		i = cpu->cd.mips.last_written_tlb_index;
-		i_end = i == 0? n_tlbs-1 : i - 1;
+		uint64_t candidates = 0;
+		int i_end = 0;
+
+		if (cp0->tlb_index != NULL) {
+			/*  Only the entries which may match need to be
+			    checked (see struct mips_tlb_index):  */
+			candidates = mips_coproc_tlb_index_candidates(cp0,
+			    vaddr, vaddr_asid);
+			i = candidates? MIPS_TLB_INDEX_FIRST(candidates) : -1;
+		} else {
+			i = cpu->cd.mips.last_written_tlb_index;
+			i_end = i == 0? n_tlbs-1 : i - 1;
+		}
 
-		/*  Scan all TLB entries:  */
-		for (;;) {
+		/*  Scan the TLB entries:  */
+		while (i >= 0) {
 #ifdef V2P_MMU3K
 			/*  R3000 or similar:  */
 			cached_hi = cp0->tlbs[i].hi;
@@ -399,13 +408,19 @@ int TRANSLATE_ADDRESS(struct cpu *cpu, uint64_t vaddr,
 				}
 			}
 
-			if (i == i_end)
-				break;
-
 			/*  Go to the next TLB entry:  */
-			i ++;
-			if (i == n_tlbs)
-				i = 0;
+			if (cp0->tlb_index != NULL) {
+				candidates &= candidates - 1;
+				if (candidates == 0)
+					break;
+				i = MIPS_TLB_INDEX_FIRST(candidates);
+			} else {
+				if (i == i_end)
+					break;
+				i ++;
+				if (i == n_tlbs)
+					i = 0;
+			}
 		}
 	}
 
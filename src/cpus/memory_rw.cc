@@ -237,17 +237,17 @@ int MEMORY_RW(struct cpu *cpu, struct memory *mem, uint64_t vaddr,
 	 */
 	if (paddr >= mem->mmap_dev_minaddr && paddr < mem->mmap_dev_maxaddr) {
 		uint64_t orig_paddr = paddr;
-		int i, start, end, res;
+		int i, res, page_is_mixed;
 
-#if 0
+		/*  Devices are not thread-safe; see MACHINE_SMP_LOCK.  */
+		MACHINE_SMP_LOCK(cpu->machine);
 
-TODO: The correct solution for this is to add RAM devices _around_ the
-dangerous device. The solution below incurs a slowdown for _everything_,
-not just the device in question.
+		i = memory_device_lookup(mem, paddr, &page_is_mixed);
 
 		/*
-		 *  Really really slow, but unfortunately necessary. This is
-		 *  to avoid the folowing scenario:
+		 *  If the page is only partially covered by devices, then it
+		 *  must not be added to the dyntrans system as a "RAM" page.
+		 *  Otherwise, the following could happen:
 		 *
 		 *	a) offsets 0x000..0x123 are normal memory
 		 *	b) offsets 0x124..0x777 are a device
@@ -258,129 +258,114 @@ not just the device in question.
 		 *	   which should access the device, but since the
 		 *	   entire page is added, it will access non-existant
 		 *	   RAM instead, without warning.
-		 *
-		 *  Setting dyntrans_device_danger = 1 on accesses which are
-		 *  on _any_ offset on pages that are device mapped avoids
-		 *  this problem, but it is probably not very fast.
-		 *
-		 *  TODO: Convert this into a quick (multi-level, 64-bit)
-		 *  address space lookup, to find dangerous pages.
 		 */
-		for (i=0; i<mem->n_mmapped_devices; i++)
-			if (paddr >= (mem->devices[i].baseaddr & ~offset_mask)&&
-			    paddr <= ((mem->devices[i].endaddr-1)|offset_mask)){
-				dyntrans_device_danger = 1;
-				break;
-			}
-#endif
-
-		start = 0; end = mem->n_mmapped_devices - 1;
-		i = mem->last_accessed_device;
-
-		/*  Scan through all devices:  */
-		do {
-			if (paddr >= mem->devices[i].baseaddr &&
-			    paddr < mem->devices[i].endaddr) {
-				/*  Found a device, let's access it:  */
-				mem->last_accessed_device = i;
-
-				paddr -= mem->devices[i].baseaddr;
-				if (paddr + len > mem->devices[i].length)
-					len = mem->devices[i].length - paddr;
-
-				if (cpu->update_translation_table != NULL &&
-				    !(ok & MEMORY_NOT_FULL_PAGE) &&
-				    mem->devices[i].flags & DM_DYNTRANS_OK) {
-					int wf = writeflag == MEM_WRITE? 1 : 0;
-					unsigned char *host_addr;
+		if (page_is_mixed)
+			dyntrans_device_danger = 1;
+
+		if (i >= 0) {
+			/*  Found a device, let's access it:  */
+			paddr -= mem->devices[i].baseaddr;
+			if (paddr + len > mem->devices[i].length)
+				len = mem->devices[i].length - paddr;
+
+			if (cpu->update_translation_table != NULL &&
+			    !(ok & MEMORY_NOT_FULL_PAGE) &&
+			    mem->devices[i].flags & DM_DYNTRANS_OK) {
+				int wf = writeflag == MEM_WRITE? 1 : 0;
+				unsigned char *host_addr;
+
+				if (!(mem->devices[i].flags &
+				    DM_DYNTRANS_WRITE_OK))
+					wf = 0;
+
+				if (writeflag && wf) {
+					if (paddr < mem->devices[i].
+					    dyntrans_write_low)
+						mem->devices[i].
+						dyntrans_write_low =
+						    paddr &~offset_mask;
+					if (paddr >= mem->devices[i].
+					    dyntrans_write_high)
+						mem->devices[i].
+					 	dyntrans_write_high =
+						    paddr | offset_mask;
+				}
 
-					if (!(mem->devices[i].flags &
-					    DM_DYNTRANS_WRITE_OK))
+				if (mem->devices[i].flags &
+				    DM_EMULATED_RAM) {
+					/*  MEM_WRITE to force the page
+					    to be allocated, if it
+					    wasn't already  */
+					uint64_t *pp = (uint64_t *)mem->
+					    devices[i].dyntrans_data;
+					uint64_t p = orig_paddr - *pp;
+					host_addr =
+					    memory_paddr_to_hostaddr(
+					    mem, p & ~offset_mask,
+					    MEM_WRITE);
+
+					/*  Clean pages must stay read-only,
+					    see memory_dirty_write_ok():  */
+					if (writeflag == MEM_WRITE)
+						memory_mark_dirty(mem, p, len);
+					if (wf && !memory_dirty_write_ok(mem,
+					    p & ~offset_mask, offset_mask + 1))
 						wf = 0;
-
-					if (writeflag && wf) {
-						if (paddr < mem->devices[i].
-						    dyntrans_write_low)
-							mem->devices[i].
-							dyntrans_write_low =
-							    paddr &~offset_mask;
-						if (paddr >= mem->devices[i].
-						    dyntrans_write_high)
-							mem->devices[i].
-						 	dyntrans_write_high =
-							    paddr | offset_mask;
-					}
-
-					if (mem->devices[i].flags &
-					    DM_EMULATED_RAM) {
-						/*  MEM_WRITE to force the page
-						    to be allocated, if it
-						    wasn't already  */
-						uint64_t *pp = (uint64_t *)mem->
-						    devices[i].dyntrans_data;
-						uint64_t p = orig_paddr - *pp;
-						host_addr =
-						    memory_paddr_to_hostaddr(
-						    mem, p & ~offset_mask,
-						    MEM_WRITE);
-					} else {
-						host_addr = mem->devices[i].
-						    dyntrans_data +
-						    (paddr & ~offset_mask);
-					}
-
-					cpu->update_translation_table(cpu,
-					    vaddr & ~offset_mask, host_addr,
-					    wf, orig_paddr & ~offset_mask);
+				} else {
+					host_addr = mem->devices[i].
+					    dyntrans_data +
+					    (paddr & ~offset_mask);
 				}
 
-				res = 0;
-				if (!no_exceptions || (mem->devices[i].flags &
-				    DM_READS_HAVE_NO_SIDE_EFFECTS))
-					res = mem->devices[i].f(cpu, mem, paddr,
-					    data, len, writeflag,
-					    mem->devices[i].extra);
-
-				if (res == 0)
-					res = -1;
+				cpu->update_translation_table(cpu,
+				    vaddr & ~offset_mask, host_addr,
+				    wf, orig_paddr & ~offset_mask);
+			}
 
-				/*
-				 *  If accessing the memory mapped device
-				 *  failed, then return with an exception.
-				 *  (Architecture specific.)
-				 */
-				if (res <= 0 && !no_exceptions) {
-					debug("[ %s device '%s' addr %08lx "
-					    "failed ]\n", writeflag?
-					    "writing to" : "reading from",
-					    mem->devices[i].name, (long)paddr);
+			res = 0;
+			if (!no_exceptions || (mem->devices[i].flags &
+			    DM_READS_HAVE_NO_SIDE_EFFECTS))
+				res = mem->devices[i].f(cpu, mem, paddr,
+				    data, len, writeflag,
+				    mem->devices[i].extra);
+
+			MACHINE_SMP_UNLOCK(cpu->machine);
+
+			if (res == 0)
+				res = -1;
+
+			/*
+			 *  If accessing the memory mapped device
+			 *  failed, then return with an exception.
+			 *  (Architecture specific.)
+			 */
+			if (res <= 0 && !no_exceptions) {
+				debug("[ %s device '%s' addr %08lx "
+				    "failed ]\n", writeflag?
+				    "writing to" : "reading from",
+				    mem->devices[i].name, (long)paddr);
 #ifdef MEM_MIPS
-					mips_cpu_exception(cpu,
-					    cache == CACHE_INSTRUCTION?
-					    EXCEPTION_IBE : EXCEPTION_DBE,
-					    0, vaddr, 0, 0, 0, 0);
+				mips_cpu_exception(cpu,
+				    cache == CACHE_INSTRUCTION?
+				    EXCEPTION_IBE : EXCEPTION_DBE,
+				    0, vaddr, 0, 0, 0, 0);
 #endif
 #ifdef MEM_M88K
-					/*  TODO: This is enough for
-					    OpenBSD/mvme88k's badaddr()
-					    implementation... but the
-					    faulting address should probably
-					    be included somewhere too!  */
-					m88k_exception(cpu, cache == CACHE_INSTRUCTION
-					    ? M88K_EXCEPTION_INSTRUCTION_ACCESS
-					    : M88K_EXCEPTION_DATA_ACCESS, 0);
+				/*  TODO: This is enough for
+				    OpenBSD/mvme88k's badaddr()
+				    implementation... but the
+				    faulting address should probably
+				    be included somewhere too!  */
+				m88k_exception(cpu, cache == CACHE_INSTRUCTION
+				    ? M88K_EXCEPTION_INSTRUCTION_ACCESS
+				    : M88K_EXCEPTION_DATA_ACCESS, 0);
 #endif
-					return MEMORY_ACCESS_FAILED;
-				}
-				goto do_return_ok;
+				return MEMORY_ACCESS_FAILED;
 			}
+			goto do_return_ok;
+		}
 
-			if (paddr < mem->devices[i].baseaddr)
-				end = i - 1;
-			if (paddr >= mem->devices[i].endaddr)
-				start = i + 1;
-			i = (start + end) >> 1;
-		} while (start <= end);
+		MACHINE_SMP_UNLOCK(cpu->machine);
 	}
 
 
@@ -483,6 +468,9 @@ not just the device in question.
 
 	offset = paddr & offset_mask;
 
+	if (writeflag == MEM_WRITE)
+		memory_mark_dirty(mem, paddr, len);
+
 	if (cpu->update_translation_table != NULL && !dyntrans_device_danger
 #ifdef MEM_MIPS
 	    /*  Ugly hack for R2000/R3000 caches:  */
@@ -490,12 +478,19 @@ not just the device in question.
             !(cpu->cd.mips.coproc[0]->reg[COP0_STATUS] & MIPS1_ISOL_CACHES))
 #endif
 	    && !(ok & MEMORY_NOT_FULL_PAGE)
-	    && !no_exceptions)
+	    && !no_exceptions) {
+		int wf = cache == CACHE_INSTRUCTION?
+		    (writeflag == MEM_WRITE? 1 : 0) : ok - 1;
+
+		/*  With dirty page tracking, clean pages are read-only:  */
+		if (wf && !memory_dirty_write_ok(mem, paddr & ~offset_mask,
+		    offset_mask + 1))
+			wf = 0;
+
 		cpu->update_translation_table(cpu, vaddr & ~offset_mask,
-		    memblock, (misc_flags & MEMORY_USER_ACCESS) |
-		    (cache == CACHE_INSTRUCTION?
-			(writeflag == MEM_WRITE? 1 : 0) : ok - 1),
+		    memblock, (misc_flags & MEMORY_USER_ACCESS) | wf,
 		    paddr & ~offset_mask);
+	}
 
 	/*
 	 *  If writing, or if mapping a page where writing is ok later on,
@@ -504,9 +499,15 @@ not just the device in question.
 
 	if ((writeflag == MEM_WRITE
 	    || (ok == 2 && cache == CACHE_DATA)
-	    ) && cpu->invalidate_code_translation != NULL)
+	    ) && cpu->invalidate_code_translation != NULL) {
 		cpu->invalidate_code_translation(cpu, paddr, INVALIDATE_PADDR);
 
+		/*  ... and in all other CPUs, if running multi-threaded:  */
+		if (cpu->machine->smp != NULL)
+			machine_smp_note_paddr(cpu, paddr,
+			    SMP_NOTE_CODE_WRITE);
+	}
+
 	if ((paddr&((1<<BITS_PER_MEMBLOCK)-1)) + len > (1<<BITS_PER_MEMBLOCK)) {
 		printf("Write over memblock boundary?\n");
 		exit(1);
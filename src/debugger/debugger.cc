@@ -38,6 +38,7 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "checkpoint.h"
 #include "console.h"
 #include "cpu.h"
 #include "device.h"
@@ -235,6 +235,76 @@ return_help:
 }
 
 
+/*  Helpers for debugger_cmd_dirtypages(), printing runs of dirty pages:  */
+struct dirtypages_run {
+	uint64_t	start;
+	uint64_t	end;
+};
+
+static void dirtypages_print(struct dirtypages_run *run)
+{
+	if (run->end > run->start)
+		printf("  0x%011" PRIx64" - 0x%011" PRIx64" (%" PRIi64" page%s)"
+		    "\n", run->start, run->end - 1, (run->end - run->start) /
+		    MEMORY_DIRTY_PAGE_SIZE, run->end - run->start ==
+		    MEMORY_DIRTY_PAGE_SIZE? "" : "s");
+}
+
+
+static void dirtypages_callback(uint64_t paddr, void *extra)
+{
+	struct dirtypages_run *run = (struct dirtypages_run *) extra;
+
+	if (paddr != run->end) {
+		dirtypages_print(run);
+		run->start = paddr;
+	}
+
+	run->end = paddr + MEMORY_DIRTY_PAGE_SIZE;
+}
+
+
+/*
+ *  debugger_cmd_dirtypages():
+ *
+ *  Starts or stops dirty page tracking, or shows (and clears) the pages
+ *  which have been written to since the last time.
+ */
+static void debugger_cmd_dirtypages(struct machine *m, char *cmd_line)
+{
+	struct dirtypages_run run;
+	size_t n;
+
+	while (cmd_line[0] == ' ')
+		cmd_line ++;
+
+	if (strcmp(cmd_line, "on") == 0) {
+		memory_dirty_tracking_start(m);
+		printf("Dirty page tracking started.\n");
+		return;
+	} else if (strcmp(cmd_line, "off") == 0) {
+		memory_dirty_tracking_stop(m);
+		printf("Dirty page tracking stopped.\n");
+		return;
+	} else if (cmd_line[0] != '\0') {
+		printf("syntax: dirtypages [on|off]\n");
+		return;
+	}
+
+	if (!m->memory->dirty_tracking) {
+		printf("Dirty page tracking is not enabled. "
+		    "(Use 'dirtypages on'.)\n");
+		return;
+	}
+
+	run.start = run.end = 0;
+	n = memory_dirty_fetch_and_clear(m, dirtypages_callback, &run);
+	dirtypages_print(&run);
+
+	printf("%lli dirty page%s.\n", (long long) n, n == 1? "" : "s");
+}
+
+
 /*
  *  debugger_cmd_dump():
  *
@@ -1183,6 +1253,33 @@ static void debugger_cmd_version(struct machine *m, char *cmd_line)
 }
 
 
+/*
+ *  debugger_cmd_writecheckpoint():
+ *
+ *  Save the state of the emulation to a file, which can be resumed from
+ *  later using the -L command line option.
+ */
+static void debugger_cmd_writecheckpoint(struct machine *m, char *cmd_line)
+{
+	size_t len;
+
+	while (cmd_line[0] == ' ')
+		cmd_line ++;
+
+	len = strlen(cmd_line);
+	while (len > 0 && cmd_line[len-1] == ' ')
+		cmd_line[--len] = '\0';
+
+	if (len == 0) {
+		printf("syntax: writecheckpoint filename\n");
+		return;
+	}
+
+	if (checkpoint_save(debugger_emul, cmd_line))
+		printf("Checkpoint written to %s.\n", cmd_line);
+}
+
+
 /****************************************************************************/
 
 
@@ -1210,6 +1307,9 @@ static struct cmd cmds[] = {
 	{ "device", "...", 0, debugger_cmd_device,
 		"show info about (or manipulate) devices" },
 
+	{ "dirtypages", "[on|off]", 0, debugger_cmd_dirtypages,
+		"track pages written to; show and clear them" },
+
 	{ "dump", "[addr [endaddr]]", 0, debugger_cmd_dump,
 		"dump memory contents in hex and ASCII" },
 
@@ -1276,6 +1376,9 @@ static struct cmd cmds[] = {
 	{ "version", "", 0, debugger_cmd_version,
 		"Print version information" },
 
+	{ "writecheckpoint", "filename", 0, debugger_cmd_writecheckpoint,
+		"save the emulation's state to a checkpoint file" },
+
 	/*  Note: NULL handler.  */
 	{ "x = expr", "", 0, NULL, "generic assignment" },
 
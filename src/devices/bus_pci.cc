@@ -50,6 +50,7 @@
 
 #include "bus_isa.h"
 #include "bus_pci.h"
+#include "checkpoint.h"
 #include "cpu.h"
 #include "device.h"
 #include "devices.h"
@@ -208,6 +209,39 @@ void bus_pci_setaddr(struct cpu *cpu, struct pci_data *pci_data,
 }
 
 
+/*
+ *  bus_pci_checkpoint():
+ *
+ *  Saves or restores the current register access, and the configuration
+ *  memory of each device on the bus. The devices themselves are created
+ *  by the machine setup, so only their number is verified.
+ */
+void bus_pci_checkpoint(struct checkpoint *ckpt, struct pci_data *pci_data)
+{
+	struct pci_device *pd;
+	int n_devices = 0, saved_n_devices;
+
+	CHECKPOINT_VAR(ckpt, pci_data->cur_bus);
+	CHECKPOINT_VAR(ckpt, pci_data->cur_device);
+	CHECKPOINT_VAR(ckpt, pci_data->cur_func);
+	CHECKPOINT_VAR(ckpt, pci_data->cur_reg);
+	CHECKPOINT_VAR(ckpt, pci_data->last_was_write_ffffffff);
+
+	for (pd = pci_data->first_device; pd != NULL; pd = pd->next)
+		n_devices ++;
+
+	saved_n_devices = n_devices;
+	CHECKPOINT_VAR(ckpt, saved_n_devices);
+	if (saved_n_devices != n_devices) {
+		checkpoint_error(ckpt, "number of PCI devices differs");
+		return;
+	}
+
+	for (pd = pci_data->first_device; pd != NULL; pd = pd->next)
+		checkpoint_data(ckpt, pd->cfg_mem, PCI_CFG_MEM_SIZE);
+}
+
+
 /*
  *  bus_pci_add():
  *
@@ -60,6 +60,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "devices.h"
 #include "diskimage.h"
@@ -136,6 +137,8 @@ struct asc_data {
 	/*  Read registers and write registers:  */
 	uint32_t	reg_ro[0x10];
 	uint32_t	reg_wo[0x10];
+
+	struct machine_event *tick_event;
 };
 
 /*  (READ/WRITE name, if split)  */
@@ -162,6 +165,14 @@ DEVICE_TICK(asc)
 		INTERRUPT_ASSERT(d->irq);
 
 	d->irq_asserted = new_assert;
+
+	/*
+	 *  The interrupt status only changes as a result of register
+	 *  accesses, and every access ends by calling this function. The
+	 *  regular tick is therefore only needed once.
+	 */
+	if (d->tick_event != NULL)
+		machine_event_cancel(cpu->machine, d->tick_event);
 }
 
 
@@ -1218,6 +1229,37 @@ break;
 }
 
 
+static void asc_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct asc_data *d = (struct asc_data *) extra;
+
+	CHECKPOINT_VAR(ckpt, d->irq_asserted);
+	CHECKPOINT_VAR(ckpt, d->cur_state);
+	CHECKPOINT_VAR(ckpt, d->cur_phase);
+	scsi_transfer_checkpoint(ckpt, &d->xferp);
+	CHECKPOINT_ARRAY(ckpt, d->fifo, ASC_FIFO_LEN);
+	CHECKPOINT_VAR(ckpt, d->fifo_in);
+	CHECKPOINT_VAR(ckpt, d->fifo_out);
+	CHECKPOINT_VAR(ckpt, d->n_bytes_in_fifo);
+	CHECKPOINT_VAR(ckpt, d->atn);
+	CHECKPOINT_VAR(ckpt, d->incoming_len);
+	CHECKPOINT_VAR(ckpt, d->incoming_data_addr);
+	CHECKPOINT_VAR(ckpt, d->dma_address_reg);
+	CHECKPOINT_ARRAY(ckpt, d->reg_ro, 0x10);
+	CHECKPOINT_ARRAY(ckpt, d->reg_wo, 0x10);
+
+	/*  (On DECstations, the DMA buffer is saved as dyntrans memory.)  */
+	if (d->mode != DEV_ASC_DEC)
+		checkpoint_data(ckpt, d->dma, ASC_DMA_SIZE);
+
+	if (ckpt->restoring && (d->fifo_in < 0 || d->fifo_in >= ASC_FIFO_LEN
+	    || d->fifo_out < 0 || d->fifo_out >= ASC_FIFO_LEN)) {
+		checkpoint_error(ckpt, "bad asc fifo state");
+		dev_asc_fifo_flush(d);
+	}
+}
+
+
 /*
  *  dev_asc_init():
  *
@@ -1264,6 +1306,9 @@ void dev_asc_init(struct machine *machine, struct memory *mem,
 		    DM_DYNTRANS_OK | DM_DYNTRANS_WRITE_OK, d->dma);
 	}
 
-	machine_add_tickfunction(machine, dev_asc_tick, d, ASC_TICK_SHIFT);
+	memory_device_set_checkpoint(mem, d, asc_checkpoint);
+
+	d->tick_event = machine_add_tickfunction(machine, dev_asc_tick, d,
+	    ASC_TICK_SHIFT);
 }
 
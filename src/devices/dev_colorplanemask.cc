@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "devices.h"
 #include "memory.h"
 #include "misc.h"
@@ -45,6 +46,20 @@ struct colorplanemask_data {
 };
 
 
+/*
+ *  colorplanemask_checkpoint():
+ *
+ *  The mask is stored in the framebuffer's data, but only written from
+ *  here.
+ */
+static void colorplanemask_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct colorplanemask_data *d = (struct colorplanemask_data *) extra;
+
+	CHECKPOINT_VAR(ckpt, *d->color_plane_mask);
+}
+
+
 DEVICE_ACCESS(colorplanemask)
 {
 	struct colorplanemask_data *d = (struct colorplanemask_data *) extra;
@@ -94,5 +109,6 @@ void dev_colorplanemask_init(struct memory *mem, uint64_t baseaddr,
 	memory_device_register(mem, "colorplanemask", baseaddr,
 	    DEV_COLORPLANEMASK_LENGTH, dev_colorplanemask_access,
 	    (void *)d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(mem, d, colorplanemask_checkpoint);
 }
 
@@ -37,6 +37,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "console.h"
 #include "cpu.h"
 #include "device.h"
@@ -66,6 +67,13 @@ DEVICE_TICK(cons)
 }
 
 
+static void cons_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	/*  Nothing to save. The interrupt is asserted on every tick, if
+	    the host console has characters available.  */
+}
+
+
 DEVICE_ACCESS(cons)
 {
 	struct cons_data *d = (struct cons_data *) extra;
@@ -137,6 +145,8 @@ DEVINIT(cons)
 	memory_device_register(devinit->machine->memory, name3,
 	    devinit->addr, DEV_CONS_LENGTH, dev_cons_access, d,
 	    DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    cons_checkpoint);
 	machine_add_tickfunction(devinit->machine, dev_cons_tick,
 	    d, CONS_TICK_SHIFT);
 
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "console.h"
 #include "cpu.h"
 #include "devices.h"
@@ -95,6 +96,44 @@ void add_to_rx_queue(void *e, int ch, int line_no)
 }
 
 
+/*
+ *  dc7085_checkpoint():
+ *
+ *  Only the characters which are in the receive queue are saved.
+ */
+static void dc7085_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct dc_data *d = (struct dc_data *) extra;
+	int i;
+
+	CHECKPOINT_VAR(ckpt, d->regs.dc_csr);
+	CHECKPOINT_VAR(ckpt, d->regs.dc_rbuf_lpr);
+	CHECKPOINT_VAR(ckpt, d->regs.dc_tcr);
+	CHECKPOINT_VAR(ckpt, d->regs.dc_msr_tdr);
+	CHECKPOINT_VAR(ckpt, d->just_transmitted_something);
+	CHECKPOINT_VAR(ckpt, d->tx_scanner);
+	CHECKPOINT_VAR(ckpt, d->cur_rx_queue_pos_read);
+	CHECKPOINT_VAR(ckpt, d->cur_rx_queue_pos_write);
+
+	if (ckpt->restoring && (d->cur_rx_queue_pos_read < 0 ||
+	    d->cur_rx_queue_pos_read >= MAX_QUEUE_LEN ||
+	    d->cur_rx_queue_pos_write < 0 ||
+	    d->cur_rx_queue_pos_write >= MAX_QUEUE_LEN)) {
+		checkpoint_error(ckpt, "bad dc7085 receive queue position");
+		d->cur_rx_queue_pos_read = d->cur_rx_queue_pos_write = 0;
+		return;
+	}
+
+	for (i = d->cur_rx_queue_pos_read; i != d->cur_rx_queue_pos_write;
+	    i = (i + 1) % MAX_QUEUE_LEN) {
+		CHECKPOINT_VAR(ckpt, d->rx_queue_char[i]);
+		CHECKPOINT_VAR(ckpt, d->rx_queue_lineno[i]);
+	}
+
+	lk201_checkpoint(ckpt, &d->lk201);
+}
+
+
 DEVICE_TICK(dc7085)
 {
 	/*
@@ -315,6 +354,7 @@ int dev_dc7085_init(struct machine *machine, struct memory *mem,
 
 	memory_device_register(mem, "dc7085", baseaddr, DEV_DC7085_LENGTH,
 	    dev_dc7085_access, d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(mem, d, dc7085_checkpoint);
 	machine_add_tickfunction(machine, dev_dc7085_tick, d,
 	    DC_TICK_SHIFT);
 
@@ -153,13 +153,14 @@ int dec21143_rx(struct cpu *cpu, struct dec21143_data *d)
 		net_ethernet_rx(d->net, d, &d->cur_rx_buf,
 		    &d->cur_rx_buf_len);
 
-		/*  Append a 4 byte CRC:  */
+		/*
+		 *  Append a 4 byte CRC. (There is always room for it in the
+		 *  packet buffer, see NET_PACKET_TAILROOM.)
+		 *
+		 *  Well... the CRC is just zeros, for now.
+		 */
+		memset(d->cur_rx_buf + d->cur_rx_buf_len, 0, 4);
 		d->cur_rx_buf_len += 4;
-		CHECK_ALLOCATION(d->cur_rx_buf = (unsigned char *) realloc(d->cur_rx_buf,
-		    d->cur_rx_buf_len));
-
-		/*  Well... the CRC is just zeros, for now.  */
-		memset(d->cur_rx_buf + d->cur_rx_buf_len - 4, 0, 4);
 
 		d->cur_rx_offset = 0;
 	}
@@ -247,7 +248,7 @@ int dec21143_rx(struct cpu *cpu, struct dec21143_data *d)
 		/*  Cause a receiver interrupt:  */
 		d->reg[CSR_STATUS/8] |= STATUS_RI;
 
-		free(d->cur_rx_buf);
+		net_ethernet_packet_free(d->cur_rx_buf);
 		d->cur_rx_buf = NULL;
 		d->cur_rx_buf_len = 0;
 	}
@@ -752,8 +753,7 @@ static void dec21143_reset(struct cpu *cpu, struct dec21143_data *d)
 {
 	int leaf;
 
-	if (d->cur_rx_buf != NULL)
-		free(d->cur_rx_buf);
+	net_ethernet_packet_free(d->cur_rx_buf);
 	if (d->cur_tx_buf != NULL)
 		free(d->cur_tx_buf);
 	d->cur_rx_buf = d->cur_tx_buf = NULL;
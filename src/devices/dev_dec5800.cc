@@ -43,6 +43,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "console.h"
 #include "cpu.h"
 #include "device.h"
@@ -172,6 +173,18 @@ DEVICE_ACCESS(dec5800)
 }
 
 
+/*
+ *  dec5800_checkpoint():
+ */
+static void dec5800_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct dec5800_data *d = (struct dec5800_data *) extra;
+
+	CHECKPOINT_VAR(ckpt, d->csr);
+	CHECKPOINT_VAR(ckpt, d->vector_0x50);
+}
+
+
 DEVINIT(dec5800)
 {
 	struct dec5800_data *d;
@@ -208,6 +221,8 @@ DEVINIT(dec5800)
 	memory_device_register(devinit->machine->memory, "dec5800_vectors",
 	    devinit->addr + 0x30000000, 0x100, dev_dec5800_vectors_access,
 	    d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    dec5800_checkpoint);
 	machine_add_tickfunction(devinit->machine, dev_dec5800_tick,
 	    d, 14);
 
@@ -310,6 +325,17 @@ DEVICE_ACCESS(decbi)
 }
 
 
+/*
+ *  decbi_checkpoint():
+ */
+static void decbi_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct decbi_data *d = (struct decbi_data *) extra;
+
+	CHECKPOINT_ARRAY(ckpt, d->csr, NNODEBI);
+}
+
+
 DEVINIT(decbi)
 {
 	struct decbi_data *d;
@@ -320,6 +346,8 @@ DEVINIT(decbi)
 	memory_device_register(devinit->machine->memory, "decbi",
 	    devinit->addr + 0x2000, DEV_DECBI_LENGTH - 0x2000,
 	    dev_decbi_access, d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    decbi_checkpoint);
 
 	return 1;
 }
@@ -383,6 +411,15 @@ DEVICE_ACCESS(deccca)
 }
 
 
+/*
+ *  deccca_checkpoint():
+ */
+static void deccca_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	/*  Nothing to save. The CCA contents are constant.  */
+}
+
+
 /*
  *  dev_deccca_init():
  */
@@ -395,6 +432,7 @@ void dev_deccca_init(struct memory *mem, uint64_t baseaddr)
 
 	memory_device_register(mem, "deccca", baseaddr, DEV_DECCCA_LENGTH,
 	    dev_deccca_access, d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(mem, d, deccca_checkpoint);
 }
 
 
@@ -495,6 +533,17 @@ DEVICE_ACCESS(decxmi)
 }
 
 
+/*
+ *  decxmi_checkpoint():
+ */
+static void decxmi_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct decxmi_data *d = (struct decxmi_data *) extra;
+
+	CHECKPOINT_ARRAY(ckpt, d->reg_0xc, NNODEXMI);
+}
+
+
 /*
  *  dev_decxmi_init():
  */
@@ -507,5 +556,6 @@ void dev_decxmi_init(struct memory *mem, uint64_t baseaddr)
 
 	memory_device_register(mem, "decxmi", baseaddr, DEV_DECXMI_LENGTH,
 	    dev_decxmi_access, d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(mem, d, decxmi_checkpoint);
 }
 
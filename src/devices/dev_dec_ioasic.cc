@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "devices.h"
 #include "interrupt.h"
@@ -63,6 +64,35 @@ void dec_ioasic_reassert(struct dec_ioasic_data* d)
 }
 
 
+static void dec_ioasic_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct dec_ioasic_data *d = (struct dec_ioasic_data *) extra;
+
+	CHECKPOINT_VAR(ckpt, d->scsi_dmaptr);
+	CHECKPOINT_VAR(ckpt, d->scsi_nextptr);
+	CHECKPOINT_VAR(ckpt, d->lance_dmaptr);
+	CHECKPOINT_VAR(ckpt, d->floppy_dmaptr);
+	CHECKPOINT_VAR(ckpt, d->isdn_x_dmaptr);
+	CHECKPOINT_VAR(ckpt, d->isdn_x_nextptr);
+	CHECKPOINT_VAR(ckpt, d->isdn_r_dmaptr);
+	CHECKPOINT_VAR(ckpt, d->isdn_r_nextptr);
+	CHECKPOINT_VAR(ckpt, d->csr);
+	CHECKPOINT_VAR(ckpt, d->intr);
+	CHECKPOINT_VAR(ckpt, d->imsk);
+	CHECKPOINT_VAR(ckpt, d->isdn_x_data);
+	CHECKPOINT_VAR(ckpt, d->isdn_r_data);
+	CHECKPOINT_VAR(ckpt, d->lance_decode);
+	CHECKPOINT_VAR(ckpt, d->scsi_decode);
+	CHECKPOINT_VAR(ckpt, d->scc0_decode);
+	CHECKPOINT_VAR(ckpt, d->scc1_decode);
+	CHECKPOINT_VAR(ckpt, d->floppy_decode);
+	CHECKPOINT_VAR(ckpt, d->scsi_scr);
+	CHECKPOINT_VAR(ckpt, d->scsi_sdr0);
+	CHECKPOINT_VAR(ckpt, d->scsi_sdr1);
+	CHECKPOINT_VAR(ckpt, d->int_asserted);
+}
+
+
 DEVICE_ACCESS(dec_ioasic)
 {
 	struct dec_ioasic_data *d = (struct dec_ioasic_data *) extra;
@@ -471,6 +501,7 @@ struct dec_ioasic_data *dev_dec_ioasic_init(struct cpu *cpu,
 	memory_device_register(mem, "dec_ioasic", baseaddr,
 	    DEV_DEC_IOASIC_LENGTH, dev_dec_ioasic_access, (void *)d,
 	    DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(mem, d, dec_ioasic_checkpoint);
 
 	return d;
 }
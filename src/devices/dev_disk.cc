@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "device.h"
 #include "diskimage.h"
@@ -59,6 +60,18 @@ struct disk_data {
 };
 
 
+static void disk_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct disk_data *d = (struct disk_data *) extra;
+
+	/*  (The data buffer is saved as device memory.)  */
+	CHECKPOINT_VAR(ckpt, d->offset);
+	CHECKPOINT_VAR(ckpt, d->disk_id);
+	CHECKPOINT_VAR(ckpt, d->command);
+	CHECKPOINT_VAR(ckpt, d->status);
+}
+
+
 DEVICE_ACCESS(disk_buf)
 {
 	struct disk_data *d = (struct disk_data *) extra;
@@ -191,6 +204,9 @@ DEVINIT(disk)
 	    (void *)d, DM_DYNTRANS_OK | DM_DYNTRANS_WRITE_OK |
 	    DM_READS_HAVE_NO_SIDE_EFFECTS, d->buf);
 
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    disk_checkpoint);
+
 	return 1;
 }
 
@@ -65,6 +65,11 @@ struct dreamcast_gdrom_data {
 	int		cur_data_offset;
 	int		cur_cnt;
 
+	// Sector data is read from the disk image when it is actually
+	// needed: directly into RAM on DMA, or into data on PIO reads.
+	int		data_pending;
+	off_t		data_disk_offset;
+
 	// 0x005f7400: GDROM DMA
 	uint32_t	dma_reg[NREGS_GDROM_DMA];
 };
@@ -92,10 +97,29 @@ static void alloc_data(struct dreamcast_gdrom_data *d)
 }
 
 
+/*
+ *  fill_pending_data():
+ *
+ *  Reads sector data, which has not yet been transfered using DMA, into
+ *  the data buffer (for PIO reads).
+ */
+static void fill_pending_data(struct cpu *cpu, struct dreamcast_gdrom_data *d)
+{
+	if (!d->data_pending)
+		return;
+
+	d->data_pending = 0;
+
+	if (!diskimage_access(cpu->machine, 0, DISKIMAGE_IDE,
+	    0, d->data_disk_offset, d->data, d->data_len))
+		fatal("GDROM: diskimage_access failed? TODO\n");
+}
+
+
 static void handle_command(struct cpu *cpu, struct dreamcast_gdrom_data *d)
 {
 	int64_t sector_nr, sector_count;
-	int i, res;
+	int i;
 
 	debug("[ GDROM cmd: ");
 	for (i=0; i<12; i++)
@@ -105,6 +129,7 @@ static void handle_command(struct cpu *cpu, struct dreamcast_gdrom_data *d)
 	if (d->data != NULL)
 		free(d->data);
 	d->data = NULL;
+	d->data_pending = 0;
 	d->cur_data_offset = 0;
 	d->cur_cnt = 0;
 
@@ -212,13 +237,10 @@ static void handle_command(struct cpu *cpu, struct dreamcast_gdrom_data *d)
 			// printf("sector nr step 3 = %i\n", (int)sector_nr);
 		}
 
-		res = diskimage_access(cpu->machine, 0, DISKIMAGE_IDE,
-		    0, sector_nr * 2048, d->data, d->data_len);
-		if (!res) {
-			fatal("GDROM: diskimage_access failed? TODO\n");
-			free(d->data);
-			d->data = NULL;
-		}
+		// The guest usually reads the data using DMA, so the
+		// disk image is not accessed until then.
+		d->data_pending = 1;
+		d->data_disk_offset = (off_t)sector_nr * 2048;
 
 		/* {
 			printf("(Dump of GDROM sector %i: \"", (int)sector_nr);
@@ -307,6 +329,8 @@ DEVICE_ACCESS(dreamcast_gdrom)
 				exit(1);
 			}
 
+			fill_pending_data(cpu, d);
+
 			if (d->cur_data_offset < d->data_len) {
 				odata = d->data[d->cur_data_offset ++];
 				odata |= (d->data[d->cur_data_offset ++] << 8);
@@ -482,8 +506,18 @@ DEVICE_ACCESS(dreamcast_gdrom_dma)
 				}
 
 				dst &= 0x0fffffff;	// 0x8c008000 => 0x0c008000
-				cpu->memory_rw(cpu, cpu->mem, dst,
-				    d->data, d->data_len, MEM_WRITE, PHYSICAL);
+
+				// Read directly from the disk image into RAM,
+				// if the data has not been read already.
+				if (d->data_pending) {
+					if (!diskimage_access_dma(cpu, 0,
+					    DISKIMAGE_IDE, 0, d->data_disk_offset,
+					    dst, d->data_len))
+						fatal("GDROM: diskimage_access_dma"
+						    " failed? TODO\n");
+				} else
+					memory_dma_copy(cpu, dst, d->data,
+					    d->data_len, MEM_WRITE);
 
 				SYSASIC_TRIGGER_EVENT(SYSASIC_EVENT_GDROM_DMA);
 
@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "device.h"
 #include "emul.h"
@@ -59,6 +60,21 @@ struct ether_data {
 };
 
 
+/*
+ *  ether_checkpoint():
+ *
+ *  The buffer is saved as dyntrans device memory. Packets which are still
+ *  queued in the emulated network are not part of the checkpoint.
+ */
+static void ether_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct ether_data *d = (struct ether_data *) extra;
+
+	CHECKPOINT_VAR(ckpt, d->status);
+	CHECKPOINT_VAR(ckpt, d->packet_len);
+}
+
+
 DEVICE_TICK(ether)
 {  
 	struct ether_data *d = (struct ether_data *) extra;
@@ -155,7 +171,7 @@ DEVICE_ACCESS(ether)
 						    DEV_ETHER_BUFFER_SIZE;
 					memcpy(d->buf, incoming_ptr,
 					    incoming_len);
-					free(incoming_ptr);
+					net_ethernet_packet_free(incoming_ptr);
 					d->packet_len = incoming_len;
 				}
 			}
@@ -236,6 +252,8 @@ DEVINIT(ether)
 	    devinit->addr + DEV_ETHER_BUFFER_SIZE,
 	    DEV_ETHER_LENGTH-DEV_ETHER_BUFFER_SIZE, dev_ether_access, (void *)d,
 	    DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    ether_checkpoint);
 
 	net_add_nic(devinit->machine->emul->net, d, d->mac);
 
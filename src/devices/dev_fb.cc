@@ -410,8 +410,12 @@ DEVICE_TICK(fb)
 	int need_to_redraw_cursor = 0;
 #endif
 
-	if (!cpu->machine->x11_md.in_use)
+	if (!cpu->machine->x11_md.in_use) {
+		/*  Nothing will ever be drawn, so stop ticking.  */
+		if (d->tick_event != NULL)
+			machine_event_cancel(cpu->machine, d->tick_event);
 		return;
+	}
 
 	do {
 		uint64_t high, low = (uint64_t)(int64_t) -1;
@@ -960,7 +964,8 @@ struct vfb_data *dev_fb_init(struct machine *machine, struct memory *mem,
 	memory_device_register(mem, name2, baseaddr, size, dev_fb_access,
 	    d, flags, d->framebuffer);
 
-	machine_add_tickfunction(machine, dev_fb_tick, d, FB_TICK_SHIFT);
+	d->tick_event = machine_add_tickfunction(machine, dev_fb_tick, d,
+	    FB_TICK_SHIFT);
 
 	return d;
 }
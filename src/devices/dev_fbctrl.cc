@@ -35,6 +35,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "device.h"
 #include "devices.h"
@@ -52,6 +53,29 @@ struct fbctrl_data {
 };
 
 
+/*
+ *  fbctrl_checkpoint():
+ *
+ *  The framebuffer's contents are saved as dyntrans device memory. Its
+ *  resolution is not restored, only checked, since that would have to be
+ *  done before the contents are restored.
+ */
+static void fbctrl_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct fbctrl_data *d = (struct fbctrl_data *) extra;
+	int xsize = d->vfb_data->xsize, ysize = d->vfb_data->ysize;
+
+	CHECKPOINT_VAR(ckpt, d->current_port);
+	CHECKPOINT_ARRAY(ckpt, d->port, DEV_FBCTRL_NPORTS);
+
+	CHECKPOINT_VAR(ckpt, xsize);
+	CHECKPOINT_VAR(ckpt, ysize);
+	if (xsize != d->vfb_data->xsize || ysize != d->vfb_data->ysize)
+		checkpoint_error(ckpt, "the framebuffer resolution was %ix%i"
+		    " when the checkpoint was saved", xsize, ysize);
+}
+
+
 /*
  *  fbctrl_command():
  *
@@ -168,6 +192,8 @@ DEVINIT(fbctrl)
 	memory_device_register(devinit->machine->memory, devinit->name,
 	    devinit->addr, DEV_FBCTRL_LENGTH, dev_fbctrl_access, d,
 	    DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    fbctrl_checkpoint);
 
 	return 1;
 }
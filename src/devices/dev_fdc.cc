@@ -39,6 +39,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "device.h"
 #include "interrupt.h"
 #include "machine.h"
@@ -55,6 +56,14 @@ struct fdc_data {
 };
 
 
+static void fdc_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct fdc_data *d = (struct fdc_data *) extra;
+
+	CHECKPOINT_ARRAY(ckpt, d->reg, DEV_FDC_LENGTH);
+}
+
+
 DEVICE_ACCESS(fdc)
 {
 	struct fdc_data *d = (struct fdc_data *) extra;
@@ -99,6 +108,8 @@ DEVINIT(fdc)
 	memory_device_register(devinit->machine->memory, devinit->name,
 	    devinit->addr, DEV_FDC_LENGTH, dev_fdc_access, d,
 	    DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    fdc_checkpoint);
 
 	return 1;
 }
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "device.h"
 #include "interrupt.h"
@@ -78,6 +79,17 @@ void irqc_interrupt_deassert(struct interrupt *interrupt)
 }
 
 
+static void irqc_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct irqc_data *d = (struct irqc_data *) extra;
+
+	/*  (The CPU's view of the irq line is part of the CPU's state.)  */
+	CHECKPOINT_VAR(ckpt, d->asserted);
+	CHECKPOINT_VAR(ckpt, d->status);
+	CHECKPOINT_VAR(ckpt, d->enabled);
+}
+
+
 DEVICE_ACCESS(irqc)
 {
 	struct irqc_data *d = (struct irqc_data *) extra;
@@ -187,6 +199,8 @@ DEVINIT(irqc)
 	memory_device_register(devinit->machine->memory, devinit->name,
 	    devinit->addr, DEV_IRQC_LENGTH, dev_irqc_access, d,
 	    DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    irqc_checkpoint);
 
 	return 1;
 }
@@ -45,6 +45,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "device.h"
 #include "devices.h"
@@ -231,6 +232,36 @@ static void timer_tick(struct timer *t, void *extra)
 }
 
 
+/*
+ *  jazz_checkpoint():
+ *
+ *  The host timer always runs at 100 Hz, so only the number of timer
+ *  interrupts which have not been delivered yet is saved.
+ */
+static void jazz_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct jazz_data *d = (struct jazz_data *) extra;
+
+	CHECKPOINT_VAR(ckpt, d->int_enable_mask);
+	CHECKPOINT_VAR(ckpt, d->int_asserted);
+	CHECKPOINT_VAR(ckpt, d->isa_int_enable_mask);
+	CHECKPOINT_VAR(ckpt, d->isa_int_asserted);
+	CHECKPOINT_VAR(ckpt, d->interval);
+	CHECKPOINT_VAR(ckpt, d->interval_start);
+	CHECKPOINT_VAR(ckpt, d->pending_timer_interrupts);
+	CHECKPOINT_VAR(ckpt, d->jazz_timer_value);
+	CHECKPOINT_VAR(ckpt, d->jazz_timer_current);
+	CHECKPOINT_VAR(ckpt, d->dma_translation_table_base);
+	CHECKPOINT_VAR(ckpt, d->dma_translation_table_limit);
+	CHECKPOINT_VAR(ckpt, d->dma0_mode);
+	CHECKPOINT_VAR(ckpt, d->dma0_enable);
+	CHECKPOINT_VAR(ckpt, d->dma0_count);
+	CHECKPOINT_VAR(ckpt, d->dma0_addr);
+	CHECKPOINT_VAR(ckpt, d->dma1_mode);
+	CHECKPOINT_VAR(ckpt, d->led);
+}
+
+
 DEVICE_TICK(jazz)
 {
 	struct jazz_data *d = (struct jazz_data *) extra;
@@ -695,6 +726,9 @@ DEVINIT(jazz)
 	    0xf0000000ULL, 4, dev_jazz_jazzio_access, (void *)d,
 	    DM_DEFAULT, NULL);
 
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    jazz_checkpoint);
+
 	/*  Add a timer, hardcoded to 100 Hz. TODO: Don't hardcode!  */
 	d->timer = timer_add(100.0, timer_tick, d);
 	machine_add_tickfunction(devinit->machine, dev_jazz_tick,
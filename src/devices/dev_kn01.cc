@@ -38,6 +38,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "devices.h"
 #include "memory.h"
@@ -75,6 +76,48 @@ struct vdac_data {
 };
 
 
+static void kn01_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct kn01_data *d = (struct kn01_data *) extra;
+
+	CHECKPOINT_VAR(ckpt, d->csr);
+}
+
+
+/*
+ *  vdac_checkpoint():
+ *
+ *  The color palette belongs to the framebuffer, but it is only changed
+ *  through the vdac, so it is saved here.
+ */
+static void vdac_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct vdac_data *d = (struct vdac_data *) extra;
+
+	CHECKPOINT_ARRAY(ckpt, d->vdac_reg, DEV_VDAC_LENGTH);
+	CHECKPOINT_VAR(ckpt, d->cur_read_addr);
+	CHECKPOINT_VAR(ckpt, d->cur_write_addr);
+	CHECKPOINT_VAR(ckpt, d->sub_color);
+	CHECKPOINT_ARRAY(ckpt, d->cur_rgb, 3);
+	CHECKPOINT_VAR(ckpt, d->cur_read_addr_overlay);
+	CHECKPOINT_VAR(ckpt, d->cur_write_addr_overlay);
+	CHECKPOINT_VAR(ckpt, d->sub_color_overlay);
+	CHECKPOINT_ARRAY(ckpt, d->cur_rgb_overlay, 3);
+	CHECKPOINT_ARRAY(ckpt, d->rgb_palette_overlay, 16 * 3);
+
+	if (d->rgb_palette != NULL)
+		checkpoint_data(ckpt, d->rgb_palette, 256 * 3);
+
+	if (ckpt->restoring && (d->sub_color < 0 || d->sub_color > 2 ||
+	    d->sub_color_overlay < 0 || d->sub_color_overlay > 2 ||
+	    d->cur_read_addr_overlay > 15 || d->cur_write_addr_overlay > 15)) {
+		checkpoint_error(ckpt, "bad vdac state");
+		d->sub_color = d->sub_color_overlay = 0;
+		d->cur_read_addr_overlay = d->cur_write_addr_overlay = 0;
+	}
+}
+
+
 DEVICE_ACCESS(kn01)
 {
 	struct kn01_data *d = (struct kn01_data *) extra;
@@ -243,6 +286,7 @@ void dev_vdac_init(struct memory *mem, uint64_t baseaddr,
 
 	memory_device_register(mem, "vdac", baseaddr, DEV_VDAC_LENGTH,
 	    dev_vdac_access, (void *)d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(mem, d, vdac_checkpoint);
 }
 
 
@@ -262,5 +306,6 @@ void dev_kn01_init(struct memory *mem, uint64_t baseaddr, int color_fb)
 
 	memory_device_register(mem, "kn01", baseaddr,
 	    DEV_KN01_LENGTH, dev_kn01_access, d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(mem, d, kn01_checkpoint);
 }
 
@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "device.h"
 #include "interrupt.h"
@@ -83,6 +84,19 @@ void kn02_interrupt_deassert(struct interrupt *interrupt)
 }
 
 
+/*
+ *  kn02_checkpoint():
+ *
+ *  The CSR is saved as dyntrans memory.
+ */
+static void kn02_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct kn02_data *d = (struct kn02_data *) extra;
+
+	CHECKPOINT_VAR(ckpt, d->int_asserted);
+}
+
+
 DEVICE_ACCESS(kn02)
 {
 	struct kn02_data *d = (struct kn02_data *) extra;
@@ -184,6 +198,8 @@ DEVINIT(kn02)
 	memory_device_register(devinit->machine->memory, devinit->name,
 	    devinit->addr, DEV_KN02_LENGTH, dev_kn02_access, d,
 	    DM_DYNTRANS_OK, &d->csr[0]);
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    kn02_checkpoint);
 
 	return 1;
 }
@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "device.h"
 #include "devices.h"
@@ -76,6 +77,21 @@ void kn02ba_interrupt_deassert(struct interrupt *interrupt)
 }
 
 
+/*
+ *  kn02ba_checkpoint():
+ *
+ *  The interrupt registers are in the IOASIC, which has a checkpoint
+ *  function of its own.
+ */
+static void kn02ba_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct kn02ba_data *d = (struct kn02ba_data *) extra;
+
+	CHECKPOINT_VAR(ckpt, d->mer);
+	CHECKPOINT_VAR(ckpt, d->msr);
+}
+
+
 DEVICE_ACCESS(kn02ba_mer)
 {
 	struct kn02ba_data *d = (struct kn02ba_data *) extra;
@@ -198,6 +214,8 @@ DEVINIT(kn02ba)
 	memory_device_register(devinit->machine->memory, "kn02ba_msr",
 	    KMIN_REG_MSR, sizeof(uint32_t), dev_kn02ba_msr_access, d,
 	    DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    kn02ba_checkpoint);
 
 	d->dec_ioasic = dev_dec_ioasic_init(devinit->machine->cpus[0],
 		devinit->machine->memory, KMIN_SYS_ASIC, 0, &d->irq);
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "device.h"
 #include "interrupt.h"
 #include "machine.h"
@@ -93,6 +94,14 @@ void kn230_interrupt_deassert(struct interrupt *interrupt)
 }
 
 
+static void kn230_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct kn230_data *d = (struct kn230_data *) extra;
+
+	CHECKPOINT_VAR(ckpt, d->csr);
+}
+
+
 DEVICE_ACCESS(kn230)
 {
 	struct kn230_data *d = (struct kn230_data *) extra;
@@ -166,6 +175,8 @@ DEVINIT(kn230)
 	memory_device_register(devinit->machine->memory, devinit->name,
 	    devinit->addr, DEV_KN230_LENGTH, dev_kn230_access, d,
 	    DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    kn230_checkpoint);
 
 	devinit->return_ptr = d;
 
@@ -54,6 +54,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "devices.h"
 #include "emul.h"
@@ -119,6 +120,8 @@ struct le_data {
 	int		rx_packet_len;
 	int		rx_packet_offset;
 	int		rx_middle_bit;
+
+	struct machine_event *tick_event;
 };
 
 
@@ -211,8 +214,7 @@ static void le_chip_init(struct le_data *d)
 	d->tx_packet = NULL;
 	d->tx_packet_len = 0;
 
-	if (d->rx_packet != NULL)
-		free(d->rx_packet);
+	net_ethernet_packet_free(d->rx_packet);
 	d->rx_packet = NULL;
 	d->rx_packet_len = 0;
 	d->rx_packet_offset = 0;
@@ -408,7 +410,7 @@ static void le_rx(struct net *net, struct le_data *d)
 			rx_descr[3] &= ~0xfff;
 			rx_descr[3] |= d->rx_packet_len + 4;
 
-			free(d->rx_packet);
+			net_ethernet_packet_free(d->rx_packet);
 			d->rx_packet = NULL;
 			d->rx_packet_len = 0;
 			d->rx_packet_offset = 0;
@@ -536,6 +538,17 @@ DEVICE_TICK(le)
 		INTERRUPT_DEASSERT(d->irq);
 
 	d->irq_asserted = new_assert;
+
+	/*
+	 *  A stopped chip has nothing to do until the next register access,
+	 *  which calls this function again.
+	 */
+	if (d->tick_event != NULL) {
+		if (d->reg[0] & (LE_RXON | LE_TXON | LE_INIT))
+			machine_event_resume(cpu->machine, d->tick_event);
+		else
+			machine_event_cancel(cpu->machine, d->tick_event);
+	}
 }
 
 
@@ -753,6 +766,72 @@ do_return:
 }
 
 
+/*
+ *  le_checkpoint():
+ *
+ *  The SRAM is saved as dyntrans memory. Packets which are only partially
+ *  transmitted or received are part of the checkpoint, but packets which
+ *  are still queued in the emulated network are not.
+ */
+static void le_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct le_data *d = (struct le_data *) extra;
+	int has_tx_packet = d->tx_packet != NULL;
+	int has_rx_packet = d->rx_packet != NULL;
+
+	CHECKPOINT_VAR(ckpt, d->irq_asserted);
+	CHECKPOINT_VAR(ckpt, d->reg_select);
+	CHECKPOINT_ARRAY(ckpt, d->reg, N_REGISTERS);
+	CHECKPOINT_VAR(ckpt, d->init_block_addr);
+	CHECKPOINT_VAR(ckpt, d->mode);
+	CHECKPOINT_VAR(ckpt, d->padr);
+	CHECKPOINT_VAR(ckpt, d->ladrf);
+	CHECKPOINT_VAR(ckpt, d->rdra);
+	CHECKPOINT_VAR(ckpt, d->rlen);
+	CHECKPOINT_VAR(ckpt, d->tdra);
+	CHECKPOINT_VAR(ckpt, d->tlen);
+	CHECKPOINT_VAR(ckpt, d->rxp);
+	CHECKPOINT_VAR(ckpt, d->txp);
+
+	CHECKPOINT_VAR(ckpt, has_tx_packet);
+	CHECKPOINT_VAR(ckpt, d->tx_packet_len);
+	CHECKPOINT_VAR(ckpt, has_rx_packet);
+	CHECKPOINT_VAR(ckpt, d->rx_packet_len);
+	CHECKPOINT_VAR(ckpt, d->rx_packet_offset);
+	CHECKPOINT_VAR(ckpt, d->rx_middle_bit);
+
+	if (ckpt->restoring) {
+		if (d->tx_packet != NULL)
+			free(d->tx_packet);
+		d->tx_packet = NULL;
+		net_ethernet_packet_free(d->rx_packet);
+		d->rx_packet = NULL;
+
+		if (ckpt->failed)
+			return;
+
+		if (d->tx_packet_len < 0 || d->tx_packet_len > 65536 ||
+		    d->rx_packet_len < 0 || d->rx_packet_len > 65536) {
+			checkpoint_error(ckpt, "bad le packet length");
+			d->tx_packet_len = d->rx_packet_len = 0;
+			return;
+		}
+
+		if (has_tx_packet)
+			CHECK_ALLOCATION(d->tx_packet = (unsigned char *)
+			    malloc(d->tx_packet_len + 1));
+		if (has_rx_packet)
+			d->rx_packet = net_ethernet_packet_alloc(
+			    d->rx_packet_len);
+	}
+
+	if (has_tx_packet)
+		checkpoint_data(ckpt, d->tx_packet, d->tx_packet_len);
+	if (has_rx_packet)
+		checkpoint_data(ckpt, d->rx_packet, d->rx_packet_len);
+}
+
+
 /*
  *  dev_le_init():
  */
@@ -811,7 +890,10 @@ void dev_le_init(struct machine *machine, struct memory *mem, uint64_t baseaddr,
 	memory_device_register(mem, name2, baseaddr + 0x100000,
 	    len - 0x100000, dev_le_access, (void *)d, DM_DEFAULT, NULL);
 
-	machine_add_tickfunction(machine, dev_le_tick, d, LE_TICK_SHIFT);
+	memory_device_set_checkpoint(mem, d, le_checkpoint);
+
+	d->tick_event = machine_add_tickfunction(machine, dev_le_tick, d,
+	    LE_TICK_SHIFT);
 
 	net_add_nic(machine->emul->net, d, &d->rom[0]);
 }
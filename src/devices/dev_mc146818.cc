@@ -42,6 +42,7 @@
 #include <string.h>
 #include <time.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "devices.h"
 #include "machine.h"
@@ -85,6 +86,8 @@ struct mc_data {
 
 	int		ugly_netbsd_prep_hack_done;
 	int		ugly_netbsd_prep_hack_sec;
+
+	struct machine_event *tick_event;
 };
 
 
@@ -140,6 +143,45 @@ DEVICE_TICK(mc146818)
 	    d->reg[MC_REGC * 4] & MC_REGC_AF ||
 	    d->reg[MC_REGC * 4] & MC_REGC_PF)
 		d->reg[MC_REGC * 4] |= MC_REGC_IRQF;
+
+	/*
+	 *  Until the guest has programmed a periodic interrupt rate, there
+	 *  are no timer interrupts to deliver. The event is resumed when the
+	 *  timer is started.
+	 */
+	if (d->timer == NULL && d->tick_event != NULL)
+		machine_event_cancel(cpu->machine, d->tick_event);
+}
+
+
+static void mc146818_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct mc_data *d = (struct mc_data *) extra;
+	int has_timer = d->timer != NULL;
+
+	CHECKPOINT_VAR(ckpt, d->last_addr);
+	CHECKPOINT_VAR(ckpt, d->register_choice);
+	CHECKPOINT_ARRAY(ckpt, d->reg, N_REGISTERS);
+	CHECKPOINT_VAR(ckpt, d->interrupt_hz);
+	CHECKPOINT_VAR(ckpt, d->old_interrupt_hz);
+	CHECKPOINT_VAR(ckpt, d->pending_timer_interrupts);
+	CHECKPOINT_VAR(ckpt, d->previous_second);
+	CHECKPOINT_VAR(ckpt, d->n_seconds_elapsed);
+	CHECKPOINT_VAR(ckpt, d->ugly_netbsd_prep_hack_done);
+	CHECKPOINT_VAR(ckpt, d->ugly_netbsd_prep_hack_sec);
+	CHECKPOINT_VAR(ckpt, has_timer);
+
+	if (!ckpt->restoring)
+		return;
+
+	if (!has_timer) {
+		if (d->timer != NULL)
+			timer_remove(d->timer);
+		d->timer = NULL;
+	} else if (d->timer == NULL)
+		d->timer = timer_add(d->old_interrupt_hz, timer_tick, d);
+	else
+		timer_update_frequency(d->timer, d->old_interrupt_hz);
 }
 
 
@@ -442,10 +484,12 @@ DEVICE_ACCESS(mc146818)
 
 				d->old_interrupt_hz = d->interrupt_hz;
 
-				if (d->timer == NULL)
+				if (d->timer == NULL) {
 					d->timer = timer_add(d->interrupt_hz,
 					    timer_tick, d);
-				else
+					machine_event_resume(cpu->machine,
+					    d->tick_event);
+				} else
 					timer_update_frequency(d->timer,
 					    d->interrupt_hz);
 			}
@@ -679,10 +723,11 @@ void dev_mc146818_init(struct machine *machine, struct memory *mem,
 	memory_device_register(mem, "mc146818", baseaddr,
 	    dev_len * addrdiv, dev_mc146818_access,
 	    d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(mem, d, mc146818_checkpoint);
 
 	mc146818_update_time(d);
 
-	machine_add_tickfunction(machine, dev_mc146818_tick, d,
-	    MC146818_TICK_SHIFT);
+	d->tick_event = machine_add_tickfunction(machine, dev_mc146818_tick,
+	    d, MC146818_TICK_SHIFT);
 }
 
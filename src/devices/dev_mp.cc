@@ -39,6 +39,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "device.h"
 #include "machine.h"
@@ -51,6 +52,7 @@
 
 struct mp_data {
 	struct cpu	**cpus;
+	int		ncpus;
 	uint64_t	startup_addr;
 	uint64_t	stack_addr;
 	uint64_t	pause_addr;
@@ -67,6 +69,36 @@ struct mp_data {
 extern int single_step;
 
 
+static void mp_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct mp_data *d = (struct mp_data *) extra;
+	int i;
+
+	CHECKPOINT_VAR(ckpt, d->startup_addr);
+	CHECKPOINT_VAR(ckpt, d->stack_addr);
+	CHECKPOINT_VAR(ckpt, d->pause_addr);
+
+	for (i=0; i<d->ncpus; i++) {
+		CHECKPOINT_VAR(ckpt, d->n_pending_ipis[i]);
+
+		if (ckpt->restoring) {
+			if (d->n_pending_ipis[i] < 0 ||
+			    d->n_pending_ipis[i] > 1000000) {
+				checkpoint_error(ckpt, "bad number of pending"
+				    " ipis");
+				d->n_pending_ipis[i] = 0;
+				return;
+			}
+
+			CHECK_ALLOCATION(d->ipi[i] = (int *) realloc(d->ipi[i],
+			    (d->n_pending_ipis[i] + 1) * sizeof(int)));
+		}
+
+		CHECKPOINT_ARRAY(ckpt, d->ipi[i], d->n_pending_ipis[i]);
+	}
+}
+
+
 DEVICE_ACCESS(mp)
 {
 	struct mp_data *d = (struct mp_data *) extra;
@@ -263,7 +295,7 @@ DEVINIT(mp)
 	d->startup_addr = INITIAL_PC;
 	d->stack_addr = INITIAL_STACK_POINTER;
 
-	n = devinit->machine->ncpus;
+	n = d->ncpus = devinit->machine->ncpus;
 
 	/*  Connect to all CPUs' IPI pins:  */
 	CHECK_ALLOCATION(d->ipi_irq = (struct interrupt *)
@@ -284,6 +316,8 @@ DEVINIT(mp)
 
 	memory_device_register(devinit->machine->memory, devinit->name,
 	    devinit->addr, DEV_MP_LENGTH, dev_mp_access, d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    mp_checkpoint);
 
 	return 1;
 }
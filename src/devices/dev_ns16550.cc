@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "console.h"
 #include "cpu.h"
 #include "device.h"
@@ -68,9 +69,28 @@ struct ns_data {
 	int		databits;
 	char		parity;
 	const char	*stopbits;
+
+	struct machine_event *tick_event;
 };
 
 
+/*
+ *  ns16550_checkpoint():
+ *
+ *  (The data format is only used for debug output, and is not saved.)
+ */
+static void ns16550_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct ns_data *d = (struct ns_data *) extra;
+
+	CHECKPOINT_ARRAY(ckpt, d->reg, DEV_NS16550_LENGTH);
+	CHECKPOINT_VAR(ckpt, d->fcr);
+	CHECKPOINT_VAR(ckpt, d->int_asserted);
+	CHECKPOINT_VAR(ckpt, d->dlab);
+	CHECKPOINT_VAR(ckpt, d->divisor);
+}
+
+
 DEVICE_TICK(ns16550)
 {
 	/*
@@ -102,6 +122,19 @@ DEVICE_TICK(ns16550)
 			INTERRUPT_DEASSERT(d->irq);
 		d->int_asserted = 0;
 	}
+
+	/*
+	 *  With all interrupts disabled, the guest has to poll the status
+	 *  registers, and those accesses call this function directly. There
+	 *  is then no need for regular ticks until IER is written to again.
+	 */
+	if (d->tick_event != NULL) {
+		if (!(d->reg[com_ier] & (IER_ETXRDY | IER_ERXRDY)) &&
+		    !d->int_asserted)
+			machine_event_cancel(cpu->machine, d->tick_event);
+		else
+			machine_event_resume(cpu->machine, d->tick_event);
+	}
 }
 
 
@@ -353,7 +386,9 @@ DEVINIT(ns16550)
 	memory_device_register(devinit->machine->memory, name, devinit->addr,
 	    DEV_NS16550_LENGTH * d->addrmult, dev_ns16550_access, d,
 	    DM_DEFAULT, NULL);
-	machine_add_tickfunction(devinit->machine,
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    ns16550_checkpoint);
+	d->tick_event = machine_add_tickfunction(devinit->machine,
 	    dev_ns16550_tick, d, TICK_SHIFT);
 
 	/*
@@ -83,6 +83,15 @@ struct osiop_data {
 	struct scsi_transfer	*xferp;
 	size_t			data_offset;
 
+	/*
+	 *  Data in transfer from an asynchronous disk image. The SCRIPTS
+	 *  processor is stalled until osiop_data_in_done() has been called.
+	 */
+	int			io_pending;
+	int			io_stalled;
+	struct cpu		*io_cpu;
+	uint32_t		io_addr;
+
 	/*  Cached emulated physical RAM page lookup:  */
 	uint32_t		last_phys_page;
 	uint8_t			*last_host_page;
@@ -107,6 +116,9 @@ static void osiop_free_xfer(struct osiop_data *d)
 }
 
 
+void osiop_execute_scripts(struct cpu *cpu, struct osiop_data *d);
+
+
 /*  Allocate memory for a new transfer.  */
 static void osiop_new_xfer(struct osiop_data *d, int target_scsi_id)
 {
@@ -118,6 +130,9 @@ static void osiop_new_xfer(struct osiop_data *d, int target_scsi_id)
 
 	d->selected_id = target_scsi_id;
 	d->xferp = scsi_transfer_alloc();
+
+	/*  Disk reads may go directly into emulated memory:  */
+	d->xferp->dma_direct = 1;
 }
 
 
@@ -193,6 +208,51 @@ static void osiop_reassert_interrupts(struct osiop_data *d)
 }
 
 
+/*
+ *  osiop_data_in_failed():
+ *
+ *  Called when the disk read for a DATA_IN move has failed. The rest of the
+ *  data is skipped, and the target returns CHECK CONDITION status.
+ */
+static void osiop_data_in_failed(struct osiop_data *d)
+{
+	d->xferp->status[0] = 0x02;	/*  CHECK CONDITION  */
+	d->data_offset = d->xferp->data_in_len;
+	osiop_set_scsi_phase(d, STATUS_PHASE);
+}
+
+
+/*
+ *  osiop_data_in_done():
+ *
+ *  Called when a disk read started by a DATA_IN move has completed. The data
+ *  is copied into emulated memory. If the SCRIPTS processor was stalled
+ *  waiting for the data, then it is restarted, and the script continues on
+ *  to its completion interrupt.
+ */
+static void osiop_data_in_done(struct diskimage_request *req)
+{
+	struct osiop_data *d = (struct osiop_data *) req->extra;
+	struct cpu *cpu = d->io_cpu;
+
+	if (req->result)
+		memory_dma_copy(cpu, d->io_addr, req->buf, req->len,
+		    MEM_WRITE);
+	else
+		osiop_data_in_failed(d);
+
+	free(req->buf);
+
+	d->io_pending = 0;
+
+	if (d->io_stalled) {
+		d->io_stalled = 0;
+		osiop_execute_scripts(cpu, d);
+		osiop_reassert_interrupts(d);
+	}
+}
+
+
 /*  Helper: returns a word in host order, from emulated physical RAM.  */
 static uint32_t read_word(struct osiop_data *d, struct cpu *cpu, uint32_t addr)
 {
@@ -238,6 +298,7 @@ static void write_byte(struct osiop_data *d, struct cpu *cpu, uint32_t addr, uin
 	}
 
 	d->last_host_page[addr & 0xfff] = byte;
+	memory_mark_dirty(cpu->mem, addr, 1);
 }
 
 
@@ -277,7 +338,8 @@ uint32_t osiop_get_next_scripts_word(struct cpu *cpu, struct osiop_data *d)
  *  osiop_execute_scripts_instr():
  *
  *  Interprets a single SCRIPTS machine code instruction. Returns 1 if
- *  execution should continue, or 0 if there was an interrupt.
+ *  execution should continue, or 0 if there was an interrupt or if the
+ *  instruction is waiting for an asynchronous disk read to complete.
  *
  *  See "Symbios SYM53C710 SCSI I/O Processor Technical Manual, version 3.1"
  *  chapter 5 for details about the instruction set.
@@ -334,8 +396,8 @@ int osiop_execute_scripts_instr(struct cpu *cpu, struct osiop_data *d)
 			uint32_t dsa = *dsap;
 			uint32_t addr, xfer_byte_count, xfer_addr;
 			int32_t tmp = ofs2 << 8;
-			int res;
-			size_t i;
+			int res = 1;
+			size_t i, n;
 
 			tmp >>= 8;
 			table_indirect_addressing = dcmd & 0x10;
@@ -438,14 +500,16 @@ int osiop_execute_scripts_instr(struct cpu *cpu, struct osiop_data *d)
 					scsi_transfer_allocbuf(&d->xferp->data_out_len,
 					    &d->xferp->data_out, d->xferp->data_out_len, 0);
 
-				while (xfer_byte_count > 0) {
-					uint8_t byte = read_byte(d, cpu, xfer_addr);
-					/*  debug("  reading data_out byte @ 0x%08x = 0x%02x\n",
-					    xfer_addr, byte);  */
-					d->xferp->data_out[d->xferp->data_out_offset++] = byte;
-					xfer_addr ++;
-					xfer_byte_count --;
-				}
+				n = d->xferp->data_out_len -
+				    d->xferp->data_out_offset;
+				if (n > xfer_byte_count)
+					n = xfer_byte_count;
+
+				memory_dma_copy(cpu, xfer_addr, d->xferp->data_out +
+				    d->xferp->data_out_offset, n, MEM_READ);
+				d->xferp->data_out_offset += n;
+				xfer_addr += n;
+				xfer_byte_count -= n;
 
 				/*  Rerun the command to actually write out the data:  */
 				res = diskimage_scsicommand(cpu,
@@ -461,20 +525,47 @@ int osiop_execute_scripts_instr(struct cpu *cpu, struct osiop_data *d)
 				break;
 
 			case DATA_IN_PHASE:
-				i = 0;
-				while (xfer_byte_count > 0 && i + d->data_offset < d->xferp->data_in_len) {
-					uint8_t byte = d->xferp->data_in[i + d->data_offset];
-					i ++;
-					/*  debug("  writing data_in byte @ 0x%08x = 0x%02x\n",
-					    xfer_addr, byte);  */
-					write_byte(d, cpu, xfer_addr, byte);
-					xfer_addr ++;
-					xfer_byte_count --;
-				}
-
-				d->data_offset += i;
+				n = d->xferp->data_in_len - d->data_offset;
+				if (n > xfer_byte_count)
+					n = xfer_byte_count;
+
+				if (d->xferp->data_in_direct &&
+				    d->xferp->data_in_disk->async) {
+					struct diskimage *disk =
+					    d->xferp->data_in_disk;
+					unsigned char *buf;
+
+					CHECK_ALLOCATION(buf = (unsigned char *)
+					    malloc(n > 0? n : 1));
+
+					d->io_pending = 1;
+					d->io_cpu = cpu;
+					d->io_addr = xfer_addr;
+					diskimage_access_async(cpu->machine,
+					    d->selected_id, DISKIMAGE_SCSI, 0,
+					    disk->override_base_offset +
+					    d->xferp->data_in_disk_offset +
+					    d->data_offset, buf, n,
+					    osiop_data_in_done, d);
+				} else if (d->xferp->data_in_direct) {
+					if (!diskimage__internal_access_dma(cpu,
+					    d->xferp->data_in_disk, 0,
+					    d->xferp->data_in_disk_offset +
+					    d->data_offset, xfer_addr, n))
+						res = 0;
+				} else
+					memory_dma_copy(cpu, xfer_addr,
+					    d->xferp->data_in + d->data_offset,
+					    n, MEM_WRITE);
+
+				xfer_addr += n;
+				xfer_byte_count -= n;
+				d->data_offset += n;
 				if (d->data_offset >= d->xferp->data_in_len)
 					osiop_set_scsi_phase(d, STATUS_PHASE);
+
+				if (res == 0)
+					osiop_data_in_failed(d);
 				break;
 
 			case STATUS_PHASE:
@@ -516,6 +607,14 @@ int osiop_execute_scripts_instr(struct cpu *cpu, struct osiop_data *d)
 			*dbcp = xfer_byte_count;
 			
 			d->reg[OSIOP_DFIFO] = 0;	/*  TODO  */
+
+			/*  Stall until osiop_data_in_done() is called:  */
+			if (d->io_pending) {
+				d->io_stalled = 1;
+				if (osiop_debug)
+					debug(" }\n");
+				return 0;
+			}
 		}
 		break;
 
@@ -792,7 +891,8 @@ void osiop_execute_scripts(struct cpu *cpu, struct osiop_data *d)
 	if (osiop_debug)
 		debug("{ SCRIPTS start }\n");
 
-	while (d->scripts_running && n < MAX_SCRIPTS_PER_CHUNK &&
+	while (d->scripts_running && !d->io_stalled &&
+	    n < MAX_SCRIPTS_PER_CHUNK &&
 	    osiop_execute_scripts_instr(cpu, d))
 		n++;
 
@@ -805,7 +905,7 @@ DEVICE_TICK(osiop)
 {
 	struct osiop_data *d = (struct osiop_data *) extra;
 
-	if (d->scripts_running)
+	if (d->scripts_running && !d->io_stalled)
 		osiop_execute_scripts(cpu, d);
 
 	osiop_reassert_interrupts(d);
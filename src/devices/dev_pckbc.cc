@@ -42,6 +42,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "console.h"
 #include "cpu.h"
 #include "devices.h"
@@ -155,6 +156,54 @@ int pckbc_get_code(struct pckbc_data *d, int port)
 }
 
 
+/*
+ *  pckbc_checkpoint():
+ *
+ *  Only the part of each queue which is in use (from the last byte read to
+ *  the last byte added) is saved.
+ */
+static void pckbc_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct pckbc_data *d = (struct pckbc_data *) extra;
+	int port, i;
+
+	CHECKPOINT_ARRAY(ckpt, d->reg, DEV_PCKBC_LENGTH);
+	CHECKPOINT_ARRAY(ckpt, d->currently_asserted, 2);
+	CHECKPOINT_VAR(ckpt, d->clocksignal);
+	CHECKPOINT_ARRAY(ckpt, d->rx_int_enable, 2);
+	CHECKPOINT_ARRAY(ckpt, d->tx_int_enable, 2);
+	CHECKPOINT_ARRAY(ckpt, d->scanning_enabled, 2);
+	CHECKPOINT_VAR(ckpt, d->translation_table);
+	CHECKPOINT_ARRAY(ckpt, d->state, 2);
+	CHECKPOINT_VAR(ckpt, d->cmdbyte);
+	CHECKPOINT_VAR(ckpt, d->output_byte);
+	CHECKPOINT_VAR(ckpt, d->last_scancode);
+	CHECKPOINT_VAR(ckpt, d->mouse_x);
+	CHECKPOINT_VAR(ckpt, d->mouse_y);
+	CHECKPOINT_VAR(ckpt, d->mouse_buttons);
+
+	for (port=0; port<2 && !ckpt->failed; port++) {
+		CHECKPOINT_VAR(ckpt, d->head[port]);
+		CHECKPOINT_VAR(ckpt, d->tail[port]);
+
+		if (ckpt->restoring && (d->head[port] < 0 ||
+		    d->head[port] >= MAX_8042_QUEUELEN || d->tail[port] < 0
+		    || d->tail[port] >= MAX_8042_QUEUELEN)) {
+			checkpoint_error(ckpt, "bad pckbc queue position");
+			d->head[port] = d->tail[port] = 0;
+			return;
+		}
+
+		i = d->tail[port];
+		CHECKPOINT_VAR(ckpt, d->key_queue[port][i]);
+		while (i != d->head[port]) {
+			i = (i + 1) % MAX_8042_QUEUELEN;
+			CHECKPOINT_VAR(ckpt, d->key_queue[port][i]);
+		}
+	}
+}
+
+
 /*
  *  ascii_to_scancodes_type1():
  *
@@ -1195,6 +1244,7 @@ int dev_pckbc_init(struct machine *machine, struct memory *mem,
 
 	memory_device_register(mem, "pckbc", baseaddr,
 	    len, dev_pckbc_access, d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(mem, d, pckbc_checkpoint);
 	machine_add_tickfunction(machine, dev_pckbc_tick, d,
 	    PCKBC_TICKSHIFT);
 
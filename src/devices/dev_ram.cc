@@ -36,6 +36,7 @@
 #include <sys/types.h>
 #include <sys/mman.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "devices.h"
 #include "machine.h"
@@ -60,6 +61,12 @@ struct ram_data {
 };
 
 
+static void ram_mirror_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	/*  Nothing to save. The mirrored memory is saved where it is.  */
+}
+
+
 DEVICE_ACCESS(ram)
 {
 	struct ram_data *d = (struct ram_data *) extra;
@@ -176,9 +183,14 @@ void dev_ram_init(struct machine *machine, uint64_t baseaddr, uint64_t length,
 			flags |= DM_DYNTRANS_OK | DM_DYNTRANS_WRITE_OK
 			    | DM_EMULATED_RAM;
 
+		/*  (The offset is only used by dyntrans if the mirror
+		    is DM_EMULATED_RAM, so it isn't device memory.)  */
 		memory_device_register(machine->memory, d->name,
 		    baseaddr, length, dev_ram_access, d, flags
-		    | DM_READS_HAVE_NO_SIDE_EFFECTS, (unsigned char*) (void *) &d->offset);
+		    | DM_READS_HAVE_NO_SIDE_EFFECTS, flags & DM_EMULATED_RAM?
+		    (unsigned char*) (void *) &d->offset : NULL);
+		memory_device_set_checkpoint(machine->memory, d,
+		    ram_mirror_checkpoint);
 		break;
 
 	case DEV_RAM_RAM:
@@ -40,6 +40,7 @@
 #include <string.h>
 #include <time.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "device.h"
 #include "machine.h"
@@ -108,6 +109,19 @@ DEVICE_ACCESS(rs5c313)
 }
 
 
+/*
+ *  rs5c313_checkpoint():
+ *
+ *  (The time registers are set from the host's clock on every access.)
+ */
+static void rs5c313_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct rs5c313_data *d = (struct rs5c313_data *) extra;
+
+	CHECKPOINT_ARRAY(ckpt, d->reg, DEV_RS5C313_LENGTH);
+}
+
+
 DEVINIT(rs5c313)
 {
 	struct rs5c313_data *d;
@@ -121,6 +135,8 @@ DEVINIT(rs5c313)
 	memory_device_register(devinit->machine->memory, devinit->name,
 	    devinit->addr, DEV_RS5C313_LENGTH,
 	    dev_rs5c313_access, (void *)d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    rs5c313_checkpoint);
 
 	return 1;
 }
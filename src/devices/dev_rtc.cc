@@ -36,6 +36,7 @@
 #include <string.h>
 #include <sys/time.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "device.h"
 #include "emul.h"
@@ -72,6 +73,27 @@ static void timer_tick(struct timer *t, void *extra)
 }
 
 
+static void rtc_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct rtc_data *d = (struct rtc_data *) extra;
+
+	CHECKPOINT_VAR(ckpt, d->pending_interrupts);
+	CHECKPOINT_VAR(ckpt, d->hz);
+
+	if (!ckpt->restoring)
+		return;
+
+	if (d->hz == 0) {
+		if (d->timer != NULL)
+			timer_remove(d->timer);
+		d->timer = NULL;
+	} else if (d->timer == NULL)
+		d->timer = timer_add(d->hz, timer_tick, d);
+	else
+		timer_update_frequency(d->timer, d->hz);
+}
+
+
 DEVICE_TICK(rtc)
 {  
 	struct rtc_data *d = (struct rtc_data *) extra;
@@ -169,6 +191,8 @@ DEVINIT(rtc)
 	memory_device_register(devinit->machine->memory, devinit->name,
 	    devinit->addr, DEV_RTC_LENGTH, dev_rtc_access, (void *)d,
 	    DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    rtc_checkpoint);
 
 	machine_add_tickfunction(devinit->machine,
 	    dev_rtc_tick, d, DEV_RTC_TICK_SHIFT);
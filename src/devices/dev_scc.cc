@@ -55,6 +55,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "console.h"
 #include "cpu.h"
 #include "devices.h"
@@ -97,6 +98,36 @@ struct scc_data {
 };
 
 
+static void scc_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct scc_data *d = (struct scc_data *) extra;
+	int i;
+
+	CHECKPOINT_ARRAY(ckpt, d->register_select_in_progress, N_SCC_PORTS);
+	CHECKPOINT_ARRAY(ckpt, d->register_selected, N_SCC_PORTS);
+	CHECKPOINT_ARRAY(ckpt, d->scc_register_r, N_SCC_PORTS * N_SCC_REGS);
+	CHECKPOINT_ARRAY(ckpt, d->scc_register_w, N_SCC_PORTS * N_SCC_REGS);
+	checkpoint_data(ckpt, d->rx_queue_char, sizeof(d->rx_queue_char));
+	CHECKPOINT_ARRAY(ckpt, d->cur_rx_queue_pos_write, N_SCC_PORTS);
+	CHECKPOINT_ARRAY(ckpt, d->cur_rx_queue_pos_read, N_SCC_PORTS);
+
+	for (i=0; i<N_SCC_PORTS && ckpt->restoring; i++)
+		if (d->register_selected[i] < 0 ||
+		    d->register_selected[i] >= N_SCC_REGS ||
+		    d->cur_rx_queue_pos_write[i] < 0 ||
+		    d->cur_rx_queue_pos_write[i] >= MAX_QUEUE_LEN ||
+		    d->cur_rx_queue_pos_read[i] < 0 ||
+		    d->cur_rx_queue_pos_read[i] >= MAX_QUEUE_LEN) {
+			checkpoint_error(ckpt, "bad scc port state");
+			d->register_selected[i] = 0;
+			d->cur_rx_queue_pos_write[i] = 0;
+			d->cur_rx_queue_pos_read[i] = 0;
+		}
+
+	lk201_checkpoint(ckpt, &d->lk201);
+}
+
+
 /*
  *  dev_scc_add_to_rx_queue():
  *
@@ -479,6 +510,7 @@ void *dev_scc_init(struct machine *machine, struct memory *mem,
 
 	memory_device_register(mem, "scc", baseaddr, DEV_SCC_LENGTH,
 	    dev_scc_access, d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(mem, d, scc_checkpoint);
 	machine_add_tickfunction(machine, dev_scc_tick, d, SCC_TICK_SHIFT);
 
 	return (void *) d;
@@ -105,8 +105,8 @@ struct sgi_mec_data {
  */
 static void mec_reset(struct sgi_mec_data *d)
 {
-	if (d->cur_rx_packet != NULL)
-		free(d->cur_rx_packet);
+	net_ethernet_packet_free(d->cur_rx_packet);
+	d->cur_rx_packet = NULL;
 
 	memset(d->reg, 0, sizeof(d->reg));
 }
@@ -201,7 +201,7 @@ static int mec_try_rx(struct cpu *cpu, struct sgi_mec_data *d)
 	    &data[0], sizeof(data), MEM_WRITE, PHYSICAL);
 
 	/*  Free the packet from memory:  */
-	free(d->cur_rx_packet);
+	net_ethernet_packet_free(d->cur_rx_packet);
 	d->cur_rx_packet = NULL;
 
 	d->reg[MEC_INT_STATUS / sizeof(uint64_t)] |= MEC_INT_RX_THRESHOLD;
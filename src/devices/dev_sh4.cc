@@ -41,6 +41,7 @@
 #include <string.h>
 
 #include "bus_pci.h"
+#include "checkpoint.h"
 #include "console.h"
 #include "cpu.h"
 #include "device.h"
@@ -1838,6 +1839,88 @@ DEVICE_ACCESS(sh4)
 }
 
 
+/*
+ *  sh4_checkpoint():
+ *
+ *  The timer frequencies are saved as the bit patterns of the doubles.
+ *  (The host timer itself always runs at SH4_PSEUDO_TIMER_HZ.)
+ */
+static void sh4_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct sh4_data *d = (struct sh4_data *) extra;
+	uint64_t hz_bits;
+	int i;
+
+	CHECKPOINT_ARRAY(ckpt, d->sq, sizeof(d->sq));
+
+	CHECKPOINT_VAR(ckpt, d->scif_smr);
+	CHECKPOINT_VAR(ckpt, d->scif_brr);
+	CHECKPOINT_VAR(ckpt, d->scif_scr);
+	CHECKPOINT_VAR(ckpt, d->scif_ssr);
+	CHECKPOINT_VAR(ckpt, d->scif_fcr);
+	CHECKPOINT_VAR(ckpt, d->scif_lsr);
+	CHECKPOINT_VAR(ckpt, d->scif_delayed_tx);
+	checkpoint_data(ckpt, d->scif_tx_fifo, sizeof(d->scif_tx_fifo));
+	CHECKPOINT_VAR(ckpt, d->scif_tx_fifo_cursize);
+	CHECKPOINT_VAR(ckpt, d->scif_tx_irq_asserted);
+	CHECKPOINT_VAR(ckpt, d->scif_rx_irq_asserted);
+	if (d->scif_tx_fifo_cursize > SCIF_TX_FIFO_SIZE)
+		checkpoint_error(ckpt, "bad sh4 SCIF fifo size");
+
+	CHECKPOINT_VAR(ckpt, d->bsc_bcr1);
+	CHECKPOINT_VAR(ckpt, d->bsc_bcr2);
+	CHECKPOINT_VAR(ckpt, d->bsc_bcr3);
+	CHECKPOINT_VAR(ckpt, d->bsc_wcr1);
+	CHECKPOINT_VAR(ckpt, d->bsc_wcr2);
+	CHECKPOINT_VAR(ckpt, d->bsc_wcr3);
+	CHECKPOINT_VAR(ckpt, d->bsc_mcr);
+	CHECKPOINT_VAR(ckpt, d->bsc_pcr);
+	CHECKPOINT_VAR(ckpt, d->bsc_rtcsr);
+	CHECKPOINT_VAR(ckpt, d->bsc_rtcor);
+	CHECKPOINT_VAR(ckpt, d->bsc_rfcr);
+
+	CHECKPOINT_VAR(ckpt, d->cpg_frqcr);
+	CHECKPOINT_VAR(ckpt, d->cpg_stbcr);
+	CHECKPOINT_VAR(ckpt, d->cpg_wtcnt);
+	CHECKPOINT_VAR(ckpt, d->cpg_wtcsr);
+	CHECKPOINT_VAR(ckpt, d->cpg_stbcr2);
+
+	CHECKPOINT_VAR(ckpt, d->pctra);
+	CHECKPOINT_VAR(ckpt, d->pdtra);
+	CHECKPOINT_VAR(ckpt, d->pctrb);
+	CHECKPOINT_VAR(ckpt, d->pdtrb);
+	CHECKPOINT_VAR(ckpt, d->bsc_gpioic);
+
+	CHECKPOINT_ARRAY(ckpt, d->pcic_reg, N_PCIC_REGS);
+	bus_pci_checkpoint(ckpt, d->pci_data);
+
+	CHECKPOINT_VAR(ckpt, d->sci_bits_outputed);
+	CHECKPOINT_VAR(ckpt, d->sci_bits_read);
+	CHECKPOINT_VAR(ckpt, d->sci_scsptr);
+	CHECKPOINT_VAR(ckpt, d->sci_curbyte);
+	CHECKPOINT_VAR(ckpt, d->sci_cur_addr);
+
+	CHECKPOINT_VAR(ckpt, d->sdmr2);
+	CHECKPOINT_VAR(ckpt, d->sdmr3);
+
+	CHECKPOINT_VAR(ckpt, d->tocr);
+	CHECKPOINT_VAR(ckpt, d->tstr);
+	CHECKPOINT_ARRAY(ckpt, d->tcnt, N_SH4_TIMERS);
+	CHECKPOINT_ARRAY(ckpt, d->tcor, N_SH4_TIMERS);
+	CHECKPOINT_ARRAY(ckpt, d->tcr, N_SH4_TIMERS);
+	CHECKPOINT_ARRAY(ckpt, d->timer_interrupts_pending, N_SH4_TIMERS);
+	for (i=0; i<N_SH4_TIMERS; i++) {
+		memcpy(&hz_bits, &d->timer_hz[i], sizeof(hz_bits));
+		CHECKPOINT_VAR(ckpt, hz_bits);
+		memcpy(&d->timer_hz[i], &hz_bits, sizeof(hz_bits));
+	}
+
+	CHECKPOINT_ARRAY(ckpt, d->rtc_reg, 14);
+	CHECKPOINT_VAR(ckpt, d->rtc_rcr1);
+	CHECKPOINT_VAR(ckpt, d->rtc_rcr2);
+}
+
+
 DEVINIT(sh4)
 {
 	char tmp[200], n[200];
@@ -1920,6 +2003,8 @@ DEVINIT(sh4)
 	    N_PCIC_REGS * sizeof(uint32_t), dev_sh4_pcic_access, d,
 	    DM_DEFAULT, NULL);
 
+	memory_device_set_checkpoint(machine->memory, d, sh4_checkpoint);
+
 	/*  Initial PCI control register contents:  */
 	d->bsc_bcr2 = BCR2_PORTEN;
 	d->pcic_reg[PCIC_REG(SH4_PCICONF2)] = PCI_CLASS_CODE(PCI_CLASS_BRIDGE,
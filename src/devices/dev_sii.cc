@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "devices.h"
 #include "interrupt.h"
@@ -91,6 +92,17 @@ void combine_sii_bits(struct sii_data *d)
 }
 
 
+static void sii_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct sii_data *d = (struct sii_data *) extra;
+
+	CHECKPOINT_VAR(ckpt, d->connected);
+	CHECKPOINT_VAR(ckpt, d->connected_to_id);
+	CHECKPOINT_VAR(ckpt, d->register_choice);
+	CHECKPOINT_ARRAY(ckpt, d->regs, sizeof(SIIRegs) / sizeof(uint16_t));
+}
+
+
 DEVICE_TICK(sii)
 {
 	struct sii_data *d = (struct sii_data *) extra;
@@ -453,6 +465,7 @@ void dev_sii_init(struct machine *machine, struct memory *mem,
 
 	memory_device_register(mem, "sii", baseaddr, DEV_SII_LENGTH,
 	    dev_sii_access, (void *)d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(mem, d, sii_checkpoint);
 
 	machine_add_tickfunction(machine, dev_sii_tick, d,
 	    SII_TICK_SHIFT);
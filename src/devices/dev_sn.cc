@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "device.h"
 #include "emul.h"
@@ -54,6 +55,14 @@ struct sn_data {
 };
 
 
+static void sn_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct sn_data *d = (struct sn_data *) extra;
+
+	CHECKPOINT_ARRAY(ckpt, d->reg, SONIC_NREGS);
+}
+
+
 DEVICE_ACCESS(sn)
 {
 	struct sn_data *d = (struct sn_data *) extra;
@@ -114,6 +123,8 @@ DEVINIT(sn)
 	memory_device_register(devinit->machine->memory, name2,
 	    devinit->addr, DEV_SN_LENGTH,
 	    dev_sn_access, (void *)d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    sn_checkpoint);
 
 	net_add_nic(devinit->machine->emul->net, d, d->macaddr);
 
@@ -37,6 +37,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "console.h"
 #include "cpu.h"
 #include "devices.h"
@@ -222,6 +223,20 @@ DEVICE_ACCESS(ssc)
 }
 
 
+/*
+ *  ssc_checkpoint():
+ *
+ *  (The availability and ready bits are updated by the tick function.)
+ */
+static void ssc_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct ssc_data *d = (struct ssc_data *) extra;
+
+	CHECKPOINT_VAR(ckpt, d->rx_ctl);
+	CHECKPOINT_VAR(ckpt, d->tx_ctl);
+}
+
+
 void dev_ssc_init(struct machine *machine, struct memory *mem,
 	uint64_t baseaddr, const char *irq_path, int use_fb)
 {
@@ -237,6 +252,7 @@ void dev_ssc_init(struct machine *machine, struct memory *mem,
 
 	memory_device_register(mem, "ssc", baseaddr, DEV_SSC_LENGTH,
 	    dev_ssc_access, d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(mem, d, ssc_checkpoint);
 
 	machine_add_tickfunction(machine, dev_ssc_tick, d, SSC_TICK_SHIFT);
 }
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "devices.h"
 #include "machine.h"
 #include "memory.h"
@@ -61,6 +62,12 @@ struct turbochannel_data {
 };
 
 
+static void turbochannel_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	/*  Nothing to save. The option ROM contents never change.  */
+}
+
+
 DEVICE_ACCESS(turbochannel)
 {
 	struct turbochannel_data *d = (struct turbochannel_data *) extra;
@@ -324,5 +331,6 @@ void dev_turbochannel_init(struct machine *machine, struct memory *mem,
 
 	memory_device_register(mem, name2, baseaddr + rom_offset + rom_skip,
 	    rom_length-rom_skip, dev_turbochannel_access, d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(mem, d, turbochannel_checkpoint);
 }
 
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "device.h"
 #include "diskimage.h"
@@ -69,6 +70,9 @@ struct wdc_data {
 
 	int		int_assert;
 
+	/*  A disk transfer is in progress (asynchronous disk I/O):  */
+	int		busy;
+
 	int		write_in_progress;
 	int		write_count;
 	int64_t		write_offset;
@@ -140,6 +144,34 @@ static void wdc_addtoinbuf(struct wdc_data *d, int c)
 }
 
 
+/*
+ *  wdc_addbuftoinbuf():
+ *
+ *  Write len bytes from buf into the controller's input buffer, using at
+ *  most two memcpy() calls.
+ */
+static void wdc_addbuftoinbuf(struct wdc_data *d, unsigned char *buf,
+	size_t len)
+{
+	size_t chunk;
+
+	if (len >= WDC_INBUF_SIZE) {
+		fatal("[ wdc_addbuftoinbuf(): WARNING! wdc inbuf overrun!"
+		    " Increase WDC_MAX_SECTORS. ]\n");
+		len = WDC_INBUF_SIZE - 1;
+	}
+
+	chunk = WDC_INBUF_SIZE - d->inbuf_head;
+	if (chunk > len)
+		chunk = len;
+
+	memcpy(d->inbuf + d->inbuf_head, buf, chunk);
+	memcpy(d->inbuf, buf + chunk, len - chunk);
+
+	d->inbuf_head = (d->inbuf_head + len) % WDC_INBUF_SIZE;
+}
+
+
 /*
  *  wdc_get_inbuf():
  *
@@ -260,15 +292,36 @@ static void wdc_initialize_identify_struct(struct cpu *cpu, struct wdc_data *d)
 }
 
 
+/*
+ *  wdc_read_done():
+ *
+ *  Called when the disk transfer started by wdc__read() has completed.
+ *  The data is moved into the inbuf, and an interrupt is raised. If the
+ *  read failed, no data is returned, and the error bit is set instead.
+ */
+static void wdc_read_done(struct diskimage_request *req)
+{
+	struct wdc_data *d = (struct wdc_data *) req->extra;
+
+	if (req->result)
+		wdc_addbuftoinbuf(d, req->buf, req->len);
+	else
+		d->error |= WDCE_UNC;
+
+	free(req->buf);
+
+	d->busy = 0;
+	d->int_assert = 1;
+}
+
+
 /*
  *  wdc__read():
  */
 void wdc__read(struct cpu *cpu, struct wdc_data *d)
 {
-#define MAX_SECTORS_PER_CHUNK	64
-	const int max_sectors_per_chunk = MAX_SECTORS_PER_CHUNK;
-	unsigned char buf[512 * MAX_SECTORS_PER_CHUNK];
-	int i, cyl = d->cyl_hi * 256+ d->cyl_lo;
+	unsigned char *buf;
+	int cyl = d->cyl_hi * 256+ d->cyl_lo;
 	int count = d->seccnt? d->seccnt : 256;
 	uint64_t offset = 512 * (d->sector - 1
 	    + (int64_t)d->head * d->sectors_per_track[d->drive] +
@@ -282,30 +335,30 @@ void wdc__read(struct cpu *cpu, struct wdc_data *d)
 	printf("WDC read from offset %lli\n", (long long)offset);
 #endif
 
-	while (count > 0) {
-		int to_read = count > max_sectors_per_chunk?
-		    max_sectors_per_chunk : count;
+	CHECK_ALLOCATION(buf = (unsigned char *) malloc(512 * count));
 
-		/*  TODO: result code from the read?  */
+	d->busy = 1;
+	diskimage_access_async(cpu->machine, d->drive + d->base_drive,
+	    DISKIMAGE_IDE, 0, offset, buf, 512 * count, wdc_read_done, d);
+}
 
-		if (d->inbuf_head + 512 * to_read <= WDC_INBUF_SIZE) {
-			diskimage_access(cpu->machine, d->drive + d->base_drive,
-			    DISKIMAGE_IDE, 0, offset,
-			    d->inbuf + d->inbuf_head, 512 * to_read);
-			d->inbuf_head += 512 * to_read;
-			if (d->inbuf_head == WDC_INBUF_SIZE)
-				d->inbuf_head = 0;
-		} else {
-			diskimage_access(cpu->machine, d->drive + d->base_drive,
-			    DISKIMAGE_IDE, 0, offset, buf, 512 * to_read);
-			for (i=0; i<512 * to_read; i++)
-				wdc_addtoinbuf(d, buf[i]);
-		}
 
-		offset += 512 * to_read;
-		count -= to_read;
-	}
+/*
+ *  wdc_write_done():
+ *
+ *  Called when a disk transfer started by a write to the data register has
+ *  completed. A failed write is reported as an aborted command.
+ */
+static void wdc_write_done(struct diskimage_request *req)
+{
+	struct wdc_data *d = (struct wdc_data *) req->extra;
 
+	if (!req->result)
+		d->error |= WDCE_ABRT;
+
+	free(req->buf);
+
+	d->busy = 0;
 	d->int_assert = 1;
 }
 
@@ -345,6 +398,11 @@ void wdc__write(struct cpu *cpu, struct wdc_data *d)
 static int status_byte(struct wdc_data *d, struct cpu *cpu)
 {
 	int odata = 0;
+
+	/*  All other bits are invalid while the drive is busy:  */
+	if (d->busy)
+		return WDCS_BSY;
+
 	if (diskimage_exist(cpu->machine, d->drive + d->base_drive,
 	    DISKIMAGE_IDE))
 		odata |= WDCS_DRDY | WDCS_DSC;
@@ -483,6 +541,13 @@ void wdc_command(struct cpu *cpu, struct wdc_data *d, int idata)
 		d->int_assert = 1;
 		break;
 
+	case WDCC_FLUSHCACHE:
+		debug("[ wdc: FLUSHCACHE drive %i ]\n", d->drive);
+		diskimage_flush(diskimage_find(cpu->machine,
+		    d->drive + d->base_drive, DISKIMAGE_IDE));
+		d->int_assert = 1;
+		break;
+
 	case WDCC_IDLE_IMMED:
 		debug("[ wdc: IDLE_IMMED drive %i ]\n", d->drive);
 		/*  TODO: interrupt here?  */
@@ -715,8 +780,8 @@ DEVICE_ACCESS(wdc)
 					if (d->atapi_st->data_in != NULL) {
 						d->atapi_phase = PHASE_DATAIN;
 						d->atapi_len = d->atapi_st->data_in_len;
-						for (int j=0; j<d->atapi_len; j++)
-							wdc_addtoinbuf(d, d->atapi_st->data_in[j]);
+						wdc_addbuftoinbuf(d, d->atapi_st->
+						    data_in, d->atapi_len);
 
 						if (d->atapi_len > 32768)
 							d->atapi_len = 32768;
@@ -740,13 +805,14 @@ DEVICE_ACCESS(wdc)
 			    inbuf_len % 512 == 0) ) {
 				int count = (d->write_in_progress ==
 				    WDCC_WRITEMULTI)? d->write_count : 1;
-				unsigned char *buf, *b;
+				unsigned char *buf;
+				int64_t offset = d->write_offset;
 
 				CHECK_ALLOCATION(buf = (unsigned char *) malloc(512 * count));
-				b = buf;
 
 				if (d->inbuf_tail+512*count <= WDC_INBUF_SIZE) {
-					b = d->inbuf + d->inbuf_tail;
+					memcpy(buf, d->inbuf + d->inbuf_tail,
+					    512 * count);
 					d->inbuf_tail = (d->inbuf_tail + 512
 					    * count) % WDC_INBUF_SIZE;
 				} else {
@@ -754,19 +820,17 @@ DEVICE_ACCESS(wdc)
 						buf[i] = wdc_get_inbuf(d);
 				}
 
-				diskimage_access(cpu->machine,
-				    d->drive + d->base_drive, DISKIMAGE_IDE, 1,
-				    d->write_offset, b, 512 * count);
-
 				d->write_count -= count;
 				d->write_offset += 512 * count;
 
-				d->int_assert = 1;
-
 				if (d->write_count == 0)
 					d->write_in_progress = 0;
 
-				free(buf);
+				/*  wdc_write_done() frees buf:  */
+				d->busy = 1;
+				diskimage_access_async(cpu->machine,
+				    d->drive + d->base_drive, DISKIMAGE_IDE, 1,
+				    offset, buf, 512 * count, wdc_write_done, d);
 			}
 		}
 		break;
@@ -903,6 +967,65 @@ ret:
 }
 
 
+/*
+ *  wdc_checkpoint():
+ *
+ *  Outstanding disk transfers have completed before a checkpoint is saved,
+ *  so only the part of the inbuf which is in use needs to be saved. (The
+ *  disk geometries are read from the disk images at startup.)
+ */
+static void wdc_checkpoint(struct checkpoint *ckpt, void *extra)
+{
+	struct wdc_data *d = (struct wdc_data *) extra;
+	int len;
+
+	CHECKPOINT_VAR(ckpt, d->io_enabled);
+	CHECKPOINT_VAR(ckpt, d->int_assert);
+	CHECKPOINT_VAR(ckpt, d->busy);
+	CHECKPOINT_VAR(ckpt, d->write_in_progress);
+	CHECKPOINT_VAR(ckpt, d->write_count);
+	CHECKPOINT_VAR(ckpt, d->write_offset);
+
+	CHECKPOINT_VAR(ckpt, d->error);
+	CHECKPOINT_VAR(ckpt, d->precomp);
+	CHECKPOINT_VAR(ckpt, d->seccnt);
+	CHECKPOINT_VAR(ckpt, d->sector);
+	CHECKPOINT_VAR(ckpt, d->cyl_lo);
+	CHECKPOINT_VAR(ckpt, d->cyl_hi);
+	CHECKPOINT_VAR(ckpt, d->sectorsize);
+	CHECKPOINT_VAR(ckpt, d->lba);
+	CHECKPOINT_VAR(ckpt, d->drive);
+	CHECKPOINT_VAR(ckpt, d->head);
+	CHECKPOINT_VAR(ckpt, d->cur_command);
+
+	CHECKPOINT_VAR(ckpt, d->atapi_cmd_in_progress);
+	CHECKPOINT_VAR(ckpt, d->atapi_phase);
+	scsi_transfer_checkpoint(ckpt, &d->atapi_st);
+	CHECKPOINT_VAR(ckpt, d->atapi_len);
+	CHECKPOINT_VAR(ckpt, d->atapi_received);
+
+	checkpoint_data(ckpt, d->identify_struct, sizeof(d->identify_struct));
+
+	CHECKPOINT_VAR(ckpt, d->inbuf_head);
+	CHECKPOINT_VAR(ckpt, d->inbuf_tail);
+	if (d->inbuf_head < 0 || d->inbuf_head >= WDC_INBUF_SIZE ||
+	    d->inbuf_tail < 0 || d->inbuf_tail >= WDC_INBUF_SIZE ||
+	    d->drive < 0 || d->drive > 1 || d->busy) {
+		checkpoint_error(ckpt, "bad wdc state");
+		return;
+	}
+
+	if (d->inbuf_tail <= d->inbuf_head) {
+		checkpoint_data(ckpt, d->inbuf + d->inbuf_tail,
+		    d->inbuf_head - d->inbuf_tail);
+	} else {
+		len = WDC_INBUF_SIZE - d->inbuf_tail;
+		checkpoint_data(ckpt, d->inbuf + d->inbuf_tail, len);
+		checkpoint_data(ckpt, d->inbuf, d->inbuf_head);
+	}
+}
+
+
 DEVINIT(wdc)
 {
 	struct wdc_data *d;
@@ -955,6 +1078,8 @@ DEVINIT(wdc)
 	memory_device_register(devinit->machine->memory, devinit->name,
 	    devinit->addr, DEV_WDC_LENGTH * devinit->addr_mult, dev_wdc_access,
 	    d, DM_DEFAULT, NULL);
+	memory_device_set_checkpoint(devinit->machine->memory, d,
+	    wdc_checkpoint);
 
 	machine_add_tickfunction(devinit->machine, dev_wdc_tick,
 	    d, tick_shift);
@@ -32,6 +32,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "checkpoint.h"
 #include "console.h"
 #include "devices.h"
 #include "machine.h"
@@ -390,6 +391,30 @@ void lk201_tx_data(struct lk201_data *d, int port, int idata)
 }
 
 
+/*
+ *  lk201_checkpoint():
+ *
+ *  Saves or restores the keyboard and mouse state. (Called by the serial
+ *  controller which the lk201 is connected to.)
+ */
+void lk201_checkpoint(struct checkpoint *ckpt, struct lk201_data *d)
+{
+	CHECKPOINT_ARRAY(ckpt, d->keyb_buf, sizeof(d->keyb_buf));
+	CHECKPOINT_VAR(ckpt, d->keyb_buf_pos);
+	CHECKPOINT_VAR(ckpt, d->mouse_mode);
+	CHECKPOINT_VAR(ckpt, d->mouse_revision);
+	CHECKPOINT_VAR(ckpt, d->mouse_x);
+	CHECKPOINT_VAR(ckpt, d->mouse_y);
+	CHECKPOINT_VAR(ckpt, d->mouse_buttons);
+
+	if (ckpt->restoring && (d->keyb_buf_pos < 0 ||
+	    d->keyb_buf_pos > (int) sizeof(d->keyb_buf))) {
+		checkpoint_error(ckpt, "bad lk201 keyboard buffer position");
+		d->keyb_buf_pos = 0;
+	}
+}
+
+
 /*
  *  lk201_init():
  *
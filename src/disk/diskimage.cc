@@ -34,13 +34,17 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "diskimage.h"
 #include "machine.h"
+#include "memory.h"
 #include "misc.h"
 
 
@@ -94,6 +98,46 @@ static int my_fseek(FILE *f, off_t offset, int whence)
 }
 
 
+/*
+ *  diskimage_pread(), diskimage_pwrite():
+ *
+ *  Like pread() and pwrite(), but retry on EINTR and on short transfers.
+ *  Returns the number of bytes transferred, which is less than len only
+ *  at end of file or on error.
+ */
+ssize_t diskimage_pread(int fd, unsigned char *buf, size_t len, off_t offset)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t res = pread(fd, buf + done, len - done, offset + done);
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (res <= 0)
+			break;
+		done += res;
+	}
+
+	return done;
+}
+
+ssize_t diskimage_pwrite(int fd, unsigned char *buf, size_t len, off_t offset)
+{
+	size_t done = 0;
+
+	while (done < len) {
+		ssize_t res = pwrite(fd, buf + done, len - done, offset + done);
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (res <= 0)
+			break;
+		done += res;
+	}
+
+	return done;
+}
+
+
 /**************************************************************************/
 
 
@@ -116,35 +160,72 @@ int diskimage_exist(struct machine *machine, int id, int type)
 }
 
 
+/*
+ *  diskimage_find():
+ *
+ *  Returns a pointer to the specified disk image, or NULL if it does not
+ *  exist.
+ */
+struct diskimage *diskimage_find(struct machine *machine, int id, int type)
+{
+	struct diskimage *d = machine->first_diskimage;
+
+	while (d != NULL) {
+		if (d->type == type && d->id == id)
+			break;
+		d = d->next;
+	}
+
+	return d;
+}
+
+
 /*
  *  diskimage_add_overlay():
  *
  *  Opens an overlay data file and its corresponding bitmap file, and adds
- *  the overlay to a disk image.
+ *  the overlay to a disk image. The bitmap is read into memory; changes to
+ *  it are written back to the bitmap file as they are made.
  */
 void diskimage_add_overlay(struct diskimage *d, char *overlay_basename)
 {
 	struct diskimage_overlay overlay;
 	size_t bitmap_name_len = strlen(overlay_basename) + 20;
 	char *bitmap_name;
+	struct stat st;
 
 	CHECK_ALLOCATION(bitmap_name = (char *) malloc(bitmap_name_len));
 	snprintf(bitmap_name, bitmap_name_len, "%s.map", overlay_basename);
 
 	CHECK_ALLOCATION(overlay.overlay_basename = strdup(overlay_basename));
-	overlay.f_data = fopen(overlay_basename, d->writable? "r+" : "r");
-	if (overlay.f_data == NULL) {
+	overlay.fd_data = open(overlay_basename, d->writable? O_RDWR : O_RDONLY);
+	if (overlay.fd_data < 0) {
 		perror(overlay_basename);
 		exit(1);
 	}
 
-	overlay.f_bitmap = fopen(bitmap_name, d->writable? "r+" : "r");
-	if (overlay.f_bitmap == NULL) {
+	overlay.fd_bitmap = open(bitmap_name, d->writable? O_RDWR : O_RDONLY);
+	if (overlay.fd_bitmap < 0) {
 		perror(bitmap_name);
 		fprintf(stderr, "Please create the map file first.\n");
 		exit(1);
 	}
 
+	if (fstat(overlay.fd_bitmap, &st) != 0) {
+		perror(bitmap_name);
+		exit(1);
+	}
+
+	overlay.bitmap_len = st.st_size;
+	CHECK_ALLOCATION(overlay.bitmap = (unsigned char *)
+	    malloc(overlay.bitmap_len + 1));
+	if (diskimage_pread(overlay.fd_bitmap, overlay.bitmap,
+	    overlay.bitmap_len, 0) != (ssize_t) overlay.bitmap_len) {
+		perror(bitmap_name);
+		fprintf(stderr, "Could not read the map file.\n");
+		exit(1);
+	}
+
 	d->nr_of_overlays ++;
 
 	CHECK_ALLOCATION(d->overlays = (struct diskimage_overlay *) realloc(d->overlays,
@@ -167,6 +248,7 @@ void diskimage_recalc_size(struct diskimage *d)
 	struct stat st;
 	int res;
 	off_t size = 0;
+	int64_t gxd_size;
 
 	res = stat(d->fname, &st);
 	if (res) {
@@ -177,6 +259,11 @@ void diskimage_recalc_size(struct diskimage *d)
 
 	size = st.st_size;
 
+	/*  GXD images contain a virtual disk of a different size:  */
+	gxd_size = diskimage_gxd_probe(d->fname);
+	if (gxd_size >= 0)
+		size = gxd_size;
+
 	/*
 	 *  TODO:  CD-ROM devices, such as /dev/cd0c, how can one
 	 *  check how much data is on that cd-rom without reading it?
@@ -334,71 +421,75 @@ static size_t diskimage_access__cdrom(struct diskimage *d, off_t offset,
 }
 
 
-/*  Helper function.  */
-static void overlay_set_block_in_use(struct diskimage *d,
-	int overlay_nr, off_t ofs)
+/*
+ *  overlay_has_block():
+ *
+ *  Returns non-zero if block block_nr is present in an overlay.
+ */
+static inline int overlay_has_block(struct diskimage_overlay *o, off_t block_nr)
 {
-	off_t bit_nr = ofs / OVERLAY_BLOCK_SIZE;
-	off_t bitmap_file_offset = bit_nr / 8;
-	int res;
-	unsigned char data;
+	if ((size_t)(block_nr / 8) >= o->bitmap_len)
+		return 0;
 
-	res = my_fseek(d->overlays[overlay_nr].f_bitmap,
-	    bitmap_file_offset, SEEK_SET);
-	if (res) {
-		perror("my_fseek");
-		fprintf(stderr, "Could not seek in bitmap file?"
-		    " offset = %lli, read\n", (long long)bitmap_file_offset);
-		exit(1);
-	}
+	return o->bitmap[block_nr / 8] & (1 << (block_nr & 7));
+}
 
-	/*  Read the original bitmap data, and OR in the new bit:  */
-	res = fread(&data, 1, 1, d->overlays[overlay_nr].f_bitmap);
-	if (res != 1)
-		data = 0x00;
 
-	data |= (1 << (bit_nr & 7));
+/*
+ *  overlay_block_layer():
+ *
+ *  Returns the number of the last overlay which has block block_nr, or -1
+ *  if the block should be read from the base disk image.
+ */
+static int overlay_block_layer(struct diskimage *d, off_t block_nr)
+{
+	int overlay_nr;
 
-	/*  Write it back:  */
-	res = my_fseek(d->overlays[overlay_nr].f_bitmap,
-	    bitmap_file_offset, SEEK_SET);
-	if (res) {
-		perror("my_fseek");
-		fprintf(stderr, "Could not seek in bitmap file?"
-		    " offset = %lli, write\n", (long long)bitmap_file_offset);
-		exit(1);
-	}
-	res = fwrite(&data, 1, 1, d->overlays[overlay_nr].f_bitmap);
-	if (res != 1) {
-		fprintf(stderr, "Could not write to bitmap file. Aborting.\n");
-		exit(1);
-	}
+	for (overlay_nr = d->nr_of_overlays-1; overlay_nr >= 0; overlay_nr --)
+		if (overlay_has_block(&d->overlays[overlay_nr], block_nr))
+			break;
+
+	return overlay_nr;
 }
 
 
-/*  Helper function.  */
-static int overlay_has_block(struct diskimage *d, int overlay_nr, off_t ofs)
+/*
+ *  overlay_set_blocks_in_use():
+ *
+ *  Marks n_blocks blocks, starting at first_block, as present in an overlay,
+ *  and writes the changed part of the bitmap back to the bitmap file.
+ */
+static void overlay_set_blocks_in_use(struct diskimage *d,
+	struct diskimage_overlay *o, off_t first_block, off_t n_blocks)
 {
-	off_t bit_nr = ofs / OVERLAY_BLOCK_SIZE;
-	off_t bitmap_file_offset = bit_nr / 8;
-	int res;
-	unsigned char data;
+	size_t first_byte = first_block / 8;
+	size_t last_byte = (first_block + n_blocks - 1) / 8;
+	off_t block_nr;
+
+	if (last_byte >= o->bitmap_len) {
+		CHECK_ALLOCATION(o->bitmap = (unsigned char *)
+		    realloc(o->bitmap, last_byte + 1));
+		memset(o->bitmap + o->bitmap_len, 0,
+		    last_byte + 1 - o->bitmap_len);
+		o->bitmap_len = last_byte + 1;
+	}
 
-	res = my_fseek(d->overlays[overlay_nr].f_bitmap,
-	    bitmap_file_offset, SEEK_SET);
-	if (res != 0)
-		return 0;
+	for (block_nr = first_block; block_nr < first_block + n_blocks;
+	    block_nr ++)
+		o->bitmap[block_nr / 8] |= (1 << (block_nr & 7));
 
-	/*  The seek succeeded, now read the bit:  */
-	res = fread(&data, 1, 1, d->overlays[overlay_nr].f_bitmap);
-	if (res != 1)
-		return 0;
+	if (diskimage_pwrite(o->fd_bitmap, o->bitmap + first_byte,
+	    last_byte + 1 - first_byte, first_byte) !=
+	    (ssize_t) (last_byte + 1 - first_byte)) {
+		fprintf(stderr, "Could not write to bitmap file for disk id"
+		    " %i. Aborting.\n", d->id);
+		exit(1);
+	}
+}
 
-	if (data & (1 << (bit_nr & 7)))
-		return 1;
 
-	return 0;
-}
+static size_t fread_helper(off_t offset, unsigned char *buf,
+	size_t len, struct diskimage *d);
 
 
 /*
@@ -406,15 +497,31 @@ static int overlay_has_block(struct diskimage *d, int overlay_nr, off_t ofs)
  *
  *  Internal helper function. Writes to a disk image file, or if the
  *  disk image has overlays, to the last overlay.
+ *
+ *  Overlays are written in whole OVERLAY_BLOCK_SIZE blocks. If the write
+ *  does not start or end on a block boundary, the rest of the first and
+ *  last blocks is first read from the disk image (or from the overlays).
  */
 static size_t fwrite_helper(off_t offset, unsigned char *buf,
 	size_t len, struct diskimage *d)
 {
-	off_t curofs;
+	struct diskimage_overlay *o;
+	off_t first_block, end_block, aligned_offset;
+	size_t aligned_len, lenwritten;
+	unsigned char *tmpbuf = NULL;
 
 	/*  Fast return-path for the case when no overlays are used:  */
 	if (d->nr_of_overlays == 0) {
-		int res = my_fseek(d->f, offset, SEEK_SET);
+		int res;
+
+		if (d->gxd != NULL)
+			return diskimage_gxd_write(d->gxd, offset, buf, len);
+
+		/*  Tapes are accessed sequentially, using stdio:  */
+		if (!d->is_a_tape)
+			return diskimage_pwrite(fileno(d->f), buf, len, offset);
+
+		res = my_fseek(d->f, offset, SEEK_SET);
 		if (res != 0) {
 			fatal("[ diskimage__internal_access(): fseek() failed"
 			    " on disk id %i \n", d->id);
@@ -424,40 +531,44 @@ static size_t fwrite_helper(off_t offset, unsigned char *buf,
 		return fwrite(buf, 1, len, d->f);
 	}
 
-	if ((len & (OVERLAY_BLOCK_SIZE-1)) != 0) {
-		fatal("TODO: overlay access (write), len not multiple of "
-		    "overlay block size. not yet implemented.\n");
-		fatal("len = %lli\n", (long long) len);
-		abort();
-	}
-	if ((offset & (OVERLAY_BLOCK_SIZE-1)) != 0) {
-		fatal("TODO: unaligned overlay access\n");
-		fatal("offset = %lli\n", (long long) offset);
-		abort();
+	/*  Always write to the last overlay:  */
+	o = &d->overlays[d->nr_of_overlays - 1];
+
+	first_block = offset / OVERLAY_BLOCK_SIZE;
+	end_block = (offset + len + OVERLAY_BLOCK_SIZE - 1) / OVERLAY_BLOCK_SIZE;
+	aligned_offset = first_block * OVERLAY_BLOCK_SIZE;
+	aligned_len = (end_block - first_block) * OVERLAY_BLOCK_SIZE;
+
+	if (aligned_offset != offset || aligned_len != len) {
+		/*  Read-modify-write of the partial first and last blocks:  */
+		CHECK_ALLOCATION(tmpbuf = (unsigned char *) malloc(aligned_len));
+		memset(tmpbuf, 0, aligned_len);
+
+		if (aligned_offset != offset)
+			fread_helper(aligned_offset, tmpbuf,
+			    OVERLAY_BLOCK_SIZE, d);
+		if ((off_t)(offset + len) != (off_t)(aligned_offset +
+		    aligned_len))
+			fread_helper(aligned_offset + aligned_len -
+			    OVERLAY_BLOCK_SIZE, tmpbuf + aligned_len -
+			    OVERLAY_BLOCK_SIZE, OVERLAY_BLOCK_SIZE, d);
+
+		memcpy(tmpbuf + (offset - aligned_offset), buf, len);
 	}
 
-	/*  Split the write into OVERLAY_BLOCK_SIZE writes:  */
-	for (curofs = offset; curofs < (off_t) (offset+len);
-	     curofs += OVERLAY_BLOCK_SIZE) {
-		/*  Always write to the last overlay:  */
-		int overlay_nr = d->nr_of_overlays-1;
-		off_t lenwritten;
-		int res = my_fseek(d->overlays[overlay_nr].f_data,
-		    curofs, SEEK_SET);
-		if (res != 0) {
-			fatal("[ diskimage__internal_access(): fseek()"
-			    " failed on disk id %i \n", d->id);
-			return 0;
-		}
+	lenwritten = diskimage_pwrite(o->fd_data, tmpbuf != NULL? tmpbuf : buf,
+	    aligned_len, aligned_offset);
+	free(tmpbuf);
 
-		lenwritten = fwrite(buf, 1, OVERLAY_BLOCK_SIZE,
-		    d->overlays[overlay_nr].f_data);
-		buf += OVERLAY_BLOCK_SIZE;
-
-		/*  Mark this block in the last overlay as in use:  */
-		overlay_set_block_in_use(d, overlay_nr, curofs);
+	if (lenwritten != aligned_len) {
+		fatal("[ diskimage__internal_access(): write to overlay"
+		    " failed on disk id %i ]\n", d->id);
+		return 0;
 	}
 
+	/*  Mark the blocks in the last overlay as in use:  */
+	overlay_set_blocks_in_use(d, o, first_block, end_block - first_block);
+
 	return len;
 }
 
@@ -468,16 +579,28 @@ static size_t fwrite_helper(off_t offset, unsigned char *buf,
  *  Internal helper function. Reads from a disk image file, or if the
  *  disk image has overlays, from the last overlay that has the specific
  *  data (or the disk image file itself).
+ *
+ *  Runs of consecutive blocks which come from the same overlay (or from the
+ *  base image) are read using a single pread().
  */
 static size_t fread_helper(off_t offset, unsigned char *buf,
 	size_t len, struct diskimage *d)
 {
-	off_t curofs;
+	off_t curofs, endofs = offset + len;
 	size_t totallenread = 0;
 
 	/*  Fast return-path for the case when no overlays are used:  */
 	if (d->nr_of_overlays == 0) {
-		int res = my_fseek(d->f, offset, SEEK_SET);
+		int res;
+
+		if (d->gxd != NULL)
+			return diskimage_gxd_read(d->gxd, offset, buf, len);
+
+		/*  Tapes are accessed sequentially, using stdio:  */
+		if (!d->is_a_tape)
+			return diskimage_pread(fileno(d->f), buf, len, offset);
+
+		res = my_fseek(d->f, offset, SEEK_SET);
 		if (res != 0) {
 			fatal("[ diskimage__internal_access(): fseek() failed"
 			    " on disk id %i \n", d->id);
@@ -487,56 +610,68 @@ static size_t fread_helper(off_t offset, unsigned char *buf,
 		return fread(buf, 1, len, d->f);
 	}
 
-	/*  Split the read into OVERLAY_BLOCK_SIZE reads:  */
-	for (curofs=offset; len != 0;
-	    curofs = (curofs | (OVERLAY_BLOCK_SIZE-1)) + 1) {
-		/*  Find the overlay, if any, that has this block:  */
-		off_t lenread, lentoread;
-		int overlay_nr;
-		for (overlay_nr = d->nr_of_overlays-1;
-		    overlay_nr >= 0; overlay_nr --) {
-			if (overlay_has_block(d, overlay_nr, curofs))
-				break;
-		}
-
-		lentoread = len > OVERLAY_BLOCK_SIZE? OVERLAY_BLOCK_SIZE : len;
-
-		if (overlay_nr >= 0) {
-			/*  Read from overlay:  */
-			int res = my_fseek(d->overlays[overlay_nr].f_data,
-			    curofs, SEEK_SET);
-			if (res != 0) {
-				fatal("[ diskimage__internal_access(): fseek()"
-				    " failed on disk id %i \n", d->id);
-				return 0;
-			}
-			lenread = fread(buf, 1, lentoread,
-			    d->overlays[overlay_nr].f_data);
-		} else {
-			/*  Read from the base disk image:  */
-			int res = my_fseek(d->f, curofs, SEEK_SET);
-			if (res != 0) {
-				fatal("[ diskimage__internal_access(): fseek()"
-				    " failed on disk id %i \n", d->id);
-				return 0;
-			}
-			lenread = fread(buf, 1, lentoread, d->f);
-		}
-
+	for (curofs = offset; curofs < endofs; ) {
+		off_t block_nr = curofs / OVERLAY_BLOCK_SIZE, runend;
+		int overlay_nr = overlay_block_layer(d, block_nr);
+		size_t lenread, lentoread;
+		int fd;
+
+		/*  Extend the run while the blocks come from the same place:  */
+		runend = (block_nr + 1) * OVERLAY_BLOCK_SIZE;
+		while (runend < endofs && overlay_block_layer(d,
+		    runend / OVERLAY_BLOCK_SIZE) == overlay_nr)
+			runend += OVERLAY_BLOCK_SIZE;
+		if (runend > endofs)
+			runend = endofs;
+
+		lentoread = runend - curofs;
+		fd = overlay_nr >= 0? d->overlays[overlay_nr].fd_data
+		    : fileno(d->f);
+
+		if (overlay_nr < 0 && d->gxd != NULL)
+			lenread = diskimage_gxd_read(d->gxd, curofs, buf,
+			    lentoread);
+		else
+			lenread = diskimage_pread(fd, buf, lentoread, curofs);
 		if (lenread != lentoread) {
 			fatal("[ INCOMPLETE READ from disk id %i, offset"
 			    " %lli ]\n", d->id, (long long)curofs);
+			memset(buf + lenread, 0, lentoread - lenread);
 		}
 
-		len -= lentoread;
 		totallenread += lenread;
-		buf += OVERLAY_BLOCK_SIZE;
+		buf += lentoread;
+		curofs = runend;
 	}
 
 	return totallenread;
 }
 
 
+/*
+ *  diskimage__raw_access():
+ *
+ *  Reads from or writes to a disk image file (or its overlays), without
+ *  going through the block cache. Returns the number of bytes transferred.
+ */
+size_t diskimage__raw_access(struct diskimage *d, int writeflag,
+	off_t offset, unsigned char *buf, size_t len)
+{
+	if (writeflag)
+		return fwrite_helper(offset, buf, len, d);
+
+	/*
+	 *  Special case for CD-ROMs. Actually, this is not needed
+	 *  for .iso images, only for physical CDROMS on some OSes,
+	 *  such as FreeBSD.
+	 */
+	if (d->is_a_cdrom && d->gxd == NULL)
+		return diskimage_access__cdrom(d, offset, buf, len);
+
+	return fread_helper(offset, buf, len, d);
+}
+
+
 /*
  *  diskimage__internal_access():
  *
@@ -558,26 +693,34 @@ int diskimage__internal_access(struct diskimage *d, int writeflag,
 	if (d->f == NULL)
 		return 0;
 
+	/*  Disks with asynchronous I/O may be accessed by I/O threads:  */
+	if (d->async)
+		pthread_mutex_lock(&d->lock);
+
 	if (writeflag) {
-		if (!d->writable)
+		if (!d->writable) {
+			if (d->async)
+				pthread_mutex_unlock(&d->lock);
 			return 0;
+		}
 
-		lendone = fwrite_helper(offset, buf, len, d);
+		if (d->cache != NULL)
+			lendone = diskimage_cache_write(d, offset, buf, len);
+		else
+			lendone = diskimage__raw_access(d, 1, offset, buf, len);
 	} else {
-		/*
-		 *  Special case for CD-ROMs. Actually, this is not needed
-		 *  for .iso images, only for physical CDROMS on some OSes,
-		 *  such as FreeBSD.
-		 */
-		if (d->is_a_cdrom)
-			lendone = diskimage_access__cdrom(d, offset, buf, len);
+		if (d->cache != NULL)
+			lendone = diskimage_cache_read(d, offset, buf, len);
 		else
-			lendone = fread_helper(offset, buf, len, d);
+			lendone = diskimage__raw_access(d, 0, offset, buf, len);
 
 		if (lendone < (ssize_t)len)
 			memset(buf + lendone, 0, len - lendone);
 	}
 
+	if (d->async)
+		pthread_mutex_unlock(&d->lock);
+
 	/*  Incomplete data transfer? Then return failure:  */
 	if (lendone != (ssize_t)len) {
 #ifdef UNSTABLE_DEVEL
@@ -595,6 +738,231 @@ int diskimage__internal_access(struct diskimage *d, int writeflag,
 }
 
 
+/*
+ *  diskimage__internal_access_dma():
+ *
+ *  Read from or write to a struct diskimage, with the data going directly
+ *  to or from emulated physical memory at paddr. The range is mapped using
+ *  memory_dma_map(), so that the disk image layer can read straight into
+ *  the host pages backing the emulated RAM, without an intermediate buffer.
+ *  If the range cannot be mapped, a temporary buffer is used instead.
+ *
+ *  Returns 1 if the access completed successfully, 0 otherwise.
+ */
+int diskimage__internal_access_dma(struct cpu *cpu, struct diskimage *d,
+	int writeflag, off_t offset, uint64_t paddr, size_t len)
+{
+	struct memory_dma_seg segs[MEMORY_DMA_MAX_SEGS];
+	unsigned char *buf;
+	int i, n, res = 1;
+
+	if (len == 0)
+		return 1;
+
+	n = memory_dma_map(cpu->mem, paddr, len, writeflag? MEM_READ :
+	    MEM_WRITE, segs, MEMORY_DMA_MAX_SEGS);
+
+	if (n >= 0) {
+		for (i=0; i<n; i++) {
+			if (!diskimage__internal_access(d, writeflag, offset,
+			    segs[i].host, segs[i].len))
+				res = 0;
+			offset += segs[i].len;
+		}
+
+		if (!writeflag)
+			memory_dma_written(cpu, paddr, len);
+
+		return res;
+	}
+
+	CHECK_ALLOCATION(buf = (unsigned char *) malloc(len));
+
+	if (writeflag)
+		memory_dma_copy(cpu, paddr, buf, len, MEM_READ);
+
+	res = diskimage__internal_access(d, writeflag, offset, buf, len);
+
+	if (!writeflag)
+		memory_dma_copy(cpu, paddr, buf, len, MEM_WRITE);
+
+	free(buf);
+	return res;
+}
+
+
+/*
+ *  diskimage_flush():
+ *
+ *  Writes any changes which are only in the block cache to the disk image
+ *  file, and asks the host to write the file to stable storage. Used when
+ *  the guest flushes the disk's write cache.
+ */
+void diskimage_flush(struct diskimage *d)
+{
+	if (d->f == NULL)
+		return;
+
+	if (d->async)
+		pthread_mutex_lock(&d->lock);
+
+	diskimage_cache_flush(d);
+	fflush(d->f);
+	fsync(fileno(d->f));
+
+	if (d->async)
+		pthread_mutex_unlock(&d->lock);
+}
+
+
+/*
+ *  diskimage_checkpoint():
+ *
+ *  Saves or restores the state of a disk image. For writable disk images,
+ *  the blocks of the last overlay (the one which writes go to) are part of
+ *  the checkpoint; on restore, the overlay and its bitmap file are changed
+ *  back to what they were when the checkpoint was saved. The base image and
+ *  any other overlays are assumed to be unchanged.
+ *
+ *  Writable disk images without overlays are written to directly, so their
+ *  contents cannot be part of the checkpoint. A warning is printed for such
+ *  disks.
+ */
+void diskimage_checkpoint(struct diskimage *d, struct checkpoint *ckpt)
+{
+	const size_t max_run = 128;
+	struct diskimage_overlay *o = NULL;
+	unsigned char *bitmap = NULL, *buf;
+	uint64_t bitmap_len = 0, block_nr, n_blocks, run;
+	int64_t total_size = d->total_size;
+	int id = d->id, type = d->type, has_overlay_data;
+
+	has_overlay_data = d->writable && d->nr_of_overlays > 0;
+
+	if (d->async)
+		pthread_mutex_lock(&d->lock);
+
+	/*  Write-back cached blocks must be in the overlay file:  */
+	diskimage_cache_flush(d);
+
+	CHECKPOINT_VAR(ckpt, id);
+	CHECKPOINT_VAR(ckpt, type);
+	CHECKPOINT_VAR(ckpt, total_size);
+	CHECKPOINT_VAR(ckpt, has_overlay_data);
+
+	if (ckpt->restoring && (id != d->id || type != d->type ||
+	    total_size != d->total_size || has_overlay_data !=
+	    (d->writable && d->nr_of_overlays > 0))) {
+		checkpoint_error(ckpt, "disk id %i (%s) does not match the"
+		    " disk in the checkpoint", d->id, d->fname);
+		goto done;
+	}
+
+	CHECKPOINT_VAR(ckpt, d->override_base_offset);
+	CHECKPOINT_VAR(ckpt, d->tape_offset);
+	CHECKPOINT_VAR(ckpt, d->tape_filenr);
+	CHECKPOINT_VAR(ckpt, d->filemark);
+
+	if (!has_overlay_data) {
+		if (d->writable && !ckpt->restoring)
+			fatal("[ checkpoint: WARNING! disk id %i is writable,"
+			    " but has no overlay. Its contents are not part of"
+			    " the checkpoint. ]\n", d->id);
+		goto done;
+	}
+
+	o = &d->overlays[d->nr_of_overlays - 1];
+
+	if (!ckpt->restoring) {
+		bitmap = o->bitmap;
+		bitmap_len = o->bitmap_len;
+	}
+
+	CHECKPOINT_VAR(ckpt, bitmap_len);
+
+	if (ckpt->restoring) {
+		if (bitmap_len > (uint64_t) total_size / OVERLAY_BLOCK_SIZE
+		    / 8 + 1) {
+			checkpoint_error(ckpt, "bad overlay bitmap length for"
+			    " disk id %i", d->id);
+			goto done;
+		}
+
+		CHECK_ALLOCATION(bitmap = (unsigned char *)
+		    malloc(bitmap_len + 1));
+	}
+
+	checkpoint_data(ckpt, bitmap, bitmap_len);
+
+	/*  The data of all blocks in use, one run of blocks at a time:  */
+	CHECK_ALLOCATION(buf = (unsigned char *)
+	    malloc(max_run * OVERLAY_BLOCK_SIZE));
+
+	n_blocks = bitmap_len * 8;
+	for (block_nr = 0; block_nr < n_blocks && !ckpt->failed; ) {
+		off_t ofs = block_nr * OVERLAY_BLOCK_SIZE;
+		size_t len;
+
+		if (!(bitmap[block_nr / 8] & (1 << (block_nr & 7)))) {
+			block_nr ++;
+			continue;
+		}
+
+		for (run = 1; run < max_run && block_nr + run < n_blocks &&
+		    bitmap[(block_nr + run) / 8] &
+		    (1 << ((block_nr + run) & 7)); run ++)
+			;
+
+		len = run * OVERLAY_BLOCK_SIZE;
+
+		if (!ckpt->restoring) {
+			ssize_t lenread = diskimage_pread(o->fd_data, buf,
+			    len, ofs);
+
+			/*  (The overlay file may end in a partial block.)  */
+			if (lenread < 0)
+				lenread = 0;
+			memset(buf + lenread, 0, len - lenread);
+		}
+
+		checkpoint_data(ckpt, buf, len);
+
+		if (ckpt->restoring && !ckpt->failed &&
+		    diskimage_pwrite(o->fd_data, buf, len, ofs) !=
+		    (ssize_t) len)
+			checkpoint_error(ckpt, "could not write to the overlay"
+			    " of disk id %i", d->id);
+
+		block_nr += run;
+	}
+
+	free(buf);
+
+	if (ckpt->restoring) {
+		if (!ckpt->failed) {
+			/*  Blocks which were not in use when the checkpoint
+			    was saved are read from the layers below again:  */
+			free(o->bitmap);
+			o->bitmap = bitmap;
+			o->bitmap_len = bitmap_len;
+
+			if (diskimage_pwrite(o->fd_bitmap, o->bitmap,
+			    o->bitmap_len, 0) != (ssize_t) o->bitmap_len ||
+			    ftruncate(o->fd_bitmap, o->bitmap_len) != 0)
+				checkpoint_error(ckpt, "could not write the"
+				    " overlay bitmap of disk id %i", d->id);
+		} else
+			free(bitmap);
+
+		diskimage_cache_invalidate(d);
+	}
+
+done:
+	if (d->async)
+		pthread_mutex_unlock(&d->lock);
+}
+
+
 /*
  *  diskimage_access():
  *
@@ -605,13 +973,7 @@ int diskimage__internal_access(struct diskimage *d, int writeflag,
 int diskimage_access(struct machine *machine, int id, int type, int writeflag,
 	off_t offset, unsigned char *buf, size_t len)
 {
-	struct diskimage *d = machine->first_diskimage;
-
-	while (d != NULL) {
-		if (d->type == type && d->id == id)
-			break;
-		d = d->next;
-	}
+	struct diskimage *d = diskimage_find(machine, id, type);
 
 	if (d == NULL) {
 		fatal("[ diskimage_access(): ERROR: trying to access a "
@@ -632,6 +994,42 @@ int diskimage_access(struct machine *machine, int id, int type, int writeflag,
 }
 
 
+/*
+ *  diskimage_access_dma():
+ *
+ *  Like diskimage_access(), but the data is transfered directly to or from
+ *  emulated physical memory at paddr. Used by DMA capable controllers.
+ *
+ *  Returns 1 if the access completed successfully, 0 otherwise.
+ */
+int diskimage_access_dma(struct cpu *cpu, int id, int type, int writeflag,
+	off_t offset, uint64_t paddr, size_t len)
+{
+	struct diskimage *d = diskimage_find(cpu->machine, id, type);
+
+	if (d == NULL) {
+		fatal("[ diskimage_access_dma(): ERROR: trying to access a "
+		    "non-existant %s disk image (id %i)\n",
+		    diskimage_types[type], id);
+		return 0;
+	}
+
+	offset -= d->override_base_offset;
+	if (offset < 0 && offset + d->override_base_offset >= 0) {
+		unsigned char *zeroes;
+
+		debug("[ reading before start of disk image ]\n");
+		CHECK_ALLOCATION(zeroes = (unsigned char *) calloc(1, len));
+		memory_dma_copy(cpu, paddr, zeroes, len, MEM_WRITE);
+		free(zeroes);
+		return 1;
+	}
+
+	return diskimage__internal_access_dma(cpu, d, writeflag, offset,
+	    paddr, len);
+}
+
+
 /*
  *  diskimage_add():
  *
@@ -639,8 +1037,11 @@ int diskimage_access(struct machine *machine, int id, int type, int writeflag,
  *  The filename may be prefixed with one or more modifiers, followed
  *  by a colon.
  *
+ *	a	asynchronous I/O (controllers which support it are
+ *		notified when a transfer has completed)
  *	b	specifies that this is a bootable device
  *	c	CD-ROM (instead of a normal DISK)
+ *	CKB;	set the size of the block cache, in KB (0 = no cache)
  *	d	DISK (this is the default)
  *	f	FLOPPY (instead of SCSI)
  *	gH;S;	set geometry (H=heads, S=sectors per track, cylinders are
@@ -651,6 +1052,7 @@ int diskimage_access(struct machine *machine, int id, int type, int writeflag,
  *	s	SCSI (this is the default)
  *	t	tape
  *	V	add an overlay to a disk image
+ *	W	write-back block cache (instead of write-through)
  *	0-7	force a specific SCSI ID number
  *
  *  machine is assumed to be non-NULL.
@@ -664,7 +1066,8 @@ int diskimage_add(struct machine *machine, char *fname)
 	char *cp;
 	int prefix_b=0, prefix_c=0, prefix_d=0, prefix_f=0, prefix_g=0;
 	int prefix_i=0, prefix_r=0, prefix_s=0, prefix_t=0, prefix_id=-1;
-	int prefix_o=0, prefix_V=0;
+	int prefix_o=0, prefix_V=0, prefix_a=0, prefix_W=0;
+	int cache_kb = DISKIMAGE_CACHE_DEFAULT_KB;
 
 	if (fname == NULL) {
 		fprintf(stderr, "diskimage_add(): NULL ptr\n");
@@ -687,12 +1090,27 @@ int diskimage_add(struct machine *machine, char *fname)
 			case '7':
 				prefix_id = c - '0';
 				break;
+			case 'a':
+				prefix_a = 1;
+				break;
 			case 'b':
 				prefix_b = 1;
 				break;
 			case 'c':
 				prefix_c = 1;
 				break;
+			case 'C':
+				cache_kb = atoi(fname);
+				while (*fname != '\0' && *fname != ':'
+				    && *fname != ';')
+					fname ++;
+				if (*fname == ';')
+					fname ++;
+				if (cache_kb < 0) {
+					fatal("Bad cache size: %i\n", cache_kb);
+					exit(1);
+				}
+				break;
 			case 'd':
 				prefix_d = 1;
 				break;
@@ -749,6 +1167,9 @@ int diskimage_add(struct machine *machine, char *fname)
 			case 'V':
 				prefix_V = 1;
 				break;
+			case 'W':
+				prefix_W = 1;
+				break;
 			case ':':
 				break;
 			default:
@@ -909,6 +1330,11 @@ int diskimage_add(struct machine *machine, char *fname)
 	if (prefix_b)
 		d->is_boot_device = 1;
 
+	if (prefix_a) {
+		d->async = 1;
+		pthread_mutex_init(&d->lock, NULL);
+	}
+
 	d->writable = access(fname, W_OK) == 0? 1 : 0;
 
 	if (d->is_a_cdrom || prefix_r) {
@@ -929,6 +1355,12 @@ int diskimage_add(struct machine *machine, char *fname)
 		exit(1);
 	}
 
+	d->gxd = diskimage_gxd_open(fname, d->writable);
+
+	/*  Tapes are read sequentially, and depend on the file position.  */
+	if (cache_kb > 0 && !d->is_a_tape)
+		diskimage_cache_init(d, cache_kb, prefix_W);
+
 	/*  Calculate which ID to use:  */
 	if (prefix_id == -1) {
 		int free = 0, collision = 1;
@@ -1124,6 +1556,8 @@ void diskimage_dump_info(struct machine *machine)
 			debug(" (%lli sectors)", (long long)
 			   (d->total_size / 512));
 
+		if (d->gxd != NULL)
+			debug(" (GXD)");
 		if (d->is_boot_device)
 			debug(" (BOOT)");
 		debug("\n");
@@ -1133,6 +1567,9 @@ void diskimage_dump_info(struct machine *machine)
 			    i, d->overlays[i].overlay_basename);
 		}
 
+		if (d->cache != NULL)
+			diskimage_cache_dump_info(d);
+
 		debug_indentation(-iadd);
 
 		d = d->next;
@@ -0,0 +1,296 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright  
+ *     notice, this list of conditions and the following disclaimer in the 
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE   
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *  Asynchronous disk image I/O.
+ *
+ *  Disk images added with the 'a' prefix are accessed by a pool of I/O
+ *  threads, so that the emulation does not stall while the host reads from
+ *  a slow disk. A controller calls diskimage_access_async() with a callback,
+ *  and the callback is called on the main thread, between quanta, when the
+ *  transfer has completed. The controller should then raise its interrupt.
+ *
+ *  Requests to the same disk image are completed in the order they were
+ *  made. For disk images without the 'a' prefix, the access is done right
+ *  away and the callback is called before diskimage_access_async() returns,
+ *  which keeps runs deterministic.
+ */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "diskimage.h"
+#include "machine.h"
+#include "misc.h"
+
+
+static pthread_mutex_t async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t async_done_cond = PTHREAD_COND_INITIALIZER;
+
+static int async_started = 0;
+static int async_n_in_flight = 0;	/*  queued or being served  */
+
+/*  Queued requests, and completed requests waiting for their callbacks:  */
+static struct diskimage_request *async_queue = NULL, *async_queue_last = NULL;
+static struct diskimage_request *async_done = NULL, *async_done_last = NULL;
+
+
+/*
+ *  diskimage_async_next_request():
+ *
+ *  Removes and returns the first queued request for a disk image which is
+ *  not already being accessed by another I/O thread, or NULL if there is
+ *  no such request. async_lock must be held.
+ */
+static struct diskimage_request *diskimage_async_next_request(void)
+{
+	struct diskimage_request *req = async_queue, *prev = NULL;
+
+	while (req != NULL && req->d->async_busy) {
+		prev = req;
+		req = req->next;
+	}
+
+	if (req == NULL)
+		return NULL;
+
+	if (prev == NULL)
+		async_queue = req->next;
+	else
+		prev->next = req->next;
+	if (async_queue_last == req)
+		async_queue_last = prev;
+
+	req->next = NULL;
+	return req;
+}
+
+
+/*
+ *  diskimage_async_thread():
+ *
+ *  I/O thread main loop.
+ */
+static void *diskimage_async_thread(void *arg)
+{
+	sigset_t sigs;
+
+	/*  Signals (CTRL-C) are handled by the main thread:  */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGCONT);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	pthread_mutex_lock(&async_lock);
+
+	for (;;) {
+		struct diskimage_request *req = diskimage_async_next_request();
+
+		if (req == NULL) {
+			pthread_cond_wait(&async_work_cond, &async_lock);
+			continue;
+		}
+
+		req->d->async_busy = 1;
+		pthread_mutex_unlock(&async_lock);
+
+		req->result = diskimage__internal_access(req->d,
+		    req->writeflag, req->offset, req->buf, req->len);
+
+		pthread_mutex_lock(&async_lock);
+		req->d->async_busy = 0;
+
+		if (async_done_last == NULL)
+			async_done = req;
+		else
+			async_done_last->next = req;
+		async_done_last = req;
+
+		/*  Other threads may be waiting for this disk to be free:  */
+		pthread_cond_broadcast(&async_work_cond);
+		pthread_cond_broadcast(&async_done_cond);
+	}
+
+	return NULL;
+}
+
+
+/*
+ *  diskimage_async_start():
+ *
+ *  Starts the I/O threads.
+ */
+static void diskimage_async_start(void)
+{
+	int i;
+
+	for (i=0; i<DISKIMAGE_ASYNC_THREADS; i++) {
+		pthread_t thread;
+
+		if (pthread_create(&thread, NULL, diskimage_async_thread,
+		    NULL) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+
+		pthread_detach(thread);
+	}
+
+	async_started = 1;
+}
+
+
+/*
+ *  diskimage_access_async():
+ *
+ *  Starts a read from or write to a disk image. callback is called (with a
+ *  request struct containing the other arguments, and the result) when the
+ *  transfer has completed. buf must not be used by the caller until then.
+ *
+ *  For disk images without the 'a' prefix, the transfer is performed
+ *  synchronously, and the callback is called before this function returns.
+ *
+ *  Returns 1 if the request was started or completed successfully, 0 on
+ *  failure. (If 0 is returned, the callback has still been called.)
+ */
+int diskimage_access_async(struct machine *machine, int id, int type,
+	int writeflag, off_t offset, unsigned char *buf, size_t len,
+	void (*callback)(struct diskimage_request *), void *extra)
+{
+	struct diskimage *d = diskimage_find(machine, id, type);
+	struct diskimage_request *req;
+
+	CHECK_ALLOCATION(req = (struct diskimage_request *)
+	    malloc(sizeof(struct diskimage_request)));
+	memset(req, 0, sizeof(struct diskimage_request));
+
+	req->d = d;
+	req->writeflag = writeflag;
+	req->offset = offset;
+	req->buf = buf;
+	req->len = len;
+	req->callback = callback;
+	req->extra = extra;
+
+	/*
+	 *  The synchronous path: Also used for reads before the start of
+	 *  the disk image, which diskimage_access() handles specially.
+	 */
+	if (d == NULL || !d->async || offset < d->override_base_offset) {
+		int result = diskimage_access(machine, id, type, writeflag,
+		    offset, buf, len);
+
+		req->result = result;
+		callback(req);
+		free(req);
+		return result;
+	}
+
+	req->offset -= d->override_base_offset;
+
+	pthread_mutex_lock(&async_lock);
+
+	if (!async_started)
+		diskimage_async_start();
+
+	if (async_queue_last == NULL)
+		async_queue = req;
+	else
+		async_queue_last->next = req;
+	async_queue_last = req;
+	async_n_in_flight ++;
+
+	pthread_cond_signal(&async_work_cond);
+	pthread_mutex_unlock(&async_lock);
+
+	return 1;
+}
+
+
+/*
+ *  diskimage_async_poll():
+ *
+ *  Calls the callbacks of all completed requests. This is called from the
+ *  main loop between quanta.
+ */
+void diskimage_async_poll(void)
+{
+	struct diskimage_request *req;
+
+	if (!async_started)
+		return;
+
+	pthread_mutex_lock(&async_lock);
+	req = async_done;
+	async_done = async_done_last = NULL;
+	pthread_mutex_unlock(&async_lock);
+
+	while (req != NULL) {
+		struct diskimage_request *next = req->next;
+
+		req->callback(req);
+
+		pthread_mutex_lock(&async_lock);
+		async_n_in_flight --;
+		pthread_mutex_unlock(&async_lock);
+
+		free(req);
+		req = next;
+	}
+}
+
+
+/*
+ *  diskimage_async_drain():
+ *
+ *  Waits for all outstanding requests to complete, and calls their
+ *  callbacks. (Used before the emulator exits, so that no writes are lost.)
+ */
+void diskimage_async_drain(void)
+{
+	if (!async_started)
+		return;
+
+	for (;;) {
+		pthread_mutex_lock(&async_lock);
+		while (async_n_in_flight > 0 && async_done == NULL)
+			pthread_cond_wait(&async_done_cond, &async_lock);
+		pthread_mutex_unlock(&async_lock);
+
+		diskimage_async_poll();
+
+		pthread_mutex_lock(&async_lock);
+		if (async_n_in_flight == 0) {
+			pthread_mutex_unlock(&async_lock);
+			break;
+		}
+		pthread_mutex_unlock(&async_lock);
+	}
+}
+
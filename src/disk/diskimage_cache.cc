@@ -0,0 +1,677 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright  
+ *     notice, this list of conditions and the following disclaimer in the 
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE   
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *  Disk image block cache.
+ *
+ *  Each disk image (except tapes) has a cache of DISKIMAGE_CACHE_BLOCK_SIZE
+ *  byte blocks in front of the disk image file, so that the many small
+ *  reads which guest filesystems do are not each turned into separate host
+ *  system calls. The cache size is set with the C disk image prefix (C0;
+ *  turns the cache off).
+ *
+ *  When a disk is read sequentially, blocks after the requested data are
+ *  read ahead in the same host read. The read-ahead window doubles for each
+ *  sequential access, up to DISKIMAGE_CACHE_MAX_READAHEAD blocks.
+ *
+ *  Writes are written through to the file by default. With the W prefix,
+ *  the cache is write-back: changed blocks are only written when they are
+ *  evicted, when the guest flushes the disk's cache (SCSI SYNCHRONIZE CACHE
+ *  or IDE FLUSH CACHE), and when the emulator exits.
+ *
+ *  Accesses which do not fit within the disk, or which are larger than half
+ *  the cache, bypass the cache.
+ *
+ *  All functions here expect the caller to hold d->lock, if the disk image
+ *  uses asynchronous I/O.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "diskimage.h"
+#include "misc.h"
+
+
+#define	BLOCK_SIZE	DISKIMAGE_CACHE_BLOCK_SIZE
+
+struct diskimage_cache_block {
+	off_t		block_nr;	/*  -1 if the block is unused  */
+	int		dirty;
+
+	/*  Indices into the blocks array, or -1:  */
+	int		hash_next;
+	int		lru_prev;
+	int		lru_next;
+
+	unsigned char	*data;
+};
+
+struct diskimage_cache {
+	struct diskimage_cache *next;	/*  all caches, for flushing  */
+	struct diskimage *d;
+
+	int		n_blocks;
+	int		max_run;	/*  in blocks  */
+	int		write_back;
+
+	struct diskimage_cache_block *blocks;
+	int		*hash;
+	int		hash_mask;
+
+	/*  Most recently used block first:  */
+	int		lru_first;
+	int		lru_last;
+
+	/*  Sequential stream detection:  */
+	off_t		seq_next_offset;
+	int		readahead;	/*  current window, in blocks  */
+
+	/*  Used for multi-block host reads and writes:  */
+	unsigned char	*run_buf;
+
+	/*  Statistics:  */
+	uint64_t	n_hits;
+	uint64_t	n_misses;
+	uint64_t	n_readahead;
+	uint64_t	n_writebacks;
+};
+
+
+static struct diskimage_cache *first_cache = NULL;
+
+
+/*
+ *  cache_lookup():
+ *
+ *  Returns the index of the block caching block_nr, or -1 if it is not
+ *  in the cache.
+ */
+static int cache_lookup(struct diskimage_cache *c, off_t block_nr)
+{
+	int i = c->hash[block_nr & c->hash_mask];
+
+	while (i >= 0 && c->blocks[i].block_nr != block_nr)
+		i = c->blocks[i].hash_next;
+
+	return i;
+}
+
+
+static void lru_unlink(struct diskimage_cache *c, int i)
+{
+	struct diskimage_cache_block *b = &c->blocks[i];
+
+	if (b->lru_prev >= 0)
+		c->blocks[b->lru_prev].lru_next = b->lru_next;
+	else
+		c->lru_first = b->lru_next;
+
+	if (b->lru_next >= 0)
+		c->blocks[b->lru_next].lru_prev = b->lru_prev;
+	else
+		c->lru_last = b->lru_prev;
+}
+
+
+/*
+ *  cache_touch():
+ *
+ *  Moves a block to the front of the LRU list.
+ */
+static void cache_touch(struct diskimage_cache *c, int i)
+{
+	if (c->lru_first == i)
+		return;
+
+	lru_unlink(c, i);
+
+	c->blocks[i].lru_prev = -1;
+	c->blocks[i].lru_next = c->lru_first;
+	c->blocks[c->lru_first].lru_prev = i;
+	c->lru_first = i;
+}
+
+
+/*
+ *  block_len():
+ *
+ *  Returns the number of bytes of a block which are within the disk. (Only
+ *  the last block of a disk may be partial.)
+ */
+static size_t block_len(struct diskimage_cache *c, off_t block_nr)
+{
+	off_t left = c->d->total_size - block_nr * BLOCK_SIZE;
+
+	return left < BLOCK_SIZE? left : BLOCK_SIZE;
+}
+
+
+/*
+ *  cache_write_block():
+ *
+ *  Writes a dirty block to the disk image file.
+ */
+static void cache_write_block(struct diskimage_cache *c, int i)
+{
+	struct diskimage_cache_block *b = &c->blocks[i];
+	size_t len = block_len(c, b->block_nr);
+
+	if (diskimage__raw_access(c->d, 1, b->block_nr * BLOCK_SIZE,
+	    b->data, len) != len)
+		fatal("[ diskimage cache: write-back failed on disk id %i,"
+		    " offset %lli ]\n", c->d->id,
+		    (long long) (b->block_nr * BLOCK_SIZE));
+
+	b->dirty = 0;
+	c->n_writebacks ++;
+}
+
+
+/*
+ *  cache_alloc():
+ *
+ *  Takes the least recently used block (writing it back first, if it is
+ *  dirty) and makes it hold block_nr. The caller fills in the data.
+ */
+static int cache_alloc(struct diskimage_cache *c, off_t block_nr)
+{
+	int i = c->lru_last;
+	struct diskimage_cache_block *b = &c->blocks[i];
+
+	if (b->block_nr >= 0) {
+		int *p = &c->hash[b->block_nr & c->hash_mask];
+
+		if (b->dirty)
+			cache_write_block(c, i);
+
+		while (*p != i)
+			p = &c->blocks[*p].hash_next;
+		*p = b->hash_next;
+	}
+
+	b->block_nr = block_nr;
+	b->dirty = 0;
+	b->hash_next = c->hash[block_nr & c->hash_mask];
+	c->hash[block_nr & c->hash_mask] = i;
+
+	cache_touch(c, i);
+	return i;
+}
+
+
+/*
+ *  cache_fill():
+ *
+ *  Reads n_blocks blocks, starting at first_block, with a single host read,
+ *  and adds them to the cache. Returns 1 on success, 0 if the read failed.
+ */
+static int cache_fill(struct diskimage_cache *c, off_t first_block,
+	int n_blocks)
+{
+	size_t len = (n_blocks - 1) * BLOCK_SIZE +
+	    block_len(c, first_block + n_blocks - 1);
+	int i;
+
+	if (diskimage__raw_access(c->d, 0, first_block * BLOCK_SIZE,
+	    c->run_buf, len) != len)
+		return 0;
+
+	memset(c->run_buf + len, 0, n_blocks * BLOCK_SIZE - len);
+
+	for (i = 0; i < n_blocks; i++) {
+		int j = cache_alloc(c, first_block + i);
+		memcpy(c->blocks[j].data, c->run_buf + i * BLOCK_SIZE,
+		    BLOCK_SIZE);
+	}
+
+	return 1;
+}
+
+
+/*
+ *  cache_update():
+ *
+ *  Copies data which has been written directly to the disk image file into
+ *  any cached blocks that it overlaps.
+ */
+static void cache_update(struct diskimage_cache *c, off_t offset,
+	unsigned char *buf, size_t len)
+{
+	off_t block_nr, first = offset / BLOCK_SIZE;
+	off_t last = (offset + len - 1) / BLOCK_SIZE;
+
+	for (block_nr = first; block_nr <= last; block_nr ++) {
+		int i = cache_lookup(c, block_nr);
+		off_t start = block_nr * BLOCK_SIZE, end = start + BLOCK_SIZE;
+
+		if (i < 0)
+			continue;
+
+		if (start < offset)
+			start = offset;
+		if (end > (off_t) (offset + len))
+			end = offset + len;
+
+		memcpy(c->blocks[i].data + (start - block_nr * BLOCK_SIZE),
+		    buf + (start - offset), end - start);
+	}
+}
+
+
+/*
+ *  cache_flush_range():
+ *
+ *  Writes back the dirty blocks which overlap an access that bypasses the
+ *  cache.
+ */
+static void cache_flush_range(struct diskimage_cache *c, off_t offset,
+	size_t len)
+{
+	off_t block_nr, first = offset / BLOCK_SIZE;
+	off_t last = (offset + len - 1) / BLOCK_SIZE;
+
+	for (block_nr = first; block_nr <= last; block_nr ++) {
+		int i = cache_lookup(c, block_nr);
+		if (i >= 0 && c->blocks[i].dirty)
+			cache_write_block(c, i);
+	}
+}
+
+
+/*
+ *  cache_bypass():
+ *
+ *  Returns non-zero if an access should not go through the cache.
+ */
+static int cache_bypass(struct diskimage_cache *c, off_t offset, size_t len)
+{
+	return offset < 0 || (off_t) (offset + len) > c->d->total_size ||
+	    len > (size_t) c->max_run * BLOCK_SIZE - BLOCK_SIZE;
+}
+
+
+/*
+ *  diskimage_cache_read():
+ *
+ *  Reads from a disk image through its cache. Returns the number of bytes
+ *  read.
+ */
+size_t diskimage_cache_read(struct diskimage *d, off_t offset,
+	unsigned char *buf, size_t len)
+{
+	struct diskimage_cache *c = d->cache;
+	off_t block_nr, last_block, missed_end = 0;
+	size_t done = 0;
+
+	if (cache_bypass(c, offset, len)) {
+		cache_flush_range(c, offset, len);
+		return diskimage__raw_access(d, 0, offset, buf, len);
+	}
+
+	/*  Sequential stream? Then double the read-ahead window:  */
+	if (offset == c->seq_next_offset) {
+		c->readahead = c->readahead == 0? 2 : c->readahead * 2;
+		if (c->readahead > DISKIMAGE_CACHE_MAX_READAHEAD)
+			c->readahead = DISKIMAGE_CACHE_MAX_READAHEAD;
+	} else
+		c->readahead = 0;
+	c->seq_next_offset = offset + len;
+
+	block_nr = offset / BLOCK_SIZE;
+	last_block = (offset + len - 1) / BLOCK_SIZE;
+
+	while (block_nr <= last_block) {
+		int i = cache_lookup(c, block_nr);
+		off_t run_end;
+		size_t ofs, chunk;
+
+		if (i >= 0 && block_nr >= missed_end)
+			c->n_hits ++;
+
+		if (i < 0) {
+			/*  Read all consecutive missing blocks at once:  */
+			run_end = block_nr + 1;
+			while (run_end <= last_block &&
+			    cache_lookup(c, run_end) < 0)
+				run_end ++;
+			missed_end = run_end;
+
+			if (run_end > last_block) {
+				off_t n_disk_blocks = (d->total_size +
+				    BLOCK_SIZE - 1) / BLOCK_SIZE;
+				while (run_end < missed_end + c->readahead &&
+				    run_end < n_disk_blocks &&
+				    run_end - block_nr < c->max_run &&
+				    cache_lookup(c, run_end) < 0)
+					run_end ++;
+			}
+
+			if (!cache_fill(c, block_nr, run_end - block_nr)) {
+				cache_flush_range(c, offset, len);
+				return diskimage__raw_access(d, 0, offset,
+				    buf, len);
+			}
+
+			c->n_misses += missed_end - block_nr;
+			c->n_readahead += run_end - missed_end;
+
+			i = cache_lookup(c, block_nr);
+		}
+
+		ofs = (offset + done) - block_nr * BLOCK_SIZE;
+		chunk = BLOCK_SIZE - ofs;
+		if (chunk > len - done)
+			chunk = len - done;
+
+		memcpy(buf + done, c->blocks[i].data + ofs, chunk);
+		cache_touch(c, i);
+
+		done += chunk;
+		block_nr ++;
+	}
+
+	return done;
+}
+
+
+/*
+ *  diskimage_cache_write():
+ *
+ *  Writes to a disk image through its cache. With a write-through cache,
+ *  the data is written to the file right away, and cached blocks are
+ *  updated. With a write-back cache, only the cached blocks are changed.
+ *
+ *  Returns the number of bytes written.
+ */
+size_t diskimage_cache_write(struct diskimage *d, off_t offset,
+	unsigned char *buf, size_t len)
+{
+	struct diskimage_cache *c = d->cache;
+	off_t block_nr, last_block;
+	size_t done = 0, res;
+
+	if (!c->write_back || cache_bypass(c, offset, len)) {
+		res = diskimage__raw_access(d, 1, offset, buf, len);
+		cache_update(c, offset, buf, len);
+		return res;
+	}
+
+	block_nr = offset / BLOCK_SIZE;
+	last_block = (offset + len - 1) / BLOCK_SIZE;
+
+	for (; block_nr <= last_block; block_nr ++) {
+		int i = cache_lookup(c, block_nr);
+		size_t ofs = (offset + done) - block_nr * BLOCK_SIZE;
+		size_t chunk = BLOCK_SIZE - ofs;
+
+		if (chunk > len - done)
+			chunk = len - done;
+
+		if (i < 0) {
+			/*  Partial blocks must be read first:  */
+			if (chunk < block_len(c, block_nr)) {
+				if (!cache_fill(c, block_nr, 1)) {
+					res = diskimage__raw_access(d, 1,
+					    offset + done, buf + done,
+					    len - done);
+					return done + res;
+				}
+				c->n_misses ++;
+				i = cache_lookup(c, block_nr);
+			} else {
+				i = cache_alloc(c, block_nr);
+				memset(c->blocks[i].data, 0, BLOCK_SIZE);
+			}
+		}
+
+		memcpy(c->blocks[i].data + ofs, buf + done, chunk);
+		c->blocks[i].dirty = 1;
+		cache_touch(c, i);
+
+		done += chunk;
+	}
+
+	return done;
+}
+
+
+static int cmp_block_nr(const void *a, const void *b)
+{
+	off_t x = (*(struct diskimage_cache_block **) a)->block_nr;
+	off_t y = (*(struct diskimage_cache_block **) b)->block_nr;
+
+	return x < y? -1 : (x > y? 1 : 0);
+}
+
+
+/*
+ *  diskimage_cache_flush():
+ *
+ *  Writes all dirty blocks of a disk image's cache to the file. Runs of
+ *  consecutive blocks are written with a single host write.
+ */
+void diskimage_cache_flush(struct diskimage *d)
+{
+	struct diskimage_cache *c = d->cache;
+	struct diskimage_cache_block **dirty;
+	int i, n = 0;
+
+	if (c == NULL || !c->write_back)
+		return;
+
+	CHECK_ALLOCATION(dirty = (struct diskimage_cache_block **)
+	    malloc(sizeof(struct diskimage_cache_block *) * c->n_blocks));
+
+	for (i = 0; i < c->n_blocks; i++)
+		if (c->blocks[i].dirty)
+			dirty[n++] = &c->blocks[i];
+
+	qsort(dirty, n, sizeof(struct diskimage_cache_block *), cmp_block_nr);
+
+	for (i = 0; i < n; ) {
+		off_t first = dirty[i]->block_nr;
+		size_t len;
+		int j = 0;
+
+		while (i + j < n && j < c->max_run &&
+		    dirty[i + j]->block_nr == first + j) {
+			memcpy(c->run_buf + j * BLOCK_SIZE, dirty[i + j]->data,
+			    BLOCK_SIZE);
+			dirty[i + j]->dirty = 0;
+			j ++;
+		}
+
+		len = (j - 1) * BLOCK_SIZE + block_len(c, first + j - 1);
+		if (diskimage__raw_access(d, 1, first * BLOCK_SIZE,
+		    c->run_buf, len) != len)
+			fatal("[ diskimage cache: write-back failed on disk id"
+			    " %i, offset %lli ]\n", d->id,
+			    (long long) (first * BLOCK_SIZE));
+
+		c->n_writebacks += j;
+		i += j;
+	}
+
+	free(dirty);
+}
+
+
+/*
+ *  diskimage_cache_invalidate():
+ *
+ *  Flushes a disk image's cache, and then forgets all cached blocks. Used
+ *  when the disk image file (or its overlay) has been changed behind the
+ *  cache's back, e.g. when restoring a checkpoint.
+ */
+void diskimage_cache_invalidate(struct diskimage *d)
+{
+	struct diskimage_cache *c = d->cache;
+	int i;
+
+	if (c == NULL)
+		return;
+
+	diskimage_cache_flush(d);
+
+	for (i = 0; i <= c->hash_mask; i++)
+		c->hash[i] = -1;
+
+	for (i = 0; i < c->n_blocks; i++) {
+		struct diskimage_cache_block *b = &c->blocks[i];
+
+		b->block_nr = -1;
+		b->dirty = 0;
+		b->hash_next = -1;
+		b->lru_prev = i - 1;
+		b->lru_next = i + 1 < c->n_blocks? i + 1 : -1;
+	}
+
+	c->lru_first = 0;
+	c->lru_last = c->n_blocks - 1;
+	c->seq_next_offset = -1;
+	c->readahead = 0;
+}
+
+
+/*
+ *  diskimage_cache_flush_all():
+ *
+ *  Flushes the caches of all disk images. Called when the emulator exits.
+ */
+void diskimage_cache_flush_all(void)
+{
+	struct diskimage_cache *c;
+
+	for (c = first_cache; c != NULL; c = c->next) {
+		if (!c->write_back)
+			continue;
+
+		/*  (If exit() was called while a disk was being accessed,
+		    then its cache cannot be flushed safely.)  */
+		if (c->d->async && pthread_mutex_trylock(&c->d->lock) != 0) {
+			fprintf(stderr, "[ diskimage cache: disk id %i is busy;"
+			    " not flushed ]\n", c->d->id);
+			continue;
+		}
+
+		diskimage_cache_flush(c->d);
+
+		if (c->d->async)
+			pthread_mutex_unlock(&c->d->lock);
+	}
+}
+
+
+/*
+ *  diskimage_cache_dump_info():
+ *
+ *  Prints the cache configuration and hit rate of a disk image.
+ */
+void diskimage_cache_dump_info(struct diskimage *d)
+{
+	struct diskimage_cache *c = d->cache;
+	uint64_t n_reads = c->n_hits + c->n_misses;
+
+	debug("cache: %i KB, %s", c->n_blocks * BLOCK_SIZE / 1024,
+	    c->write_back? "write-back" : "write-through");
+
+	if (n_reads > 0)
+		debug(", %.1f%% hits (%lli of %lli blocks)",
+		    100.0 * c->n_hits / n_reads, (long long) c->n_hits,
+		    (long long) n_reads);
+	if (c->n_readahead > 0)
+		debug(", %lli blocks read ahead", (long long) c->n_readahead);
+	if (c->n_writebacks > 0)
+		debug(", %lli blocks written back", (long long)
+		    c->n_writebacks);
+
+	debug("\n");
+}
+
+
+/*
+ *  diskimage_cache_init():
+ *
+ *  Adds a cache of size_kb KB to a disk image. A write-back cache is only
+ *  used if the disk image is writable.
+ */
+void diskimage_cache_init(struct diskimage *d, int size_kb, int write_back)
+{
+	struct diskimage_cache *c;
+	int i, hash_size = 1;
+
+	CHECK_ALLOCATION(c = (struct diskimage_cache *) malloc(sizeof(*c)));
+	memset(c, 0, sizeof(*c));
+
+	c->d = d;
+	c->n_blocks = size_kb * 1024 / BLOCK_SIZE;
+	if (c->n_blocks < 4)
+		c->n_blocks = 4;
+	c->max_run = c->n_blocks / 2;
+	c->write_back = write_back && d->writable;
+	c->seq_next_offset = -1;
+
+	while (hash_size < c->n_blocks)
+		hash_size <<= 1;
+	c->hash_mask = hash_size - 1;
+
+	CHECK_ALLOCATION(c->hash = (int *) malloc(sizeof(int) * hash_size));
+	for (i = 0; i < hash_size; i++)
+		c->hash[i] = -1;
+
+	CHECK_ALLOCATION(c->blocks = (struct diskimage_cache_block *)
+	    malloc(sizeof(struct diskimage_cache_block) * c->n_blocks));
+	CHECK_ALLOCATION(c->blocks[0].data = (unsigned char *)
+	    malloc((size_t) c->n_blocks * BLOCK_SIZE));
+	CHECK_ALLOCATION(c->run_buf = (unsigned char *)
+	    malloc((size_t) c->max_run * BLOCK_SIZE));
+
+	for (i = 0; i < c->n_blocks; i++) {
+		struct diskimage_cache_block *b = &c->blocks[i];
+
+		b->data = c->blocks[0].data + (size_t) i * BLOCK_SIZE;
+		b->block_nr = -1;
+		b->dirty = 0;
+		b->hash_next = -1;
+		b->lru_prev = i - 1;
+		b->lru_next = i + 1 < c->n_blocks? i + 1 : -1;
+	}
+
+	c->lru_first = 0;
+	c->lru_last = c->n_blocks - 1;
+
+	if (first_cache == NULL)
+		atexit(diskimage_cache_flush_all);
+
+	c->next = first_cache;
+	first_cache = c;
+
+	d->cache = c;
+}
+
@@ -0,0 +1,542 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright  
+ *     notice, this list of conditions and the following disclaimer in the 
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE   
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *  GXD disk images: sparse, copy-on-write and compressed.
+ *
+ *  The file format is described in diskimage_gxd.h. A GXD image is used
+ *  instead of a raw file whenever the disk image file starts with the GXD
+ *  magic, so all controllers (which go through diskimage__internal_access())
+ *  can use them. Images are created from raw images and overlays using
+ *  experiments/gxdconvert.
+ *
+ *  Clusters which are not allocated in an image are read from its backing
+ *  file, which may be a raw image or another GXD image (which may in turn
+ *  have a backing file). Backing files are only ever opened read-only;
+ *  writes always end up in the top image, as whole uncompressed clusters.
+ *
+ *  Compressed clusters use the LZ4 block encoding: each sequence is a
+ *  token byte (literal length in the high nibble, match length minus 4 in
+ *  the low nibble; 15 means that more length bytes follow, each adding up
+ *  to 255), the literals, and a 16-bit little endian match offset. The last
+ *  sequence has literals only.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "diskimage.h"
+#include "diskimage_gxd.h"
+#include "lz4_block.h"
+#include "misc.h"
+
+
+/*  Protects against backing file loops:  */
+#define	GXD_MAX_CHAIN_LENGTH	64
+static int gxd_chain_length = 0;
+
+
+struct diskimage_gxd {
+	char		*fname;
+	int		fd;
+	int		writable;
+
+	int		cluster_bits;
+	size_t		cluster_size;
+	int		l2_bits;
+	uint64_t	size;
+
+	/*  The L1 table is always in memory, L2 tables are loaded
+	    on demand and then kept:  */
+	uint64_t	l1_offset;
+	uint32_t	l1_entries;
+	uint64_t	*l1;
+	unsigned char	**l2;
+
+	/*  New clusters and L2 tables are appended here:  */
+	off_t		file_end;
+
+	/*  Backing file, either another GXD image or a raw file:  */
+	struct diskimage_gxd *backing_gxd;
+	int		backing_fd;
+
+	/*  The most recently decompressed cluster:  */
+	int64_t		cached_cluster;
+	unsigned char	*cluster_buf;
+	unsigned char	*compressed_buf;
+
+	/*  Used when a cluster is copied on write:  */
+	unsigned char	*write_buf;
+};
+
+
+static inline uint32_t gxd_get32(const unsigned char *p)
+{
+	return p[0] + (p[1] << 8) + (p[2] << 16) + ((uint32_t)p[3] << 24);
+}
+
+static inline uint64_t gxd_get64(const unsigned char *p)
+{
+	return gxd_get32(p) + ((uint64_t)gxd_get32(p + 4) << 32);
+}
+
+static inline void gxd_put32(unsigned char *p, uint32_t x)
+{
+	p[0] = x; p[1] = x >> 8; p[2] = x >> 16; p[3] = x >> 24;
+}
+
+static inline void gxd_put64(unsigned char *p, uint64_t x)
+{
+	gxd_put32(p, x);
+	gxd_put32(p + 4, x >> 32);
+}
+
+
+/*
+ *  gxd_l2_entry():
+ *
+ *  Returns a pointer to the (in-memory copy of the) L2 entry for a cluster.
+ *  If there is no L2 table for the cluster yet, NULL is returned, unless
+ *  allocate is set, in which case a new empty table is appended to the file.
+ */
+static unsigned char *gxd_l2_entry(struct diskimage_gxd *g,
+	uint64_t cluster_nr, int allocate)
+{
+	uint32_t l1_index = cluster_nr >> g->l2_bits;
+	size_t l2_index = cluster_nr & (((uint64_t)1 << g->l2_bits) - 1);
+	size_t l2_len = GXD_L2_ENTRY_SIZE << g->l2_bits;
+
+	if (l1_index >= g->l1_entries)
+		return NULL;
+
+	if (g->l2[l1_index] == NULL) {
+		unsigned char l1_entry[8];
+
+		if (g->l1[l1_index] == 0 && !allocate)
+			return NULL;
+
+		CHECK_ALLOCATION(g->l2[l1_index] = (unsigned char *)
+		    malloc(l2_len));
+
+		if (g->l1[l1_index] != 0) {
+			if (diskimage_pread(g->fd, g->l2[l1_index], l2_len,
+			    g->l1[l1_index]) != (ssize_t) l2_len) {
+				fatal("[ %s: could not read L2 table %i ]\n",
+				    g->fname, (int) l1_index);
+				memset(g->l2[l1_index], 0, l2_len);
+			}
+		} else {
+			memset(g->l2[l1_index], 0, l2_len);
+			gxd_put64(l1_entry, g->file_end);
+			if (diskimage_pwrite(g->fd, g->l2[l1_index], l2_len,
+			    g->file_end) != (ssize_t) l2_len ||
+			    diskimage_pwrite(g->fd, l1_entry, sizeof(l1_entry),
+			    g->l1_offset + 8 * l1_index) != sizeof(l1_entry)) {
+				fatal("[ %s: could not allocate an L2 table"
+				    " ]\n", g->fname);
+				free(g->l2[l1_index]);
+				g->l2[l1_index] = NULL;
+				return NULL;
+			}
+
+			g->l1[l1_index] = g->file_end;
+			g->file_end += l2_len;
+		}
+	}
+
+	return g->l2[l1_index] + l2_index * GXD_L2_ENTRY_SIZE;
+}
+
+
+/*
+ *  gxd_read_backing():
+ *
+ *  Reads data for clusters which are not allocated in an image. Anything
+ *  beyond the end of the backing file (or everything, if there is no
+ *  backing file) reads as zeroes.
+ */
+static void gxd_read_backing(struct diskimage_gxd *g, off_t offset,
+	unsigned char *buf, size_t len)
+{
+	ssize_t lenread = 0;
+
+	if (g->backing_gxd != NULL)
+		lenread = diskimage_gxd_read(g->backing_gxd, offset, buf, len);
+	else if (g->backing_fd >= 0)
+		lenread = diskimage_pread(g->backing_fd, buf, len, offset);
+
+	if (lenread < 0)
+		lenread = 0;
+	memset(buf + lenread, 0, len - lenread);
+}
+
+
+/*
+ *  gxd_read_cluster():
+ *
+ *  Reads len bytes, starting at offset ofs within cluster cluster_nr.
+ *  Returns 1 on success, 0 if the image is damaged.
+ */
+static int gxd_read_cluster(struct diskimage_gxd *g, uint64_t cluster_nr,
+	size_t ofs, unsigned char *buf, size_t len)
+{
+	unsigned char *entry = gxd_l2_entry(g, cluster_nr, 0);
+	uint64_t data_offset;
+	uint32_t csize, flags;
+	ssize_t res;
+
+	data_offset = entry != NULL? gxd_get64(entry + GXD_L2E_OFFSET) : 0;
+	csize = entry != NULL? gxd_get32(entry + GXD_L2E_CSIZE) : 0;
+	flags = entry != NULL? gxd_get32(entry + GXD_L2E_FLAGS) : 0;
+
+	if (data_offset == 0 && flags == 0) {
+		gxd_read_backing(g, (cluster_nr << g->cluster_bits) + ofs,
+		    buf, len);
+		return 1;
+	}
+
+	if (flags & GXD_FLAG_ZERO) {
+		memset(buf, 0, len);
+		return 1;
+	}
+
+	if (csize == 0)
+		return diskimage_pread(g->fd, buf, len, data_offset + ofs) ==
+		    (ssize_t) len;
+
+	if (g->cached_cluster != (int64_t) cluster_nr) {
+		g->cached_cluster = -1;
+		if (csize > g->cluster_size || diskimage_pread(g->fd,
+		    g->compressed_buf, csize, data_offset) != (ssize_t) csize)
+			return 0;
+
+		res = lz4_block_decompress(g->compressed_buf, csize,
+		    g->cluster_buf, g->cluster_size);
+		if (res != (ssize_t) g->cluster_size)
+			return 0;
+
+		g->cached_cluster = cluster_nr;
+	}
+
+	memcpy(buf, g->cluster_buf + ofs, len);
+	return 1;
+}
+
+
+/*
+ *  diskimage_gxd_read():
+ *
+ *  Reads from the virtual disk of a GXD image. Returns the number of bytes
+ *  read, which is less than len if the read goes beyond the end of the
+ *  virtual disk, or if the image is damaged.
+ */
+ssize_t diskimage_gxd_read(struct diskimage_gxd *g, off_t offset,
+	unsigned char *buf, size_t len)
+{
+	size_t done = 0;
+
+	if (offset < 0 || (uint64_t) offset >= g->size)
+		return 0;
+	if (len > g->size - offset)
+		len = g->size - offset;
+
+	while (done < len) {
+		uint64_t cluster_nr = (offset + done) >> g->cluster_bits;
+		size_t ofs = (offset + done) & (g->cluster_size - 1);
+		size_t chunk = g->cluster_size - ofs;
+
+		if (chunk > len - done)
+			chunk = len - done;
+
+		if (!gxd_read_cluster(g, cluster_nr, ofs, buf + done, chunk)) {
+			fatal("[ %s: damaged cluster %lli ]\n", g->fname,
+			    (long long) cluster_nr);
+			break;
+		}
+
+		done += chunk;
+	}
+
+	return done;
+}
+
+
+/*
+ *  diskimage_gxd_write():
+ *
+ *  Writes to the virtual disk of a GXD image. Clusters which are already
+ *  stored uncompressed in the image are overwritten in place. Other clusters
+ *  are first read (from the image or its backing file), and then written as
+ *  a new uncompressed cluster at the end of the file.
+ *
+ *  Returns the number of bytes written.
+ */
+ssize_t diskimage_gxd_write(struct diskimage_gxd *g, off_t offset,
+	unsigned char *buf, size_t len)
+{
+	size_t done = 0;
+
+	if (!g->writable || offset < 0 || (uint64_t) offset >= g->size)
+		return 0;
+	if (len > g->size - offset)
+		len = g->size - offset;
+
+	while (done < len) {
+		uint64_t cluster_nr = (offset + done) >> g->cluster_bits;
+		size_t ofs = (offset + done) & (g->cluster_size - 1);
+		size_t chunk = g->cluster_size - ofs;
+		unsigned char *entry, new_entry[GXD_L2_ENTRY_SIZE];
+		uint64_t data_offset, entry_offset;
+
+		if (chunk > len - done)
+			chunk = len - done;
+
+		entry = gxd_l2_entry(g, cluster_nr, 1);
+		if (entry == NULL)
+			break;
+
+		data_offset = gxd_get64(entry + GXD_L2E_OFFSET);
+		if (data_offset != 0 && gxd_get32(entry + GXD_L2E_CSIZE) == 0
+		    && gxd_get32(entry + GXD_L2E_FLAGS) == 0) {
+			if (diskimage_pwrite(g->fd, buf + done, chunk,
+			    data_offset + ofs) != (ssize_t) chunk)
+				break;
+			done += chunk;
+			continue;
+		}
+
+		/*  Copy on write:  */
+		if (chunk != g->cluster_size && !gxd_read_cluster(g,
+		    cluster_nr, 0, g->write_buf, g->cluster_size))
+			break;
+		memcpy(g->write_buf + ofs, buf + done, chunk);
+
+		if (diskimage_pwrite(g->fd, g->write_buf, g->cluster_size,
+		    g->file_end) != (ssize_t) g->cluster_size)
+			break;
+
+		/*  The data must be in place before the entry points to it:  */
+		memset(new_entry, 0, sizeof(new_entry));
+		gxd_put64(new_entry + GXD_L2E_OFFSET, g->file_end);
+		entry_offset = g->l1[cluster_nr >> g->l2_bits] +
+		    (entry - g->l2[cluster_nr >> g->l2_bits]);
+		if (diskimage_pwrite(g->fd, new_entry, sizeof(new_entry),
+		    entry_offset) != sizeof(new_entry))
+			break;
+
+		memcpy(entry, new_entry, sizeof(new_entry));
+		g->file_end += g->cluster_size;
+		if (g->cached_cluster == (int64_t) cluster_nr)
+			g->cached_cluster = -1;
+
+		done += chunk;
+	}
+
+	if (done != len)
+		fatal("[ %s: write failed at offset %lli ]\n", g->fname,
+		    (long long) (offset + done));
+
+	return done;
+}
+
+
+/*
+ *  diskimage_gxd_size():
+ *
+ *  Returns the size of the virtual disk in a GXD image.
+ */
+off_t diskimage_gxd_size(struct diskimage_gxd *g)
+{
+	return g->size;
+}
+
+
+/*
+ *  gxd_read_header():
+ *
+ *  Reads the header of a file. Returns 1 if the file is a GXD image,
+ *  0 otherwise.
+ */
+static int gxd_read_header(int fd, unsigned char *hdr)
+{
+	return diskimage_pread(fd, hdr, GXD_HEADER_SIZE, 0) == GXD_HEADER_SIZE
+	    && memcmp(hdr + GXD_HDR_MAGIC, GXD_MAGIC, GXD_MAGIC_LEN) == 0;
+}
+
+
+/*
+ *  diskimage_gxd_probe():
+ *
+ *  Returns the size of the virtual disk if fname is a GXD image, or -1 if
+ *  it is not.
+ */
+int64_t diskimage_gxd_probe(const char *fname)
+{
+	unsigned char hdr[GXD_HEADER_SIZE];
+	int fd = open(fname, O_RDONLY);
+	int is_gxd;
+
+	if (fd < 0)
+		return -1;
+
+	is_gxd = gxd_read_header(fd, hdr);
+	close(fd);
+
+	return is_gxd? (int64_t) gxd_get64(hdr + GXD_HDR_SIZE) : -1;
+}
+
+
+/*
+ *  diskimage_gxd_open():
+ *
+ *  Opens a GXD image, and its chain of backing files. Returns NULL if fname
+ *  is not a GXD image. Damaged images are fatal errors.
+ */
+struct diskimage_gxd *diskimage_gxd_open(const char *fname, int writable)
+{
+	unsigned char hdr[GXD_HEADER_SIZE], *l1_buf;
+	struct diskimage_gxd *g;
+	uint64_t n_clusters, l1_needed;
+	uint32_t backing_len, i;
+	struct stat st;
+	int fd;
+
+	fd = open(fname, writable? O_RDWR : O_RDONLY);
+	if (fd < 0) {
+		perror(fname);
+		exit(1);
+	}
+
+	if (!gxd_read_header(fd, hdr)) {
+		close(fd);
+		return NULL;
+	}
+
+	CHECK_ALLOCATION(g = (struct diskimage_gxd *) malloc(sizeof(*g)));
+	memset(g, 0, sizeof(*g));
+
+	CHECK_ALLOCATION(g->fname = strdup(fname));
+	g->fd = fd;
+	g->writable = writable;
+	g->backing_fd = -1;
+	g->cached_cluster = -1;
+
+	g->cluster_bits = gxd_get32(hdr + GXD_HDR_CLUSTER_BITS);
+	g->l2_bits = gxd_get32(hdr + GXD_HDR_L2_BITS);
+	g->size = gxd_get64(hdr + GXD_HDR_SIZE);
+	g->l1_offset = gxd_get64(hdr + GXD_HDR_L1_OFFSET);
+	g->l1_entries = gxd_get32(hdr + GXD_HDR_L1_ENTRIES);
+	backing_len = gxd_get32(hdr + GXD_HDR_BACKING_LEN);
+
+	if (gxd_get32(hdr + GXD_HDR_VERSION) != GXD_VERSION) {
+		fprintf(stderr, "%s: unsupported GXD version %i\n", fname,
+		    (int) gxd_get32(hdr + GXD_HDR_VERSION));
+		exit(1);
+	}
+
+	if (g->cluster_bits < GXD_MIN_CLUSTER_BITS ||
+	    g->cluster_bits > GXD_MAX_CLUSTER_BITS ||
+	    g->l2_bits < 1 || g->l2_bits > 20 ||
+	    backing_len > GXD_MAX_BACKING_LEN || fstat(fd, &st) != 0) {
+		fprintf(stderr, "%s: damaged GXD header\n", fname);
+		exit(1);
+	}
+
+	g->cluster_size = (size_t)1 << g->cluster_bits;
+	n_clusters = (g->size + g->cluster_size - 1) >> g->cluster_bits;
+	l1_needed = (n_clusters + ((uint64_t)1 << g->l2_bits) - 1) >> g->l2_bits;
+	g->file_end = st.st_size;
+
+	if (g->l1_entries < l1_needed || g->l1_offset < GXD_HEADER_SIZE ||
+	    g->l1_offset + 8 * (uint64_t) g->l1_entries > (uint64_t) st.st_size) {
+		fprintf(stderr, "%s: damaged GXD cluster table\n", fname);
+		exit(1);
+	}
+
+	CHECK_ALLOCATION(l1_buf = (unsigned char *) malloc(8 * g->l1_entries + 1));
+	CHECK_ALLOCATION(g->l1 = (uint64_t *) malloc(sizeof(uint64_t) *
+	    (g->l1_entries + 1)));
+	CHECK_ALLOCATION(g->l2 = (unsigned char **) calloc(g->l1_entries + 1,
+	    sizeof(unsigned char *)));
+
+	if (diskimage_pread(fd, l1_buf, 8 * g->l1_entries, g->l1_offset) !=
+	    (ssize_t) (8 * g->l1_entries)) {
+		perror(fname);
+		exit(1);
+	}
+	for (i = 0; i < g->l1_entries; i++)
+		g->l1[i] = gxd_get64(l1_buf + 8 * i);
+	free(l1_buf);
+
+	CHECK_ALLOCATION(g->cluster_buf = (unsigned char *) malloc(g->cluster_size));
+	CHECK_ALLOCATION(g->compressed_buf = (unsigned char *) malloc(g->cluster_size));
+	CHECK_ALLOCATION(g->write_buf = (unsigned char *) malloc(g->cluster_size));
+
+	/*
+	 *  Open the backing file, read-only. Relative names are relative
+	 *  to the directory of the image itself.
+	 */
+	if (backing_len > 0) {
+		const char *slash = strrchr(fname, '/');
+		size_t dirlen = (hdr[GXD_HDR_BACKING_NAME] == '/' ||
+		    slash == NULL)? 0 : slash - fname + 1;
+		char *backing_name;
+
+		CHECK_ALLOCATION(backing_name = (char *)
+		    malloc(dirlen + backing_len + 1));
+		memcpy(backing_name, fname, dirlen);
+		memcpy(backing_name + dirlen, hdr + GXD_HDR_BACKING_NAME,
+		    backing_len);
+		backing_name[dirlen + backing_len] = '\0';
+
+		if (++gxd_chain_length > GXD_MAX_CHAIN_LENGTH) {
+			fprintf(stderr, "%s: too many backing files (a loop?)"
+			    "\n", fname);
+			exit(1);
+		}
+
+		g->backing_gxd = diskimage_gxd_open(backing_name, 0);
+		gxd_chain_length --;
+		if (g->backing_gxd == NULL) {
+			g->backing_fd = open(backing_name, O_RDONLY);
+			if (g->backing_fd < 0) {
+				perror(backing_name);
+				exit(1);
+			}
+		}
+
+		debug("[ %s: backing file %s ]\n", fname, backing_name);
+		free(backing_name);
+	}
+
+	return g;
+}
+
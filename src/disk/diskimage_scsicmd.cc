@@ -43,12 +43,16 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "diskimage.h"
 #include "machine.h"
 #include "misc.h"
 
 
+/*  Larger buffers in a checkpoint file are assumed to be corrupt:  */
+#define	SCSI_TRANSFER_MAX_CHECKPOINT_LEN	(1 << 30)
+
 static const char *diskimage_types[] = DISKIMAGE_TYPES;
 static struct scsi_transfer *first_free_scsi_transfer_alloc = NULL;
 
@@ -148,6 +152,90 @@ void scsi_transfer_allocbuf(size_t *lenp, unsigned char **pp, size_t want_len,
 }
 
 
+/*
+ *  scsi_transfer_checkpoint_buf():
+ *
+ *  Helper function for scsi_transfer_checkpoint(). Saves or restores one
+ *  buffer, which may be NULL.
+ */
+static void scsi_transfer_checkpoint_buf(struct checkpoint *ckpt,
+	size_t *lenp, unsigned char **pp)
+{
+	int present = (*pp) != NULL;
+
+	CHECKPOINT_VAR(ckpt, present);
+	CHECKPOINT_VAR(ckpt, *lenp);
+
+	if (ckpt->restoring) {
+		if ((*pp) != NULL)
+			free(*pp);
+		(*pp) = NULL;
+
+		if (ckpt->failed || !present)
+			return;
+
+		if ((*lenp) > SCSI_TRANSFER_MAX_CHECKPOINT_LEN) {
+			checkpoint_error(ckpt, "bad SCSI buffer length");
+			(*lenp) = 0;
+			return;
+		}
+
+		CHECK_ALLOCATION((*pp) = (unsigned char *)
+		    malloc((*lenp) == 0? 1 : (*lenp)));
+	}
+
+	if (present)
+		checkpoint_data(ckpt, *pp, *lenp);
+}
+
+
+/*
+ *  scsi_transfer_checkpoint():
+ *
+ *  Saves or restores a SCSI controller's transfer in progress (*xferpp may
+ *  be NULL, if there is none). Transfers where the disk has left the data
+ *  to be read directly from the disk image (data_in_direct) are not
+ *  supported.
+ */
+void scsi_transfer_checkpoint(struct checkpoint *ckpt,
+	struct scsi_transfer **xferpp)
+{
+	struct scsi_transfer *p;
+	int present = (*xferpp) != NULL;
+
+	CHECKPOINT_VAR(ckpt, present);
+
+	if (ckpt->restoring) {
+		if ((*xferpp) != NULL)
+			scsi_transfer_free(*xferpp);
+		(*xferpp) = NULL;
+
+		if (ckpt->failed || !present)
+			return;
+
+		(*xferpp) = scsi_transfer_alloc();
+	}
+
+	if (!present)
+		return;
+
+	p = *xferpp;
+	if (p->data_in_direct) {
+		checkpoint_error(ckpt, "direct SCSI transfers cannot be saved");
+		return;
+	}
+
+	scsi_transfer_checkpoint_buf(ckpt, &p->msg_out_len, &p->msg_out);
+	scsi_transfer_checkpoint_buf(ckpt, &p->cmd_len, &p->cmd);
+	scsi_transfer_checkpoint_buf(ckpt, &p->data_out_len, &p->data_out);
+	CHECKPOINT_VAR(ckpt, p->data_out_offset);
+	scsi_transfer_checkpoint_buf(ckpt, &p->data_in_len, &p->data_in);
+	scsi_transfer_checkpoint_buf(ckpt, &p->msg_in_len, &p->msg_in);
+	scsi_transfer_checkpoint_buf(ckpt, &p->status_len, &p->status);
+	CHECKPOINT_VAR(ckpt, p->dma_direct);
+}
+
+
 /**************************************************************************/
 
 
@@ -643,12 +731,28 @@ xferp->data_in[4] = 0x2c - 4;	/*  Additional length  */
 			ofs *= d->logical_block_size;
 		}
 
+		debug(" READ  ofs=%lli size=%i\n", (long long)ofs, (int)size);
+
+		/*
+		 *  If the controller can do it, let it read the data directly
+		 *  from the disk image into emulated memory, instead of via
+		 *  the data_in buffer:
+		 */
+		if (xferp->dma_direct && !d->is_a_tape) {
+			xferp->data_in_direct = 1;
+			xferp->data_in_disk = d;
+			xferp->data_in_disk_offset = ofs;
+			xferp->data_in_len = size;
+
+			diskimage__return_default_status_and_message(xferp);
+			d->filemark = 0;
+			break;
+		}
+
 		/*  Return data:  */
 		scsi_transfer_allocbuf(&xferp->data_in_len, &xferp->data_in,
 		    size, 0);
 
-		debug(" READ  ofs=%lli size=%i\n", (long long)ofs, (int)size);
-
 		diskimage__return_default_status_and_message(xferp);
 
 		d->filemark = 0;
@@ -668,14 +772,12 @@ xferp->data_in[4] = 0x2c - 4;	/*  Additional length  */
 			xferp->status[0] = 0x02;	/*  CHECK CONDITION  */
 
 			d->filemark = 1;
-		} else
-			diskimage__internal_access(d, 0, ofs,
-			    xferp->data_in, size);
+		} else if (!diskimage__internal_access(d, 0, ofs,
+		    xferp->data_in, size))
+			xferp->status[0] = 0x02;	/*  CHECK CONDITION  */
 
 		if (d->is_a_tape && d->f != NULL)
 			d->tape_offset = ftello(d->f);
-
-		/*  TODO: other errors?  */
 		break;
 
 	case SCSICMD_WRITE:
@@ -750,7 +852,7 @@ xferp->data_in[4] = 0x2c - 4;	/*  Additional length  */
 			debug(" (weird len=%i)", xferp->cmd_len);
 
 		/*  TODO: actualy care about cmd[]  */
-		fsync(fileno(d->f));
+		diskimage_flush(d);
 
 		diskimage__return_default_status_and_message(xferp);
 		break;
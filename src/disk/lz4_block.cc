@@ -0,0 +1,206 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright  
+ *     notice, this list of conditions and the following disclaimer in the 
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE   
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *  LZ4 block format compression.
+ *
+ *  Used for compressed GXD disk image clusters (by the emulator and by
+ *  experiments/gxdconvert), and for the data blocks of binary GXemul files.
+ *  Only the block format is implemented, not the LZ4 frame format; callers
+ *  store the lengths themselves.
+ */
+
+#include <string.h>
+
+#include "lz4_block.h"
+
+
+#define	LZ4_HASH_BITS		14
+#define	LZ4_MIN_MATCH		4
+
+
+/*
+ *  lz4_block_emit():
+ *
+ *  Appends one LZ4 sequence (literals, and a match unless match_len is 0).
+ *  Returns the new output position, or 0 if the output would not fit.
+ */
+static size_t lz4_block_emit(uint8_t *dst, size_t op, size_t dstmax,
+	const uint8_t *lit, size_t lit_len, size_t offset, size_t match_len)
+{
+	size_t ml = match_len > 0? match_len - LZ4_MIN_MATCH : 0;
+	size_t n;
+
+	/*  Worst case size of this sequence:  */
+	if (op + 1 + lit_len + lit_len / 255 + 1 + 2 + ml / 255 + 1 > dstmax)
+		return 0;
+
+	dst[op++] = ((lit_len < 15? lit_len : 15) << 4) | (ml < 15? ml : 15);
+
+	if (lit_len >= 15) {
+		for (n = lit_len - 15; n >= 255; n -= 255)
+			dst[op++] = 255;
+		dst[op++] = n;
+	}
+
+	memcpy(dst + op, lit, lit_len);
+	op += lit_len;
+
+	if (match_len == 0)
+		return op;
+
+	dst[op++] = offset;
+	dst[op++] = offset >> 8;
+
+	if (ml >= 15) {
+		for (n = ml - 15; n >= 255; n -= 255)
+			dst[op++] = 255;
+		dst[op++] = n;
+	}
+
+	return op;
+}
+
+
+/*
+ *  lz4_block_compress():
+ *
+ *  Greedy LZ4 block compressor. Returns the compressed length, or 0 if it
+ *  would be dstmax bytes or more.
+ *
+ *  As required by the LZ4 block format, the last match starts at least 12
+ *  bytes before the end, and the last 5 bytes are always literals.
+ */
+size_t lz4_block_compress(const uint8_t *src, size_t len,
+	uint8_t *dst, size_t dstmax)
+{
+	int32_t table[1 << LZ4_HASH_BITS];
+	size_t ip = 0, anchor = 0, op = 0;
+
+	memset(table, 0xff, sizeof(table));
+
+	while (ip + 12 <= len) {
+		uint32_t seq = src[ip] | (src[ip+1] << 8) | (src[ip+2] << 16)
+		    | ((uint32_t)src[ip+3] << 24);
+		uint32_t h = (seq * 2654435761U) >> (32 - LZ4_HASH_BITS);
+		int32_t ref = table[h];
+		size_t match_len;
+
+		table[h] = ip;
+
+		if (ref < 0 || ip - ref > 65535 ||
+		    memcmp(src + ref, src + ip, LZ4_MIN_MATCH) != 0) {
+			ip ++;
+			continue;
+		}
+
+		match_len = LZ4_MIN_MATCH;
+		while (ip + match_len < len - 5 &&
+		    src[ref + match_len] == src[ip + match_len])
+			match_len ++;
+
+		op = lz4_block_emit(dst, op, dstmax, src + anchor,
+		    ip - anchor, ip - ref, match_len);
+		if (op == 0)
+			return 0;
+
+		ip += match_len;
+		anchor = ip;
+	}
+
+	op = lz4_block_emit(dst, op, dstmax, src + anchor, len - anchor, 0, 0);
+	return op < dstmax? op : 0;
+}
+
+
+/*
+ *  lz4_block_decompress():
+ *
+ *  Decompresses srclen bytes of LZ4 block data into dst. Returns the number
+ *  of bytes produced, or -1 if the data is malformed or does not fit in
+ *  dstlen bytes.
+ */
+ssize_t lz4_block_decompress(const uint8_t *src, size_t srclen,
+	uint8_t *dst, size_t dstlen)
+{
+	const uint8_t *src_end = src + srclen;
+	size_t produced = 0;
+
+	while (src < src_end) {
+		int token = *src++;
+		size_t lit_len = token >> 4, match_len = token & 15, offset;
+
+		if (lit_len == 15) {
+			int b;
+			do {
+				if (src >= src_end)
+					return -1;
+				b = *src++;
+				lit_len += b;
+			} while (b == 255);
+		}
+
+		if (lit_len > (size_t)(src_end - src) ||
+		    lit_len > dstlen - produced)
+			return -1;
+		memcpy(dst + produced, src, lit_len);
+		src += lit_len;
+		produced += lit_len;
+
+		/*  The last sequence has no match part:  */
+		if (src == src_end)
+			break;
+
+		if (src_end - src < 2)
+			return -1;
+		offset = src[0] + (src[1] << 8);
+		src += 2;
+		if (offset == 0 || offset > produced)
+			return -1;
+
+		if (match_len == 15) {
+			int b;
+			do {
+				if (src >= src_end)
+					return -1;
+				b = *src++;
+				match_len += b;
+			} while (b == 255);
+		}
+		match_len += LZ4_MIN_MATCH;
+
+		if (match_len > dstlen - produced)
+			return -1;
+
+		/*  Byte by byte, since the match may overlap itself:  */
+		while (match_len-- > 0) {
+			dst[produced] = dst[produced - offset];
+			produced ++;
+		}
+	}
+
+	return produced;
+}
+
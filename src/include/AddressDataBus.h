@@ -139,6 +139,30 @@ public:
 	 *	because of a timeout).
 	 */
 	virtual bool WriteData(const uint64_t& data, Endianness endianness) = 0;
+
+	/**
+	 * \brief Looks up host memory for direct access to an address range.
+	 *
+	 * Components which are backed by ordinary host memory, e.g. the
+	 * RAMComponent, may return a pointer to the host memory for the range
+	 * [address, address + length), so that callers can bypass
+	 * AddressSelect() and ReadData()/WriteData() altogether. Data in the
+	 * range is stored in emulated byte order.
+	 *
+	 * The pointer is only valid until the next time the component's
+	 * cached state is flushed, or the component is reset.
+	 *
+	 * \param address The first address of the range.
+	 * \param length The number of bytes in the range.
+	 * \param forWrite True if the memory is going to be written to.
+	 * \return A pointer to host memory, or NULL if direct access is not
+	 *	possible for the range (the default).
+	 */
+	virtual uint8_t* LookupHostPage(uint64_t address, uint64_t length,
+		bool forWrite)
+	{
+		return NULL;
+	}
 };
 
 
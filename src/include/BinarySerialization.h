@@ -0,0 +1,195 @@
+#ifndef BINARYSERIALIZATION_H
+#define	BINARYSERIALIZATION_H
+
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include "misc.h"
+
+#include "UnitTest.h"
+
+
+/**
+ * \brief Helper functions for the binary serialization format.
+ *
+ * A binary serialization stream starts with a header (an 8-byte magic
+ * string and a format version number), followed by one component record.
+ * A component record is:
+ *
+ * <ul>
+ *	<li>'C', the class name, then any number of:
+ *	<li>'V', the variable type, name, and value (as text), or
+ *	<li>'D', the variable name, and a sequence of data blocks
+ *		ending with an empty block (used by custom variables), or
+ *	<li>a child component record,
+ *	<li>and finally 'E'.
+ * </ul>
+ *
+ * Numbers are stored as variable length integers (7 bits per byte, least
+ * significant group first), and strings as a length followed by the
+ * characters.
+ *
+ * A data block is stored either as is, or compressed using the LZ4 block
+ * format. The data blocks are written and read one at a time, so that large
+ * state (such as RAM) can be streamed to and from a file without ever
+ * building the entire image in memory.
+ */
+class BinarySerialization
+	: public UnitTestable
+{
+public:
+	/**
+	 * \brief The current version of the binary serialization format.
+	 */
+	static const uint32_t Version = 1;
+
+	/**
+	 * \brief The largest data block which may be written or read.
+	 */
+	static const size_t MaxBlockSize = 1 << 20;
+
+	/**
+	 * \brief Writes the magic string and format version.
+	 *
+	 * @param os The stream to write to.
+	 */
+	static void WriteHeader(ostream& os);
+
+	/**
+	 * \brief Reads and checks the magic string and format version.
+	 *
+	 * @param is The stream to read from.
+	 * @param messages A stream where error messages are written.
+	 * @return true if the header was valid and the version is supported,
+	 *	false otherwise.
+	 */
+	static bool ReadHeader(istream& is, ostream& messages);
+
+	/**
+	 * \brief Checks whether a buffer starts with the magic string.
+	 *
+	 * @param buf A pointer to the start of a file.
+	 * @param len The number of bytes in buf.
+	 * @return true if the buffer starts with the magic string.
+	 */
+	static bool HasMagic(const char* buf, size_t len);
+
+	static void WriteByte(ostream& os, uint8_t value);
+	static bool ReadByte(istream& is, uint8_t& value);
+
+	/**
+	 * \brief Writes a number as a variable length integer.
+	 *
+	 * @param os The stream to write to.
+	 * @param value The number.
+	 */
+	static void WriteNumber(ostream& os, uint64_t value);
+	static bool ReadNumber(istream& is, uint64_t& value);
+
+	/**
+	 * \brief Writes a string, as its length followed by the characters.
+	 *
+	 * @param os The stream to write to.
+	 * @param str The string.
+	 */
+	static void WriteString(ostream& os, const string& str);
+	static bool ReadString(istream& is, string& str);
+
+	/**
+	 * \brief Writes a data block.
+	 *
+	 * Empty blocks are not allowed, since an empty block marks the end of
+	 * a sequence of blocks; see WriteEndOfBlocks().
+	 *
+	 * @param os The stream to write to.
+	 * @param data A pointer to the data.
+	 * @param len The length of the data, 1 to MaxBlockSize bytes.
+	 * @param compress If true, the block is stored compressed (but only
+	 *	if that actually makes it smaller).
+	 */
+	static void WriteBlock(ostream& os, const uint8_t* data, size_t len,
+		bool compress);
+
+	/**
+	 * \brief Writes the empty block which ends a sequence of blocks.
+	 *
+	 * @param os The stream to write to.
+	 */
+	static void WriteEndOfBlocks(ostream& os);
+
+	/**
+	 * \brief Reads a data block.
+	 *
+	 * @param is The stream to read from.
+	 * @param data Set to the contents of the block. Empty at the end of
+	 *	a sequence of blocks.
+	 * @return true on success, false if the block was malformed.
+	 */
+	static bool ReadBlock(istream& is, vector<uint8_t>& data);
+
+	/**
+	 * \brief Skips the rest of a sequence of data blocks.
+	 *
+	 * @param is The stream to read from.
+	 * @return true on success, false if a block was malformed.
+	 */
+	static bool SkipBlocks(istream& is);
+
+	/**
+	 * \brief Compresses data using the LZ4 block format.
+	 *
+	 * @param src The data to compress.
+	 * @param len The length of the data.
+	 * @param dst Where to store the compressed data.
+	 * @param dstMax The size of the dst buffer.
+	 * @return The length of the compressed data, or 0 if it would not
+	 *	be smaller than dstMax.
+	 */
+	static size_t Compress(const uint8_t* src, size_t len,
+		uint8_t* dst, size_t dstMax);
+
+	/**
+	 * \brief Decompresses data in the LZ4 block format.
+	 *
+	 * @param src The compressed data.
+	 * @param srcLen The length of the compressed data.
+	 * @param dst Where to store the decompressed data.
+	 * @param dstLen The size of the dst buffer.
+	 * @return The number of bytes decompressed, or -1 if the data
+	 *	was malformed or did not fit in dst.
+	 */
+	static ssize_t Decompress(const uint8_t* src, size_t srcLen,
+		uint8_t* dst, size_t dstLen);
+
+
+	/********************************************************************/
+
+	static void RunUnitTests(int& nSucceeded, int& nFailures);
+};
+
+
+#endif	// BINARYSERIALIZATION_H
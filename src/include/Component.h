@@ -508,8 +508,13 @@ public:
 	/**
 	 * \brief Serializes the %Component into a string stream.
 	 *
+	 * If the context is in binary mode, the %Component is written in the
+	 * binary serialization format (without the header; see
+	 * BinarySerialization::WriteHeader()), directly to the stream.
+	 *
 	 * @param ss An ostream which the %Component will be serialized to.
-	 * @param context A serialization context (used for TAB indentation).
+	 * @param context A serialization context (used for TAB indentation,
+	 *	and for selecting the binary format).
 	 */
 	void Serialize(ostream& ss, SerializationContext& context) const;
 
@@ -528,10 +533,28 @@ public:
 	static refcount_ptr<Component> Deserialize(ostream& messages,
 	    const string& str, size_t& pos);
 
+	/**
+	 * \brief Deserializes a component tree in the binary format.
+	 *
+	 * The tree is read record by record from the stream, so that large
+	 * state does not have to be read into memory first. The header
+	 * should already have been read using
+	 * BinarySerialization::ReadHeader().
+	 *
+	 * @param messages A stream where errors/warnings may be reported.
+	 * @param is The stream to deserialize from.
+	 * @return If deserialization was successful, the
+	 *	reference counted pointer will point to a component tree;
+	 *	on error, it will be set to NULL
+	 */
+	static refcount_ptr<Component> Deserialize(ostream& messages,
+	    istream& is);
+
 	/**
 	 * \brief Checks consistency by serializing and deserializing the
 	 *	component (including all its child components), and comparing
 	 *	the checksum of the original tree with the deserialized tree.
+	 *	Both the text and the binary formats are checked.
 	 *
 	 * @return true if the serialization/deserialization was correct,
 	 *	false if there was some inconsistency
@@ -37,6 +37,21 @@
 #include "UI.h"
 
 
+/**
+ * \brief An executable component in GXemul's execution plan.
+ *
+ * Components that have a "frequency" (and are not paused) are executable.
+ */
+struct ComponentAndFrequency
+{
+	refcount_ptr<Component>	component;
+	double			frequency;
+	uint64_t*		step;
+
+	uint64_t		nextTimeToExecute;
+};
+
+
 /**
  * \brief The main emulator class.
  *
@@ -223,6 +238,48 @@ public:
 	 */
 	void SetSnapshottingEnabled(bool enabled);
 
+	/**
+	 * \brief Sets how often snapshots are taken.
+	 *
+	 * When snapshotting is enabled, a snapshot is taken at step 0, and
+	 * then whenever at least this many steps have been executed since
+	 * the last snapshot.
+	 *
+	 * @param steps The number of steps between snapshots, at least 1.
+	 */
+	void SetSnapshotInterval(uint64_t steps);
+
+	/**
+	 * \brief Sets the maximum amount of host memory used by snapshots.
+	 *
+	 * Snapshots share RAM with the running emulation (copy-on-write),
+	 * so a snapshot's cost is the RAM which has been modified since
+	 * it was taken. When the budget is exceeded, snapshots are thinned
+	 * out, so that the remaining ones are spread out over the
+	 * emulation's history. The oldest and the newest snapshots are
+	 * always kept.
+	 *
+	 * @param bytes The memory budget, in bytes.
+	 */
+	void SetSnapshotMemoryBudget(size_t bytes);
+
+	/**
+	 * \brief Gets the number of snapshots currently kept.
+	 *
+	 * @return The number of snapshots.
+	 */
+	size_t GetNrOfSnapshots() const;
+
+	/**
+	 * \brief Finds the newest snapshot taken before a step.
+	 *
+	 * @param step The step.
+	 * @param snapshotStep Set to the step of the snapshot, if one
+	 *	was found.
+	 * @return True if a snapshot was found, false otherwise.
+	 */
+	bool FindSnapshotBefore(uint64_t step, uint64_t& snapshotStep) const;
+
 	/**
 	 * \brief Gets the current quiet mode setting.
 	 *
@@ -272,6 +329,17 @@ public:
 	 */
 	void Execute(const int longestTotalRun = 100000);
 
+	/**
+	 * \brief Invalidates the cached execution plan.
+	 *
+	 * Execute() caches the list of executable components, their
+	 * frequencies, and pointers to their step counters. This function
+	 * should be called whenever the component tree, or a variable which
+	 * affects execution (e.g. a frequency), is changed. The plan is then
+	 * rebuilt on the next call to Execute().
+	 */
+	void InvalidateExecutionPlan();
+
 	/**
 	 * \brief Dump a list to stdout with all available machine templates.
 	 */
@@ -310,9 +378,28 @@ private:
 	void SetStep(uint64_t step);
 
 	/**
-	 * \brief Takes a snapshot of the full emulation state.
+	 * \brief Takes a snapshot of the full emulation state, if snapshotting
+	 *	is enabled and it is time for a new snapshot.
+	 */
+	void TakeSnapshotIfNeeded();
+
+	/**
+	 * \brief Removes snapshots, until the snapshot memory budget is
+	 *	no longer exceeded.
 	 */
-	void TakeSnapshot();
+	void ThinOutSnapshots();
+
+	/**
+	 * \brief Discards all snapshots taken after a step.
+	 *
+	 * @param step The step.
+	 */
+	void DiscardSnapshotsAfter(uint64_t step);
+
+	/**
+	 * \brief Builds the execution plan, unless it is already valid.
+	 */
+	void MakeSureExecutionPlanExists();
 
 
 	/********************************************************************/
@@ -331,6 +418,13 @@ private:
 	bool			m_interrupting;
 	uint64_t		m_nrOfSingleStepsLeft;
 
+	// Execution plan (cached between calls to Execute):
+	bool			m_executionPlanValid;
+	vector<ComponentAndFrequency> m_componentsAndFrequencies;
+	size_t			m_fastestComponentIndex;
+	bool			m_sloppyAccuracy;
+	uint64_t*		m_rootStep;
+
 	// Performance measurement:
 	struct timeval		m_lastOutputTime;
 	uint64_t		m_lastOutputStep;
@@ -339,9 +433,17 @@ private:
 	string			m_emulationFileName;
 	refcount_ptr<Component>	m_rootComponent;
 
-	// Snapshotting:   TODO: Multiple snapshots!
+	// Snapshotting:
+	struct Snapshot
+	{
+		uint64_t		step;
+		refcount_ptr<Component>	root;
+	};
+
 	bool			m_snapshottingEnabled;
-	refcount_ptr<Component>	m_snapshot;
+	uint64_t		m_snapshotInterval;
+	size_t			m_snapshotMemoryBudget;
+	vector<Snapshot>	m_snapshots;	// Sorted by step
 };
 
 #endif	// GXEMUL_H
@@ -33,6 +33,10 @@
 
 /**
  * \brief A context used during serialization of objects.
+ *
+ * Component trees are serialized either as readable text (the .gxemul
+ * format), or in a binary form (see BinarySerialization) which is much
+ * faster and smaller for large state, such as the contents of RAM.
  */
 class SerializationContext
 {
@@ -42,7 +46,51 @@ public:
 	 */
 	SerializationContext()
 		: m_indentation(0)
+		, m_binary(false)
+		, m_compress(false)
+	{
+	}
+
+	/**
+	 * \brief Returns whether the binary serialization format is used.
+	 *
+	 * @return true for binary, false for text
+	 */
+	bool IsBinary() const
+	{
+		return m_binary;
+	}
+
+	/**
+	 * \brief Selects the binary or the text serialization format.
+	 *
+	 * @param binary true for binary, false for text
+	 */
+	void SetBinary(bool binary)
+	{
+		m_binary = binary;
+	}
+
+	/**
+	 * \brief Returns whether large data blocks should be compressed.
+	 *
+	 * Only used with the binary format.
+	 *
+	 * @return true if data blocks should be compressed
+	 */
+	bool GetCompress() const
+	{
+		return m_compress;
+	}
+
+	/**
+	 * \brief Sets whether large data blocks should be compressed.
+	 *
+	 * @param compress true if data blocks should be compressed
+	 */
+	void SetCompress(bool compress)
 	{
+		m_compress = compress;
 	}
 
 	/**
@@ -73,7 +121,7 @@ public:
 	 */
 	SerializationContext Indented()
 	{
-		SerializationContext newContext;
+		SerializationContext newContext(*this);
 		newContext.SetIndentation(GetIndentation() + 1);
 		return newContext;
 	}
@@ -94,6 +142,8 @@ public:
 
 private:
 	int	m_indentation;
+	bool	m_binary;
+	bool	m_compress;
 };
 
 
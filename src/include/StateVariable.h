@@ -56,6 +56,28 @@ public:
 	virtual void Serialize(ostream& ss) const = 0;
 	virtual bool Deserialize(const string& value) = 0;
 	virtual void CopyValueFrom(CustomStateVariableHandler* other) = 0;
+
+	/**
+	 * \brief Serializes the value as a sequence of binary data blocks.
+	 *
+	 * The sequence must be ended using
+	 * BinarySerialization::WriteEndOfBlocks(). The default implementation
+	 * stores the text serialization. Handlers for large state (e.g. RAM)
+	 * should override this, and DeserializeBinary().
+	 *
+	 * @param ss The stream to write to.
+	 * @param context Serialization context (e.g. compression).
+	 */
+	virtual void SerializeBinary(ostream& ss,
+		const SerializationContext& context) const;
+
+	/**
+	 * \brief Deserializes a value written by SerializeBinary().
+	 *
+	 * @param is The stream to read from.
+	 * @return true on success, false if the data was malformed.
+	 */
+	virtual bool DeserializeBinary(istream& is);
 };
 
 
@@ -221,6 +243,19 @@ public:
 	 */
 	void Serialize(ostream& ss, SerializationContext& context) const;
 
+	/**
+	 * \brief Deserializes the binary data blocks of a Custom variable.
+	 *
+	 * (Other variable types are serialized as text also in the binary
+	 * format, and set using SetValue().)
+	 *
+	 * @param is The stream to read from, positioned at the first
+	 *	data block.
+	 * @return true on success, false if the variable is not a Custom
+	 *	variable, or if the data was malformed.
+	 */
+	bool DeserializeBinary(istream& is);
+
 	/**
 	 * \brief Copy the value from another variable into this variable.
 	 *
@@ -276,6 +311,18 @@ public:
 	 */
 	bool SetValue(uint64_t value);
 
+	/**
+	 * \brief Returns a direct pointer to the value of a UInt64 variable.
+	 *
+	 * This is meant for performance critical code, which needs to read
+	 * or write the value often, without going via ToInteger() and
+	 * SetValue().
+	 *
+	 * @return A pointer to the variable's value, or NULL if the
+	 *	variable is not of type UInt64.
+	 */
+	uint64_t* GetUInt64Pointer();
+
 
 	/********************************************************************/
 
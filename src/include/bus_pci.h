@@ -35,6 +35,7 @@
 
 #include "thirdparty/pcireg.h"
 
+struct checkpoint;
 struct machine;
 struct memory;
 
@@ -149,6 +150,7 @@ void bus_pci_setaddr(struct cpu *cpu, struct pci_data *pci_data,
 	int bus, int device, int function, int reg);
 void bus_pci_data_access(struct cpu *cpu, struct pci_data *pci_data,
 	uint64_t *data, int len, int writeflag);
+void bus_pci_checkpoint(struct checkpoint *ckpt, struct pci_data *pci_data);
 
 /*  Initialization:  */
 struct pci_data *bus_pci_init(struct machine *machine, const char *irq_path,
@@ -0,0 +1,84 @@
+#ifndef	CHECKPOINT_H
+#define	CHECKPOINT_H
+
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  Checkpoints (saved machine state) for the legacy emulation.
+ *
+ *  The same code is used both for saving and restoring: each piece of state
+ *  is passed by pointer to one of the checkpoint_*() functions, which either
+ *  writes the value to the file or overwrites it with the value read from
+ *  the file, depending on ckpt->restoring.
+ */
+
+#include <stdio.h>
+#include <inttypes.h>
+
+struct emul;
+
+
+struct checkpoint {
+	FILE		*f;
+	const char	*filename;
+
+	int		restoring;	/*  0 when saving, 1 when restoring  */
+	int		failed;		/*  set on any I/O or format error  */
+};
+
+#define	CHECKPOINT_MAGIC	"GXCKPT\032\n"
+#define	CHECKPOINT_VERSION	2
+
+/*
+ *  CHECKPOINT_VAR saves or restores an integer variable of any size, and
+ *  CHECKPOINT_ARRAY an array of such variables. They are stored as 64-bit
+ *  values, so that the file format does not depend on the host's types.
+ */
+#define	CHECKPOINT_VAR(ckpt, var)	do {				\
+		uint64_t checkpoint_tmp_ = (uint64_t) (var);		\
+		checkpoint_uint64((ckpt), &checkpoint_tmp_);		\
+		(var) = checkpoint_tmp_;				\
+	} while (0)
+
+#define	CHECKPOINT_ARRAY(ckpt, arr, n)	do {				\
+		size_t checkpoint_i_;					\
+		for (checkpoint_i_ = 0; checkpoint_i_ < (size_t) (n);	\
+		    checkpoint_i_ ++)					\
+			CHECKPOINT_VAR((ckpt), (arr)[checkpoint_i_]);	\
+	} while (0)
+
+
+/*  checkpoint.cc:  */
+void checkpoint_error(struct checkpoint *ckpt, const char *fmt, ...);
+void checkpoint_data(struct checkpoint *ckpt, void *data, size_t len);
+void checkpoint_uint64(struct checkpoint *ckpt, uint64_t *valuep);
+void checkpoint_tag(struct checkpoint *ckpt, const char *tag);
+int checkpoint_save(struct emul *emul, const char *filename);
+int checkpoint_restore(struct emul *emul, const char *filename);
+
+
+#endif	/*  CHECKPOINT_H  */
@@ -35,7 +35,8 @@
 
 
 /**
- * \brief A Command which sets the RunState to BackwardsRunning.
+ * \brief A Command which runs the emulation backwards, to the previous
+ * snapshot.
  */
 class ContinueBackwardsCommand
 	: public Command
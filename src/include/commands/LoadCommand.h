@@ -30,6 +30,8 @@
 
 #include "misc.h"
 
+#include <fstream>
+
 #include "Command.h"
 #include "Component.h"
 #include "UnitTest.h"
@@ -59,6 +61,9 @@ private:
 	bool IsComponentTree(GXemul& gxemul, const string& filename) const;
 	bool LoadComponentTree(GXemul& gxemul, const string&filename,
 		refcount_ptr<Component> specifiedComponent) const;
+	bool LoadTextComponentTree(GXemul& gxemul, const string& filename,
+		std::ifstream& file, ostream& messages,
+		refcount_ptr<Component>& component) const;
 };
 
 
@@ -37,6 +37,12 @@
 #include "UnitTest.h"
 
 
+// Host page TLB: page size and number of (direct-mapped) entries.
+#define	CPU_HOSTPAGE_TLB_SHIFT		12
+#define	CPU_HOSTPAGE_SIZE		(1 << CPU_HOSTPAGE_TLB_SHIFT)
+#define	CPU_HOSTPAGE_TLB_NENTRIES	256
+
+
 /**
  * \brief A base-class for processors Component implementations.
  */
@@ -185,9 +191,105 @@ protected:
 	virtual int64_t FunctionTraceArgument(int n) { return 0; }
 	virtual bool FunctionTraceReturnImpl(int64_t& retval) { return false; }
 
+	/**
+	 * \brief Reads data directly from host memory, if possible.
+	 *
+	 * On a host page TLB hit, the data is read directly from the host
+	 * memory which backs the virtual address, bypassing AddressSelect()
+	 * and the AddressDataBus. This is meant to be used by load
+	 * instructions.
+	 *
+	 * @param vaddr The (naturally aligned) virtual address to read from.
+	 * @param data A reference to a variable which will receive the data.
+	 * @param endianness The endianness of the access.
+	 * @return True if the data was read, false if the caller needs to
+	 *	fall back to AddressSelect() and ReadData().
+	 */
+	template<typename T> bool ReadDataDirect(uint64_t vaddr, T& data,
+		Endianness endianness)
+	{
+		uint8_t* host = LookupHostPageTLB(vaddr, false);
+		if (host == NULL)
+			return false;
+
+		data = ConvertEndianness(*(T*)host, endianness);
+		return true;
+	}
+
+	/**
+	 * \brief Writes data directly to host memory, if possible.
+	 *
+	 * The write counterpart of ReadDataDirect().
+	 *
+	 * @param vaddr The (naturally aligned) virtual address to write to.
+	 * @param data A reference to a variable which contains the data.
+	 * @param endianness The endianness of the access.
+	 * @return True if the data was written, false if the caller needs to
+	 *	fall back to AddressSelect() and WriteData().
+	 */
+	template<typename T> bool WriteDataDirect(uint64_t vaddr, const T& data,
+		Endianness endianness)
+	{
+		uint8_t* host = LookupHostPageTLB(vaddr, true);
+		if (host == NULL)
+			return false;
+
+		*(T*)host = ConvertEndianness(data, endianness);
+		return true;
+	}
+
+	/**
+	 * \brief Invalidates all entries in the host page TLB.
+	 *
+	 * Should be called by CPU implementations whenever virtual to
+	 * physical address translations change.
+	 */
+	void InvalidateHostPageTLB();
+
 private:
 	bool LookupAddressDataBus(GXemul* gxemul = NULL);
 
+	uint8_t* FillHostPageTLB(uint64_t vaddr, bool forWrite);
+
+	uint8_t* LookupHostPageTLB(uint64_t vaddr, bool forWrite)
+	{
+		HostPageTLBEntry& entry = m_hostPageTLB[(vaddr >>
+		    CPU_HOSTPAGE_TLB_SHIFT) & (CPU_HOSTPAGE_TLB_NENTRIES - 1)];
+
+		if (entry.hostPage != NULL &&
+		    entry.vpage == (vaddr >> CPU_HOSTPAGE_TLB_SHIFT) &&
+		    (entry.writable || !forWrite))
+			return entry.hostPage + (vaddr & (CPU_HOSTPAGE_SIZE - 1));
+
+		return FillHostPageTLB(vaddr, forWrite);
+	}
+
+	// Converts between host byte order and emulated byte order.
+	// (The conversion is symmetric.)
+	template<typename T> static T ConvertEndianness(T data,
+		Endianness endianness)
+	{
+		if (sizeof(T) == sizeof(uint16_t)) {
+			uint16_t d = data;
+			return endianness == BigEndian?
+			    BE16_TO_HOST(d) : LE16_TO_HOST(d);
+		}
+
+		if (sizeof(T) == sizeof(uint32_t)) {
+			uint32_t d = data;
+			return endianness == BigEndian?
+			    BE32_TO_HOST(d) : LE32_TO_HOST(d);
+		}
+
+		if (sizeof(T) == sizeof(uint64_t)) {
+			uint64_t d = data;
+			return endianness == BigEndian?
+			    BE64_TO_HOST(d) : LE64_TO_HOST(d);
+		}
+
+		return data;
+	}
+
 protected:
 	/*
 	 * Variables common to all (or most) kinds of CPUs:
@@ -230,6 +332,17 @@ protected:
 	uint64_t		m_addressSelect;
 	bool			m_exceptionOrAbortInDelaySlot;
 
+	// Host page TLB: virtual page number to host memory, for pages
+	// which are backed directly by host memory (e.g. RAMComponent
+	// blocks). Only entries with writable set may be used for writes.
+	struct HostPageTLBEntry {
+		uint64_t		vpage;
+		uint8_t *		hostPage;
+		bool			writable;
+	};
+
+	HostPageTLBEntry	m_hostPageTLB[CPU_HOSTPAGE_TLB_NENTRIES];
+
 private:
 	SymbolRegistry		m_symbolRegistry;
 };
@@ -32,6 +32,7 @@
 
 
 #include "AddressDataBus.h"
+#include "BinarySerialization.h"
 #include "MemoryMappedComponent.h"
 
 #include "UnitTest.h"
@@ -43,9 +44,8 @@
 /**
  * \brief A Random Access Memory Component.
  *
- * RAM is emulated by allocating large blocks of host memory (e.g. 4 MB
- * per block), and simply forwarding all read and write requests to those
- * memory blocks.
+ * RAM is emulated by allocating blocks of host memory (64 KB per block),
+ * and simply forwarding all read and write requests to those memory blocks.
  *
  * The host memory blocks are not allocated until they are actually written to.
  * Reading from uninitialized/unwritten emulated memory returns zeros. This
@@ -57,6 +57,12 @@
  * memory using mmap(), so the blocks do not necessariliy use up host RAM
  * unless they are touched.
  *
+ * When a RAMComponent is cloned (e.g. when the emulator takes a snapshot for
+ * reverse execution), the clone shares all memory blocks with the original.
+ * A shared block is copied the first time either of them writes to it
+ * (copy-on-write), so a snapshot only costs as much host memory as has been
+ * modified since it was taken.
+ *
  * Note 1: This class does <i>not</i> handle unaligned access. It is up to the
  * caller to make sure that e.g. ReadData(uint64_t&, Endianness) is only
  * called when the selected address is 64-bit aligned.
@@ -127,6 +133,70 @@ public:
 	virtual bool WriteData(const uint16_t& data, Endianness endianness);
 	virtual bool WriteData(const uint32_t& data, Endianness endianness);
 	virtual bool WriteData(const uint64_t& data, Endianness endianness);
+	virtual uint8_t* LookupHostPage(uint64_t address, uint64_t length,
+		bool forWrite);
+
+	/**
+	 * \brief Gets the amount of host memory used by all RAM components.
+	 *
+	 * Memory blocks which are shared between clones are only counted
+	 * once.
+	 *
+	 * @return The number of bytes of allocated memory blocks.
+	 */
+	static size_t GetTotalAllocatedMemory();
+
+	/**
+	 * \brief Gets the amount of host memory used by the RAM components
+	 *	in a component tree.
+	 *
+	 * @param component The root of the component tree.
+	 * @return The number of bytes of memory blocks referenced by RAM
+	 *	components in the tree.
+	 */
+	static size_t GetAllocatedMemory(const refcount_ptr<Component>& component);
+
+	/**
+	 * \brief The size of the pages tracked by dirty page tracking.
+	 */
+	static const uint64_t DirtyPageSize = 4096;
+
+	/**
+	 * \brief Starts tracking which pages are written to.
+	 *
+	 * All pages start out as clean. Host pages which have already been
+	 * looked up for writing (e.g. by a CPU's host page TLB) are flushed,
+	 * so that the first write to each page is noticed.
+	 */
+	void StartDirtyPageTracking();
+
+	/**
+	 * \brief Stops tracking which pages are written to.
+	 */
+	void StopDirtyPageTracking();
+
+	/**
+	 * \brief Checks whether dirty page tracking is enabled.
+	 *
+	 * @return true if StartDirtyPageTracking() has been called.
+	 */
+	bool IsTrackingDirtyPages() const
+	{
+		return m_dirtyTracking;
+	}
+
+	/**
+	 * \brief Fetches and clears the set of dirty pages.
+	 *
+	 * The time taken is proportional to the number of dirty pages, not
+	 * to the size of the RAM. Host pages looked up for writing are
+	 * flushed again, so that later writes to the pages are noticed.
+	 *
+	 * @param pages A vector which is filled with the addresses (relative
+	 *	to the start of the RAM component) of all pages which have been
+	 *	written to since tracking was started, or since the last call.
+	 */
+	void FetchAndClearDirtyPages(vector<uint64_t>& pages);
 
 
 	/********************************************************************/
@@ -134,9 +204,35 @@ public:
 	static void RunUnitTests(int& nSucceeded, int& nFailures);
 
 private:
+	/*
+	 * A host memory block. Blocks are reference counted, so that a
+	 * RAMComponent and its clones can share them until one of them
+	 * writes to the block.
+	 */
+	class MemoryBlock
+		: public ReferenceCountable
+	{
+	public:
+		MemoryBlock(size_t size);
+		~MemoryBlock();
+
+		void*	data;
+		size_t	size;
+	};
+
 	void ReleaseAllBlocks();
 
-	void* AllocateBlock();
+	/*
+	 * Returns a block which may be written to: allocates the block if
+	 * necessary, and makes a private copy of it if it is shared.
+	 */
+	void* AllocateBlock(uint64_t blockNr);
+
+	void ShareBlocksWith(RAMComponent& other);
+
+	void MarkDirty(uint64_t address, uint64_t length);
+
+	void FlushCachedStateOfTree();
 
 	class RAMDataHandler : public CustomStateVariableHandler
 	{
@@ -153,8 +249,9 @@ private:
 		virtual void Serialize(ostream& ss) const
 		{
 			for (size_t i=0; i<m_ram.m_memoryBlocks.size(); ++i)
-				if (m_ram.m_memoryBlocks[i] != NULL)
-					SerializeMemoryBlock(ss, i, m_ram.m_memoryBlocks[i]);
+				if (!m_ram.m_memoryBlocks[i].IsNULL())
+					SerializeMemoryBlock(ss, i,
+					    m_ram.m_memoryBlocks[i]->data);
 
 			// End of data.
 			ss << ".";
@@ -238,16 +335,130 @@ private:
 			return true;
 		}
 		
-		virtual void CopyValueFrom(CustomStateVariableHandler* other)
+		/*
+		 * In the binary format, each run of up to 64 KB of non-zero
+		 * 4 KB pages is stored as an 8-byte address block, followed
+		 * by a (possibly compressed) data block. Pages which are all
+		 * zeroes are not stored at all.
+		 */
+		virtual void SerializeBinary(ostream& ss,
+			const SerializationContext& context) const
+		{
+			const size_t pageSize = 4096, maxRunLength = 65536;
+
+			for (size_t i=0; i<m_ram.m_memoryBlocks.size(); ++i) {
+				if (m_ram.m_memoryBlocks[i].IsNULL())
+					continue;
+
+				const uint8_t *block = (const uint8_t*)
+				    m_ram.m_memoryBlocks[i]->data;
+
+				size_t ofs = 0;
+				while (ofs < m_ram.m_blockSize) {
+					if (IsZero(block + ofs, pageSize)) {
+						ofs += pageSize;
+						continue;
+					}
+
+					size_t len = pageSize;
+					while (ofs + len < m_ram.m_blockSize &&
+					    len < maxRunLength &&
+					    !IsZero(block + ofs + len, pageSize))
+						len += pageSize;
+
+					uint64_t addr = ((uint64_t)i <<
+					    m_ram.m_blockSizeShift) + ofs;
+					uint8_t addrBuf[8];
+					for (int j=0; j<8; ++j)
+						addrBuf[j] = addr >> (j*8);
+
+					BinarySerialization::WriteBlock(ss,
+					    addrBuf, sizeof(addrBuf), false);
+					BinarySerialization::WriteBlock(ss,
+					    block + ofs, len,
+					    context.GetCompress());
+
+					ofs += len;
+				}
+			}
+
+			BinarySerialization::WriteEndOfBlocks(ss);
+		}
+
+		/*
+		 * The memoryMappedSize variable is deserialized before the
+		 * data (see Component::Serialize), and data outside of it is
+		 * rejected.
+		 */
+		virtual bool DeserializeBinary(istream& is)
 		{
-			// NOTE/TODO: Not space efficient, but works for now.
+			m_ram.ReleaseAllBlocks();
+
+			const StateVariable* sizeVar =
+			    m_ram.GetVariable("memoryMappedSize");
+			uint64_t size = sizeVar == NULL? 0 :
+			    sizeVar->ToInteger();
+
+			vector<uint8_t> addrBuf, data;
+			while (true) {
+				if (!BinarySerialization::ReadBlock(is, addrBuf))
+					return false;
+				if (addrBuf.size() == 0)
+					break;
+
+				if (addrBuf.size() != 8 ||
+				    !BinarySerialization::ReadBlock(is, data) ||
+				    data.size() == 0)
+					return false;
+
+				uint64_t addr = 0;
+				for (int j=0; j<8; ++j)
+					addr |= (uint64_t)addrBuf[j] << (j*8);
+
+				if (addr >= size || data.size() > size - addr)
+					return false;
+
+				// Copy the data, block by block:
+				size_t done = 0;
+				while (done < data.size()) {
+					uint64_t a = addr + done;
+					size_t ofs = a & (m_ram.m_blockSize - 1);
+					size_t len = m_ram.m_blockSize - ofs;
+					if (len > data.size() - done)
+						len = data.size() - done;
+
+					uint8_t* block = (uint8_t*) m_ram.
+					    AllocateBlock(a >> m_ram.m_blockSizeShift);
+					memcpy(block + ofs, &data[done], len);
+					done += len;
+				}
+			}
 
-			stringstream ss;
-			other->Serialize(ss);
-			Deserialize(ss.str());
+			// Refresh the cached host block pointer:
+			m_ram.AddressSelect(m_ram.m_addressSelect);
+			return true;
+		}
+
+		/*
+		 * Clones share the memory blocks, instead of copying them.
+		 */
+		virtual void CopyValueFrom(CustomStateVariableHandler* other)
+		{
+			m_ram.ShareBlocksWith(
+			    ((RAMDataHandler*) other)->m_ram);
 		}
 
 	private:
+		static bool IsZero(const uint8_t* data, size_t len)
+		{
+			const uint64_t* p = (const uint64_t*) data;
+			for (size_t i=0; i<len / sizeof(uint64_t); i++)
+				if (p[i] != 0)
+					return false;
+
+			return true;
+		}
+
 		void SerializeMemoryBlock(ostream& ss, size_t blockNr, void *block) const
 		{
 			const size_t rowSize = 1024;
@@ -298,7 +509,7 @@ private:
 	RAMDataHandler m_dataHandler;
 	
 	// State:
-	typedef vector<void *> BlockNrToMemoryBlockVector;
+	typedef vector< refcount_ptr<MemoryBlock> > BlockNrToMemoryBlockVector;
 	BlockNrToMemoryBlockVector	m_memoryBlocks;
 	bool				m_writeProtected;
 	uint64_t			m_lastDumpAddr;
@@ -306,7 +517,17 @@ private:
 	// Cached/runtime state:
 	uint64_t	m_addressSelect;  // For AddressDataBus read/write
 	void *		m_selectedHostMemoryBlock;
+	void *		m_selectedWritableBlock; // NULL if shared
 	size_t		m_selectedOffsetWithinBlock;
+
+	// Dirty page tracking: one bit per page, and the indices of all
+	// non-zero words in the bitmap.
+	bool			m_dirtyTracking;
+	vector<uint64_t>	m_dirtyBitmap;
+	vector<size_t>		m_dirtyWords;
+
+	// Total size of all allocated memory blocks, in all RAM components:
+	static size_t	s_totalAllocatedMemory;
 };
 
 
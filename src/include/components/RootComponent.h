@@ -85,6 +85,7 @@ public:
 
 protected:
 	virtual bool CheckVariableWrite(StateVariable& var, const string& oldValue);
+	virtual void FlushCachedStateForComponent();
 
 private:
 	// Pointer to owner (may be NULL):
@@ -68,6 +68,12 @@
  *  length; to extend the list, the list should be made to point to another
  *  list, and so forth. (Bad, O(n) find/insert complexity. Should be fixed some
  *  day. TODO)  See definition of physpage_ranges below.
+ *
+ *  lru_prev_ofs and lru_next_ofs link all physpages in the translation cache
+ *  into a list ordered from most recently used to least recently used. When
+ *  the cache is full, the least recently used page is evicted and its slot
+ *  is reused. The quick pc_to_pointers lookups do not reorder the list; they
+ *  set referenced instead, which gives the page a second chance at eviction.
  */
 #define DYNTRANS_MISC_DECLARATIONS(arch,ARCH,addrtype)  struct \
 	arch ## _instr_call {					\
@@ -81,6 +87,9 @@
 		uint32_t	next_ofs;	/*  (0 for end of chain)  */ \
 		uint32_t	translations_bitmap;			\
 		uint32_t	translation_ranges_ofs;			\
+		uint32_t	lru_prev_ofs;	/*  (0 for MRU page)  */	\
+		uint32_t	lru_next_ofs;	/*  (0 for LRU page)  */	\
+		uint32_t	referenced;				\
 		addrtype	physaddr;				\
 	};								\
 									\
@@ -236,6 +245,7 @@ struct physpage_ranges {
 #include "cpu_ppc.h"
 #include "cpu_sh.h"
 
+struct checkpoint;
 struct cpu;
 struct emul;
 struct machine;
@@ -379,6 +389,11 @@ struct cpu {
 	int		(*instruction_has_delayslot)(struct cpu *cpu,
 			    unsigned char *ib);
 
+	/*  Saves or restores CPU family specific state, NULL if
+	    checkpoints are not supported for this CPU family:  */
+	void		(*checkpoint)(struct cpu *cpu,
+			    struct checkpoint *ckpt);
+
 	/*  The program counter. (For 32-bit modes, not all bits are used.)  */
 	uint64_t	pc;
 
@@ -415,7 +430,7 @@ struct cpu {
 	 *
 	 *  The translation cache is a relative large chunk of memory (say,
 	 *  32 MB) which is used for translations. When it has been used up,
-	 *  everything restarts from scratch.
+	 *  the least recently used physpages are evicted one at a time.
 	 *
 	 *  translation_readahead is non-zero when translating instructions
 	 *  ahead of the current (emulated) instruction pointer.
@@ -427,6 +442,14 @@ struct cpu {
 	int		n_translated_instrs;
 	unsigned char	*translation_cache;
 	size_t		translation_cache_cur_ofs;
+	uint32_t	translation_cache_mru_ofs;
+	uint32_t	translation_cache_lru_ofs;
+
+	/*  Translation cache statistics:  */
+	uint64_t	translation_cache_hits;
+	uint64_t	translation_cache_misses;
+	uint64_t	translation_cache_evictions;
+	uint64_t	translation_cache_resets;
 
 
 	/*
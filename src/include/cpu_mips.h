@@ -34,6 +34,7 @@
 #include "interrupt.h"
 #include "misc.h"
 
+struct checkpoint;
 struct cpu_family;
 struct emul;
 struct machine;
@@ -83,6 +84,50 @@ struct mips_tlb {
 	uint64_t	mask;
 };
 
+/*
+ *  TLB lookup index:
+ *
+ *  Instead of scanning all TLB entries on every translation, entries are
+ *  hashed into buckets by VPN (shifted by the entry's own page size) and
+ *  ASID. Global entries are kept in a separate table, hashed by VPN only.
+ *  Each bucket is a bitmask of TLB entry numbers, so the TLB may have at
+ *  most 64 entries for the index to be used. Entries with a page mask that
+ *  the index does not understand are always candidates.
+ */
+#define	MIPS_TLB_INDEX_MAX_ENTRIES	64
+#define	MIPS_TLB_INDEX_BUCKETS		64
+#define	MIPS_TLB_INDEX_HASH(vpn,asid)	(((vpn) + ((asid) ^ ((asid) >> 6)) \
+					    * 37) & (MIPS_TLB_INDEX_BUCKETS - 1))
+#ifdef __GNUC__
+#define	MIPS_TLB_INDEX_FIRST(mask)	__builtin_ctzll(mask)
+#else
+static inline int MIPS_TLB_INDEX_FIRST(uint64_t mask)
+{
+	int i = 0;
+	while (!(mask & 1)) {
+		mask >>= 1;
+		i ++;
+	}
+	return i;
+}
+#endif
+
+struct mips_tlb_index {
+	uint64_t	by_asid[MIPS_TLB_INDEX_BUCKETS];
+	uint64_t	global[MIPS_TLB_INDEX_BUCKETS];
+	uint64_t	unindexed;
+
+	/*  The VPN shifts (page sizes) which are currently in use:  */
+	int		n_vpn_shifts;
+	int8_t		vpn_shifts[32];
+	int		n_with_vpn_shift[32];
+
+	/*  Per TLB entry, for removal from the index:  */
+	int8_t		vpn_shift[MIPS_TLB_INDEX_MAX_ENTRIES];
+	int8_t		bucket[MIPS_TLB_INDEX_MAX_ENTRIES];
+	int8_t		is_global[MIPS_TLB_INDEX_MAX_ENTRIES];
+};
+
 
 /*
  *  Coproc 1:
@@ -104,6 +149,7 @@ struct mips_coproc {
 	/*  Only for COP0:  */
 	struct mips_tlb	*tlbs;
 	int		nr_of_tlbs;
+	struct mips_tlb_index *tlb_index;	/*  NULL if not used  */
 
 	/*  Only for COP1:  floating point control registers  */
 	/*  (Maybe also for COP0?)  */
@@ -286,6 +332,7 @@ struct mips_cpu {
 void mips_cpu_interrupt_assert(struct interrupt *interrupt);
 void mips_cpu_interrupt_deassert(struct interrupt *interrupt);
 int mips_cpu_instruction_has_delayslot(struct cpu *cpu, unsigned char *ib);
+void mips_cpu_checkpoint(struct cpu *cpu, struct checkpoint *ckpt);
 void mips_cpu_tlbdump(struct machine *m, int x, int rawflag);
 void mips_cpu_register_match(struct machine *m, char *name, 
 	int writeflag, uint64_t *valuep, int *match_register);
@@ -303,6 +350,7 @@ int mips_cpu_family_init(struct cpu_family *);
 
 /*  cpu_mips_coproc.c:  */
 struct mips_coproc *mips_coproc_new(struct cpu *cpu, int coproc_nr);
+void mips_coproc_checkpoint(struct cpu *cpu, struct checkpoint *ckpt);
 void mips_coproc_tlb_set_entry(struct cpu *cpu, int entrynr, int size,
         uint64_t vaddr, uint64_t paddr0, uint64_t paddr1,
         int valid0, int valid1, int dirty0, int dirty1, int global, int asid,
@@ -312,6 +360,8 @@ void coproc_register_read(struct cpu *cpu,
 void coproc_register_write(struct cpu *cpu,
         struct mips_coproc *cp, int reg_nr, uint64_t *ptr, int flag64,
 	int select);
+uint64_t mips_coproc_tlb_index_candidates(struct mips_coproc *cp,
+	uint64_t vaddr, uint64_t asid);
 void coproc_tlbpr(struct cpu *cpu, int readflag);
 void coproc_tlbwri(struct cpu *cpu, int randomflag);
 void coproc_rfe(struct cpu *cpu);
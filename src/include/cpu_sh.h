@@ -46,6 +46,7 @@
 #include "thirdparty/sh4_cpu.h"
 
 
+struct checkpoint;
 struct cpu_family;
 
 
@@ -227,6 +228,7 @@ struct sh_cpu {
 void sh_cpu_interrupt_assert(struct interrupt *interrupt);
 void sh_cpu_interrupt_deassert(struct interrupt *interrupt);
 int sh_cpu_instruction_has_delayslot(struct cpu *cpu, unsigned char *ib);
+void sh_cpu_checkpoint(struct cpu *cpu, struct checkpoint *ckpt);
 int sh_run_instr(struct cpu *cpu);
 void sh_update_translation_table(struct cpu *cpu, uint64_t vaddr_page,
 	unsigned char *host_page, int writeflag, uint64_t paddr_page);
@@ -49,8 +49,10 @@
 
 #include "interrupt.h"
 
+struct checkpoint;
 struct cpu;
 struct machine;
+struct machine_event;
 struct memory;
 struct pci_data;
 struct timer;
@@ -230,6 +232,8 @@ struct vfb_data {
 	/*  These should always be in sync:  */
 	unsigned char	*framebuffer;
 	struct fb_window *fb_window;
+
+	struct machine_event *tick_event;
 };
 #define	VFB_MFB_BT455			0x100000
 #define	VFB_MFB_BT431			0x180000
@@ -523,6 +527,7 @@ struct lk201_data {
 };
 void lk201_tick(struct machine *, struct lk201_data *); 
 void lk201_tx_data(struct lk201_data *, int port, int idata);
+void lk201_checkpoint(struct checkpoint *, struct lk201_data *);
 void lk201_init(struct lk201_data *d, int use_fb,
 	void (*add_to_rx_queue)(void *,int,int), int console_handle, void *);
 
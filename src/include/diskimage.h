@@ -31,6 +31,7 @@
  *  Generic disk image functions.  (See diskimage.c for more info.)
  */
 
+#include <pthread.h>
 #include <stdio.h>
 #include <sys/types.h>
 
@@ -49,10 +50,17 @@
 
 struct diskimage_overlay {
 	char		*overlay_basename;
-	FILE		*f_data;
-	FILE		*f_bitmap;
+	int		fd_data;
+	int		fd_bitmap;
+
+	/*  In-memory copy of the bitmap file, one bit per block:  */
+	unsigned char	*bitmap;
+	size_t		bitmap_len;
 };
 
+struct diskimage_cache;
+struct diskimage_gxd;
+
 struct diskimage {
 	struct diskimage *next;
 	int		type;		/*  DISKIMAGE_SCSI, etc  */
@@ -62,6 +70,9 @@ struct diskimage {
 	char		*fname;
 	FILE		*f;
 
+	/*  Non-NULL if the file is a GXD image:  */
+	struct diskimage_gxd *gxd;
+
 	/*  Overlays:  */
 	int		nr_of_overlays;
 	struct diskimage_overlay *overlays;
@@ -86,6 +97,33 @@ struct diskimage {
 
 	int		rpms;
 	int		ncyls;
+
+	/*  Block cache, NULL if disabled:  */
+	struct diskimage_cache *cache;
+
+	/*  Asynchronous I/O (the 'a' prefix):  */
+	int		async;
+	int		async_busy;	/*  being accessed by an I/O thread  */
+	pthread_mutex_t	lock;
+};
+
+
+/*  Asynchronous disk I/O request, see diskimage_async.c:  */
+struct diskimage_request {
+	struct diskimage_request *next;
+
+	struct diskimage *d;
+	int		writeflag;
+	off_t		offset;
+	unsigned char	*buf;
+	size_t		len;
+
+	/*  Same as the return value from diskimage_access():  */
+	int		result;
+
+	/*  Called on the main thread when the request has completed:  */
+	void		(*callback)(struct diskimage_request *req);
+	void		*extra;
 };
 
 
@@ -112,9 +150,21 @@ struct scsi_transfer {
 	size_t			msg_in_len;
 	unsigned char		*status;
 	size_t			status_len;
+
+	/*
+	 *  Zero-copy DMA: If the controller sets dma_direct, then the disk
+	 *  may (instead of filling data_in) set data_in_direct, and leave it
+	 *  to the controller to read data_in_len bytes from data_in_disk at
+	 *  data_in_disk_offset, using diskimage__internal_access_dma().
+	 */
+	int			dma_direct;
+	int			data_in_direct;
+	struct diskimage	*data_in_disk;
+	off_t			data_in_disk_offset;
 };
 
 
+struct checkpoint;
 struct machine;
 
 
@@ -123,20 +173,67 @@ struct scsi_transfer *scsi_transfer_alloc(void);
 void scsi_transfer_free(struct scsi_transfer *);
 void scsi_transfer_allocbuf(size_t *lenp, unsigned char **pp,
 	size_t want_len, int clearflag);
+void scsi_transfer_checkpoint(struct checkpoint *ckpt,
+	struct scsi_transfer **xferpp);
 int diskimage_scsicommand(struct cpu *cpu, int id, int type,
 	struct scsi_transfer *);
 
 
+/*  diskimage_async.c:  */
+#define	DISKIMAGE_ASYNC_THREADS		4
+int diskimage_access_async(struct machine *machine, int id, int type,
+	int writeflag, off_t offset, unsigned char *buf, size_t len,
+	void (*callback)(struct diskimage_request *), void *extra);
+void diskimage_async_poll(void);
+void diskimage_async_drain(void);
+
+
+/*  diskimage_cache.c:  */
+#define	DISKIMAGE_CACHE_BLOCK_SIZE	4096
+#define	DISKIMAGE_CACHE_DEFAULT_KB	1024
+#define	DISKIMAGE_CACHE_MAX_READAHEAD	32	/*  blocks  */
+void diskimage_cache_init(struct diskimage *d, int size_kb, int write_back);
+size_t diskimage_cache_read(struct diskimage *d, off_t offset,
+	unsigned char *buf, size_t len);
+size_t diskimage_cache_write(struct diskimage *d, off_t offset,
+	unsigned char *buf, size_t len);
+void diskimage_cache_flush(struct diskimage *d);
+void diskimage_cache_invalidate(struct diskimage *d);
+void diskimage_cache_flush_all(void);
+void diskimage_cache_dump_info(struct diskimage *d);
+
+
+/*  diskimage_gxd.c:  */
+int64_t diskimage_gxd_probe(const char *fname);
+struct diskimage_gxd *diskimage_gxd_open(const char *fname, int writable);
+off_t diskimage_gxd_size(struct diskimage_gxd *g);
+ssize_t diskimage_gxd_read(struct diskimage_gxd *g, off_t offset,
+	unsigned char *buf, size_t len);
+ssize_t diskimage_gxd_write(struct diskimage_gxd *g, off_t offset,
+	unsigned char *buf, size_t len);
+
+
 /*  diskimage.c:  */
+ssize_t diskimage_pread(int fd, unsigned char *buf, size_t len, off_t offset);
+ssize_t diskimage_pwrite(int fd, unsigned char *buf, size_t len, off_t offset);
+struct diskimage *diskimage_find(struct machine *machine, int id, int type);
 int64_t diskimage_getsize(struct machine *machine, int id, int type);
 int64_t diskimage_get_baseoffset(struct machine *machine, int id, int type);
 void diskimage_set_baseoffset(struct machine *machine, int id, int type, int64_t offset);
 void diskimage_getchs(struct machine *machine, int id, int type,
 	int *c, int *h, int *s);
+size_t diskimage__raw_access(struct diskimage *d, int writeflag,
+	off_t offset, unsigned char *buf, size_t len);
 int diskimage__internal_access(struct diskimage *d, int writeflag,
 	off_t offset, unsigned char *buf, size_t len);
 int diskimage_access(struct machine *machine, int id, int type, int writeflag,
 	off_t offset, unsigned char *buf, size_t len);
+int diskimage__internal_access_dma(struct cpu *cpu, struct diskimage *d,
+	int writeflag, off_t offset, uint64_t paddr, size_t len);
+int diskimage_access_dma(struct cpu *cpu, int id, int type, int writeflag,
+	off_t offset, uint64_t paddr, size_t len);
+void diskimage_flush(struct diskimage *d);
+void diskimage_checkpoint(struct diskimage *d, struct checkpoint *ckpt);
 void diskimage_add_overlay(struct diskimage *d, char *overlay_basename);
 void diskimage_recalc_size(struct diskimage *d);
 int diskimage_exist(struct machine *machine, int id, int type);
@@ -0,0 +1,89 @@
+#ifndef	DISKIMAGE_GXD_H
+#define	DISKIMAGE_GXD_H
+
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright  
+ *     notice, this list of conditions and the following disclaimer in the 
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE   
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *  GXD disk image format. (Included both by the emulator and by the
+ *  stand-alone converter in experiments/, so this file must stay plain C.)
+ *
+ *  A GXD image contains a virtual disk split into clusters of
+ *  (1 << cluster_bits) bytes. A two-level table maps each cluster to its
+ *  data in the file:
+ *
+ *	header (GXD_HEADER_SIZE bytes, at offset 0)
+ *	L1 table: l1_entries 64-bit file offsets of L2 tables (0 = none)
+ *	L2 tables: (1 << l2_bits) entries of GXD_L2_ENTRY_SIZE bytes each
+ *	cluster data
+ *
+ *  An L2 entry is a 64-bit file offset, a 32-bit compressed length (0 if
+ *  the cluster is stored uncompressed) and 32 bits of flags. A cluster
+ *  with offset 0 and no flags is not allocated: its contents come from the
+ *  backing file, if there is one, and are zero otherwise.
+ *
+ *  Compressed clusters use the LZ4 block format (see lz4_block.cc). Writes
+ *  from the emulator always store whole, uncompressed clusters, either in
+ *  place or appended to the file.
+ *
+ *  All values are little endian.
+ */
+
+#define	GXD_MAGIC		"GXDISK\r\n"
+#define	GXD_MAGIC_LEN		8
+#define	GXD_VERSION		1
+
+#define	GXD_HEADER_SIZE		512
+
+/*  Header field offsets:  */
+#define	GXD_HDR_MAGIC		0	/*  8 bytes  */
+#define	GXD_HDR_VERSION		8	/*  32-bit  */
+#define	GXD_HDR_CLUSTER_BITS	12	/*  32-bit  */
+#define	GXD_HDR_SIZE		16	/*  64-bit, virtual disk size  */
+#define	GXD_HDR_L1_OFFSET	24	/*  64-bit  */
+#define	GXD_HDR_L1_ENTRIES	32	/*  32-bit  */
+#define	GXD_HDR_L2_BITS		36	/*  32-bit  */
+#define	GXD_HDR_COMPRESSION	40	/*  32-bit  */
+#define	GXD_HDR_BACKING_LEN	44	/*  32-bit  */
+#define	GXD_HDR_BACKING_NAME	48	/*  backing file name, not 0-terminated  */
+#define	GXD_MAX_BACKING_LEN	(GXD_HEADER_SIZE - GXD_HDR_BACKING_NAME)
+
+#define	GXD_COMPRESSION_NONE	0
+#define	GXD_COMPRESSION_LZ	1
+
+#define	GXD_DEFAULT_CLUSTER_BITS	16
+#define	GXD_DEFAULT_L2_BITS		12
+#define	GXD_MIN_CLUSTER_BITS		9
+#define	GXD_MAX_CLUSTER_BITS		22
+
+#define	GXD_L2_ENTRY_SIZE	16
+#define	GXD_L2E_OFFSET		0	/*  64-bit  */
+#define	GXD_L2E_CSIZE		8	/*  32-bit  */
+#define	GXD_L2E_FLAGS		12	/*  32-bit  */
+
+#define	GXD_FLAG_ZERO		1	/*  all zeroes, no data stored  */
+
+
+#endif	/*  DISKIMAGE_GXD_H  */
@@ -45,6 +45,9 @@ struct emul {
 	int		n_machines;
 	struct machine	**machines;
 
+	/*  Run each machine on its own host thread:  */
+	int		parallel_machines;
+
 	/*  Additional debugger commands to run before
 	    starting the simulation:  */
 	int		n_debugger_cmds;
@@ -32,12 +32,14 @@
 
 #include "symbol.h"
 
+struct checkpoint;
 struct cpu_family;
 struct diskimage;
 struct emul;
 struct fb_window;
 struct machine_arcbios;
 struct machine_pmax;
+struct machine_smp;
 struct memory;
 struct of_data;
 struct settings;
@@ -67,14 +69,33 @@ struct statistics {
 	char	*fields;		/*  "vpi" etc.  */
 };
 
-struct tick_functions {
-	int	n_entries;
+/*
+ *  Events:
+ *
+ *  Hardware devices are driven by one-shot or periodic events, kept in a
+ *  priority queue (a binary min-heap) keyed on the number of cycles executed
+ *  by cpu0. Tick functions are periodic events. A device may cancel its
+ *  event while it is idle, and resume it when it has something to do.
+ */
+struct machine_event {
+	uint64_t	when;		/*  cpu0 cycle count to fire at  */
+	uint64_t	period;		/*  0 for one-shot events  */
+	int		heap_index;	/*  -1 if not scheduled  */
 
-	/*  Arrays, with one element for each entry:  */
-	int	*ticks_till_next;
-	int	*ticks_reset_value;
-	void	(**f)(struct cpu *, void *);
-	void	**extra;
+	void		(*f)(struct cpu *, void *);
+	void		*extra;
+};
+
+struct machine_events {
+	uint64_t	now;		/*  cpu0 cycles executed so far  */
+
+	/*  All events, scheduled or not, in the order they were added:  */
+	int		n_events;
+	struct machine_event **events;
+
+	/*  Scheduled events, ordered by "when":  */
+	int		n_scheduled;
+	struct machine_event **heap;
 };
 
 struct x11_md {
@@ -127,8 +148,8 @@ struct machine {
 
 	int	main_console_handle;
 
-	/*  Tick functions (e.g. hardware devices):  */
-	struct tick_functions tick_functions;
+	/*  Events and tick functions (e.g. hardware devices):  */
+	struct machine_events events;
 
 	char	*cpu_name;  /*  TODO: remove this, there could be several
 				cpus with different names in a machine  */
@@ -139,6 +160,10 @@ struct machine {
 	int	ncpus;
 	struct cpu **cpus;
 
+	/*  Host-threaded SMP: one host thread per emulated CPU.  */
+	int	threaded_smp;
+	struct machine_smp *smp;	/*  NULL until threads are started  */
+
 	struct diskimage *first_diskimage;
 
 	struct symbol_context symbol_context;
@@ -146,6 +171,8 @@ struct machine {
 	int	random_mem_contents;
 	int	physical_ram_in_mb;
 	int	memory_offset_in_mb;
+	char	*ram_filename;		/*  RAM backed by a file, or NULL  */
+	int	ram_hugepages;		/*  contiguous RAM with huge pages  */
 	int	prom_emulation;
 	int	register_dump;
 	int	arch_pagesize;
@@ -191,6 +218,31 @@ struct machine {
 };
 
 
+/*
+ *  Threaded SMP:
+ *
+ *  When machine->smp is non-NULL, the CPUs of the machine run concurrently
+ *  on separate host threads during each quantum. Device accesses and atomic
+ *  sequences spanning several CPUs (e.g. MIPS sc) must then be done while
+ *  holding the machine's SMP lock.
+ *
+ *  Physical pages which need to be invalidated in other CPUs' translation
+ *  caches are noted with machine_smp_note_paddr(), and are processed when
+ *  all CPUs have reached the end of the quantum.
+ */
+#define	SMP_NOTE_CODE_WRITE	1	/*  page written, or mapped writable  */
+#define	SMP_NOTE_CODE_PAGE	2	/*  page now contains translations  */
+
+#define	MACHINE_SMP_LOCK(m)	do {					\
+		if ((m)->smp != NULL)					\
+			machine_smp_lock(m);				\
+	} while (0)
+#define	MACHINE_SMP_UNLOCK(m)	do {					\
+		if ((m)->smp != NULL)					\
+			machine_smp_unlock(m);				\
+	} while (0)
+
+
 /*  Tick function "prototype":  */
 #define	DEVICE_TICK(x)	void dev_ ## x ## _tick(struct cpu *cpu, void *extra)
 
@@ -381,8 +433,17 @@ void machine_destroy(struct machine *machine);
 int machine_name_to_type(char *stype, char *ssubtype,
 	int *type, int *subtype, int *arch);
 void machine_add_breakpoint_string(struct machine *machine, char *str);
-void machine_add_tickfunction(struct machine *machine,
-	void (*func)(struct cpu *, void *), void *extra, int clockshift);
+struct machine_event *machine_event_new(struct machine *machine,
+	void (*func)(struct cpu *, void *), void *extra);
+void machine_event_schedule(struct machine *machine,
+	struct machine_event *ev, uint64_t delay, uint64_t period);
+void machine_event_cancel(struct machine *machine, struct machine_event *ev);
+void machine_event_resume(struct machine *machine, struct machine_event *ev);
+void machine_events_tick_all(struct machine *machine, struct cpu *cpu);
+void machine_events_checkpoint(struct machine *machine,
+	struct checkpoint *ckpt);
+struct machine_event *machine_add_tickfunction(struct machine *machine,
+	void (*func)(struct cpu *, void *), void *extra, int tickshift);
 void machine_statistics_init(struct machine *, char *fname);
 void machine_register(char *name, MACHINE_SETUP_TYPE(setup));
 void machine_setup(struct machine *);
@@ -390,6 +451,10 @@ void machine_memsize_fix(struct machine *);
 void machine_default_cputype(struct machine *);
 void machine_dumpinfo(struct machine *);
 int machine_run(struct machine *machine);
+void machine_smp_lock(struct machine *machine);
+void machine_smp_unlock(struct machine *machine);
+void machine_smp_stop(struct machine *machine);
+void machine_smp_note_paddr(struct cpu *cpu, uint64_t paddr, int kind);
 void machine_list_available_types_and_cpus(void);
 struct machine_entry *machine_entry_new(const char *name, 
 	int arch, int oldstyle_type);
@@ -39,7 +39,9 @@
 
 #define	DEFAULT_RAM_IN_MB		32
 
+struct checkpoint;
 struct cpu;
+struct machine;
 
 
 /*
@@ -61,6 +63,36 @@ struct memory_device {
 
 	uint64_t	dyntrans_write_low;
 	uint64_t	dyntrans_write_high;
+
+	/*  Saves or restores the device's state, see checkpoint.h:  */
+	void		(*checkpoint)(struct checkpoint *, void *extra);
+};
+
+
+/*
+ *  Device page index
+ *  -----------------
+ *
+ *  Direct-mapped cache of "which device is on this physical page" lookups,
+ *  filled on demand (using a binary search of the sorted devices array) and
+ *  cleared whenever a device is registered or removed.
+ *
+ *  An entry's device field is the index of the only device touching the
+ *  page, MEMORY_DEVICE_INDEX_NONE if no device touches the page at all, or
+ *  MEMORY_DEVICE_INDEX_MULTIPLE if there is more than one device on the page
+ *  (in which case the exact device has to be searched for). The partial flag
+ *  is set if the page is not entirely covered by one device; such a page
+ *  must not be added to the dyntrans translation tables as RAM.
+ */
+#define	MEMORY_DEVICE_INDEX_BITS	10
+#define	N_MEMORY_DEVICE_INDEX_ENTRIES	(1 << MEMORY_DEVICE_INDEX_BITS)
+#define	MEMORY_DEVICE_INDEX_NONE	(-1)
+#define	MEMORY_DEVICE_INDEX_MULTIPLE	(-2)
+
+struct memory_device_index_entry {
+	uint64_t	page;		/*  paddr >> device_index_shift  */
+	int		device;
+	int		partial;
 };
 
 
@@ -79,13 +111,26 @@ struct memory {
 	int		dev_dyntrans_alignment;
 
 	int		n_mmapped_devices;
-	int		last_accessed_device;
 	/*  The following two might speed up things a little bit.  */
 	/*  (actually maxaddr is the addr after the last address)  */
 	uint64_t	mmap_dev_minaddr;
 	uint64_t	mmap_dev_maxaddr;
 
 	struct memory_device *devices;
+
+	int		device_index_shift;
+	struct memory_device_index_entry *device_index;
+
+	/*  Contiguous RAM, from physical address 0 (see memory_map_ram()):  */
+	unsigned char	*ram_base;
+	uint64_t	ram_len;
+
+	/*  Dirty page tracking:  */
+	int		dirty_tracking;
+	struct memory_dirty_block **dirty_table;
+	int		*dirty_list;		/*  memblock numbers  */
+	int		n_dirty_list;
+	int		max_dirty_list;
 };
 
 #define	BITS_PER_PAGETABLE	20
@@ -93,6 +138,29 @@ struct memory {
 #define	MAX_BITS		40
 
 
+/*
+ *  Dirty page tracking
+ *  -------------------
+ *
+ *  When enabled, every page of RAM which is written to is marked as dirty
+ *  in a bitmap, one bitmap per memblock. Clean pages are never mapped as
+ *  writable in the dyntrans translation tables, so the first store to a
+ *  clean page always goes through memory_rw(), where the page is marked.
+ *  The list of memblocks with dirty pages makes it possible to fetch (and
+ *  clear) the dirty pages in time proportional to the number of dirty pages,
+ *  not the size of RAM. See memory_dirty_fetch_and_clear().
+ */
+#define	MEMORY_DIRTY_PAGE_SHIFT		12
+#define	MEMORY_DIRTY_PAGE_SIZE		(1 << MEMORY_DIRTY_PAGE_SHIFT)
+#define	MEMORY_DIRTY_WORDS_PER_BLOCK	\
+	((1 << (BITS_PER_MEMBLOCK - MEMORY_DIRTY_PAGE_SHIFT)) / 64)
+
+struct memory_dirty_block {
+	uint64_t	bits[MEMORY_DIRTY_WORDS_PER_BLOCK];
+	int		listed;		/*  in memory's dirty_list  */
+};
+
+
 /*  memory.c:  */
 #define	MEM_PCI_LITTLE_ENDIAN	128
 uint64_t memory_readmax64(struct cpu *cpu, unsigned char *buf, int len);
@@ -102,6 +170,8 @@ void memory_writemax64(struct cpu *cpu, unsigned char *buf, int len,
 void *zeroed_alloc(size_t s);
 
 struct memory *memory_new(uint64_t physical_max, int arch);
+void memory_map_ram(struct memory *mem, uint64_t len, const char *filename,
+	int hugepages);
 
 int memory_points_to_string(struct cpu *cpu, struct memory *mem,
 	uint64_t addr, int min_string_length);
@@ -111,6 +181,25 @@ char *memory_conv_to_string(struct cpu *cpu, struct memory *mem,
 unsigned char *memory_paddr_to_hostaddr(struct memory *mem,
 	uint64_t paddr, int writeflag);
 
+/*  Scatter/gather list for device DMA, see memory_dma_map():  */
+#define	MEMORY_DMA_MAX_SEGS		32
+struct memory_dma_seg {
+	unsigned char	*host;
+	size_t		len;
+};
+int memory_dma_map(struct memory *mem, uint64_t paddr, size_t len,
+	int writeflag, struct memory_dma_seg *segs, int max_segs);
+void memory_dma_written(struct cpu *cpu, uint64_t paddr, size_t len);
+void memory_dma_copy(struct cpu *cpu, uint64_t paddr, unsigned char *buf,
+	size_t len, int writeflag);
+
+void memory_dirty_tracking_start(struct machine *machine);
+void memory_dirty_tracking_stop(struct machine *machine);
+void memory_mark_dirty(struct memory *mem, uint64_t paddr, size_t len);
+int memory_dirty_write_ok(struct memory *mem, uint64_t paddr, size_t len);
+size_t memory_dirty_fetch_and_clear(struct machine *machine,
+	void (*func)(uint64_t paddr, void *extra), void *extra);
+
 
 /*  Writeflag:  */
 #define	MEM_READ			0
@@ -157,6 +246,10 @@ void memory_device_register(struct memory *mem, const char *,
 	    struct memory *,uint64_t,unsigned char *,size_t,int,void *),
 	void *extra, int flags, unsigned char *dyntrans_data);
 void memory_device_remove(struct memory *mem, int i);
+void memory_device_set_checkpoint(struct memory *mem, void *extra,
+	void (*checkpoint)(struct checkpoint *, void *));
+int memory_device_lookup(struct memory *mem, uint64_t paddr,
+	int *page_is_mixed);
 
 uint64_t memory_checksum(struct memory *mem);
 
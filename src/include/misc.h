@@ -74,6 +74,9 @@ using std::stringstream;
 #include <ostream>
 using std::ostream;
 
+#include <istream>
+using std::istream;
+
 #include <iostream>
 using std::cout;
 using std::cerr;
@@ -34,10 +34,16 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <pthread.h>
 
 struct emul;
-struct ethernet_packet_link;
+struct net_nic;
+struct net_packet;
+struct net_reactor;
+struct net_reactor_source;
+struct net_shm_ring;
 struct remote_net;
+struct tcp_forward;
 
 
 /*  Default emulated "simple" IPv4 network, if nothing else is specified:  */
@@ -62,7 +68,10 @@ struct remote_net;
 /*  NOTE: udp_connection and tcp_connection are actually for
           internal use only.  */
 struct udp_connection {
-	int		in_use;
+	struct udp_connection *hash_next;
+	struct udp_connection *lru_prev;	/*  least recently used  */
+	struct udp_connection *lru_next;	/*  first  */
+
 	int64_t		last_used_timestamp;
 
 	/*  Inside:  */
@@ -76,12 +85,19 @@ struct udp_connection {
 	/*  Outside:  */
 	int		udp_id;
 	int		socket;
+	struct net_reactor_source *source;
 	unsigned char	outside_ip_address[4];
 	int		outside_udp_port;
 };
 
 struct tcp_connection {
-	int		in_use;
+	struct tcp_connection *hash_next;
+
+	/*  On the net's list of connections with unacknowledged data:  */
+	struct tcp_connection *unacked_prev;
+	struct tcp_connection *unacked_next;
+	int		unacked;
+
 	int64_t		last_used_timestamp;
 
 	/*  Inside:  */
@@ -90,21 +106,47 @@ struct tcp_connection {
 	int		inside_tcp_port;
 	uint32_t	inside_timestamp;
 
-	/*  TODO:  tx and rx buffers?  */
-	unsigned char	*incoming_buf;
-	int		incoming_buf_rounds;
-	int		incoming_buf_len;
-	uint32_t	incoming_buf_seqnr;
+	/*  Negotiated in the SYN packets:  */
+	int		inside_mss;
+	int		inside_wscale;		/*  -1 = no window scaling  */
+	int		use_timestamps;
+
+	/*  The guest OS' receive window, and the retransmit timer:  */
+	uint32_t	inside_window;
+	int64_t		rto_deadline;		/*  0 = not running  */
+	int		rto;			/*  in microseconds  */
+	int		n_retransmits;
+
+	/*
+	 *  Data read from the outside socket, which the guest OS has not
+	 *  acknowledged yet. The first byte (send_buf[send_ofs]) has sequence
+	 *  number inside_acknr. Bytes up to outside_seqnr have been sent.
+	 */
+	unsigned char	*send_buf;
+	int		send_ofs;
+	int		send_len;
+
+	/*  Data from the guest OS, not yet written to the outside socket:  */
+	unsigned char	*recv_buf;
+	int		recv_len;
 
 	uint32_t	inside_seqnr;
 	uint32_t	inside_acknr;
 	uint32_t	outside_seqnr;
 	uint32_t	outside_acknr;
 
+	/*  Connection setup and teardown:  */
+	int		syn_acked;	/*  the guest OS has acked our SYN  */
+	int		outside_eof;	/*  read() on the socket returned 0  */
+	int		fin_sent;	/*  our FIN, once all data is sent  */
+	int		fin_acked;
+	int		inside_fin;	/*  the guest OS has sent its FIN  */
+
 	/*  Outside:  */
 	int		state;
 	int		tcp_id;
 	int		socket;
+	struct net_reactor_source *source;
 	unsigned char	outside_ip_address[4];
 	int		outside_tcp_port;
 	uint32_t	outside_timestamp;
@@ -113,20 +155,53 @@ struct tcp_connection {
 /*****************************************************************************/
 
 
-#define	MAX_TCP_CONNECTIONS	100
-#define	MAX_UDP_CONNECTIONS	100
+/*
+ *  NAT connections are kept in hash tables, keyed on the inside and outside
+ *  addresses and ports. (The limits are only there to keep the emulator
+ *  from running out of host file descriptors.) When there are too many UDP
+ *  connections, the least recently used one is reused.
+ */
+#define	MAX_TCP_CONNECTIONS	1024
+#define	MAX_UDP_CONNECTIONS	1024
+#define	NET_CONN_HASH_SIZE	1024
+
+/*
+ *  Like a switch, the network remembers which NIC (or remote network) each
+ *  ethernet address was last seen on, and sends frames for a known unicast
+ *  address only there. Frames for other addresses are sent everywhere.
+ *  Entries which have not been refreshed for NET_MAC_TABLE_AGE seconds are
+ *  forgotten.
+ */
+#define	NET_MAC_TABLE_SIZE	256
+#define	NET_MAC_TABLE_AGE	300
+
+struct net_mac_entry {
+	unsigned char	addr[6];
+	int		valid;
+	int64_t		last_seen;
+
+	/*  A local NIC, or NULL if the address is on a remote network:  */
+	struct net_nic	*nic;
+
+	/*  The remote network, if known:  */
+	struct remote_net *remote;
+};
 
 struct net {
 	/*  The emul struct which this net belong to:  */
 	struct emul	*emul;
 
+	/*  Held by the net_ethernet_*() functions, since NICs in different
+	    machines may run on different host threads:  */
+	pthread_mutex_t	lock;
+
 	/*  The network's addresses:  */
 	struct in_addr	netmask_ipv4;
 	int		netmask_ipv4_len;
 
 	/*  NICs connected to this network:  */
 	int		n_nics;
-	void		**nic_extra;	/*  one void * per NIC  */
+	struct net_nic	**nics;
 
 	/*  The "special machine":  */
 	unsigned char	gateway_ipv4_addr[4];
@@ -139,16 +214,31 @@ struct net {
 
 	int64_t		timestamp;
 
-	struct ethernet_packet_link *first_ethernet_packet;
-	struct ethernet_packet_link *last_ethernet_packet;
+	/*  NAT connections:  */
+	struct udp_connection *udp_hash[NET_CONN_HASH_SIZE];
+	struct udp_connection *udp_lru_first, *udp_lru_last;
+	int		n_udp_connections;
+
+	struct tcp_connection *tcp_hash[NET_CONN_HASH_SIZE];
+	struct tcp_connection *tcp_unacked_first;
+	int		n_tcp_connections;
 
-	struct udp_connection udp_connections[MAX_UDP_CONNECTIONS];
-	struct tcp_connection tcp_connections[MAX_TCP_CONNECTIONS];
+	/*  Waits for the outside sockets to become ready:  */
+	struct net_reactor *reactor;
 
 	/*  Distributed network:  */
 	int		local_port;
 	int		local_port_socket;
+	struct net_reactor_source *local_port_source;
 	struct remote_net *remote_nets;
+	struct net_mac_entry mac_table[NET_MAC_TABLE_SIZE];
+
+	/*  Frames from other emulators on this host (see net_shm.c):  */
+	struct net_shm_ring *shm_ring;
+	int		shm_rx_more;
+
+	/*  Incoming TCP connections, forwarded to the guest OS:  */
+	struct tcp_forward *tcp_forwards;
 };
 
 /*  net_misc.c:  */
@@ -157,29 +247,70 @@ void net_generate_unique_mac(struct machine *, unsigned char *macbuf);
 void send_udp(struct in_addr *addrp, int portnr, unsigned char *packet,
 	size_t len);
 
+/*  net_checksum.c:  */
+uint32_t net_checksum_partial(const unsigned char *data, int len,
+	uint32_t sum);
+uint16_t net_checksum_finish(uint32_t sum);
+void net_checksum_adjust(unsigned char *checksum,
+	const unsigned char *old_data, const unsigned char *new_data, int len);
+int net_checksum_use(const char *name);
+const char *net_checksum_name(void);
+
 /*  net_ip.c:  */
 void net_ip_checksum(unsigned char *ip_header, int chksumoffset, int len);
 void net_ip_tcp_checksum(unsigned char *tcp_header, int chksumoffset,
 	int tcp_len, unsigned char *srcaddr, unsigned char *dstaddr,
 	int udpflag);
-void net_ip_tcp_connectionreply(struct net *net, void *extra,
-	int con_id, int connecting, unsigned char *data, int datalen, int rst);
+int net_ip_tcp_connectionreply(struct net *net, void *extra,
+	struct tcp_connection *con, int flags, unsigned char *data,
+	int datalen);
 void net_ip_broadcast(struct net *net, void *extra,
         unsigned char *packet, int len);
 void net_ip(struct net *net, void *extra, unsigned char *packet, int len);
-void net_udp_rx_avail(struct net *net, void *extra);
 void net_tcp_rx_avail(struct net *net, void *extra);
+void net_tcp_forward_add(struct net *net, const char *spec);
+void net_tcp_forward_learn(struct net *net, unsigned char *ipv4_addr,
+	unsigned char *ethernet_addr);
+
+/*  net_shm.c:  */
+void net_shm_init(struct net *net);
+int net_shm_send(struct net *net, struct remote_net *rnp,
+	unsigned char *packet, int len);
+void net_shm_rx(struct net *net);
+void net_shm_dumpinfo(struct net *net, struct remote_net *rnp);
+
+/*  Return values from net_shm_send():  */
+#define	NET_SHM_NOT_SENT		0
+#define	NET_SHM_SENT			1
+#define	NET_SHM_SENT_WAKEUP		2
+
+/*  net_reactor.c:  */
+struct net_reactor_source *net_reactor_add(struct net *net, int fd,
+	void (*handler)(struct net *, void *extra, void *owner), void *owner);
+void net_reactor_arm(struct net *net, struct net_reactor_source *src,
+	int events);
+void net_reactor_remove(struct net *net, struct net_reactor_source *src);
+int net_reactor_pending(struct net *net);
+void net_reactor_dispatch(struct net *net, void *extra);
+
+/*  Events for net_reactor_arm():  */
+#define	NET_REACTOR_READ		1
+#define	NET_REACTOR_WRITE		2
 
 /*  net.c:  */
-struct ethernet_packet_link *net_allocate_ethernet_packet_link(
-	struct net *net, void *extra, size_t len);
+struct net_packet *net_ethernet_rx_alloc(struct net *net, void *extra,
+	size_t len);
 int net_ethernet_rx_avail(struct net *net, void *extra);
 int net_ethernet_rx(struct net *net, void *extra,
 	unsigned char **packetp, int *lenp);
+unsigned char *net_ethernet_packet_alloc(size_t len);
+void net_ethernet_packet_free(unsigned char *packet);
 void net_ethernet_tx(struct net *net, void *extra,
 	unsigned char *packet, int len);
 void net_dumpinfo(struct net *net);
 void net_add_nic(struct net *net, void *extra, unsigned char *macaddr);
+void net_distributed_deliver(struct net *net, struct in_addr *from_addr,
+	int from_port, unsigned char *packet, int len);
 struct net *net_init(struct emul *emul, int init_flags,
 	const char *ipv4addr, int netipv4len, char **remote, int n_remote,
 	int local_port, const char *settings_prefix);
@@ -189,31 +320,107 @@ struct net *net_init(struct emul *emul, int init_flags,
 
 
 /*
- *  This is for internal use in src/net.c:
+ *  Packet buffers and receive rings:
+ *
+ *  Packets on their way to a NIC are kept in a fixed size receive ring per
+ *  NIC, so finding the next packet for a NIC does not depend on how many
+ *  packets are queued for other NICs. When a NIC's ring is full, further
+ *  packets for it are dropped (and counted). The NAT gateway and the
+ *  distributed network do not read from their sockets while the polling
+ *  NIC has fewer than NET_RX_RING_RESERVE free slots, so that incoming data
+ *  waits in the host's socket buffers instead of being dropped.
+ *
+ *  Packet buffers come from a pool of NET_PACKET_BUF_SIZE byte buffers,
+ *  allocated in slabs, so that there is no malloc()/free() per packet. (Only
+ *  larger packets are allocated individually.) There is always room for
+ *  NET_PACKET_TAILROOM bytes after the packet data, e.g. for a CRC added by
+ *  the NIC. A packet returned by net_ethernet_rx() must be given back using
+ *  net_ethernet_packet_free().
  */
-struct ethernet_packet_link {
-	struct ethernet_packet_link *prev;
-	struct ethernet_packet_link *next;
+#define	NET_PACKET_BUF_SIZE		1536
+#define	NET_PACKET_TAILROOM		4
+#define	NET_PACKETS_PER_SLAB		64
+
+#define	NET_RX_RING_SIZE		256
+#define	NET_RX_RING_RESERVE		64
+
+struct net_packet {
+	struct net_packet *next_free;	/*  in the pool  */
+	int		pooled;		/*  0 if allocated individually  */
 
-	void		*extra;
 	unsigned char	*data;
 	int		len;
 };
 
+struct net_nic {
+	void		*extra;
+
+	struct net_packet *rx_ring[NET_RX_RING_SIZE];
+	int		rx_first;
+	int		rx_count;
+
+	uint64_t	rx_packets;	/*  queued for the NIC  */
+	uint64_t	rx_dropped;	/*  dropped because the ring was full  */
+};
+
 struct remote_net {
 	struct remote_net *next;
 
 	char		*name;
 	struct in_addr	ipv4_addr;
 	int		portnr;
+
+	/*  The remote's shared memory ring, if it runs on this host:  */
+	int		shm_possible;
+	struct net_shm_ring *shm_ring;
+	int64_t		shm_last_attempt;
+	uint64_t	shm_sent;
+	uint64_t	shm_dropped;
+};
+
+/*
+ *  An incoming TCP connection to host port host_port is forwarded to the
+ *  guest OS at inside_ip_address:inside_tcp_port. The guest's ethernet
+ *  address is learned from the packets (and ARP requests) it sends.
+ */
+struct tcp_forward {
+	struct tcp_forward *next;
+
+	int		host_port;
+	int		socket;
+	struct net_reactor_source *source;
+
+	unsigned char	inside_ip_address[4];
+	int		inside_tcp_port;
+	unsigned char	ethernet_address[6];
+	int		ethernet_address_known;
 };
 
-#define	TCP_OUTSIDE_TRYINGTOCONNECT	1
+#define	TCP_OUTSIDE_TRYINGTOCONNECT	1	/*  connect() in progress  */
 #define	TCP_OUTSIDE_CONNECTED		2
-#define	TCP_OUTSIDE_DISCONNECTED	3
-#define	TCP_OUTSIDE_DISCONNECTED2	4
+#define	TCP_INSIDE_TRYINGTOCONNECT	3	/*  SYN sent to the guest OS  */
+
+/*  TCP header flags, for net_ip_tcp_connectionreply():  */
+#define	NET_TCP_FIN			0x01
+#define	NET_TCP_SYN			0x02
+#define	NET_TCP_RST			0x04
+#define	NET_TCP_PSH			0x08
+#define	NET_TCP_ACK			0x10
 
-#define	TCP_INCOMING_BUF_LEN	2000
+/*
+ *  Data is sent to the guest OS in segments of at most the MSS which the
+ *  guest OS announced in its SYN (or 536 bytes, if it didn't), and as many
+ *  at a time as the guest's receive window allows. Unacknowledged data is
+ *  resent when the retransmit timer (in host time) runs out; the timeout is
+ *  doubled for each attempt, and the connection is reset after too many.
+ */
+#define	TCP_MSS				1460
+#define	TCP_DEFAULT_MSS			536
+#define	TCP_SEND_BUF_LEN		65536
+#define	TCP_RECV_BUF_LEN		65535
+#define	TCP_RTO_INITIAL			300000
+#define	TCP_RTO_MAX			8000000
+#define	TCP_MAX_RETRANSMITS		12
 
 #define	NET_ADDR_IPV4		1
 #define	NET_ADDR_IPV6		2
@@ -8,6 +8,7 @@
 	struct DYNTRANS_TC_PHYSPAGE *ppp_tmp;				\
 	ppp_tmp = cpu->cd.DYNTRANS_ARCH.phys_page[pc_tmp32 >> 12];	\
 	if (ppp_tmp != NULL) {						\
+		ppp_tmp->referenced = 1;				\
 		cpu->cd.DYNTRANS_ARCH.cur_ic_page = &ppp_tmp->ics[0];	\
 		cpu->cd.DYNTRANS_ARCH.next_ic =				\
 		    cpu->cd.DYNTRANS_ARCH.cur_ic_page +			\
@@ -81,6 +81,19 @@ public:
 		}
 	}
 
+	/**
+	 * \brief Gets the reference count of the object.
+	 *
+	 * Useful e.g. for copy-on-write objects, which may be modified
+	 * in place only when there is a single reference to them.
+	 *
+	 * @return The number of reference counted pointers to the object.
+	 */
+	int get_refcount() const
+	{
+		return m_refCount;
+	}
+
 private:
 	template<class T> friend class refcount_ptr;
 
@@ -37,7 +37,9 @@ struct timer *timer_add(double freq, void (*timer_tick)(struct timer *timer,
 void timer_remove(struct timer *t);
 
 void timer_update_frequency(struct timer *t, double new_freq);
+double timer_get_frequency(struct timer *t);
 
+void timer_poll(void);
 void timer_start(void);
 void timer_stop(void);
 
@@ -28,6 +28,8 @@
  *  Machine registry.
  */
 
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
@@ -35,6 +37,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "checkpoint.h"
 #include "cpu.h"
 #include "device.h"
 #include "diskimage.h"
@@ -49,6 +52,48 @@
 /*  This is initialized by machine_init():  */
 struct machine_entry *first_machine_entry = NULL;
 
+extern int single_step;
+
+
+/*
+ *  Host-threaded SMP state:
+ *
+ *  CPU 0 is run on the calling (main) thread, CPUs 1..ncpus-1 on one worker
+ *  thread each. All CPUs run one dyntrans quantum, and then wait for each
+ *  other. Tick functions, interrupts from tick functions, and cross-CPU
+ *  translation cache invalidations are handled by the main thread while all
+ *  workers are parked.
+ */
+#define	SMP_MAX_NOTES		64
+
+struct machine_smp_cpu {
+	pthread_t		thread;
+	int			instrs_run;
+
+	/*  Physical pages to invalidate in the other CPUs:  */
+	int			n_notes;
+	int			notes_overflowed;
+	uint64_t		note_paddr[SMP_MAX_NOTES];
+	int			note_kind[SMP_MAX_NOTES];
+};
+
+struct machine_smp {
+	struct machine		*machine;
+
+	/*  Serializes device accesses and cross-CPU atomic sequences:  */
+	pthread_mutex_t		lock;
+
+	/*  Quantum start/end synchronization:  */
+	pthread_mutex_t		sync_mutex;
+	pthread_cond_t		start_cond;
+	pthread_cond_t		done_cond;
+	uint64_t		generation;
+	int			n_running_workers;
+	int			shutdown;
+
+	struct machine_smp_cpu	*cpu;
+};
+
 
 /*
  *  machine_new():
@@ -105,6 +150,9 @@ struct machine *machine_new(char *name, struct emul *emul, int id)
 	settings_add(m->settings, "allow_instruction_combinations", 0,
 	    SETTINGS_TYPE_INT, SETTINGS_FORMAT_YESNO,
 	    (void *) &m->allow_instruction_combinations);
+	settings_add(m->settings, "threaded_smp", 0,
+	    SETTINGS_TYPE_INT, SETTINGS_FORMAT_YESNO,
+	    (void *) &m->threaded_smp);
 	settings_add(m->settings, "n_gfx_cards", 0,
 	    SETTINGS_TYPE_INT, SETTINGS_FORMAT_DECIMAL,
 	    (void *) &m->n_gfx_cards);
@@ -136,6 +184,11 @@ void machine_destroy(struct machine *machine)
 	if (machine->path != NULL)
 		free(machine->path);
 
+	if (machine->ram_filename != NULL)
+		free(machine->ram_filename);
+
+	machine_smp_stop(machine);
+
 	/*  Remove any remaining level-1 settings:  */
 	settings_remove_all(machine->settings);
 	settings_destroy(machine->settings);
@@ -266,30 +319,268 @@ void machine_add_breakpoint_string(struct machine *machine, char *str)
 
 
 /*
- *  machine_add_tickfunction():
+ *  machine_event_heap_swap(), machine_event_heap_up(),
+ *  machine_event_heap_down():
  *
- *  Adds a tick function (a function called every now and then, depending on
- *  clock cycle count) to a machine.
+ *  Helper functions for maintaining the event priority queue.
+ */
+static void machine_event_heap_swap(struct machine_events *evs, int a, int b)
+{
+	struct machine_event *tmp = evs->heap[a];
+
+	evs->heap[a] = evs->heap[b];
+	evs->heap[b] = tmp;
+	evs->heap[a]->heap_index = a;
+	evs->heap[b]->heap_index = b;
+}
+
+static void machine_event_heap_up(struct machine_events *evs, int i)
+{
+	while (i > 0) {
+		int parent = (i - 1) / 2;
+		if (evs->heap[parent]->when <= evs->heap[i]->when)
+			break;
+		machine_event_heap_swap(evs, parent, i);
+		i = parent;
+	}
+}
+
+static void machine_event_heap_down(struct machine_events *evs, int i)
+{
+	for (;;) {
+		int smallest = i, l = 2*i + 1, r = 2*i + 2;
+
+		if (l < evs->n_scheduled &&
+		    evs->heap[l]->when < evs->heap[smallest]->when)
+			smallest = l;
+		if (r < evs->n_scheduled &&
+		    evs->heap[r]->when < evs->heap[smallest]->when)
+			smallest = r;
+		if (smallest == i)
+			break;
+
+		machine_event_heap_swap(evs, smallest, i);
+		i = smallest;
+	}
+}
+
+
+/*
+ *  machine_event_new():
+ *
+ *  Creates a new event for a machine. The event is not scheduled; use
+ *  machine_event_schedule() for that. func is called with cpu0 as the cpu
+ *  argument when the event fires.
+ */
+struct machine_event *machine_event_new(struct machine *machine,
+	void (*func)(struct cpu *, void *), void *extra)
+{
+	struct machine_events *evs = &machine->events;
+	struct machine_event *ev;
+	int n = evs->n_events;
+
+	CHECK_ALLOCATION(ev = (struct machine_event *)
+	    malloc(sizeof(struct machine_event)));
+	memset(ev, 0, sizeof(struct machine_event));
+	ev->heap_index = -1;
+	ev->f = func;
+	ev->extra = extra;
+
+	/*  The heap can never be larger than the list of all events.  */
+	CHECK_ALLOCATION(evs->events = (struct machine_event **) realloc(
+	    evs->events, (n+1) * sizeof(struct machine_event *)));
+	CHECK_ALLOCATION(evs->heap = (struct machine_event **) realloc(
+	    evs->heap, (n+1) * sizeof(struct machine_event *)));
+
+	evs->events[n] = ev;
+	evs->n_events = n + 1;
+
+	return ev;
+}
+
+
+/*
+ *  machine_event_schedule():
  *
- *  If tickshift is non-zero, a tick will occur every (1 << tickshift) cycles.
- *  This is used for the normal (fast dyntrans) emulation modes.
+ *  Schedules an event to fire after delay cpu0 cycles. If period is
+ *  non-zero, the event is then fired every period cycles until it is
+ *  cancelled. An event which is already scheduled is moved.
  *
- *  If tickshift is zero, then this is a cycle-accurate tick function.
- *  The hz value is used in this case.
+ *  Events are only checked between dyntrans quanta, so an event may fire
+ *  up to one quantum late.
  */
-void machine_add_tickfunction(struct machine *machine, void (*func)
-	(struct cpu *, void *), void *extra, int tickshift)
+void machine_event_schedule(struct machine *machine,
+	struct machine_event *ev, uint64_t delay, uint64_t period)
 {
-	int n = machine->tick_functions.n_entries;
+	struct machine_events *evs = &machine->events;
+
+	ev->when = evs->now + delay;
+	ev->period = period;
+
+	if (ev->heap_index < 0) {
+		ev->heap_index = evs->n_scheduled ++;
+		evs->heap[ev->heap_index] = ev;
+	}
+
+	machine_event_heap_up(evs, ev->heap_index);
+	machine_event_heap_down(evs, ev->heap_index);
+}
+
+
+/*
+ *  machine_event_cancel():
+ *
+ *  Removes an event from the queue. (Does nothing if the event is not
+ *  scheduled.)
+ */
+void machine_event_cancel(struct machine *machine, struct machine_event *ev)
+{
+	struct machine_events *evs = &machine->events;
+	int i = ev->heap_index;
+
+	if (i < 0)
+		return;
+
+	ev->heap_index = -1;
+	evs->n_scheduled --;
+	if (i == evs->n_scheduled)
+		return;
+
+	evs->heap[i] = evs->heap[evs->n_scheduled];
+	evs->heap[i]->heap_index = i;
+	machine_event_heap_up(evs, i);
+	machine_event_heap_down(evs, i);
+}
+
+
+/*
+ *  machine_event_resume():
+ *
+ *  Schedules a cancelled periodic event again, to fire one period from now.
+ *  (Does nothing if the event is already scheduled.) This is meant to be
+ *  called by devices when they stop being idle.
+ */
+void machine_event_resume(struct machine *machine, struct machine_event *ev)
+{
+	if (ev->heap_index < 0 && ev->period != 0)
+		machine_event_schedule(machine, ev, ev->period, ev->period);
+}
 
-	CHECK_ALLOCATION(machine->tick_functions.ticks_till_next = (int *) realloc(
-	    machine->tick_functions.ticks_till_next, (n+1) * sizeof(int)));
-	CHECK_ALLOCATION(machine->tick_functions.ticks_reset_value = (int *) realloc(
-	    machine->tick_functions.ticks_reset_value, (n+1) * sizeof(int)));
-	CHECK_ALLOCATION(machine->tick_functions.f = (void (**)(cpu*,void*)) realloc(
-	    machine->tick_functions.f, (n+1) * sizeof(void *)));
-	CHECK_ALLOCATION(machine->tick_functions.extra = (void **) realloc(
-	    machine->tick_functions.extra, (n+1) * sizeof(void *)));
+
+/*
+ *  machine_events_run():
+ *
+ *  Advances the event clock by cycles, and fires all events which are due.
+ *  A periodic event which has fallen behind by several periods is only
+ *  fired once.
+ */
+static void machine_events_run(struct machine *machine, int cycles)
+{
+	struct machine_events *evs = &machine->events;
+
+	evs->now += cycles;
+
+	while (evs->n_scheduled > 0 && evs->heap[0]->when <= evs->now) {
+		struct machine_event *ev = evs->heap[0];
+
+		if (ev->period != 0) {
+			while (ev->when <= evs->now)
+				ev->when += ev->period;
+			machine_event_heap_down(evs, 0);
+		} else {
+			machine_event_cancel(machine, ev);
+		}
+
+		ev->f(machine->cpus[0], ev->extra);
+	}
+}
+
+
+/*
+ *  machine_events_tick_all():
+ *
+ *  Calls the function of every event in the machine, whether it is
+ *  scheduled or not. Used e.g. to let framebuffers draw their last updates
+ *  before the emulator exits.
+ */
+void machine_events_tick_all(struct machine *machine, struct cpu *cpu)
+{
+	int i;
+
+	for (i=0; i<machine->events.n_events; i++)
+		machine->events.events[i]->f(cpu,
+		    machine->events.events[i]->extra);
+}
+
+
+/*
+ *  machine_events_checkpoint():
+ *
+ *  Saves or restores the event clock, and the time and period of every
+ *  event, whether it is scheduled or cancelled. The events themselves are
+ *  created when the machine is set up, so only their number is checked.
+ *  When restoring, the heap is rebuilt from the scheduled events.
+ */
+void machine_events_checkpoint(struct machine *machine,
+	struct checkpoint *ckpt)
+{
+	struct machine_events *evs = &machine->events;
+	uint64_t n = evs->n_events;
+	int i;
+
+	CHECKPOINT_VAR(ckpt, n);
+	if (ckpt->restoring && !ckpt->failed && n != (uint64_t)evs->n_events) {
+		checkpoint_error(ckpt, "number of events does not match (it is"
+		    " %i in the checkpoint, but %i now)", (int) n,
+		    evs->n_events);
+		return;
+	}
+
+	CHECKPOINT_VAR(ckpt, evs->now);
+
+	for (i=0; i<evs->n_events && !ckpt->failed; i++) {
+		struct machine_event *ev = evs->events[i];
+		int scheduled = ev->heap_index >= 0;
+
+		CHECKPOINT_VAR(ckpt, ev->when);
+		CHECKPOINT_VAR(ckpt, ev->period);
+		CHECKPOINT_VAR(ckpt, scheduled);
+
+		if (ckpt->restoring)
+			ev->heap_index = scheduled? 0 : -1;
+	}
+
+	if (!ckpt->restoring || ckpt->failed)
+		return;
+
+	evs->n_scheduled = 0;
+	for (i=0; i<evs->n_events; i++) {
+		struct machine_event *ev = evs->events[i];
+
+		if (ev->heap_index < 0)
+			continue;
+
+		ev->heap_index = evs->n_scheduled ++;
+		evs->heap[ev->heap_index] = ev;
+		machine_event_heap_up(evs, ev->heap_index);
+	}
+}
+
+
+/*
+ *  machine_add_tickfunction():
+ *
+ *  Adds a tick function (a function called every now and then, depending on
+ *  clock cycle count) to a machine. A tick will occur every (1 << tickshift)
+ *  cycles, starting after the first quantum.
+ *
+ *  The returned event may be cancelled by the device while it is idle, and
+ *  resumed using machine_event_resume().
+ */
+struct machine_event *machine_add_tickfunction(struct machine *machine,
+	void (*func)(struct cpu *, void *), void *extra, int tickshift)
+{
+	struct machine_event *ev;
 
 	/*
 	 *  The dyntrans subsystem wants to run code in relatively
@@ -303,12 +594,10 @@ void machine_add_tickfunction(struct machine *machine, void (*func)
 		exit(1);
 	}
 
-	machine->tick_functions.ticks_till_next[n]   = 0;
-	machine->tick_functions.ticks_reset_value[n] = 1 << tickshift;
-	machine->tick_functions.f[n]                 = func;
-	machine->tick_functions.extra[n]             = extra;
+	ev = machine_event_new(machine, func, extra);
+	machine_event_schedule(machine, ev, 0, 1 << tickshift);
 
-	machine->tick_functions.n_entries = n + 1;
+	return ev;
 }
 
 
@@ -604,6 +893,304 @@ void machine_default_cputype(struct machine *m)
 /*****************************************************************************/
 
 
+/*
+ *  machine_smp_lock(), machine_smp_unlock():
+ *
+ *  Take or release the machine-wide SMP lock. Only call these when
+ *  machine->smp is non-NULL (use the MACHINE_SMP_LOCK macros).
+ */
+void machine_smp_lock(struct machine *machine)
+{
+	pthread_mutex_lock(&machine->smp->lock);
+}
+
+void machine_smp_unlock(struct machine *machine)
+{
+	pthread_mutex_unlock(&machine->smp->lock);
+}
+
+
+/*
+ *  machine_smp_note_paddr():
+ *
+ *  Called by a CPU when a physical page has been written to or mapped as
+ *  writable (SMP_NOTE_CODE_WRITE), or when it has started to contain code
+ *  translations (SMP_NOTE_CODE_PAGE). The other CPUs' translation caches are
+ *  updated accordingly at the end of the current quantum.
+ */
+void machine_smp_note_paddr(struct cpu *cpu, uint64_t paddr, int kind)
+{
+	struct machine_smp_cpu *sc;
+	int n;
+
+	if (cpu->machine->smp == NULL)
+		return;
+
+	sc = &cpu->machine->smp->cpu[cpu->cpu_id];
+	n = sc->n_notes;
+	paddr &= ~(uint64_t)(cpu->machine->arch_pagesize - 1);
+
+	/*  Most notes are repeats of the previous one:  */
+	if (n > 0 && sc->note_paddr[n-1] == paddr && sc->note_kind[n-1] == kind)
+		return;
+
+	if (n >= SMP_MAX_NOTES) {
+		sc->notes_overflowed = 1;
+		return;
+	}
+
+	sc->note_paddr[n] = paddr;
+	sc->note_kind[n] = kind;
+	sc->n_notes = n + 1;
+}
+
+
+/*
+ *  machine_smp_apply_notes():
+ *
+ *  Propagate each CPU's noted pages to all other CPUs. Must only be called
+ *  when no CPU is running (i.e. between quanta).
+ */
+static void machine_smp_apply_notes(struct machine *machine)
+{
+	struct machine_smp *smp = machine->smp;
+	int i, j, k;
+
+	for (i=0; i<machine->ncpus; i++) {
+		struct machine_smp_cpu *sc = &smp->cpu[i];
+
+		if (sc->n_notes == 0 && !sc->notes_overflowed)
+			continue;
+
+		for (j=0; j<machine->ncpus; j++) {
+			struct cpu *other = machine->cpus[j];
+
+			if (j == i || other->invalidate_code_translation
+			    == NULL)
+				continue;
+
+			if (sc->notes_overflowed) {
+				/*  Too many pages; start over from scratch,
+				    which also marks all pages as writable.  */
+				cpu_create_or_reset_tc(other);
+				other->invalidate_translation_caches(other, 0,
+				    INVALIDATE_ALL);
+				continue;
+			}
+
+			for (k=0; k<sc->n_notes; k++) {
+				if (sc->note_kind[k] == SMP_NOTE_CODE_WRITE)
+					other->invalidate_code_translation(
+					    other, sc->note_paddr[k],
+					    INVALIDATE_PADDR);
+				else
+					other->invalidate_translation_caches(
+					    other, sc->note_paddr[k],
+					    JUST_MARK_AS_NON_WRITABLE |
+					    INVALIDATE_PADDR);
+			}
+		}
+
+		sc->n_notes = 0;
+		sc->notes_overflowed = 0;
+	}
+}
+
+
+/*
+ *  machine_smp_worker():
+ *
+ *  Host thread main loop for one emulated CPU (not CPU 0).
+ */
+static void *machine_smp_worker(void *arg)
+{
+	struct cpu *cpu = (struct cpu *) arg;
+	struct machine_smp *smp = cpu->machine->smp;
+	uint64_t generation = 0;
+	sigset_t sigs;
+
+	/*  Signals (CTRL-C) are handled by the main thread:  */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGCONT);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	for (;;) {
+		pthread_mutex_lock(&smp->sync_mutex);
+		while (smp->generation == generation && !smp->shutdown)
+			pthread_cond_wait(&smp->start_cond, &smp->sync_mutex);
+		if (smp->shutdown) {
+			pthread_mutex_unlock(&smp->sync_mutex);
+			break;
+		}
+		generation = smp->generation;
+		pthread_mutex_unlock(&smp->sync_mutex);
+
+		smp->cpu[cpu->cpu_id].instrs_run = 0;
+		if (cpu->running)
+			smp->cpu[cpu->cpu_id].instrs_run =
+			    cpu->run_instr(cpu);
+
+		pthread_mutex_lock(&smp->sync_mutex);
+		if (--smp->n_running_workers == 0)
+			pthread_cond_signal(&smp->done_cond);
+		pthread_mutex_unlock(&smp->sync_mutex);
+	}
+
+	return NULL;
+}
+
+
+/*
+ *  machine_smp_start():
+ *
+ *  Create one host thread for each emulated CPU except CPU 0.
+ */
+static void machine_smp_start(struct machine *machine)
+{
+	pthread_mutexattr_t attr;
+	struct machine_smp *smp;
+	int i;
+
+	CHECK_ALLOCATION(smp = (struct machine_smp *)
+	    malloc(sizeof(struct machine_smp)));
+	memset(smp, 0, sizeof(struct machine_smp));
+
+	CHECK_ALLOCATION(smp->cpu = (struct machine_smp_cpu *)
+	    malloc(sizeof(struct machine_smp_cpu) * machine->ncpus));
+	memset(smp->cpu, 0, sizeof(struct machine_smp_cpu) * machine->ncpus);
+
+	smp->machine = machine;
+
+	/*  Recursive, since e.g. a locked MIPS sc may access a device:  */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&smp->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	pthread_mutex_init(&smp->sync_mutex, NULL);
+	pthread_cond_init(&smp->start_cond, NULL);
+	pthread_cond_init(&smp->done_cond, NULL);
+
+	machine->smp = smp;
+
+	for (i=1; i<machine->ncpus; i++) {
+		if (pthread_create(&smp->cpu[i].thread, NULL,
+		    machine_smp_worker, machine->cpus[i]) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+
+	debug("[ %s: running %i CPUs on separate host threads ]\n",
+	    machine->path, machine->ncpus);
+}
+
+
+/*
+ *  machine_smp_stop():
+ *
+ *  Stop all host threads started by machine_smp_start(). (Does nothing if
+ *  no threads are running.)
+ */
+void machine_smp_stop(struct machine *machine)
+{
+	struct machine_smp *smp = machine->smp;
+	int i;
+
+	if (smp == NULL)
+		return;
+
+	pthread_mutex_lock(&smp->sync_mutex);
+	smp->shutdown = 1;
+	pthread_cond_broadcast(&smp->start_cond);
+	pthread_mutex_unlock(&smp->sync_mutex);
+
+	for (i=1; i<machine->ncpus; i++)
+		pthread_join(smp->cpu[i].thread, NULL);
+
+	machine->smp = NULL;
+
+	pthread_cond_destroy(&smp->done_cond);
+	pthread_cond_destroy(&smp->start_cond);
+	pthread_mutex_destroy(&smp->sync_mutex);
+	pthread_mutex_destroy(&smp->lock);
+	free(smp->cpu);
+	free(smp);
+}
+
+
+/*
+ *  machine_smp_run_quantum():
+ *
+ *  Run one quantum on all CPUs in parallel, and wait for all of them to
+ *  finish. Returns the number of instructions executed by CPU 0.
+ */
+static int machine_smp_run_quantum(struct machine *machine)
+{
+	struct machine_smp *smp = machine->smp;
+	struct cpu *cpu0 = machine->cpus[0];
+	int cpu0instrs = 0;
+
+	pthread_mutex_lock(&smp->sync_mutex);
+	smp->n_running_workers = machine->ncpus - 1;
+	smp->generation ++;
+	pthread_cond_broadcast(&smp->start_cond);
+	pthread_mutex_unlock(&smp->sync_mutex);
+
+	if (cpu0->running)
+		cpu0instrs = cpu0->run_instr(cpu0);
+
+	pthread_mutex_lock(&smp->sync_mutex);
+	while (smp->n_running_workers > 0)
+		pthread_cond_wait(&smp->done_cond, &smp->sync_mutex);
+	pthread_mutex_unlock(&smp->sync_mutex);
+
+	machine_smp_apply_notes(machine);
+
+	return cpu0instrs;
+}
+
+
+/*  Max number of dyntrans quanta run by machine_run() between events:  */
+#define	MAX_QUANTA_PER_RUN	16
+
+
+/*
+ *  machine_run_quantum():
+ *
+ *  Runs one dyntrans quantum on all running CPUs in the machine. Returns the
+ *  number of instructions executed on cpu0.
+ */
+static int machine_run_quantum(struct machine *machine)
+{
+	struct cpu **cpus = machine->cpus;
+	int ncpus = machine->ncpus, cpu0instrs = 0, i;
+
+	if (machine->threaded_smp && ncpus > 1 && !single_step &&
+	    !machine->instruction_trace && !machine->register_dump &&
+	    !machine->statistics.enabled) {
+		if (machine->smp == NULL)
+			machine_smp_start(machine);
+
+		return machine_smp_run_quantum(machine);
+	}
+
+	for (i=0; i<ncpus; i++) {
+		if (cpus[i]->running) {
+			int instrs_run = cpus[i]->run_instr(cpus[i]);
+			if (i == 0)
+				cpu0instrs += instrs_run;
+		}
+	}
+
+	/*  Pages noted while running on the main thread:  */
+	if (machine->smp != NULL)
+		machine_smp_apply_notes(machine);
+
+	return cpu0instrs;
+}
+
+
 /*
  *  machine_run():
  *
@@ -611,43 +1198,44 @@ void machine_default_cputype(struct machine *m)
  *  around N_SAFE_DYNTRANS_LIMIT instructions will be run by the dyntrans
  *  system.)
  *
+ *  If no event is due within the next quantum, up to MAX_QUANTA_PER_RUN
+ *  quanta are run back to back before returning. Single-stepping and
+ *  instruction tracing always return after one quantum.
+ *
+ *  If threaded SMP is enabled, all CPUs run concurrently on separate host
+ *  threads. Single-stepping, tracing, and statistics gathering always run
+ *  the CPUs one after another on the main thread.
+ *
  *  Return value is 1 if any CPU in this machine is still running,
  *  or 0 if all CPUs are stopped.
  */
 int machine_run(struct machine *machine)
 {
 	struct cpu **cpus = machine->cpus;
-	int ncpus = machine->ncpus, cpu0instrs = 0, i, te;
+	struct machine_events *evs = &machine->events;
+	int ncpus = machine->ncpus, cpu0instrs = 0, n_quanta = 0, i;
 
-	for (i=0; i<ncpus; i++) {
-		if (cpus[i]->running) {
-			int instrs_run = cpus[i]->run_instr(cpus[i]);
-			if (i == 0)
-				cpu0instrs += instrs_run;
-		}
+	for (;;) {
+		int instrs_run = machine_run_quantum(machine);
+
+		cpu0instrs += instrs_run;
+		if (instrs_run <= 0 || ++n_quanta >= MAX_QUANTA_PER_RUN ||
+		    single_step || machine->instruction_trace ||
+		    machine->register_dump || !cpus[0]->running)
+			break;
+
+		/*  Stop if the next event may be due during the next quantum:  */
+		if (evs->n_scheduled > 0 && evs->heap[0]->when <=
+		    evs->now + cpu0instrs + N_SAFE_DYNTRANS_LIMIT)
+			break;
 	}
 
 	/*
-	 *  Hardware 'ticks':  (clocks, interrupt sources...)
+	 *  Hardware events:  (clocks, interrupt sources...)
 	 *
 	 *  Here, cpu0instrs is the number of instructions executed on cpu0.
-	 *
-	 *  TODO: This should be redesigned into some "mainbus" stuff instead!
 	 */
-
-	for (te=0; te<machine->tick_functions.n_entries; te++) {
-		machine->tick_functions.ticks_till_next[te] -= cpu0instrs;
-		if (machine->tick_functions.ticks_till_next[te] <= 0) {
-			while (machine->tick_functions.ticks_till_next[te]<=0) {
-				machine->tick_functions.ticks_till_next[te] +=
-				    machine->tick_functions.
-				    ticks_reset_value[te];
-			}
-
-			machine->tick_functions.f[te](cpus[0],
-			    machine->tick_functions.extra[te]);
-		}
-	}
+	machine_events_run(machine, cpu0instrs);
 
 	/*  Is any CPU still alive?  */
 	for (i=0; i<ncpus; i++)
@@ -0,0 +1,380 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ */
+
+#include <string.h>
+
+#include "BinarySerialization.h"
+#include "lz4_block.h"
+
+
+// The magic string. The 0x1a byte makes e.g. "type" stop at the header on
+// some systems, and the file does not look like a text component tree.
+static const char magic[8] = { 'G', 'X', 'E', 'M', 'U', 'L', 0x1a, '\n' };
+
+// Block storage methods:
+#define	BLOCK_STORED		0
+#define	BLOCK_LZ4		1
+
+
+void BinarySerialization::WriteHeader(ostream& os)
+{
+	os.write(magic, sizeof(magic));
+	WriteNumber(os, Version);
+}
+
+
+bool BinarySerialization::ReadHeader(istream& is, ostream& messages)
+{
+	char buf[sizeof(magic)];
+	is.read(buf, sizeof(buf));
+	if (is.gcount() != sizeof(buf) || !HasMagic(buf, sizeof(buf))) {
+		messages << "Not a binary GXemul file.\n";
+		return false;
+	}
+
+	uint64_t version;
+	if (!ReadNumber(is, version)) {
+		messages << "Truncated binary GXemul file.\n";
+		return false;
+	}
+
+	if (version > Version) {
+		messages << "Binary GXemul file format version " << version
+		    << " is not supported (this version of GXemul supports "
+		    "up to version " << Version << ").\n";
+		return false;
+	}
+
+	return true;
+}
+
+
+bool BinarySerialization::HasMagic(const char* buf, size_t len)
+{
+	return len >= sizeof(magic) && memcmp(buf, magic, sizeof(magic)) == 0;
+}
+
+
+void BinarySerialization::WriteByte(ostream& os, uint8_t value)
+{
+	os.put((char) value);
+}
+
+
+bool BinarySerialization::ReadByte(istream& is, uint8_t& value)
+{
+	int ch = is.get();
+	if (ch == EOF)
+		return false;
+
+	value = ch;
+	return true;
+}
+
+
+void BinarySerialization::WriteNumber(ostream& os, uint64_t value)
+{
+	char buf[10];
+	size_t n = 0;
+
+	while (value >= 0x80) {
+		buf[n++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+
+	buf[n++] = value;
+	os.write(buf, n);
+}
+
+
+bool BinarySerialization::ReadNumber(istream& is, uint64_t& value)
+{
+	value = 0;
+
+	for (int shift = 0; shift < 64; shift += 7) {
+		uint8_t b;
+		if (!ReadByte(is, b))
+			return false;
+
+		value |= (uint64_t)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+
+	// Too many bytes.
+	return false;
+}
+
+
+void BinarySerialization::WriteString(ostream& os, const string& str)
+{
+	WriteNumber(os, str.length());
+	os.write(str.data(), str.length());
+}
+
+
+bool BinarySerialization::ReadString(istream& is, string& str)
+{
+	uint64_t len;
+	if (!ReadNumber(is, len) || len > MaxBlockSize)
+		return false;
+
+	str.resize(len);
+	if (len > 0)
+		is.read(&str[0], len);
+
+	return (uint64_t) is.gcount() == len || len == 0;
+}
+
+
+void BinarySerialization::WriteBlock(ostream& os, const uint8_t* data,
+	size_t len, bool compress)
+{
+	if (len == 0 || len > MaxBlockSize) {
+		std::cerr << "BinarySerialization::WriteBlock: invalid length "
+		    << len << "\n";
+		throw std::exception();
+	}
+
+	WriteNumber(os, len);
+
+	if (compress) {
+		vector<uint8_t> compressed(len);
+		size_t compressedLen = Compress(data, len, &compressed[0], len);
+
+		// Only worth it if at least 1/8 is saved:
+		if (compressedLen > 0 && compressedLen <= len - len / 8) {
+			WriteByte(os, BLOCK_LZ4);
+			WriteNumber(os, compressedLen);
+			os.write((const char*) &compressed[0], compressedLen);
+			return;
+		}
+	}
+
+	WriteByte(os, BLOCK_STORED);
+	os.write((const char*) data, len);
+}
+
+
+void BinarySerialization::WriteEndOfBlocks(ostream& os)
+{
+	WriteNumber(os, 0);
+}
+
+
+bool BinarySerialization::ReadBlock(istream& is, vector<uint8_t>& data)
+{
+	uint64_t len;
+	uint8_t method;
+
+	data.clear();
+
+	if (!ReadNumber(is, len) || len > MaxBlockSize)
+		return false;
+
+	if (len == 0)
+		return true;
+
+	if (!ReadByte(is, method))
+		return false;
+
+	data.resize(len);
+
+	switch (method) {
+
+	case BLOCK_STORED:
+		is.read((char*) &data[0], len);
+		return (uint64_t) is.gcount() == len;
+
+	case BLOCK_LZ4:
+		{
+			uint64_t compressedLen;
+			if (!ReadNumber(is, compressedLen) ||
+			    compressedLen > len)
+				return false;
+
+			vector<uint8_t> compressed(compressedLen);
+			is.read((char*) &compressed[0], compressedLen);
+			if ((uint64_t) is.gcount() != compressedLen)
+				return false;
+
+			return Decompress(&compressed[0], compressedLen,
+			    &data[0], len) == (ssize_t) len;
+		}
+	}
+
+	return false;
+}
+
+
+bool BinarySerialization::SkipBlocks(istream& is)
+{
+	vector<uint8_t> data;
+
+	do {
+		if (!ReadBlock(is, data))
+			return false;
+	} while (data.size() > 0);
+
+	return true;
+}
+
+
+size_t BinarySerialization::Compress(const uint8_t* src, size_t len,
+	uint8_t* dst, size_t dstMax)
+{
+	return lz4_block_compress(src, len, dst, dstMax);
+}
+
+
+ssize_t BinarySerialization::Decompress(const uint8_t* src, size_t srcLen,
+	uint8_t* dst, size_t dstLen)
+{
+	return lz4_block_decompress(src, srcLen, dst, dstLen);
+}
+
+
+/*****************************************************************************/
+
+
+#ifdef WITHUNITTESTS
+
+static void Test_BinarySerialization_Numbers()
+{
+	stringstream ss;
+	BinarySerialization::WriteNumber(ss, 0);
+	BinarySerialization::WriteNumber(ss, 127);
+	BinarySerialization::WriteNumber(ss, 128);
+	BinarySerialization::WriteNumber(ss, 0xffffffffffffffffULL);
+
+	UnitTest::Assert("unexpected encoded length", ss.str().length(),
+	    1 + 1 + 2 + 10);
+
+	uint64_t value = 42;
+	UnitTest::Assert("read 0", BinarySerialization::ReadNumber(ss, value));
+	UnitTest::Assert("value 0", value, 0);
+	BinarySerialization::ReadNumber(ss, value);
+	UnitTest::Assert("value 127", value, 127);
+	BinarySerialization::ReadNumber(ss, value);
+	UnitTest::Assert("value 128", value, 128);
+	BinarySerialization::ReadNumber(ss, value);
+	UnitTest::Assert("value max", value, 0xffffffffffffffffULL);
+
+	UnitTest::Assert("read past end should fail",
+	    !BinarySerialization::ReadNumber(ss, value));
+}
+
+static void Test_BinarySerialization_Strings()
+{
+	stringstream ss;
+	BinarySerialization::WriteString(ss, "");
+	BinarySerialization::WriteString(ss, string("a\0b\n", 4));
+
+	string str = "x";
+	UnitTest::Assert("read empty", BinarySerialization::ReadString(ss, str));
+	UnitTest::Assert("empty string", str, "");
+	UnitTest::Assert("read binary", BinarySerialization::ReadString(ss, str));
+	UnitTest::Assert("binary string", str == string("a\0b\n", 4));
+}
+
+static void Test_BinarySerialization_Header()
+{
+	stringstream ss;
+	BinarySerialization::WriteHeader(ss);
+	UnitTest::Assert("magic", BinarySerialization::HasMagic(
+	    ss.str().data(), ss.str().length()));
+
+	stringstream messages;
+	UnitTest::Assert("valid header",
+	    BinarySerialization::ReadHeader(ss, messages));
+
+	stringstream text("component root\n{\n}\n");
+	UnitTest::Assert("text is not binary",
+	    !BinarySerialization::ReadHeader(text, messages));
+}
+
+static void Test_BinarySerialization_Compress()
+{
+	vector<uint8_t> data(65536);
+	for (size_t i=0; i<data.size(); ++i)
+		data[i] = (i % 1000) < 500? (i & 0x1f) : (uint8_t)(i * 7 / 3);
+
+	vector<uint8_t> compressed(data.size());
+	size_t len = BinarySerialization::Compress(&data[0], data.size(),
+	    &compressed[0], compressed.size());
+	UnitTest::Assert("should compress", len > 0 && len < data.size() / 2);
+
+	vector<uint8_t> decompressed(data.size());
+	ssize_t res = BinarySerialization::Decompress(&compressed[0], len,
+	    &decompressed[0], decompressed.size());
+	UnitTest::Assert("decompressed length", res, data.size());
+	UnitTest::Assert("decompressed data", decompressed == data);
+
+	// Malformed data must not overflow the destination:
+	res = BinarySerialization::Decompress(&compressed[0], len,
+	    &decompressed[0], 100);
+	UnitTest::Assert("too small destination", res, -1);
+}
+
+static void Test_BinarySerialization_Blocks()
+{
+	vector<uint8_t> zeroes(4096, 0), random(300);
+	for (size_t i=0; i<random.size(); ++i)
+		random[i] = (i * 2654435761U) >> 13;
+
+	stringstream ss;
+	BinarySerialization::WriteBlock(ss, &zeroes[0], zeroes.size(), true);
+	BinarySerialization::WriteBlock(ss, &random[0], random.size(), true);
+	BinarySerialization::WriteBlock(ss, &zeroes[0], zeroes.size(), false);
+	BinarySerialization::WriteEndOfBlocks(ss);
+	BinarySerialization::WriteString(ss, "after");
+
+	UnitTest::Assert("compressed block should be small",
+	    ss.str().length() < 4096 + 400);
+
+	vector<uint8_t> data;
+	UnitTest::Assert("block 1", BinarySerialization::ReadBlock(ss, data));
+	UnitTest::Assert("block 1 data", data == zeroes);
+	UnitTest::Assert("block 2", BinarySerialization::ReadBlock(ss, data));
+	UnitTest::Assert("block 2 data", data == random);
+	UnitTest::Assert("skip", BinarySerialization::SkipBlocks(ss));
+
+	string str;
+	BinarySerialization::ReadString(ss, str);
+	UnitTest::Assert("string after blocks", str, "after");
+}
+
+UNITTESTS(BinarySerialization)
+{
+	UNITTEST(Test_BinarySerialization_Numbers);
+	UNITTEST(Test_BinarySerialization_Strings);
+	UNITTEST(Test_BinarySerialization_Header);
+	UNITTEST(Test_BinarySerialization_Compress);
+	UNITTEST(Test_BinarySerialization_Blocks);
+}
+
+#endif
@@ -32,6 +32,7 @@
 #include <fstream>
 
 #include "components/RootComponent.h"
+#include "BinarySerialization.h"
 #include "Component.h"
 #include "ComponentFactory.h"
 #include "EscapedString.h"
@@ -609,6 +610,11 @@ void Component::AddChild(refcount_ptr<Component> childComponent,
 
 	childComponent->SetParent(this);
 
+	// The set of executable components may have changed.
+	GXemul* gxemul = GetRunningGXemulInstance();
+	if (gxemul != NULL)
+		gxemul->InvalidateExecutionPlan();
+
 	// Make sure that the child's "name" state variable is unique among
 	// all children of this component. (Yes, this is O(n^2) and it may
 	// need to be rewritten to cope with _lots_ of components.)
@@ -660,6 +666,11 @@ size_t Component::RemoveChild(Component* childToRemove)
 		if (childToRemove == (*it)) {
 			childToRemove->SetParent(NULL);
 			m_childComponents.erase(it);
+
+			GXemul* gxemul = GetRunningGXemulInstance();
+			if (gxemul != NULL)
+				gxemul->InvalidateExecutionPlan();
+
 			return index;
 		}
 	}
@@ -1061,6 +1072,14 @@ bool Component::SetVariableValue(const string& name, const string& expression)
 			var.SetValue(oldValue.str());
 			return false;
 		}
+
+		// Variables which affect GXemul's execution plan:
+		if (name == "frequency" || name == "paused" ||
+		    name == "accuracy") {
+			GXemul* gxemul = GetRunningGXemulInstance();
+			if (gxemul != NULL)
+				gxemul->InvalidateExecutionPlan();
+		}
 	}
 
 	return true;
@@ -1070,6 +1089,30 @@ bool Component::SetVariableValue(const string& name, const string& expression)
 void Component::Serialize(ostream& ss, SerializationContext& context) const
 {
 	SerializationContext subContext = context.Indented();
+
+	if (context.IsBinary()) {
+		BinarySerialization::WriteByte(ss, 'C');
+		BinarySerialization::WriteString(ss, m_className);
+
+		// Plain variables first, so that custom data (e.g. RAM
+		// contents) can be checked against them when deserialized:
+		for (StateVariableMap::const_iterator it =
+		    m_stateVariables.begin(); it != m_stateVariables.end(); ++it)
+			if ((it->second).GetType() != StateVariable::Custom)
+				(it->second).Serialize(ss, subContext);
+
+		for (StateVariableMap::const_iterator it =
+		    m_stateVariables.begin(); it != m_stateVariables.end(); ++it)
+			if ((it->second).GetType() == StateVariable::Custom)
+				(it->second).Serialize(ss, subContext);
+
+		for (size_t i = 0, n = m_childComponents.size(); i < n; ++ i)
+			m_childComponents[i]->Serialize(ss, subContext);
+
+		BinarySerialization::WriteByte(ss, 'E');
+		return;
+	}
+
 	string tabs = context.Tabs();
 
 	ss << tabs << "component " << m_className << "\n" << tabs << "{\n";
@@ -1223,6 +1266,105 @@ refcount_ptr<Component> Component::Deserialize(ostream& messages, const string&
 }
 
 
+refcount_ptr<Component> Component::Deserialize(ostream& messages, istream& is)
+{
+	refcount_ptr<Component> deserializedTree = NULL;
+	uint8_t recordType;
+
+	if (!BinarySerialization::ReadByte(is, recordType) ||
+	    recordType != 'C') {
+		messages << "Expecting a component record.\n";
+		return deserializedTree;
+	}
+
+	string className;
+	if (!BinarySerialization::ReadString(is, className)) {
+		messages << "Expecting a class name.\n";
+		return deserializedTree;
+	}
+
+	if (className == "root") {
+		deserializedTree = new RootComponent;
+	} else {
+		deserializedTree = ComponentFactory::CreateComponent(className);
+		if (deserializedTree.IsNULL()) {
+			messages << "Could not create a '" << className << "' component.\n";
+			return deserializedTree;
+		}
+	}
+
+	while (true) {
+		// Child components are read recursively:
+		if (is.peek() == 'C') {
+			refcount_ptr<Component> child =
+			    Component::Deserialize(messages, is);
+			if (child.IsNULL())
+				return NULL;
+
+			deserializedTree->AddChild(child);
+			continue;
+		}
+
+		if (!BinarySerialization::ReadByte(is, recordType)) {
+			messages << "Unexpected end of file.\n";
+			return NULL;
+		}
+
+		if (recordType == 'E')
+			break;
+
+		string name;
+		if ((recordType != 'V' && recordType != 'D') ||
+		    !BinarySerialization::ReadString(is, name)) {
+			messages << "Malformed record in component " <<
+			    className << ".\n";
+			return NULL;
+		}
+
+		if (recordType == 'V') {
+			// The name read above was actually the type.
+			string varName, varValue;
+			if (!BinarySerialization::ReadString(is, varName) ||
+			    !BinarySerialization::ReadString(is, varValue)) {
+				messages << "Malformed variable in component "
+				    << className << ".\n";
+				return NULL;
+			}
+
+			if (!deserializedTree->SetVariableValue(varName,
+			    varValue)) {
+				messages << "Warning: variable '" << varName <<
+				    "' for component class " << className <<
+				    " could not be deserialized; skipping.\n";
+			}
+		} else {
+			StateVariableMap::iterator it =
+			    deserializedTree->m_stateVariables.find(name);
+			bool success;
+
+			if (it == deserializedTree->m_stateVariables.end() ||
+			    (it->second).GetType() != StateVariable::Custom) {
+				messages << "Warning: variable '" << name <<
+				    "' for component class " << className <<
+				    " could not be deserialized; skipping.\n";
+				success = BinarySerialization::SkipBlocks(is);
+			} else {
+				success = (it->second).DeserializeBinary(is);
+			}
+
+			if (!success) {
+				messages << "Malformed data for variable '" <<
+				    name << "' in component " << className <<
+				    ".\n";
+				return NULL;
+			}
+		}
+	}
+
+	return deserializedTree;
+}
+
+
 bool Component::CheckConsistency() const
 {
 	// Serialize
@@ -1246,7 +1388,24 @@ bool Component::CheckConsistency() const
 	tmpDeserializedTree->AddChecksum(checksumDeserialized);
 
 	// ... and compare the checksums:
-	return checksumOriginal == checksumDeserialized;
+	if (checksumOriginal != checksumDeserialized)
+		return false;
+
+	// The same thing, using the binary format:
+	SerializationContext binaryContext;
+	binaryContext.SetBinary(true);
+	binaryContext.SetCompress(true);
+	stringstream binary;
+	Serialize(binary, binaryContext);
+
+	tmpDeserializedTree = Deserialize(messages, binary);
+	if (tmpDeserializedTree.IsNULL())
+		return false;
+
+	Checksum checksumBinary;
+	tmpDeserializedTree->AddChecksum(checksumBinary);
+
+	return checksumOriginal == checksumBinary;
 }
 
 
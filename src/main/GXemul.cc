@@ -159,6 +159,7 @@
 #include "NullUI.h"
 
 #include "GXemul.h"
+#include "components/RAMComponent.h"
 #include "components/RootComponent.h"
 #include "ComponentFactory.h"
 #include "UnitTest.h"
@@ -172,6 +173,19 @@
 #include <iostream>
 
 
+// By default, when snapshotting is enabled, a snapshot is taken every
+// DEFAULT_SNAPSHOT_INTERVAL steps. Snapshots are thinned out when they use
+// more than DEFAULT_SNAPSHOT_MEMORY_BUDGET bytes of host memory, or when
+// there are more than MAX_NR_OF_SNAPSHOTS of them.
+#define	DEFAULT_SNAPSHOT_INTERVAL	1000000
+#define	DEFAULT_SNAPSHOT_MEMORY_BUDGET	(256 * 1048576)
+#define	MAX_NR_OF_SNAPSHOTS		100
+
+// When replaying from a snapshot, Execute() is called with at most this many
+// steps at a time.
+#define	SNAPSHOT_REPLAY_CHUNK		100000
+
+
 GXemul::GXemul()
 	: m_quietMode(false)
 	, m_ui(new NullUI(this))
@@ -179,8 +193,14 @@ GXemul::GXemul()
 	, m_runState(Paused)
 	, m_interrupting(false)
 	, m_nrOfSingleStepsLeft(1)
+	, m_executionPlanValid(false)
+	, m_fastestComponentIndex(0)
+	, m_sloppyAccuracy(false)
+	, m_rootStep(NULL)
 	, m_rootComponent(new RootComponent(this))
 	, m_snapshottingEnabled(false)
+	, m_snapshotInterval(DEFAULT_SNAPSHOT_INTERVAL)
+	, m_snapshotMemoryBudget(DEFAULT_SNAPSHOT_MEMORY_BUDGET)
 {
 	gettimeofday(&m_lastOutputTime, NULL);
 	m_lastOutputStep = 0;
@@ -196,6 +216,9 @@ void GXemul::ClearEmulation()
 
 	m_rootComponent = new RootComponent(this);
 	m_emulationFileName = "";
+	m_snapshots.clear();
+
+	InvalidateExecutionPlan();
 
 	GetUI()->UpdateUI();
 }
@@ -532,7 +555,8 @@ void GXemul::PrintUsage() const
 	    "  1. Run  gxemul  with the machine selection option "
 	    "(-e), which creates\n"
 	    "     a default emulation from a template machine.\n\n"
-	    "  2. Run  gxemul  with a configuration file (.gxemul).\n"
+	    "  2. Run  gxemul  with a configuration file (.gxbin or"
+	    " .gxemul).\n"
 	    "     This is useful for more complicated setups.\n\n"
 	    "  3. Run  gxemul -V  with no other options, which causes"
 	    " gxemul to be started\n"
@@ -693,12 +717,17 @@ void GXemul::SetRootComponent(refcount_ptr<Component> newRootComponent)
 
 	m_rootComponent = newRootComponent;
 
+	InvalidateExecutionPlan();
+
 	GetUI()->UpdateUI();
 }
 
 
 bool GXemul::Reset()
 {
+	// Snapshots taken before the reset are not valid anymore.
+	m_snapshots.clear();
+
 	// 1. Reset all components in the tree.
 	GetRootComponent()->Reset();
 
@@ -785,6 +814,42 @@ void GXemul::SetSnapshottingEnabled(bool enabled)
 }
 
 
+void GXemul::SetSnapshotInterval(uint64_t steps)
+{
+	if (steps < 1)
+		steps = 1;
+
+	m_snapshotInterval = steps;
+}
+
+
+void GXemul::SetSnapshotMemoryBudget(size_t bytes)
+{
+	m_snapshotMemoryBudget = bytes;
+
+	ThinOutSnapshots();
+}
+
+
+size_t GXemul::GetNrOfSnapshots() const
+{
+	return m_snapshots.size();
+}
+
+
+bool GXemul::FindSnapshotBefore(uint64_t step, uint64_t& snapshotStep) const
+{
+	for (size_t i=m_snapshots.size(); i-- > 0; ) {
+		if (m_snapshots[i].step < step) {
+			snapshotStep = m_snapshots[i].step;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
 bool GXemul::GetQuietMode() const
 {
 	return m_quietMode;
@@ -815,20 +880,40 @@ bool GXemul::ModifyStep(int64_t oldStep, int64_t newStep)
 		return true;
 
 	if (newStep < oldStep) {
-		// Run in reverse, by running forward from the most suitable
-		// snapshot.
+		// Run in reverse, by running forward from the newest snapshot
+		// which was taken at or before newStep.
+		size_t i = m_snapshots.size();
+		while (i > 0 && m_snapshots[i-1].step > (uint64_t) newStep)
+			-- i;
 
-		// TODO: Multiple snapshots!
-		refcount_ptr<Component> newRoot = m_snapshot->Clone();
-		SetRootComponent(newRoot);
+		if (i == 0) {
+			stringstream ss;
+			ss << "No snapshot was taken at or before step "
+			    << newStep << ".\n";
+			GetUI()->ShowDebugMessage(ss.str());
+			return false;
+		}
 
-		// GetStep will now return the step count for the new root.
-		int64_t nrOfStepsToRunFromSnapshot = newStep - GetStep();
+		// Snapshots taken after newStep are not kept, since the state
+		// may be modified before the emulation continues.
+		DiscardSnapshotsAfter(newStep);
+
+		refcount_ptr<Component> newRoot = m_snapshots[i-1].root->Clone();
+		SetRootComponent(newRoot);
 
 		RunState oldRunState = GetRunState();
 		SetRunState(Running);
 
-		Execute(nrOfStepsToRunFromSnapshot);
+		// GetStep will now return the step count for the new root.
+		while (GetStep() < (uint64_t) newStep) {
+			uint64_t stepBefore = GetStep();
+			uint64_t nrOfStepsLeft = newStep - stepBefore;
+			Execute(nrOfStepsLeft > SNAPSHOT_REPLAY_CHUNK ?
+			    SNAPSHOT_REPLAY_CHUNK : nrOfStepsLeft);
+
+			if (GetStep() == stepBefore || GetRunState() != Running)
+				break;
+		}
 
 		SetRunState(oldRunState);
 	} else {
@@ -841,29 +926,79 @@ bool GXemul::ModifyStep(int64_t oldStep, int64_t newStep)
 }
 
 
-void GXemul::TakeSnapshot()
+void GXemul::TakeSnapshotIfNeeded()
 {
-	// TODO: Multiple snapshots!
+	if (!m_snapshottingEnabled)
+		return;
+
+	uint64_t step = *m_rootStep;
 
-	if (m_snapshot.IsNULL()) {
+	// The step may have been changed, e.g. by a reset, since the newest
+	// snapshot was taken.
+	if (!m_snapshots.empty() && m_snapshots.back().step > step)
+		DiscardSnapshotsAfter(step);
+
+	if (!m_snapshots.empty() &&
+	    step < m_snapshots.back().step + m_snapshotInterval)
+		return;
+
+	if (m_snapshots.empty()) {
 		stringstream ss;
-		ss << "(snapshot at step " << GetStep() << ")\n";
+		ss << "(snapshot at step " << step << ")\n";
 		GetUI()->ShowDebugMessage(ss.str());
+	}
+
+	Snapshot snapshot;
+	snapshot.step = step;
+	snapshot.root = GetRootComponent()->Clone();
+	m_snapshots.push_back(snapshot);
 
-		m_snapshot = GetRootComponent()->Clone();
+	ThinOutSnapshots();
+}
+
+
+void GXemul::ThinOutSnapshots()
+{
+	if (m_snapshots.size() < 3)
+		return;
+
+	// The memory used by snapshots is the memory which is not also used
+	// by the running emulation.
+	size_t memoryUsedByEmulation =
+	    RAMComponent::GetAllocatedMemory(GetRootComponent());
+
+	while (m_snapshots.size() > 2) {
+		size_t memoryUsedBySnapshots =
+		    RAMComponent::GetTotalAllocatedMemory() - memoryUsedByEmulation;
+		if (memoryUsedBySnapshots <= m_snapshotMemoryBudget &&
+		    m_snapshots.size() <= MAX_NR_OF_SNAPSHOTS)
+			break;
+
+		// Remove the snapshot whose neighbours are closest to each
+		// other, but never the oldest or the newest. This keeps the
+		// remaining snapshots spread out over the whole history, with
+		// recent history being covered more densely.
+		size_t best = 1;
+		for (size_t i=2; i<m_snapshots.size() - 1; ++i)
+			if (m_snapshots[i+1].step - m_snapshots[i-1].step <=
+			    m_snapshots[best+1].step - m_snapshots[best-1].step)
+				best = i;
+
+		m_snapshots.erase(m_snapshots.begin() + best);
 	}
 }
 
 
-struct ComponentAndFrequency
+void GXemul::DiscardSnapshotsAfter(uint64_t step)
 {
-	refcount_ptr<Component>	component;
-	double			frequency;
-	StateVariable*		step;
+	while (!m_snapshots.empty() && m_snapshots.back().step > step)
+		m_snapshots.pop_back();
+}
 
-	uint64_t		nextTimeToExecute;
-};
 
+// In sloppy accuracy mode, the fastest component runs this many steps at a
+// time, before the other components are allowed to catch up.
+#define	SLOPPY_QUANTUM		10000
 
 // Gathers a list of components and their frequencies. (Only components that
 // have a variable named "frequency" are executable.)
@@ -873,13 +1008,13 @@ static void GetComponentsAndFrequencies(refcount_ptr<Component> component,
 	const StateVariable* paused = component->GetVariable("paused");
 	const StateVariable* freq = component->GetVariable("frequency");
 	StateVariable* step = component->GetVariable("step");
-	if (freq != NULL && step != NULL &&
+	if (freq != NULL && step != NULL && step->GetUInt64Pointer() != NULL &&
 	    (paused == NULL || paused->ToInteger() == 0)) {
 		struct ComponentAndFrequency caf;
 
 		caf.component = component;
 		caf.frequency = freq->ToDouble();
-		caf.step      = step;
+		caf.step      = step->GetUInt64Pointer();
 		caf.nextTimeToExecute = 0;
 
 		componentsAndFrequencies.push_back(caf);
@@ -891,10 +1026,44 @@ static void GetComponentsAndFrequencies(refcount_ptr<Component> component,
 }
 
 
+void GXemul::InvalidateExecutionPlan()
+{
+	m_executionPlanValid = false;
+}
+
+
+void GXemul::MakeSureExecutionPlanExists()
+{
+	if (m_executionPlanValid)
+		return;
+
+	m_componentsAndFrequencies.clear();
+	GetComponentsAndFrequencies(GetRootComponent(), m_componentsAndFrequencies);
+
+	// Find the fastest component:
+	m_fastestComponentIndex = 0;
+	for (size_t i=0; i<m_componentsAndFrequencies.size(); ++i)
+		if (m_componentsAndFrequencies[i].frequency >
+		    m_componentsAndFrequencies[m_fastestComponentIndex].frequency)
+			m_fastestComponentIndex = i;
+
+	m_sloppyAccuracy = GetRootComponent()->GetVariable("accuracy")->ToString() == "sloppy";
+
+	m_rootStep = GetRootComponent()->GetVariable("step")->GetUInt64Pointer();
+	if (m_rootStep == NULL) {
+		std::cerr << "root component has no 'step' variable? aborting.\n";
+		throw std::exception();
+	}
+
+	m_executionPlanValid = true;
+}
+
+
 void GXemul::Execute(const int longestTotalRun)
 {
-	vector<ComponentAndFrequency> componentsAndFrequencies;
-	GetComponentsAndFrequencies(GetRootComponent(), componentsAndFrequencies);
+	MakeSureExecutionPlanExists();
+
+	vector<ComponentAndFrequency>& componentsAndFrequencies = m_componentsAndFrequencies;
 
 	if (componentsAndFrequencies.size() == 0) {
 		GetUI()->ShowDebugMessage("No executable components"
@@ -903,18 +1072,11 @@ void GXemul::Execute(const int longestTotalRun)
 		return;
 	}
 
-	// Take an initial snapshot at step 0, if snapshotting is enabled:
-	if (m_snapshottingEnabled && GetStep() == 0)
-		TakeSnapshot();
+	// Take an initial snapshot, if snapshotting is enabled:
+	TakeSnapshotIfNeeded();
 
-	// Find the fastest component:
-	double fastestFrequency = componentsAndFrequencies[0].frequency;
-	size_t fastestComponentIndex = 0;
-	for (size_t i=0; i<componentsAndFrequencies.size(); ++i)
-		if (componentsAndFrequencies[i].frequency > fastestFrequency) {
-			fastestFrequency = componentsAndFrequencies[i].frequency;
-			fastestComponentIndex = i;
-		}
+	const size_t fastestComponentIndex = m_fastestComponentIndex;
+	const double fastestFrequency = componentsAndFrequencies[fastestComponentIndex].frequency;
 
 	bool printEmptyLineBetweenSteps = false;
 
@@ -927,7 +1089,7 @@ void GXemul::Execute(const int longestTotalRun)
 		// Note that setting run state to something else, OR
 		// decreasing nr of single steps left to 0, will break the loop.
 		while (!m_interrupting && m_nrOfSingleStepsLeft > 0 && GetRunState() == SingleStepping) {
-			uint64_t step = GetStep();
+			uint64_t step = *m_rootStep;
 
 			if (printEmptyLineBetweenSteps)
 				GetUI()->ShowDebugMessage("\n");
@@ -948,7 +1110,7 @@ void GXemul::Execute(const int longestTotalRun)
 				uint64_t nsteps = (k == fastestComponentIndex ? step
 				    : (uint64_t) (step * componentsAndFrequencies[k].frequency / fastestFrequency));
 
-				uint64_t stepsExecutedSoFar = componentsAndFrequencies[k].step->ToInteger();
+				uint64_t stepsExecutedSoFar = *componentsAndFrequencies[k].step;
 
 				if (stepsExecutedSoFar > nsteps) {
 					std::cerr << "Internal error: " <<
@@ -972,7 +1134,7 @@ void GXemul::Execute(const int longestTotalRun)
 					}
 					
 					// ... and write back the number of executed steps:
-					componentsAndFrequencies[k].step->SetValue(stepsExecutedSoFar);
+					*componentsAndFrequencies[k].step = stepsExecutedSoFar;
 
 					// Now, let's compare the clone of the component tree
 					// before execution with what we have now.
@@ -984,8 +1146,10 @@ void GXemul::Execute(const int longestTotalRun)
 				}
 			}
 
-			SetStep(step);
+			*m_rootStep = step;
 			-- m_nrOfSingleStepsLeft;
+
+			TakeSnapshotIfNeeded();
 		}
 
 		// Done. Let's pause again.
@@ -995,20 +1159,84 @@ void GXemul::Execute(const int longestTotalRun)
 
 	case Running:
 		{
-			uint64_t step = GetStep();
+			uint64_t step = *m_rootStep;
 			uint64_t startingStep = step;
 
-			// TODO: sloppy vs cycle accuracy.
-			if (GetRootComponent()->GetVariable("accuracy")->ToString() != "cycle") {
-				std::cerr << "GXemul::Execute(): TODO: Only "
-				    "root.accuracy=\"cycle\" is currently supported\n";
-				SetRunState(Paused);
-				return;
+			bool sloppy = m_sloppyAccuracy;
+
+			// The following code is for sloppy emulation:
+			//
+			// The fastest component runs for a quantum of up to
+			// SLOPPY_QUANTUM steps at a time, and then all the other
+			// components catch up, i.e. run as many steps as they
+			// would have run in cycle accurate mode. The skew between
+			// components is thus never larger than one quantum, and
+			// all components are in sync between quanta.
+
+			while (sloppy && step < startingStep + longestTotalRun) {
+				if (m_interrupting || GetRunState() != Running)
+					break;
+
+				int toExecute = SLOPPY_QUANTUM;
+				if (step + toExecute > startingStep + longestTotalRun)
+					toExecute = startingStep + longestTotalRun - step;
+
+				ComponentAndFrequency& fastest =
+				    componentsAndFrequencies[fastestComponentIndex];
+				int n = fastest.component->Execute(this, toExecute);
+				*fastest.step += n;
+
+				bool abort = false;
+				if (n != toExecute) {
+					abort = true;
+
+					stringstream ss;
+					ss << "only " << n << " steps of " << toExecute << " executed.";
+					GetUI()->ShowDebugMessage(fastest.component, ss.str());
+				}
+
+				for (size_t k=0; k<componentsAndFrequencies.size(); ++k) {
+					if (k == fastestComponentIndex)
+						continue;
+
+					// Same as in single-stepping mode: component k
+					// should have executed step * fk / fastestFrequency
+					// steps.
+					uint64_t nsteps = (uint64_t) ((step + n) *
+					    componentsAndFrequencies[k].frequency / fastestFrequency);
+					uint64_t stepsExecutedSoFar =
+					    *componentsAndFrequencies[k].step;
+					if (stepsExecutedSoFar >= nsteps)
+						continue;
+
+					int toExecuteK = nsteps - stepsExecutedSoFar;
+					int nk = componentsAndFrequencies[k].component->Execute(this, toExecuteK);
+					*componentsAndFrequencies[k].step = stepsExecutedSoFar + nk;
+
+					if (nk != toExecuteK) {
+						abort = true;
+
+						stringstream ss;
+						ss << "only " << nk << " steps of " << toExecuteK << " executed.";
+						GetUI()->ShowDebugMessage(componentsAndFrequencies[k].component, ss.str());
+					}
+				}
+
+				step += n;
+				*m_rootStep = step;
+
+				TakeSnapshotIfNeeded();
+
+				if (abort) {
+					GetUI()->ShowDebugMessage("Continuous execution aborted.\n");
+					SetRunState(Paused);
+					break;
+				}
 			}
 
 			// The following code is for cycle accurate emulation:
 
-			while (step < startingStep + longestTotalRun) {
+			while (!sloppy && step < startingStep + longestTotalRun) {
 				if (m_interrupting || GetRunState() != Running)
 					break;
 
@@ -1031,7 +1259,7 @@ void GXemul::Execute(const int longestTotalRun)
 						double q = (k == fastestComponentIndex ? 1.0
 						    : fastestFrequency / componentsAndFrequencies[k].frequency);
 
-						double c = (componentsAndFrequencies[k].step->ToInteger()+1) * q;
+						double c = (*componentsAndFrequencies[k].step + 1) * q;
 						componentsAndFrequencies[k].nextTimeToExecute = (uint64_t) ceil(c) - 1;
 					}
 
@@ -1072,8 +1300,8 @@ void GXemul::Execute(const int longestTotalRun)
 
 					// ... and write back the number of executed steps:
 					uint64_t stepsExecutedSoFar = n +
-					    componentsAndFrequencies[k].step->ToInteger();
-					componentsAndFrequencies[k].step->SetValue(stepsExecutedSoFar);
+					    *componentsAndFrequencies[k].step;
+					*componentsAndFrequencies[k].step = stepsExecutedSoFar;
 
 					if (k == fastestComponentIndex)
 						maxExecuted = n;
@@ -1104,7 +1332,9 @@ void GXemul::Execute(const int longestTotalRun)
 				}
 
 				step += maxExecuted;
-				SetStep(step);
+				*m_rootStep = step;
+
+				TakeSnapshotIfNeeded();
 			}
 
 			// Output nr of steps (and speed) every second:
@@ -1154,9 +1384,81 @@ static void Test_Construction()
 	GXemul gxemul;
 }
 
+static void Test_Snapshots_ReplayFromNearest()
+{
+	char filename[] = "test/FileLoader_ELF_MIPS";
+	char *filenames[] = { filename };
+
+	GXemul reference;
+	reference.ParseFilenames("testmips", 1, filenames);
+	reference.Reset();
+	reference.GetCommandInterpreter().RunCommand("step 13");
+	reference.Execute();
+
+	GXemul gxemul;
+	gxemul.ParseFilenames("testmips", 1, filenames);
+	gxemul.Reset();
+	gxemul.SetSnapshottingEnabled(true);
+	gxemul.SetSnapshotInterval(10);
+	gxemul.GetCommandInterpreter().RunCommand("step 25");
+	gxemul.Execute();
+
+	UnitTest::Assert("root.step should be 25", gxemul.GetStep(), 25);
+	UnitTest::Assert("snapshots at steps 0, 10, and 20",
+	    gxemul.GetNrOfSnapshots(), 3);
+
+	uint64_t snapshotStep = 0;
+	UnitTest::Assert("there should be a snapshot before step 13",
+	    gxemul.FindSnapshotBefore(13, snapshotStep));
+	UnitTest::Assert("nearest snapshot", snapshotStep, 10);
+
+	UnitTest::Assert("going back should succeed",
+	    gxemul.GetRootComponent()->SetVariableValue("step", "13"));
+	UnitTest::Assert("root.step should be 13", gxemul.GetStep(), 13);
+	UnitTest::Assert("the snapshot at step 20 should be discarded",
+	    gxemul.GetNrOfSnapshots(), 2);
+
+	refcount_ptr<Component> cpu = gxemul.GetRootComponent()->LookupPath("cpu0");
+	refcount_ptr<Component> cpuRef = reference.GetRootComponent()->LookupPath("cpu0");
+	UnitTest::Assert("pc", cpu->GetVariable("pc")->ToString(),
+	    cpuRef->GetVariable("pc")->ToString());
+	UnitTest::Assert("sp", cpu->GetVariable("sp")->ToString(),
+	    cpuRef->GetVariable("sp")->ToString());
+	UnitTest::Assert("v0", cpu->GetVariable("v0")->ToString(),
+	    cpuRef->GetVariable("v0")->ToString());
+}
+
+static void Test_Snapshots_ThinOut()
+{
+	char filename[] = "test/FileLoader_ELF_MIPS";
+	char *filenames[] = { filename };
+
+	GXemul gxemul;
+	gxemul.ParseFilenames("testmips", 1, filenames);
+	gxemul.Reset();
+	gxemul.SetSnapshottingEnabled(true);
+	gxemul.SetSnapshotInterval(1);
+	gxemul.GetCommandInterpreter().RunCommand("step 150");
+	gxemul.Execute();
+
+	UnitTest::Assert("root.step should be 150", gxemul.GetStep(), 150);
+	UnitTest::Assert("too many snapshots",
+	    gxemul.GetNrOfSnapshots() <= MAX_NR_OF_SNAPSHOTS);
+
+	uint64_t snapshotStep = 99;
+	UnitTest::Assert("the oldest snapshot should be kept",
+	    gxemul.FindSnapshotBefore(1, snapshotStep));
+	UnitTest::Assert("oldest snapshot", snapshotStep, 0);
+	UnitTest::Assert("the newest snapshot should be kept",
+	    gxemul.FindSnapshotBefore(151, snapshotStep));
+	UnitTest::Assert("newest snapshot", snapshotStep, 150);
+}
+
 UNITTESTS(GXemul)
 {
 	UNITTEST(Test_Construction);
+	UNITTEST(Test_Snapshots_ReplayFromNearest);
+	UNITTEST(Test_Snapshots_ThinOut);
 
 	// Note: Most execution tests are in DummyComponent.cc, because they
 	// test component behavior. But they also test GXemul::Execute etc.
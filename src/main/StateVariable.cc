@@ -28,6 +28,7 @@
 #include <assert.h>
 #include <math.h>
 
+#include "BinarySerialization.h"
 #include "EscapedString.h"
 #include "StateVariable.h"
 #include "StringHelper.h"
@@ -382,12 +383,78 @@ void StateVariable::SerializeValue(ostream& ss) const
 
 void StateVariable::Serialize(ostream& ss, SerializationContext& context) const
 {
+	if (context.IsBinary()) {
+		if (m_type == Custom) {
+			BinarySerialization::WriteByte(ss, 'D');
+			BinarySerialization::WriteString(ss, m_name);
+			m_value.phandler->SerializeBinary(ss, context);
+		} else {
+			stringstream value;
+			SerializeValue(value);
+
+			BinarySerialization::WriteByte(ss, 'V');
+			BinarySerialization::WriteString(ss, GetTypeString());
+			BinarySerialization::WriteString(ss, m_name);
+			BinarySerialization::WriteString(ss, value.str());
+		}
+
+		return;
+	}
+
 	ss << context.Tabs() << GetTypeString() << " " << m_name + " ";
 	SerializeValue(ss);
 	ss << "\n";
 }
 
 
+bool StateVariable::DeserializeBinary(istream& is)
+{
+	if (m_type != Custom)
+		return false;
+
+	return m_value.phandler->DeserializeBinary(is);
+}
+
+
+void CustomStateVariableHandler::SerializeBinary(ostream& ss,
+	const SerializationContext& context) const
+{
+	stringstream text;
+	Serialize(text);
+
+	string str = text.str();
+	const size_t chunkSize = 65536;
+	for (size_t i = 0; i < str.length(); i += chunkSize) {
+		size_t len = str.length() - i;
+		if (len > chunkSize)
+			len = chunkSize;
+
+		BinarySerialization::WriteBlock(ss, (const uint8_t*) str.data()
+		    + i, len, context.GetCompress());
+	}
+
+	BinarySerialization::WriteEndOfBlocks(ss);
+}
+
+
+bool CustomStateVariableHandler::DeserializeBinary(istream& is)
+{
+	string str;
+	vector<uint8_t> data;
+
+	while (true) {
+		if (!BinarySerialization::ReadBlock(is, data))
+			return false;
+		if (data.size() == 0)
+			break;
+
+		str.append((const char*) &data[0], data.size());
+	}
+
+	return Deserialize(str);
+}
+
+
 string StateVariable::EvaluateExpression(const string& expression,
 	bool& success) const
 {
@@ -629,6 +696,15 @@ bool StateVariable::SetValue(uint64_t value)
 }
 
 
+uint64_t* StateVariable::GetUInt64Pointer()
+{
+	if (m_type != UInt64)
+		return NULL;
+
+	return m_value.puint64;
+}
+
+
 /*****************************************************************************/
 
 
@@ -938,6 +1014,24 @@ static void Test_StateVariable_Numeric_SetValue()
 	// Tests for other numeric types: TODO
 }
 
+static void Test_StateVariable_Numeric_UInt64Pointer()
+{
+	uint32_t varUInt32 = 42;
+	uint64_t varUInt64 = 123;
+
+	StateVariable vuint32("vuint32", &varUInt32);
+	StateVariable vuint64("vuint64", &varUInt64);
+
+	UnitTest::Assert("vuint32 should not have a uint64_t pointer",
+	    vuint32.GetUInt64Pointer() == NULL);
+	UnitTest::Assert("vuint64 should have a uint64_t pointer",
+	    vuint64.GetUInt64Pointer() == &varUInt64);
+
+	*vuint64.GetUInt64Pointer() = 456;
+	UnitTest::Assert("write via pointer not visible?",
+	    vuint64.ToInteger(), 456);
+}
+
 UNITTESTS(StateVariable)
 {
 	// String tests
@@ -956,6 +1050,7 @@ UNITTESTS(StateVariable)
 	// Numeric tests
 	UNITTEST(Test_StateVariable_Numeric_Construct);
 	UNITTEST(Test_StateVariable_Numeric_SetValue);
+	UNITTEST(Test_StateVariable_Numeric_UInt64Pointer);
 	//UNITTEST(Test_StateVariable_Numeric_CopyValueFrom);
 	//UNITTEST(Test_StateVariable_Numeric_Serialize);
 
@@ -42,8 +42,34 @@ ContinueBackwardsCommand::~ContinueBackwardsCommand()
 
 bool ContinueBackwardsCommand::Execute(GXemul& gxemul, const vector<string>& arguments)
 {
-	gxemul.GetUI()->ShowDebugMessage("TODO\n");
-	return false;
+	if (!gxemul.GetSnapshottingEnabled()) {
+		gxemul.GetUI()->ShowDebugMessage("Snapshotting was not enabled"
+		    " prior to starting the emulation. (-B command line"
+		    " option.)\n");
+		return false;
+	}
+
+	uint64_t step = gxemul.GetStep();
+	uint64_t snapshotStep;
+	if (!gxemul.FindSnapshotBefore(step, snapshotStep)) {
+		gxemul.GetUI()->ShowDebugMessage("Cannot go back further; there"
+		    " is no snapshot before the current step.\n");
+		return false;
+	}
+
+	stringstream stepss;
+	stepss << snapshotStep;
+
+	if (!gxemul.GetRootComponent()->SetVariableValue("step", stepss.str())) {
+		gxemul.GetUI()->ShowDebugMessage("Failed to set root.step.\n");
+		return false;
+	}
+
+	stringstream ss;
+	ss << "step " << step << " -> " << snapshotStep << "\n";
+	gxemul.GetUI()->ShowDebugMessage(ss.str());
+
+	return true;
 }
 
 
@@ -55,7 +81,14 @@ string ContinueBackwardsCommand::GetShortDescription() const
 
 string ContinueBackwardsCommand::GetLongDescription() const
 {
-	return "Runs the emulation backwards.";
+	return
+	    "Runs the emulation backwards, to the most recent snapshot taken before\n"
+	    "the current step. Snapshots are taken periodically while the emulation\n"
+	    "runs, so executing this command repeatedly moves further and further\n"
+	    "back in time, until step 0 is reached.\n"
+	    "\n"
+	    "This command requires that snapshotting support is enabled (using the\n"
+	    "-B command line option).\n";
 }
 
 
@@ -64,14 +97,75 @@ string ContinueBackwardsCommand::GetLongDescription() const
 
 #ifdef WITHUNITTESTS
 
-static void Test_ContinueBackwardsCommand_Test()
+static void Test_ContinueBackwardsCommand_NotWhenSnapshotsAreDisabled()
 {
-	// TODO
+	refcount_ptr<Command> cmd = new ContinueBackwardsCommand;
+	vector<string> dummyArguments;
+
+	GXemul gxemul;
+
+	char filename[] = "test/FileLoader_ELF_MIPS";
+	char *filenames[] = { filename };
+	gxemul.ParseFilenames("testmips", 1, filenames);
+	gxemul.Reset();
+
+	gxemul.GetCommandInterpreter().RunCommand("step 3");
+	gxemul.Execute();
+
+	UnitTest::Assert("continue-backwards should fail",
+	    cmd->Execute(gxemul, dummyArguments) == false);
+	UnitTest::Assert("root.step should still be 3", gxemul.GetStep(), 3);
+}
+
+static void Test_ContinueBackwardsCommand_Snapshots()
+{
+	refcount_ptr<Command> cmd = new ContinueBackwardsCommand;
+	vector<string> dummyArguments;
+
+	GXemul gxemul;
+
+	char filename[] = "test/FileLoader_ELF_MIPS";
+	char *filenames[] = { filename };
+	gxemul.ParseFilenames("testmips", 1, filenames);
+	gxemul.Reset();
+
+	gxemul.SetSnapshottingEnabled(true);
+	gxemul.SetSnapshotInterval(2);
+
+	gxemul.GetCommandInterpreter().RunCommand("step 5");
+	gxemul.Execute();
+
+	UnitTest::Assert("root.step should be 5", gxemul.GetStep(), 5);
+	UnitTest::Assert("snapshots at steps 0, 2, and 4",
+	    gxemul.GetNrOfSnapshots(), 3);
+
+	cmd->Execute(gxemul, dummyArguments);
+	UnitTest::Assert("root.step should be 4", gxemul.GetStep(), 4);
+
+	cmd->Execute(gxemul, dummyArguments);
+	UnitTest::Assert("root.step should be 2", gxemul.GetStep(), 2);
+	UnitTest::Assert("later snapshots should have been discarded",
+	    gxemul.GetNrOfSnapshots(), 2);
+
+	refcount_ptr<Component> cpu = gxemul.GetRootComponent()->LookupPath("cpu0");
+	UnitTest::Assert("2: cpu0.pc", cpu->GetVariable("pc")->ToString(), "0xffffffff80010100");
+	UnitTest::Assert("2: cpu0.v0", cpu->GetVariable("v0")->ToString(), "0");
+	UnitTest::Assert("2: cpu0.v1", cpu->GetVariable("v1")->ToString(), "0xffffffffcccc0000");
+
+	cmd->Execute(gxemul, dummyArguments);
+	UnitTest::Assert("root.step should be 0", gxemul.GetStep(), 0);
+	cpu = gxemul.GetRootComponent()->LookupPath("cpu0");
+	UnitTest::Assert("0: cpu0.pc", cpu->GetVariable("pc")->ToString(), "0xffffffff800100f8");
+
+	UnitTest::Assert("cannot go back from step 0",
+	    cmd->Execute(gxemul, dummyArguments) == false);
+	UnitTest::Assert("root.step should still be 0", gxemul.GetStep(), 0);
 }
 
 UNITTESTS(ContinueBackwardsCommand)
 {
-	UNITTEST(Test_ContinueBackwardsCommand_Test);
+	UNITTEST(Test_ContinueBackwardsCommand_NotWhenSnapshotsAreDisabled);
+	UNITTEST(Test_ContinueBackwardsCommand_Snapshots);
 }
 
 #endif
@@ -30,6 +30,7 @@
 #include <string.h>
 
 #include "commands/LoadCommand.h"
+#include "BinarySerialization.h"
 #include "FileLoader.h"
 #include "GXemul.h"
 
@@ -62,57 +63,51 @@ bool LoadCommand::IsComponentTree(GXemul& gxemul, const string& filename) const
 	if (file.gcount() < 10)
 		return false;
 
-	// Saved component trees start with the string "component ".
-	return (strncmp(buf, "component ", 10) == 0);
+	// Saved component trees start with the string "component ", or
+	// with the binary format's magic string.
+	return (strncmp(buf, "component ", 10) == 0) ||
+	    BinarySerialization::HasMagic(buf, file.gcount());
 }
 
 
 bool LoadCommand::LoadComponentTree(GXemul& gxemul, const string&filename,
 	refcount_ptr<Component> specifiedComponent) const
 {
-	const string extension = ".gxemul";
-	if (filename.length() < extension.length() || filename.substr(
-	    filename.length() - extension.length()) != extension)
-		ShowMsg(gxemul, "Warning: the name " + filename +
-		    " does not have a .gxemul extension. Continuing anyway.\n");
-
 	refcount_ptr<Component> component;
 
 	// Load from the file
-	std::ifstream file(filename.c_str());
+	std::ifstream file(filename.c_str(), std::ios::in | std::ios::binary);
 	if (file.fail()) {
 		ShowMsg(gxemul, "Unable to open " + filename + " for reading.\n");
 		return false;
 	}
 
-	// Figure out the file's size:
-	file.seekg(0, std::ios::end);
-	std::streampos fileSize = file.tellg();
+	char magic[8];
+	file.read(magic, sizeof(magic));
+	bool binary = BinarySerialization::HasMagic(magic, file.gcount());
+	file.clear();
 	file.seekg(0, std::ios::beg);
 
-	// Read the entire file into a string.
-	// TODO: This is wasteful, of course. It actually takes twice the
-	// size of the file, since the string constructor generates a _copy_.
-	// But string takes care of unicode and such (if compiled as ustring).
-	vector<char> buf;
-	buf.resize((size_t)fileSize + 1);
+	stringstream messages;
 
-	memset(&buf[0], 0, fileSize);
-	file.read(&buf[0], fileSize);
-	if (file.gcount() != fileSize) {
-		ShowMsg(gxemul, "Loading from " + filename + " failed; "
-		    "could not read all of the file?\n");
-		return false;
+	if (binary) {
+		// The binary format is read directly from the file, without
+		// reading all of it into memory first.
+		if (BinarySerialization::ReadHeader(file, messages))
+			component = Component::Deserialize(messages, file);
+	} else {
+		const string extension = ".gxemul";
+		if (filename.length() < extension.length() || filename.substr(
+		    filename.length() - extension.length()) != extension)
+			ShowMsg(gxemul, "Warning: the name " + filename +
+			    " does not have a .gxemul extension. Continuing"
+			    " anyway.\n");
+
+		if (!LoadTextComponentTree(gxemul, filename, file, messages,
+		    component))
+			return false;
 	}
 
-	string str(&buf[0], fileSize);
-
-	file.close();
-
-	size_t strPos = 0;
-	stringstream messages;
-	component = Component::Deserialize(messages, str, strPos);
-
 	if (messages.str().length() > 0)
 		ShowMsg(gxemul, messages.str());
 
@@ -142,6 +137,41 @@ bool LoadCommand::LoadComponentTree(GXemul& gxemul, const string&filename,
 	return true;
 }
 
+
+bool LoadCommand::LoadTextComponentTree(GXemul& gxemul,
+	const string& filename, std::ifstream& file, ostream& messages,
+	refcount_ptr<Component>& component) const
+{
+	// Figure out the file's size:
+	file.seekg(0, std::ios::end);
+	std::streampos fileSize = file.tellg();
+	file.seekg(0, std::ios::beg);
+
+	// Read the entire file into a string.
+	// TODO: This is wasteful, of course. It actually takes twice the
+	// size of the file, since the string constructor generates a _copy_.
+	// But string takes care of unicode and such (if compiled as ustring).
+	vector<char> buf;
+	buf.resize((size_t)fileSize + 1);
+
+	memset(&buf[0], 0, fileSize);
+	file.read(&buf[0], fileSize);
+	if (file.gcount() != fileSize) {
+		ShowMsg(gxemul, "Loading from " + filename + " failed; "
+		    "could not read all of the file?\n");
+		return false;
+	}
+
+	string str(&buf[0], fileSize);
+
+	file.close();
+
+	size_t strPos = 0;
+	component = Component::Deserialize(messages, str, strPos);
+
+	return true;
+}
+
 bool LoadCommand::Execute(GXemul& gxemul, const vector<string>& arguments)
 {
 	string filename = gxemul.GetEmulationFilename();
@@ -232,19 +262,19 @@ string LoadCommand::GetLongDescription() const
 	    "Loads a file into a location in the component tree. There are two different\n"
 	    "uses, which all share the same general syntax but differ in meaning.\n"
 	    "\n"
-	    "1. Loads an emulation setup (.gxemul) which was previously saved with the\n"
-	    "   'save' command. For example, if a machine was previously saved into\n"
-	    "   myMachine.gxemul, then\n"
+	    "1. Loads an emulation setup (.gxbin or .gxemul) which was previously saved\n"
+	    "   with the 'save' command. For example, if a machine was previously saved\n"
+	    "   into myMachine.gxbin, then\n"
 	    "\n"
-	    "       load myMachine.gxemul root\n"
+	    "       load myMachine.gxbin root\n"
 	    "\n"
 	    "   will add the machine to the current emulation tree, next to any other\n"
 	    "   machines.\n"
 	    "\n"
-	    "       load myMachine.gxemul\n"
+	    "       load myMachine.gxbin\n"
 	    "\n"
 	    "   will instead replace the whole configuration tree with what's in\n"
-	    "   myMachine.gxemul. The filename may be omitted, if it is known from an\n"
+	    "   myMachine.gxbin. The filename may be omitted, if it is known from an\n"
 	    "   earlier save or load command.\n"
 	    "\n"
 	    "2. Loads a binary (ELF, a.out, ...) into a CPU or data bus. E.g.:\n"
@@ -26,13 +26,14 @@
  */
 
 #include "commands/SaveCommand.h"
+#include "BinarySerialization.h"
 #include "GXemul.h"
 
 #include <fstream>
 
 
 SaveCommand::SaveCommand()
-	: Command("save", "[filename [component-path]]")
+	: Command("save", "[-u] [filename [component-path]]")
 {
 }
 
@@ -52,22 +53,29 @@ bool SaveCommand::Execute(GXemul& gxemul, const vector<string>& arguments)
 {
 	string filename = gxemul.GetEmulationFilename();
 	string path = "root";
+	vector<string> args = arguments;
+	bool compress = true;
 
-	if (arguments.size() > 2) {
+	if (args.size() > 0 && args[0] == "-u") {
+		compress = false;
+		args.erase(args.begin());
+	}
+
+	if (args.size() > 2) {
 		ShowMsg(gxemul, "Too many arguments.\n");
 		return false;
 	}
 
-	if (arguments.size() > 0)
-		filename = arguments[0];
+	if (args.size() > 0)
+		filename = args[0];
 
 	if (filename == "") {
 		ShowMsg(gxemul, "No filename given.\n");
 		return false;
 	}
 
-	if (arguments.size() > 1)
-		path = arguments[1];
+	if (args.size() > 1)
+		path = args[1];
 
 	vector<string> matches = gxemul.GetRootComponent()->
 	    FindPathByPartialMatch(path);
@@ -89,16 +97,24 @@ bool SaveCommand::Execute(GXemul& gxemul, const vector<string>& arguments)
 		return false;
 	}
 
-	const string extension = ".gxemul";
-	if (filename.length() < extension.length() || filename.substr(
-	    filename.length() - extension.length()) != extension)
+	// Files with the .gxemul extension are saved as text. Everything
+	// else is saved in the binary format.
+	const string textExtension = ".gxemul", binaryExtension = ".gxbin";
+	bool text = filename.length() >= textExtension.length() &&
+	    filename.substr(filename.length() - textExtension.length())
+	    == textExtension;
+
+	if (!text && (filename.length() < binaryExtension.length() ||
+	    filename.substr(filename.length() - binaryExtension.length())
+	    != binaryExtension))
 		ShowMsg(gxemul, "Warning: the name "+filename+" does not have"
-		    " a .gxemul extension. Continuing anyway.\n");
+		    " a .gxbin or .gxemul extension. Saving in the binary"
+		    " format anyway.\n");
 
 	// Write to the file:
 	{
 		std::fstream outputstream(filename.c_str(),
-		    std::ios::out | std::ios::trunc);
+		    std::ios::out | std::ios::trunc | std::ios::binary);
 		if (outputstream.fail()) {
 			ShowMsg(gxemul, "Error: Could not open " + filename +
 			    " for writing.\n");
@@ -106,7 +122,20 @@ bool SaveCommand::Execute(GXemul& gxemul, const vector<string>& arguments)
 		}
 
 		SerializationContext context;
+		if (!text) {
+			context.SetBinary(true);
+			context.SetCompress(compress);
+			BinarySerialization::WriteHeader(outputstream);
+		}
+
 		component->Serialize(outputstream, context);
+
+		outputstream.flush();
+		if (outputstream.fail()) {
+			ShowMsg(gxemul, "Error: Writing to " + filename +
+			    " failed.\n");
+			return false;
+		}
 	}
 
 	// Check that the file exists:
@@ -141,7 +170,11 @@ string SaveCommand::GetLongDescription() const
 	    "command. If the component path is omitted, the entire emulation setup, starting\n"
 	    "from the 'root' component, is saved.\n"
 	    "\n"
-	    "The filename extension should usually be .gxemul.\n"
+	    "Files are saved in a compact binary format, and should usually have the\n"
+	    "extension .gxbin. Pages of RAM which are all zeroes are not saved, and the\n"
+	    "rest is compressed; use -u to save without compression, which is faster.\n"
+	    "If the filename has the extension .gxemul, the emulation is instead saved\n"
+	    "in a readable text format (which is much larger for machines with RAM).\n"
 	    "\n"
 	    "See also:  load    (to load an emulation setup)\n";
 }
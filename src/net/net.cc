@@ -42,12 +42,14 @@
 #include <unistd.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <fcntl.h>
 #include <signal.h>
+#include <time.h>
 
 #include "machine.h"
 #include "misc.h"
@@ -58,40 +60,159 @@
 
 
 /*
- *  net_allocate_ethernet_packet_link():
+ *  The packet buffer pool. (It is shared by all networks, and has a lock of
+ *  its own, since packets are freed by the devices without holding any
+ *  network's lock.)
+ */
+static pthread_mutex_t net_packet_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct net_packet *net_packet_free_list = NULL;
+
+
+/*
+ *  net_packet_alloc():
  *
- *  This routine allocates an ethernet_packet_link struct, and adds it at
- *  the end of the packet chain.  A data buffer is allocated, and the data,
- *  extra, and len fields of the link are set.
+ *  Returns a packet buffer with room for len bytes of data, plus
+ *  NET_PACKET_TAILROOM bytes. Buffers are taken from the pool when possible;
+ *  the pool is refilled with a new slab of NET_PACKETS_PER_SLAB buffers when
+ *  it is empty.
  *
  *  Note: The data buffer is not zeroed.
+ */
+static struct net_packet *net_packet_alloc(size_t len)
+{
+	struct net_packet *p;
+
+	if (len + NET_PACKET_TAILROOM > NET_PACKET_BUF_SIZE) {
+		CHECK_ALLOCATION(p = (struct net_packet *) malloc(
+		    sizeof(struct net_packet) + len + NET_PACKET_TAILROOM));
+		p->pooled = 0;
+	} else {
+		pthread_mutex_lock(&net_packet_pool_lock);
+
+		if (net_packet_free_list == NULL) {
+			size_t stride = sizeof(struct net_packet) +
+			    NET_PACKET_BUF_SIZE;
+			unsigned char *slab;
+			int i;
+
+			CHECK_ALLOCATION(slab = (unsigned char *)
+			    malloc(stride * NET_PACKETS_PER_SLAB));
+
+			for (i=0; i<NET_PACKETS_PER_SLAB; i++) {
+				struct net_packet *q = (struct net_packet *)
+				    (slab + stride * i);
+				q->pooled = 1;
+				q->next_free = net_packet_free_list;
+				net_packet_free_list = q;
+			}
+		}
+
+		p = net_packet_free_list;
+		net_packet_free_list = p->next_free;
+
+		pthread_mutex_unlock(&net_packet_pool_lock);
+	}
+
+	p->next_free = NULL;
+	p->data = (unsigned char *) (p + 1);
+	p->len = len;
+
+	return p;
+}
+
+
+/*
+ *  net_ethernet_packet_alloc():
  *
- *  Return value is a pointer to the link on success. It doesn't return on
- *  failure.
+ *  Returns a packet buffer with room for len bytes of data, which must be
+ *  given back using net_ethernet_packet_free(). (This is for NICs which
+ *  have to recreate a packet that they were in the middle of receiving,
+ *  e.g. when restoring a checkpoint.)
  */
-struct ethernet_packet_link *net_allocate_ethernet_packet_link(
-	struct net *net, void *extra, size_t len)
+unsigned char *net_ethernet_packet_alloc(size_t len)
 {
-	struct ethernet_packet_link *lp;
+	return net_packet_alloc(len)->data;
+}
 
-	CHECK_ALLOCATION(lp = (struct ethernet_packet_link *)
-	    malloc(sizeof(struct ethernet_packet_link)));
 
-	lp->len = len;
-	lp->extra = extra;
-	CHECK_ALLOCATION(lp->data = (unsigned char *) malloc(len));
+/*
+ *  net_ethernet_packet_free():
+ *
+ *  Gives back a packet (returned by net_ethernet_rx()) to the pool.
+ */
+void net_ethernet_packet_free(unsigned char *packet)
+{
+	struct net_packet *p;
 
-	lp->next = NULL;
+	if (packet == NULL)
+		return;
 
-	/*  Add last in the link chain:  */
-	lp->prev = net->last_ethernet_packet;
-	if (lp->prev != NULL)
-		lp->prev->next = lp;
-	else
-		net->first_ethernet_packet = lp;
-	net->last_ethernet_packet = lp;
+	p = ((struct net_packet *) packet) - 1;
+
+	if (!p->pooled) {
+		free(p);
+		return;
+	}
+
+	pthread_mutex_lock(&net_packet_pool_lock);
+	p->next_free = net_packet_free_list;
+	net_packet_free_list = p;
+	pthread_mutex_unlock(&net_packet_pool_lock);
+}
+
+
+/*
+ *  net_find_nic():
+ *
+ *  Returns the NIC with a specific 'extra' pointer, or NULL if there is no
+ *  such NIC connected to the network.
+ */
+static struct net_nic *net_find_nic(struct net *net, void *extra)
+{
+	int i;
+
+	for (i=0; i<net->n_nics; i++)
+		if (net->nics[i]->extra == extra)
+			return net->nics[i];
+
+	return NULL;
+}
+
+
+/*
+ *  net_ethernet_rx_alloc():
+ *
+ *  This routine allocates a packet buffer of len bytes, and adds it last in
+ *  the receive ring of the NIC identified by 'extra'. The caller should fill
+ *  in the packet's data.
+ *
+ *  Note: The data buffer is not zeroed.
+ *
+ *  Return value is a pointer to the packet on success, or NULL if the
+ *  packet was dropped because the NIC's receive ring is full (or there is
+ *  no such NIC).
+ */
+struct net_packet *net_ethernet_rx_alloc(struct net *net, void *extra,
+	size_t len)
+{
+	struct net_nic *nic = net_find_nic(net, extra);
+	struct net_packet *p;
+
+	if (nic == NULL)
+		return NULL;
 
-	return lp;
+	if (nic->rx_count >= NET_RX_RING_SIZE) {
+		nic->rx_dropped ++;
+		return NULL;
+	}
+
+	p = net_packet_alloc(len);
+
+	nic->rx_ring[(nic->rx_first + nic->rx_count) % NET_RX_RING_SIZE] = p;
+	nic->rx_count ++;
+	nic->rx_packets ++;
+
+	return p;
 }
 
 
@@ -151,17 +272,22 @@ static void net_arp(struct net *net, void *extra,
 	    packet[2] == 0x08 && packet[3] == 0x00 &&
 	    packet[4] == 0x06 && packet[5] == 0x04) {
 		int r = (packet[6] << 8) + packet[7];
-		struct ethernet_packet_link *lp;
+		struct net_packet *lp;
 
 		switch (r) {
 		case 1:		/*  Request  */
+			if (net->tcp_forwards != NULL)
+				net_tcp_forward_learn(net, packet + 14,
+				    packet + 8);
+
 			/*  Only create a reply if this was meant for the
 			    gateway:  */
 			if (memcmp(packet+24, net->gateway_ipv4_addr, 4) != 0)
 				break;
 
-			lp = net_allocate_ethernet_packet_link(
-			    net, extra, 60 + 14);
+			lp = net_ethernet_rx_alloc(net, extra, 60 + 14);
+			if (lp == NULL)
+				break;
 
 			/*  Copy the old packet first:  */
 			memset(lp->data, 0, 60 + 14);
@@ -185,8 +311,9 @@ static void net_arp(struct net *net, void *extra,
 
 			break;
 		case 3:		/*  Reverse Request  */
-			lp = net_allocate_ethernet_packet_link(
-			    net, extra, 60 + 14);
+			lp = net_ethernet_rx_alloc(net, extra, 60 + 14);
+			if (lp == NULL)
+				break;
 
 			/*  Copy the old packet first:  */
 			memset(lp->data, 0, 60 + 14);
@@ -239,6 +366,223 @@ static void net_arp(struct net *net, void *extra,
 }
 
 
+/*
+ *  net_mac_hash():
+ *
+ *  Returns the index in the MAC table for an ethernet address.
+ */
+static inline int net_mac_hash(unsigned char *addr)
+{
+	uint32_t x = (addr[2] << 24) + (addr[3] << 16) + (addr[4] << 8)
+	    + addr[5];
+
+	x ^= (addr[0] << 8) + addr[1];
+	return ((x * 0x9e3779b1) >> 16) % NET_MAC_TABLE_SIZE;
+}
+
+
+/*
+ *  net_mac_learn():
+ *
+ *  Remembers that the station with ethernet address addr was seen on a
+ *  local NIC (nic), or, if nic is NULL, on a remote network (rnp, or NULL
+ *  if it is not known which one).
+ */
+static void net_mac_learn(struct net *net, unsigned char *addr,
+	struct net_nic *nic, struct remote_net *rnp)
+{
+	struct net_mac_entry *e = &net->mac_table[net_mac_hash(addr)];
+	int64_t now;
+
+	/*  Multicast and broadcast addresses are never sources:  */
+	if (addr[0] & 1)
+		return;
+
+	now = time(NULL);
+	if (e->valid && e->nic == nic && e->remote == rnp &&
+	    e->last_seen == now && !memcmp(e->addr, addr, 6))
+		return;
+
+	memcpy(e->addr, addr, 6);
+	e->valid = 1;
+	e->last_seen = now;
+	e->nic = nic;
+	e->remote = rnp;
+}
+
+
+/*
+ *  net_mac_lookup():
+ *
+ *  Returns the MAC table entry for the destination address of a frame, or
+ *  NULL if the frame should be sent everywhere (because the destination is
+ *  a multicast or broadcast address, or has not been seen recently).
+ */
+static struct net_mac_entry *net_mac_lookup(struct net *net,
+	unsigned char *addr)
+{
+	struct net_mac_entry *e;
+
+	if (addr[0] & 1)
+		return NULL;
+
+	e = &net->mac_table[net_mac_hash(addr)];
+	if (!e->valid || memcmp(e->addr, addr, 6))
+		return NULL;
+
+	if (time(NULL) - e->last_seen > NET_MAC_TABLE_AGE) {
+		e->valid = 0;
+		return NULL;
+	}
+
+	return e;
+}
+
+
+/*
+ *  net_find_remote():
+ *
+ *  Returns the remote network which a frame was received from, or NULL if
+ *  it is not one of those added with add_remote(). (Remotes on this host
+ *  may use any loopback address.)
+ */
+static struct remote_net *net_find_remote(struct net *net,
+	struct in_addr *addr, int portnr)
+{
+	struct remote_net *rnp;
+	int loopback = (ntohl(addr->s_addr) >> 24) == 127;
+
+	for (rnp = net->remote_nets; rnp != NULL; rnp = rnp->next)
+		if (rnp->portnr == portnr && (rnp->ipv4_addr.s_addr ==
+		    addr->s_addr || (loopback &&
+		    (ntohl(rnp->ipv4_addr.s_addr) >> 24) == 127)))
+			return rnp;
+
+	return NULL;
+}
+
+
+/*
+ *  net_distributed_deliver():
+ *
+ *  Adds a frame received from another emulator process (from_addr and
+ *  from_port tell which) to the NICs on this network: to the NIC which
+ *  owns the destination address, if it is known, otherwise to all of them.
+ */
+void net_distributed_deliver(struct net *net, struct in_addr *from_addr,
+	int from_port, unsigned char *packet, int len)
+{
+	struct net_mac_entry *dst;
+	struct net_packet *lp;
+	int i;
+
+	if (len < 14)
+		return;
+
+	net_mac_learn(net, packet + 6, NULL,
+	    net_find_remote(net, from_addr, from_port));
+
+	dst = net_mac_lookup(net, packet);
+	if (dst != NULL) {
+		/*  Not for any of "our" NICs?  */
+		if (dst->nic == NULL)
+			return;
+
+		lp = net_ethernet_rx_alloc(net, dst->nic->extra, len);
+		if (lp != NULL)
+			memcpy(lp->data, packet, len);
+		return;
+	}
+
+	for (i=0; i<net->n_nics; i++) {
+		lp = net_ethernet_rx_alloc(net, net->nics[i]->extra, len);
+		if (lp != NULL)
+			memcpy(lp->data, packet, len);
+	}
+}
+
+
+/*
+ *  net_distributed_tx():
+ *
+ *  Sends a frame to another emulator process. Processes on the same host
+ *  are sent to through shared memory (see net_shm.c) when possible.
+ *
+ *  UDP datagrams are sent from the local port's socket, if there is one,
+ *  so that the receiver can tell which remote network they came from.
+ */
+static void net_distributed_tx(struct net *net, struct remote_net *rnp,
+	unsigned char *packet, int len)
+{
+	struct sockaddr_in si;
+
+	switch (net_shm_send(net, rnp, packet, len)) {
+	case NET_SHM_SENT:
+		return;
+	case NET_SHM_SENT_WAKEUP:
+		/*  An empty datagram wakes up the remote's reactor:  */
+		len = 0;
+		break;
+	}
+
+	if (net->local_port == 0) {
+		send_udp(&rnp->ipv4_addr, rnp->portnr, packet, len);
+		return;
+	}
+
+	memset(&si, 0, sizeof(si));
+	si.sin_family = AF_INET;
+	si.sin_addr = rnp->ipv4_addr;
+	si.sin_port = htons(rnp->portnr);
+
+	if (sendto(net->local_port_socket, packet, len, 0,
+	    (struct sockaddr *)&si, sizeof(si)) != (ssize_t)len &&
+	    errno != EAGAIN && errno != EWOULDBLOCK)
+		perror("net_distributed_tx(): sendto");
+}
+
+
+/*
+ *  net_distributed_rx():
+ *
+ *  If the network is distributed across multiple emulator processes, then
+ *  this receives incoming packets from those processes. (Called by the
+ *  reactor when the local port's socket is readable.)
+ *
+ *  Empty datagrams only mean that there are frames in the shared memory
+ *  ring.
+ */
+static void net_distributed_rx(struct net *net, void *extra, void *owner)
+{
+	struct sockaddr_in si;
+	socklen_t si_len;
+	int res, nreceived = 0;
+	unsigned char buf[60000];
+
+	do {
+		si_len = sizeof(si);
+		res = recvfrom(net->local_port_socket, buf,
+		    sizeof(buf), 0, (struct sockaddr *)&si, &si_len);
+
+		if (res > 0) {
+			nreceived ++;
+
+			/*  fatal("[ incoming DISTRIBUTED packet, %i "
+			    "bytes from %s:%d\n", res,
+			    inet_ntoa(si.sin_addr),
+			    ntohs(si.sin_port));  */
+
+			net_distributed_deliver(net, &si.sin_addr,
+			    ntohs(si.sin_port), buf, res);
+		}
+	} while (res != -1 && nreceived < 100);
+
+	net_shm_rx(net);
+
+	net_reactor_arm(net, net->local_port_source, NET_REACTOR_READ);
+}
+
+
 /*
  *  net_ethernet_rx_avail():
  *
@@ -249,51 +593,42 @@ static void net_arp(struct net *net, void *extra,
  *  this function basically works like net_ethernet_rx() but it only receives
  *  a return value telling us whether there is a packet or not, we don't
  *  actually get the packet.
+ *
+ *  The outside world's sockets are only touched if the reactor has found
+ *  some of them to be ready (or if there is unacknowledged TCP data to
+ *  resend), so this is cheap when nothing is going on.
  */
 int net_ethernet_rx_avail(struct net *net, void *extra)
 {
+	struct net_nic *nic;
+	int avail;
+
 	if (net == NULL)
 		return 0;
 
+	pthread_mutex_lock(&net->lock);
+
 	/*
-	 *  If the network is distributed across multiple emulator processes,
-	 *  then receive incoming packets from those processes.
+	 *  Backpressure: Only read from the outside world if there is room
+	 *  for more packets in this NIC's receive ring. Otherwise, the data
+	 *  is left in the host's socket buffers until the guest has caught up.
 	 */
-	if (net->local_port != 0) {
-		struct sockaddr_in si;
-		socklen_t si_len = sizeof(si);
-		int res, i, nreceived = 0;
-		unsigned char buf[60000];
-
-		do {
-			res = recvfrom(net->local_port_socket, buf,
-			    sizeof(buf), 0, (struct sockaddr *)&si, &si_len);
-
-			if (res != -1) {
-				nreceived ++;
-
-				/*  fatal("[ incoming DISTRIBUTED packet, %i "
-				    "bytes from %s:%d\n", res,
-				    inet_ntoa(si.sin_addr),
-				    ntohs(si.sin_port));  */
-
-				/*  Add the packet to all "our" NICs on this
-				    network:  */
-				for (i=0; i<net->n_nics; i++) {
-					struct ethernet_packet_link *lp;
-					lp = net_allocate_ethernet_packet_link(
-					    net, net->nic_extra[i], res);
-					memcpy(lp->data, buf, res);
-				}
-			}
-		} while (res != -1 && nreceived < 100);
+	nic = net_find_nic(net, extra);
+	if (nic != NULL &&
+	    NET_RX_RING_SIZE - nic->rx_count >= NET_RX_RING_RESERVE) {
+		net_reactor_dispatch(net, extra);
+
+		if (net->shm_rx_more)
+			net_shm_rx(net);
+
+		if (net->tcp_unacked_first != NULL)
+			net_tcp_rx_avail(net, extra);
 	}
 
-	/*  IP protocol specific:  */
-	net_udp_rx_avail(net, extra);
-	net_tcp_rx_avail(net, extra);
+	avail = net_ethernet_rx(net, extra, NULL, NULL);
 
-	return net_ethernet_rx(net, extra, NULL, NULL);
+	pthread_mutex_unlock(&net->lock);
+	return avail;
 }
 
 
@@ -305,77 +640,62 @@ int net_ethernet_rx_avail(struct net *net, void *extra)
  *
  *  Return value is 1 if there was a packet available. *packetp and *lenp
  *  will be set to the packet's data pointer and length, respectively, and
- *  the packet will be removed from the linked list). If there was no packet
- *  available, 0 is returned.
+ *  the packet will be removed from the NIC's receive ring. The caller must
+ *  give back the packet using net_ethernet_packet_free() when done with it.
+ *  If there was no packet available, 0 is returned.
  *
- *  If packetp is NULL, then the search is aborted as soon as a packet with
- *  the correct 'extra' field is found, and a 1 is returned, but as packetp
- *  is NULL we can't return the actual packet. (This is the internal form
- *  if net_ethernet_rx_avail().)
+ *  If packetp is NULL, then 1 is returned if there is a packet available,
+ *  but the packet is left in the ring. (This is the internal form of
+ *  net_ethernet_rx_avail().)
  */
 int net_ethernet_rx(struct net *net, void *extra,
 	unsigned char **packetp, int *lenp)
 {
-	struct ethernet_packet_link *lp, *prev;
+	struct net_nic *nic;
+	struct net_packet *p;
 
 	if (net == NULL)
 		return 0;
 
-	/*  Find the first packet which has the right 'extra' field.  */
-
-	lp = net->first_ethernet_packet;
-	prev = NULL;
-	while (lp != NULL) {
-		if (lp->extra == extra) {
-			/*  We found a packet for this controller!  */
-			if (packetp == NULL || lenp == NULL)
-				return 1;
+	pthread_mutex_lock(&net->lock);
 
-			/*  Let's return it:  */
-			(*packetp) = lp->data;
-			(*lenp) = lp->len;
-
-			/*  Remove this link from the linked list:  */
-			if (prev == NULL)
-				net->first_ethernet_packet = lp->next;
-			else
-				prev->next = lp->next;
-
-			if (lp->next == NULL)
-				net->last_ethernet_packet = prev;
-			else
-				lp->next->prev = prev;
+	nic = net_find_nic(net, extra);
+	if (nic == NULL || nic->rx_count == 0) {
+		pthread_mutex_unlock(&net->lock);
+		return 0;
+	}
 
-			free(lp);
+	if (packetp == NULL || lenp == NULL) {
+		pthread_mutex_unlock(&net->lock);
+		return 1;
+	}
 
-			/*  ... and return successfully:  */
-			return 1;
-		}
+	p = nic->rx_ring[nic->rx_first];
+	nic->rx_ring[nic->rx_first] = NULL;
+	nic->rx_first = (nic->rx_first + 1) % NET_RX_RING_SIZE;
+	nic->rx_count --;
 
-		prev = lp;
-		lp = lp->next;
-	}
+	(*packetp) = p->data;
+	(*lenp) = p->len;
 
-	/*  No packet found. :-(  */
-	return 0;
+	pthread_mutex_unlock(&net->lock);
+	return 1;
 }
 
 
 /*
- *  net_ethernet_tx():
+ *  net_ethernet_tx_locked():
  *
- *  Transmit an ethernet packet, as seen from the emulated ethernet controller.
- *  If the packet can be handled here, it will not necessarily be transmitted
- *  to the outside world.
+ *  Helper for net_ethernet_tx(), called with net->lock held.
  */
-void net_ethernet_tx(struct net *net, void *extra,
+static void net_ethernet_tx_locked(struct net *net, void *extra,
 	unsigned char *packet, int len)
 {
+	struct net_nic *src_nic = NULL;
+	struct net_mac_entry *dst = NULL;
+	struct remote_net *rnp;
 	int i, eth_type, for_the_gateway;
 
-	if (net == NULL)
-		return;
-
 	for_the_gateway = !memcmp(packet, net->gateway_ethernet_addr, 6);
 
 	/*  Drop too small packets:  */
@@ -385,32 +705,50 @@ void net_ethernet_tx(struct net *net, void *extra,
 		return;
 	}
 
+	if (extra != NULL) {
+		src_nic = net_find_nic(net, extra);
+		if (src_nic != NULL)
+			net_mac_learn(net, packet + 6, src_nic, NULL);
+	}
+
+	if (!for_the_gateway)
+		dst = net_mac_lookup(net, packet);
+
 	/*
-	 *  Copy this packet to all other NICs on this network (except if
-	 *  it is aimed specifically at the gateway's ethernet address):
+	 *  Copy this packet to the other NICs on this network (except if
+	 *  it is aimed specifically at the gateway's ethernet address). If
+	 *  the NIC which owns the destination address is known, then the
+	 *  packet is only copied to that NIC:
 	 */
 	if (!for_the_gateway && extra != NULL && net->n_nics > 0) {
-		for (i=0; i<net->n_nics; i++)
-			if (extra != net->nic_extra[i]) {
-				struct ethernet_packet_link *lp;
-				lp = net_allocate_ethernet_packet_link(net,
-				    net->nic_extra[i], len);
+		for (i=0; i<net->n_nics; i++) {
+			struct net_packet *lp;
+
+			if (extra == net->nics[i]->extra ||
+			    (dst != NULL && dst->nic != net->nics[i]))
+				continue;
 
-				/*  Copy the entire packet:  */
+			lp = net_ethernet_rx_alloc(net,
+			    net->nics[i]->extra, len);
+
+			/*  Copy the entire packet:  */
+			if (lp != NULL)
 				memcpy(lp->data, packet, len);
-			}
+		}
 	}
 
 	/*
 	 *  If this network is distributed across multiple emulator processes,
-	 *  then transmit the packet to those other processes.
+	 *  then transmit the packet to those other processes (or only to the
+	 *  one which owns the destination address, if it is known).
 	 */
-	if (!for_the_gateway && net->remote_nets != NULL) {
-		struct remote_net *rnp = net->remote_nets;
-		while (rnp != NULL) {
-			send_udp(&rnp->ipv4_addr, rnp->portnr, packet, len);
-			rnp = rnp->next;
-		}
+	if (!for_the_gateway && (dst == NULL || dst->nic == NULL)) {
+		if (dst != NULL && dst->remote != NULL)
+			net_distributed_tx(net, dst->remote, packet, len);
+		else
+			for (rnp = net->remote_nets; rnp != NULL;
+			    rnp = rnp->next)
+				net_distributed_tx(net, rnp, packet, len);
 	}
 
 
@@ -494,6 +832,25 @@ void net_ethernet_tx(struct net *net, void *extra,
 }
 
 
+/*
+ *  net_ethernet_tx():
+ *
+ *  Transmit an ethernet packet, as seen from the emulated ethernet controller.
+ *  If the packet can be handled here, it will not necessarily be transmitted
+ *  to the outside world.
+ */
+void net_ethernet_tx(struct net *net, void *extra,
+	unsigned char *packet, int len)
+{
+	if (net == NULL)
+		return;
+
+	pthread_mutex_lock(&net->lock);
+	net_ethernet_tx_locked(net, extra, packet, len);
+	pthread_mutex_unlock(&net->lock);
+}
+
+
 /*
  *  parse_resolvconf():
  *
@@ -592,11 +949,14 @@ static void parse_resolvconf(struct net *net)
 /*
  *  net_add_nic():
  *
- *  Add a NIC to a network. (All NICs on a network will see each other's
- *  packets.)
+ *  Add a NIC to a network. (NICs on a network see each other's packets,
+ *  except unicast packets for some other NIC's ethernet address. macaddr,
+ *  if non-NULL, is the NIC's initial ethernet address.)
  */
 void net_add_nic(struct net *net, void *extra, unsigned char *macaddr)
 {
+	struct net_nic *nic;
+
 	if (net == NULL)
 		return;
 
@@ -605,11 +965,19 @@ void net_add_nic(struct net *net, void *extra, unsigned char *macaddr)
 		exit(1);
 	}
 
+	CHECK_ALLOCATION(nic = (struct net_nic *)
+	    malloc(sizeof(struct net_nic)));
+	memset(nic, 0, sizeof(struct net_nic));
+	nic->extra = extra;
+
 	net->n_nics ++;
-	CHECK_ALLOCATION(net->nic_extra = (void **)
-	    realloc(net->nic_extra, sizeof(void *) * net->n_nics));
+	CHECK_ALLOCATION(net->nics = (struct net_nic **)
+	    realloc(net->nics, sizeof(struct net_nic *) * net->n_nics));
 
-	net->nic_extra[net->n_nics - 1] = extra;
+	net->nics[net->n_nics - 1] = nic;
+
+	if (macaddr != NULL)
+		net_mac_learn(net, macaddr, nic, NULL);
 }
 
 
@@ -654,8 +1022,9 @@ static void net_gateway_init(struct net *net)
  */
 void net_dumpinfo(struct net *net)
 {
-	int iadd = DEBUG_INDENTATION;
+	int i, iadd = DEBUG_INDENTATION;
 	struct remote_net *rnp;
+	struct tcp_forward *fwd;
 
 	debug("net:\n");
 
@@ -690,14 +1059,29 @@ void net_dumpinfo(struct net *net)
 		debug("distributed network: local port = %i\n",
 		    net->local_port);
 	debug_indentation(iadd);
+	net_shm_dumpinfo(net, NULL);
 	while (rnp != NULL) {
 		debug("remote \"%s\": ", rnp->name);
 		net_debugaddr(&rnp->ipv4_addr, NET_ADDR_IPV4);
 		debug(" port %i\n", rnp->portnr);
+		debug_indentation(iadd);
+		net_shm_dumpinfo(net, rnp);
+		debug_indentation(-iadd);
 		rnp = rnp->next;
 	}
 	debug_indentation(-iadd);
 
+	for (fwd = net->tcp_forwards; fwd != NULL; fwd = fwd->next) {
+		debug("forwarding TCP port %i to ", fwd->host_port);
+		net_debugaddr(&fwd->inside_ip_address, NET_ADDR_IPV4);
+		debug(":%i\n", fwd->inside_tcp_port);
+	}
+
+	for (i=0; i<net->n_nics; i++)
+		debug("nic %i: %llu packets queued, %llu dropped\n", i,
+		    (unsigned long long) net->nics[i]->rx_packets,
+		    (unsigned long long) net->nics[i]->rx_dropped);
+
 	debug_indentation(-iadd);
 }
 
@@ -722,6 +1106,8 @@ struct net *net_init(struct emul *emul, int init_flags,
 	char **remote, int n_remote, int local_port,
 	const char *settings_prefix)
 {
+	pthread_mutexattr_t attr;
+	struct rlimit rl;
 	struct net *net;
 	int res;
 
@@ -731,9 +1117,14 @@ struct net *net_init(struct emul *emul, int init_flags,
 	/*  Set the back pointer:  */
 	net->emul = emul;
 
+	/*  Recursive, since net_ethernet_rx_avail() calls net_ethernet_rx():  */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&net->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
 	/*  Sane defaults:  */
 	net->timestamp = 0;
-	net->first_ethernet_packet = net->last_ethernet_packet = NULL;
 
 #ifdef HAVE_INET_PTON
 	res = inet_pton(AF_INET, ipv4addr, &net->netmask_ipv4);
@@ -781,6 +1172,10 @@ struct net *net_init(struct emul *emul, int init_flags,
 		/*  Set the socket to non-blocking:  */
 		res = fcntl(net->local_port_socket, F_GETFL);
 		fcntl(net->local_port_socket, F_SETFL, res | O_NONBLOCK);
+
+		net->local_port_source = net_reactor_add(net,
+		    net->local_port_socket, net_distributed_rx, NULL);
+		net_reactor_arm(net, net->local_port_source, NET_REACTOR_READ);
 	}
 	if (n_remote != 0) {
 		struct remote_net *rnp;
@@ -819,6 +1214,10 @@ struct net *net_init(struct emul *emul, int init_flags,
 		}
 	}
 
+	/*  Other emulators on this host may send to us via shared memory:  */
+	if (local_port != 0)
+		net_shm_init(net);
+
 	if (init_flags & NET_INIT_FLAG_GATEWAY)
 		net_gateway_init(net);
 
@@ -827,6 +1226,13 @@ struct net *net_init(struct emul *emul, int init_flags,
 	/*  This is necessary when using the real network:  */
 	signal(SIGPIPE, SIG_IGN);
 
+	/*  Each NAT connection uses a host socket, so allow as many open
+	    files as possible:  */
+	if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+		rl.rlim_cur = rl.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &rl);
+	}
+
 	return net;
 }
 
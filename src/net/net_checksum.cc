@@ -0,0 +1,374 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright  
+ *     notice, this list of conditions and the following disclaimer in the 
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE   
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *  Internet checksums (RFC 1071), used for the IP, ICMP, UDP and TCP
+ *  headers which the NAT gateway builds or rewrites.
+ *
+ *  The one's complement sum of 16-bit words does not depend on the byte
+ *  order it is calculated in, as long as the result is byte swapped
+ *  afterwards, and carries out of the low 16 bits can be added in at any
+ *  time. So the data is summed in host order, in 32-bit pieces added to
+ *  64-bit accumulators, and only folded to 16 bits at the end.
+ *
+ *  There is a plain C implementation, and SSE2 and AVX2 (on x86, chosen at
+ *  runtime depending on what the host CPU supports) or NEON (on AArch64)
+ *  implementations. experiments/checksum_bench compares them.
+ *
+ *  When only a few bytes of a header are changed, for example when the
+ *  gateway turns an ICMP echo request into a reply, the checksum can be
+ *  updated without summing the rest of the packet (RFC 1624); see
+ *  net_checksum_adjust().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "misc.h"
+#include "net.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define	NET_CHECKSUM_NEON
+#include <arm_neon.h>
+#endif
+
+
+/*  Shorter data is always summed by net_checksum_generic():  */
+#define	NET_CHECKSUM_SHORT	64
+
+
+/*
+ *  net_checksum_tail():
+ *
+ *  Adds the last len (less than 8) bytes to a host order sum.
+ */
+static inline uint64_t net_checksum_tail(const unsigned char *p, int len,
+	uint64_t acc)
+{
+	unsigned char last[2];
+	uint16_t w;
+
+	while (len >= 2) {
+		memcpy(&w, p, 2);
+		acc += w;
+		p += 2; len -= 2;
+	}
+
+	/*  An odd byte is the high byte of a word, padded with zero:  */
+	if (len) {
+		last[0] = p[0];
+		last[1] = 0;
+		memcpy(&w, last, 2);
+		acc += w;
+	}
+
+	return acc;
+}
+
+
+/*
+ *  net_checksum_generic():
+ *
+ *  Plain C version. Returns the host order sum of len bytes (not folded).
+ */
+static uint64_t net_checksum_generic(const unsigned char *p, int len)
+{
+	uint64_t acc0 = 0, acc1 = 0, x, y;
+
+	while (len >= 16) {
+		memcpy(&x, p, 8);
+		memcpy(&y, p + 8, 8);
+		acc0 += (uint32_t) x;
+		acc1 += x >> 32;
+		acc0 += (uint32_t) y;
+		acc1 += y >> 32;
+		p += 16; len -= 16;
+	}
+
+	if (len >= 8) {
+		memcpy(&x, p, 8);
+		acc0 += (uint32_t) x;
+		acc1 += x >> 32;
+		p += 8; len -= 8;
+	}
+
+	return net_checksum_tail(p, len, acc0 + acc1);
+}
+
+
+#ifdef HAVE_X86_SIMD
+
+/*
+ *  net_checksum_sse2():
+ *
+ *  SSE2 version: the 32-bit pieces are zero extended to 64 bits, and added
+ *  to two vectors of 64-bit accumulators.
+ */
+__attribute__((target("sse2")))
+static uint64_t net_checksum_sse2(const unsigned char *p, int len)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc0 = zero, acc1 = zero;
+	uint64_t sum[2];
+
+	while (len >= 32) {
+		__m128i a = _mm_loadu_si128((const __m128i *) p);
+		__m128i b = _mm_loadu_si128((const __m128i *) (p + 16));
+		acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+		acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+		acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+		acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+		p += 32; len -= 32;
+	}
+
+	_mm_storeu_si128((__m128i *) sum, _mm_add_epi64(acc0, acc1));
+	return sum[0] + sum[1] + net_checksum_generic(p, len);
+}
+
+
+/*
+ *  net_checksum_avx2():
+ *
+ *  AVX2 version, like the SSE2 version but with 256-bit vectors.
+ */
+__attribute__((target("avx2")))
+static uint64_t net_checksum_avx2(const unsigned char *p, int len)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i acc0 = zero, acc1 = zero;
+	uint64_t sum[4];
+
+	while (len >= 64) {
+		__m256i a = _mm256_loadu_si256((const __m256i *) p);
+		__m256i b = _mm256_loadu_si256((const __m256i *) (p + 32));
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+		acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+		acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+		p += 64; len -= 64;
+	}
+
+	_mm256_storeu_si256((__m256i *) sum, _mm256_add_epi64(acc0, acc1));
+	return sum[0] + sum[1] + sum[2] + sum[3] + net_checksum_sse2(p, len);
+}
+
+#endif	/*  HAVE_X86_SIMD  */
+
+
+#ifdef NET_CHECKSUM_NEON
+
+/*
+ *  net_checksum_neon():
+ *
+ *  NEON version: pairs of 32-bit pieces are added to 64-bit accumulators.
+ */
+static uint64_t net_checksum_neon(const unsigned char *p, int len)
+{
+	uint64x2_t acc0 = vdupq_n_u64(0), acc1 = vdupq_n_u64(0);
+
+	while (len >= 32) {
+		acc0 = vpadalq_u32(acc0, vreinterpretq_u32_u8(vld1q_u8(p)));
+		acc1 = vpadalq_u32(acc1,
+		    vreinterpretq_u32_u8(vld1q_u8(p + 16)));
+		p += 32; len -= 32;
+	}
+
+	acc0 = vaddq_u64(acc0, acc1);
+	return vgetq_lane_u64(acc0, 0) + vgetq_lane_u64(acc0, 1) +
+	    net_checksum_generic(p, len);
+}
+
+#endif	/*  NET_CHECKSUM_NEON  */
+
+
+static uint64_t net_checksum_select(const unsigned char *p, int len);
+
+static uint64_t (*net_checksum_impl)(const unsigned char *, int) =
+    net_checksum_select;
+static const char *net_checksum_impl_name = "generic";
+
+static const struct {
+	const char	*name;
+	uint64_t	(*f)(const unsigned char *, int);
+} net_checksum_impls[] = {
+#ifdef HAVE_X86_SIMD
+	{ "avx2",	net_checksum_avx2 },
+	{ "sse2",	net_checksum_sse2 },
+#endif
+#ifdef NET_CHECKSUM_NEON
+	{ "neon",	net_checksum_neon },
+#endif
+	{ "generic",	net_checksum_generic },
+	{ NULL,		NULL }
+};
+
+
+/*
+ *  net_checksum_supported():
+ *
+ *  Returns 1 if the host CPU can run a checksum implementation.
+ */
+static int net_checksum_supported(const char *name)
+{
+#ifdef HAVE_X86_SIMD
+	if (!strcmp(name, "avx2"))
+		return __builtin_cpu_supports("avx2");
+	if (!strcmp(name, "sse2"))
+		return __builtin_cpu_supports("sse2");
+#endif
+	(void) name;
+	return 1;
+}
+
+
+/*
+ *  net_checksum_select():
+ *
+ *  Called the first time a checksum is calculated. Picks the first (i.e.
+ *  fastest) implementation which the host CPU supports.
+ */
+static uint64_t net_checksum_select(const unsigned char *p, int len)
+{
+	int i;
+
+	for (i=0; net_checksum_impls[i].name != NULL; i++)
+		if (net_checksum_supported(net_checksum_impls[i].name)) {
+			net_checksum_use(net_checksum_impls[i].name);
+			break;
+		}
+
+	return net_checksum_impl(p, len);
+}
+
+
+/*
+ *  net_checksum_use():
+ *
+ *  Selects a checksum implementation by name ("generic", "sse2", "avx2" or
+ *  "neon"). Returns 1 on success, 0 if it is not available on this host.
+ *  (Normally, the fastest one is selected automatically.)
+ */
+int net_checksum_use(const char *name)
+{
+	int i;
+
+	for (i=0; net_checksum_impls[i].name != NULL; i++)
+		if (!strcmp(net_checksum_impls[i].name, name) &&
+		    net_checksum_supported(name)) {
+			net_checksum_impl_name = net_checksum_impls[i].name;
+			net_checksum_impl = net_checksum_impls[i].f;
+			return 1;
+		}
+
+	return 0;
+}
+
+
+/*
+ *  net_checksum_name():
+ *
+ *  Returns the name of the checksum implementation in use.
+ */
+const char *net_checksum_name(void)
+{
+	if (net_checksum_impl == net_checksum_select)
+		net_checksum_select(NULL, 0);
+
+	return net_checksum_impl_name;
+}
+
+
+/*
+ *  net_checksum_partial():
+ *
+ *  Adds len bytes, taken as big-endian 16-bit words, to a partial checksum
+ *  'sum' (0 to start with), and returns the new partial checksum. (If len
+ *  is odd, the last byte is padded with a zero byte, so only the last piece
+ *  of data may have an odd length.)
+ */
+uint32_t net_checksum_partial(const unsigned char *data, int len,
+	uint32_t sum)
+{
+	uint64_t acc;
+
+	/*  Headers are too short for the vector versions to pay off:  */
+	if (len < NET_CHECKSUM_SHORT)
+		acc = net_checksum_generic(data, len);
+	else
+		acc = net_checksum_impl(data, len);
+
+	/*  Fold to 16 bits:  */
+	acc = (acc & 0xffffffff) + (acc >> 32);
+	acc = (acc & 0xffff) + (acc >> 16);
+	acc = (acc & 0xffff) + (acc >> 16);
+	acc = (acc & 0xffff) + (acc >> 16);
+
+#ifdef HOST_LITTLE_ENDIAN
+	acc = ((acc & 0xff) << 8) | (acc >> 8);
+#endif
+
+	return sum + (uint32_t) acc;
+}
+
+
+/*
+ *  net_checksum_finish():
+ *
+ *  Folds a partial checksum to 16 bits, and returns its one's complement,
+ *  i.e. the value to store in a checksum field.
+ */
+uint16_t net_checksum_finish(uint32_t sum)
+{
+	sum = (sum & 0xffff) + (sum >> 16);
+	sum = (sum & 0xffff) + (sum >> 16);
+
+	return ~sum & 0xffff;
+}
+
+
+/*
+ *  net_checksum_adjust():
+ *
+ *  Updates the big-endian checksum at 'checksum' when len bytes (an even
+ *  number, at an even offset in the checksummed data) are changed from
+ *  old_data to new_data (RFC 1624, eqn. 3):  HC' = ~(~HC + ~m + m')
+ */
+void net_checksum_adjust(unsigned char *checksum,
+	const unsigned char *old_data, const unsigned char *new_data, int len)
+{
+	uint32_t sum = ~((checksum[0] << 8) + checksum[1]) & 0xffff;
+
+	sum += net_checksum_finish(net_checksum_partial(old_data, len, 0));
+	sum = net_checksum_partial(new_data, len, sum);
+	sum = net_checksum_finish(sum);
+
+	checksum[0] = sum >> 8;
+	checksum[1] = sum & 0xff;
+}
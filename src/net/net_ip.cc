@@ -45,29 +45,28 @@
 /*  #define debug fatal  */
 
 
+/*  Max number of datagrams read from a UDP socket each time it is ready:  */
+#define	NET_UDP_MAX_PER_WAKEUP		16
+
+static void net_udp_socket_ready(struct net *net, void *extra, void *owner);
+static void net_tcp_socket_ready(struct net *net, void *extra, void *owner);
+static void net_tcp_accept_ready(struct net *net, void *extra, void *owner);
+
+
 /*
  *  net_ip_checksum():
  *
  *  Fill in an IP header checksum. (This works for ICMP too.)
- *  chksumoffset should be 10 for IP headers, and len = 20.
- *  For ICMP packets, chksumoffset = 2 and len = length of the ICMP packet.
+ *  chksumoffset is the checksum field's offset, which must be even.
  */
 void net_ip_checksum(unsigned char *ip_header, int chksumoffset, int len)
 {
-	int i;
-	uint32_t sum = 0;
-
-	for (i=0; i<len; i+=2)
-		if (i != chksumoffset) {
-			uint16_t w = (ip_header[i] << 8) + ip_header[i+1];
-			sum += w;
-			while (sum > 65535) {
-				int to_add = sum >> 16;
-				sum = (sum & 0xffff) + to_add;
-			}
-		}
+	uint16_t sum;
+
+	ip_header[chksumoffset + 0] = 0;
+	ip_header[chksumoffset + 1] = 0;
 
-	sum ^= 0xffff;
+	sum = net_checksum_finish(net_checksum_partial(ip_header, len, 0));
 	ip_header[chksumoffset + 0] = sum >> 8;
 	ip_header[chksumoffset + 1] = sum & 0xff;
 }
@@ -85,53 +84,24 @@ void net_ip_checksum(unsigned char *ip_header, int chksumoffset, int len)
  *	uint16_t protocol; (= 6 for tcp)
  *	uint16_t tcp_len;
  *
- *  tcp_len is length of header PLUS data.  The psedo header is created
- *  internally here, and does not need to be supplied by the caller.
+ *  tcp_len is length of header PLUS data.  The psedo header is summed
+ *  here, and does not need to be supplied by the caller.
  */
 void net_ip_tcp_checksum(unsigned char *tcp_header, int chksumoffset,
 	int tcp_len, unsigned char *srcaddr, unsigned char *dstaddr,
 	int udpflag)
 {
-	int i, pad = 0;
-	unsigned char pseudoh[12];
-	uint32_t sum = 0;
-
-	memcpy(pseudoh + 0, srcaddr, 4);
-	memcpy(pseudoh + 4, dstaddr, 4);
-	pseudoh[8] = 0x00;
-	pseudoh[9] = udpflag? 17 : 6;
-	pseudoh[10] = tcp_len >> 8;
-	pseudoh[11] = tcp_len & 255;
-
-	for (i=0; i<12; i+=2) {
-		uint16_t w = (pseudoh[i] << 8) + pseudoh[i+1];
-		sum += w;
-		while (sum > 65535) {
-			int to_add = sum >> 16;
-			sum = (sum & 0xffff) + to_add;
-		}
-	}
+	uint32_t sum;
 
-	if (tcp_len & 1) {
-		tcp_len ++;
-		pad = 1;
-	}
+	sum = (srcaddr[0] << 8) + srcaddr[1] + (srcaddr[2] << 8) + srcaddr[3]
+	    + (dstaddr[0] << 8) + dstaddr[1] + (dstaddr[2] << 8) + dstaddr[3]
+	    + (udpflag? 17 : 6) + tcp_len;
 
-	for (i=0; i<tcp_len; i+=2)
-		if (i != chksumoffset) {
-			uint16_t w;
-			if (!pad || i < tcp_len-2)
-				w = (tcp_header[i] << 8) + tcp_header[i+1];
-			else
-				w = (tcp_header[i] << 8) + 0x00;
-			sum += w;
-			while (sum > 65535) {
-				int to_add = sum >> 16;
-				sum = (sum & 0xffff) + to_add;
-			}
-		}
+	tcp_header[chksumoffset + 0] = 0;
+	tcp_header[chksumoffset + 1] = 0;
 
-	sum ^= 0xffff;
+	sum = net_checksum_finish(net_checksum_partial(tcp_header, tcp_len,
+	    sum));
 	tcp_header[chksumoffset + 0] = sum >> 8;
 	tcp_header[chksumoffset + 1] = sum & 0xff;
 }
@@ -159,14 +129,16 @@ static void net_ip_icmp(struct net *net, void *extra,
 	unsigned char *packet, int len)
 {
 	int type;
-	struct ethernet_packet_link *lp;
+	struct net_packet *lp;
 
 	type = packet[34];
 
 	switch (type) {
 	case 8:	/*  ECHO request  */
 		debug("[ ICMP echo ]\n");
-		lp = net_allocate_ethernet_packet_link(net, extra, len);
+		lp = net_ethernet_rx_alloc(net, extra, len);
+		if (lp == NULL)
+			break;
 
 		/*  Copy the old packet first:  */
 		memcpy(lp->data + 12, packet + 12, len - 12);
@@ -179,17 +151,19 @@ static void net_ip_icmp(struct net *net, void *extra,
 		memcpy(lp->data + 26, packet + 30, 4);
 		memcpy(lp->data + 30, packet + 26, 4);
 
-		/*  Change from echo REQUEST to echo REPLY:  */
+		/*
+		 *  Change from echo REQUEST to echo REPLY, and decrease the
+		 *  TTL to a low value. Only the checksums of the words which
+		 *  change need to be updated. (Swapping the IP addresses
+		 *  does not change the sums.)
+		 */
 		lp->data[34] = 0x00;
+		net_checksum_adjust(lp->data + 36, packet + 34,
+		    lp->data + 34, 2);
 
-		/*  Decrease the TTL to a low value:  */
 		lp->data[22] = 2;
-
-		/*  Recalculate ICMP checksum:  */
-		net_ip_checksum(lp->data + 34, 2, len - 34);
-
-		/*  Recalculate IP header checksum:  */
-		net_ip_checksum(lp->data + 14, 10, 20);
+		net_checksum_adjust(lp->data + 24, packet + 22,
+		    lp->data + 22, 2);
 
 		break;
 	default:
@@ -199,49 +173,392 @@ static void net_ip_icmp(struct net *net, void *extra,
 
 
 /*
- *  tcp_closeconnection():
+ *  net_conn_hash():
  *
- *  Helper function which closes down a TCP connection completely.
+ *  Returns the hash table index of a NAT connection. The key is the guest
+ *  OS' (inside) address and port, and the outside address and port.
  */
-static void tcp_closeconnection(struct net *net, int con_id)
+static int net_conn_hash(unsigned char *inside_ip, int inside_port,
+	unsigned char *outside_ip, int outside_port)
 {
-	close(net->tcp_connections[con_id].socket);
-	net->tcp_connections[con_id].state = TCP_OUTSIDE_DISCONNECTED;
-	net->tcp_connections[con_id].in_use = 0;
-	net->tcp_connections[con_id].incoming_buf_len = 0;
+	uint32_t x;
+
+	x = ((uint32_t)inside_ip[0] << 24) + (inside_ip[1] << 16) +
+	    (inside_ip[2] << 8) + inside_ip[3];
+	x = x * 31 + (((uint32_t)outside_ip[0] << 24) + (outside_ip[1] << 16)
+	    + (outside_ip[2] << 8) + outside_ip[3]);
+	x = x * 31 + (((uint32_t)inside_port << 16) ^ outside_port);
+
+	x ^= x >> 16;
+	x *= 0x45d9f3b;
+	x ^= x >> 16;
+
+	return x % NET_CONN_HASH_SIZE;
 }
 
 
 /*
- *  net_ip_tcp_connectionreply():
+ *  udp_findconnection(), tcp_findconnection():
+ *
+ *  Look up a NAT connection. Returns NULL if there is no such connection.
+ */
+static struct udp_connection *udp_findconnection(struct net *net,
+	unsigned char *inside_ip, int inside_port,
+	unsigned char *outside_ip, int outside_port)
+{
+	struct udp_connection *con = net->udp_hash[net_conn_hash(inside_ip,
+	    inside_port, outside_ip, outside_port)];
+
+	while (con != NULL) {
+		if (con->inside_udp_port == inside_port &&
+		    con->outside_udp_port == outside_port &&
+		    memcmp(con->inside_ip_address, inside_ip, 4) == 0 &&
+		    memcmp(con->outside_ip_address, outside_ip, 4) == 0)
+			return con;
+		con = con->hash_next;
+	}
+
+	return NULL;
+}
+
+static struct tcp_connection *tcp_findconnection(struct net *net,
+	unsigned char *inside_ip, int inside_port,
+	unsigned char *outside_ip, int outside_port)
+{
+	struct tcp_connection *con = net->tcp_hash[net_conn_hash(inside_ip,
+	    inside_port, outside_ip, outside_port)];
+
+	while (con != NULL) {
+		if (con->inside_tcp_port == inside_port &&
+		    con->outside_tcp_port == outside_port &&
+		    memcmp(con->inside_ip_address, inside_ip, 4) == 0 &&
+		    memcmp(con->outside_ip_address, outside_ip, 4) == 0)
+			return con;
+		con = con->hash_next;
+	}
+
+	return NULL;
+}
+
+
+/*
+ *  udp_touch():
  *
- *  When changing from state _TRYINGTOCONNECT to _CONNECTED, then this
- *  function should be called with connecting set to 1.
+ *  Marks a UDP connection as the most recently used one.
+ */
+static void udp_touch(struct net *net, struct udp_connection *con)
+{
+	net->timestamp ++;
+	con->last_used_timestamp = net->timestamp;
+
+	if (net->udp_lru_last == con)
+		return;
+
+	/*  Unlink:  */
+	if (con->lru_prev != NULL)
+		con->lru_prev->lru_next = con->lru_next;
+	else if (net->udp_lru_first == con)
+		net->udp_lru_first = con->lru_next;
+	if (con->lru_next != NULL)
+		con->lru_next->lru_prev = con->lru_prev;
+
+	/*  ... and add last:  */
+	con->lru_next = NULL;
+	con->lru_prev = net->udp_lru_last;
+	if (con->lru_prev != NULL)
+		con->lru_prev->lru_next = con;
+	else
+		net->udp_lru_first = con;
+	net->udp_lru_last = con;
+}
+
+
+/*
+ *  udp_closeconnection():
+ *
+ *  Helper function which closes down and frees a UDP connection.
+ */
+static void udp_closeconnection(struct net *net, struct udp_connection *con)
+{
+	struct udp_connection **conp = &net->udp_hash[net_conn_hash(
+	    con->inside_ip_address, con->inside_udp_port,
+	    con->outside_ip_address, con->outside_udp_port)];
+
+	while (*conp != con)
+		conp = &(*conp)->hash_next;
+	*conp = con->hash_next;
+
+	if (con->lru_prev != NULL)
+		con->lru_prev->lru_next = con->lru_next;
+	else
+		net->udp_lru_first = con->lru_next;
+	if (con->lru_next != NULL)
+		con->lru_next->lru_prev = con->lru_prev;
+	else
+		net->udp_lru_last = con->lru_prev;
+
+	net_reactor_remove(net, con->source);
+	close(con->socket);
+
+	free(con);
+	net->n_udp_connections --;
+}
+
+
+/*
+ *  tcp_set_unacked():
+ *
+ *  Adds a TCP connection to (or removes it from) the list of connections
+ *  with data which the guest OS has not acknowledged yet. (See
+ *  tcp_check_pending().)
+ */
+static void tcp_set_unacked(struct net *net, struct tcp_connection *con,
+	int unacked)
+{
+	if (con->unacked == unacked)
+		return;
+
+	con->unacked = unacked;
+
+	if (unacked) {
+		con->unacked_prev = NULL;
+		con->unacked_next = net->tcp_unacked_first;
+		if (con->unacked_next != NULL)
+			con->unacked_next->unacked_prev = con;
+		net->tcp_unacked_first = con;
+	} else {
+		if (con->unacked_prev != NULL)
+			con->unacked_prev->unacked_next = con->unacked_next;
+		else
+			net->tcp_unacked_first = con->unacked_next;
+		if (con->unacked_next != NULL)
+			con->unacked_next->unacked_prev = con->unacked_prev;
+	}
+}
+
+
+/*
+ *  tcp_now():
+ *
+ *  Returns the host's time, in microseconds. The retransmit timers use host
+ *  time, since the outside world doesn't care how fast the emulation runs.
+ */
+static int64_t tcp_now(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+
+/*
+ *  tcp_rearm():
+ *
+ *  Arms a TCP connection's socket for the next thing to wait for: the
+ *  outcome of connect(), incoming data (if there is room for it in the send
+ *  buffer), and/or room for data from the guest OS which could not be
+ *  written yet.
+ */
+static void tcp_rearm(struct net *net, struct tcp_connection *con)
+{
+	int events = 0;
+
+	if (con->state == TCP_OUTSIDE_TRYINGTOCONNECT)
+		events = NET_REACTOR_WRITE;
+	else if (con->state == TCP_OUTSIDE_CONNECTED) {
+		if (!con->outside_eof && con->send_len < TCP_SEND_BUF_LEN)
+			events |= NET_REACTOR_READ;
+		if (con->recv_len > 0)
+			events |= NET_REACTOR_WRITE;
+	}
+
+	net_reactor_arm(net, con->source, events);
+}
+
+
+/*
+ *  tcp_check_pending():
+ *
+ *  A connection is on the list of connections with unacknowledged data
+ *  while anything which has been sent to the guest OS is unacknowledged, or
+ *  while there is data (or a FIN) which has not been sent yet. The
+ *  retransmit timer runs while this is the case.
+ */
+static void tcp_check_pending(struct net *net, struct tcp_connection *con)
+{
+	int pending;
+
+	if (con->state == TCP_OUTSIDE_TRYINGTOCONNECT)
+		pending = 0;
+	else if (!con->syn_acked || con->outside_seqnr != con->inside_acknr)
+		pending = 1;
+	else
+		pending = con->send_len > 0 ||
+		    (con->outside_eof && !con->fin_sent);
+
+	tcp_set_unacked(net, con, pending);
+
+	if (!pending)
+		con->rto_deadline = 0;
+	else if (con->rto_deadline == 0)
+		con->rto_deadline = tcp_now() + con->rto;
+}
+
+
+/*
+ *  tcp_newconnection():
+ *
+ *  Creates a TCP connection for an outside socket, and adds it to the hash
+ *  table and to the reactor. (The caller sets the state, and arms the
+ *  socket.)
+ */
+static struct tcp_connection *tcp_newconnection(struct net *net, int s,
+	unsigned char *ethernet_addr, unsigned char *inside_ip,
+	int inside_port, unsigned char *outside_ip, int outside_port)
+{
+	struct tcp_connection *con;
+	int h, res;
+
+	CHECK_ALLOCATION(con = (struct tcp_connection *)
+	    malloc(sizeof(struct tcp_connection)));
+	memset(con, 0, sizeof(struct tcp_connection));
+
+	CHECK_ALLOCATION(con->send_buf = (unsigned char *)
+	    malloc(TCP_SEND_BUF_LEN));
+	CHECK_ALLOCATION(con->recv_buf = (unsigned char *)
+	    malloc(TCP_RECV_BUF_LEN));
+
+	memcpy(con->ethernet_address, ethernet_addr, 6);
+	memcpy(con->inside_ip_address, inside_ip, 4);
+	con->inside_tcp_port = inside_port;
+	memcpy(con->outside_ip_address, outside_ip, 4);
+	con->outside_tcp_port = outside_port;
+	con->socket = s;
+
+	con->inside_mss = TCP_DEFAULT_MSS;
+	con->inside_wscale = -1;
+	con->rto = TCP_RTO_INITIAL;
+
+	/*  Our initial sequence number. (The SYN is not acked yet.)  */
+	con->outside_seqnr = ((random() & 0xffff) << 16) + (random() & 0xffff);
+	con->inside_acknr = con->outside_seqnr;
+
+	h = net_conn_hash(inside_ip, inside_port, outside_ip, outside_port);
+	con->hash_next = net->tcp_hash[h];
+	net->tcp_hash[h] = con;
+	net->n_tcp_connections ++;
+
+	/*  Set the socket to non-blocking:  */
+	res = fcntl(s, F_GETFL);
+	fcntl(s, F_SETFL, res | O_NONBLOCK);
+
+	con->source = net_reactor_add(net, s, net_tcp_socket_ready, con);
+
+	return con;
+}
+
+
+/*
+ *  tcp_closeconnection():
  *
- *  To send a generic ack reply, set connecting to 0.
+ *  Helper function which closes down and frees a TCP connection.
+ */
+static void tcp_closeconnection(struct net *net, struct tcp_connection *con)
+{
+	struct tcp_connection **conp = &net->tcp_hash[net_conn_hash(
+	    con->inside_ip_address, con->inside_tcp_port,
+	    con->outside_ip_address, con->outside_tcp_port)];
+
+	while (*conp != con)
+		conp = &(*conp)->hash_next;
+	*conp = con->hash_next;
+
+	tcp_set_unacked(net, con, 0);
+
+	net_reactor_remove(net, con->source);
+	close(con->socket);
+
+	free(con->send_buf);
+	free(con->recv_buf);
+	free(con);
+	net->n_tcp_connections --;
+}
+
+
+/*
+ *  tcp_reset():
  *
- *  To send data (PSH), set data to non-NULL and datalen to the length.
+ *  Sends an RST to the guest OS, and forgets about the connection.
+ */
+static void tcp_reset(struct net *net, void *extra,
+	struct tcp_connection *con)
+{
+	net_ip_tcp_connectionreply(net, extra, con, NET_TCP_RST | NET_TCP_ACK,
+	    NULL, 0);
+	tcp_closeconnection(net, con);
+}
+
+
+/*
+ *  tcp_finished():
  *
- *  This creates an ethernet packet for the guest OS with an ACK to the
- *  initial SYN packet.
+ *  Forgets about a TCP connection once both sides have closed it, and
+ *  everything has been acknowledged and written. Returns 1 if the
+ *  connection was freed.
  */
-void net_ip_tcp_connectionreply(struct net *net, void *extra,
-	int con_id, int connecting, unsigned char *data, int datalen, int rst)
+static int tcp_finished(struct net *net, struct tcp_connection *con)
 {
-	struct ethernet_packet_link *lp;
-	int tcp_length, ip_len, option_len = 20;
+	if (!con->inside_fin || !con->fin_acked || con->recv_len != 0)
+		return 0;
+
+	debug("[ net: TCP: connection %i closed ]\n", con->socket);
+	tcp_closeconnection(net, con);
+	return 1;
+}
+
 
-	if (connecting)
-		net->tcp_connections[con_id].outside_acknr =
-		    net->tcp_connections[con_id].inside_seqnr + 1;
+/*
+ *  net_ip_tcp_connectionreply():
+ *
+ *  Sends a TCP segment to the guest OS, with sequence number outside_seqnr
+ *  and acknowledgement number outside_acknr. flags are the NET_TCP_* flags
+ *  to set. SYN, FIN, and data (if data is non-NULL), advance outside_seqnr.
+ *
+ *  Returns 1 if the segment was sent, or 0 if the NIC's receive ring was
+ *  full. (outside_seqnr is then left as it was, so that the same data can
+ *  be sent later.)
+ */
+int net_ip_tcp_connectionreply(struct net *net, void *extra,
+	struct tcp_connection *con, int flags, unsigned char *data,
+	int datalen)
+{
+	struct net_packet *lp;
+	int tcp_length, ip_len, option_len = 0, window, o;
+
+	if (data == NULL)
+		datalen = 0;
+
+	/*  MSS and window scale options are only sent in SYN packets, and
+	    timestamps in all packets (if the guest OS uses them):  */
+	if (flags & NET_TCP_SYN) {
+		option_len += 4;
+		if (con->inside_wscale >= 0)
+			option_len += 4;
+	}
+	if (con->use_timestamps)
+		option_len += 12;
 
-	net->tcp_connections[con_id].tcp_id ++;
 	tcp_length = 20 + option_len + datalen;
 	ip_len = 20 + tcp_length;
-	lp = net_allocate_ethernet_packet_link(net, extra, 14 + ip_len);
+	lp = net_ethernet_rx_alloc(net, extra, 14 + ip_len);
+	if (lp == NULL)
+		return 0;
+
+	con->tcp_id ++;
 
 	/*  Ethernet header:  */
-	memcpy(lp->data + 0, net->tcp_connections[con_id].ethernet_address, 6);
+	memcpy(lp->data + 0, con->ethernet_address, 6);
 	memcpy(lp->data + 6, net->gateway_ethernet_addr, 6);
 	lp->data[12] = 0x08;	/*  IP = 0x0800  */
 	lp->data[13] = 0x00;
@@ -251,89 +568,76 @@ void net_ip_tcp_connectionreply(struct net *net, void *extra,
 	lp->data[15] = 0x10;	/*  tos  */
 	lp->data[16] = ip_len >> 8;
 	lp->data[17] = ip_len & 0xff;
-	lp->data[18] = net->tcp_connections[con_id].tcp_id >> 8;
-	lp->data[19] = net->tcp_connections[con_id].tcp_id & 0xff;
+	lp->data[18] = con->tcp_id >> 8;
+	lp->data[19] = con->tcp_id & 0xff;
 	lp->data[20] = 0x40;	/*  don't fragment  */
 	lp->data[21] = 0x00;
 	lp->data[22] = 0x40;	/*  ttl  */
 	lp->data[23] = 6;	/*  p = TCP  */
-	memcpy(lp->data + 26, net->tcp_connections[con_id].
-	    outside_ip_address, 4);
-	memcpy(lp->data + 30, net->tcp_connections[con_id].
-	    inside_ip_address, 4);
+	memcpy(lp->data + 26, con->outside_ip_address, 4);
+	memcpy(lp->data + 30, con->inside_ip_address, 4);
 	net_ip_checksum(lp->data + 14, 10, 20);
 
 	/*  TCP header and options at offset 34:  */
-	lp->data[34] = net->tcp_connections[con_id].outside_tcp_port >> 8;
-	lp->data[35] = net->tcp_connections[con_id].outside_tcp_port & 0xff;
-	lp->data[36] = net->tcp_connections[con_id].inside_tcp_port >> 8;
-	lp->data[37] = net->tcp_connections[con_id].inside_tcp_port & 0xff;
-	lp->data[38] = (net->tcp_connections[con_id].
-	    outside_seqnr >> 24) & 0xff;
-	lp->data[39] = (net->tcp_connections[con_id].
-	    outside_seqnr >> 16) & 0xff;
-	lp->data[40] = (net->tcp_connections[con_id].
-	    outside_seqnr >>  8) & 0xff;
-	lp->data[41] = net->tcp_connections[con_id].
-	    outside_seqnr & 0xff;
-	lp->data[42] = (net->tcp_connections[con_id].
-	    outside_acknr >> 24) & 0xff;
-	lp->data[43] = (net->tcp_connections[con_id].
-	    outside_acknr >> 16) & 0xff;
-	lp->data[44] = (net->tcp_connections[con_id].
-	    outside_acknr >>  8) & 0xff;
-	lp->data[45] = net->tcp_connections[con_id].outside_acknr & 0xff;
+	lp->data[34] = con->outside_tcp_port >> 8;
+	lp->data[35] = con->outside_tcp_port & 0xff;
+	lp->data[36] = con->inside_tcp_port >> 8;
+	lp->data[37] = con->inside_tcp_port & 0xff;
+	lp->data[38] = (con->outside_seqnr >> 24) & 0xff;
+	lp->data[39] = (con->outside_seqnr >> 16) & 0xff;
+	lp->data[40] = (con->outside_seqnr >>  8) & 0xff;
+	lp->data[41] = con->outside_seqnr & 0xff;
+	lp->data[42] = (con->outside_acknr >> 24) & 0xff;
+	lp->data[43] = (con->outside_acknr >> 16) & 0xff;
+	lp->data[44] = (con->outside_acknr >>  8) & 0xff;
+	lp->data[45] = con->outside_acknr & 0xff;
 
 	/*  Control  */
 	lp->data[46] = (option_len + 20) / 4 * 0x10;
-	lp->data[47] = 0x10;	/*  ACK  */
-	if (connecting)
-		lp->data[47] |= 0x02;	/*  SYN  */
-	if (net->tcp_connections[con_id].state == TCP_OUTSIDE_CONNECTED)
-		lp->data[47] |= 0x08;	/*  PSH  */
-	if (rst)
-		lp->data[47] |= 0x04;	/*  RST  */
-	if (net->tcp_connections[con_id].state >= TCP_OUTSIDE_DISCONNECTED)
-		lp->data[47] |= 0x01;	/*  FIN  */
-
-	/*  Window  */
-	lp->data[48] = 0x10;
-	lp->data[49] = 0x00;
+	lp->data[47] = flags;
+
+	/*  Window: the free space in the receive buffer.  */
+	window = TCP_RECV_BUF_LEN - con->recv_len;
+	lp->data[48] = window >> 8;
+	lp->data[49] = window & 0xff;
 
 	/*  no urgent ptr  */
+	lp->data[52] = lp->data[53] = 0;
 
 	/*  options  */
-	/*  TODO:  HAHA, this is ugly  */
-	lp->data[54] = 0x02;
-	lp->data[55] = 0x04;
-	lp->data[56] = 0x05;
-	lp->data[57] = 0xb4;
-	lp->data[58] = 0x01;
-	lp->data[59] = 0x03;
-	lp->data[60] = 0x03;
-	lp->data[61] = 0x00;
-	lp->data[62] = 0x01;
-	lp->data[63] = 0x01;
-	lp->data[64] = 0x08;
-	lp->data[65] = 0x0a;
-	lp->data[66] = (net->timestamp >> 24) & 0xff;
-	lp->data[67] = (net->timestamp >> 16) & 0xff;
-	lp->data[68] = (net->timestamp >> 8) & 0xff;
-	lp->data[69] = net->timestamp & 0xff;
-	lp->data[70] = (net->tcp_connections[con_id].
-	    inside_timestamp >> 24) & 0xff;
-	lp->data[71] = (net->tcp_connections[con_id].
-	    inside_timestamp >> 16) & 0xff;
-	lp->data[72] = (net->tcp_connections[con_id].
-	    inside_timestamp >> 8) & 0xff;
-	lp->data[73] = net->tcp_connections[con_id].
-	    inside_timestamp & 0xff;
+	o = 54;
+	if (flags & NET_TCP_SYN) {
+		lp->data[o++] = 2;	/*  MSS  */
+		lp->data[o++] = 4;
+		lp->data[o++] = TCP_MSS >> 8;
+		lp->data[o++] = TCP_MSS & 0xff;
+
+		if (con->inside_wscale >= 0) {
+			/*  Our own window is never scaled:  */
+			lp->data[o++] = 1;	/*  NOP  */
+			lp->data[o++] = 3;	/*  window scale  */
+			lp->data[o++] = 3;
+			lp->data[o++] = 0;
+		}
+	}
+	if (con->use_timestamps) {
+		lp->data[o++] = 1;	/*  NOP  */
+		lp->data[o++] = 1;	/*  NOP  */
+		lp->data[o++] = 8;	/*  timestamps  */
+		lp->data[o++] = 10;
+		lp->data[o++] = (net->timestamp >> 24) & 0xff;
+		lp->data[o++] = (net->timestamp >> 16) & 0xff;
+		lp->data[o++] = (net->timestamp >> 8) & 0xff;
+		lp->data[o++] = net->timestamp & 0xff;
+		lp->data[o++] = (con->inside_timestamp >> 24) & 0xff;
+		lp->data[o++] = (con->inside_timestamp >> 16) & 0xff;
+		lp->data[o++] = (con->inside_timestamp >> 8) & 0xff;
+		lp->data[o++] = con->inside_timestamp & 0xff;
+	}
 
 	/*  data:  */
-	if (data != NULL) {
-		memcpy(lp->data + 74, data, datalen);
-		net->tcp_connections[con_id].outside_seqnr += datalen;
-	}
+	if (datalen > 0)
+		memcpy(lp->data + o, data, datalen);
 
 	/*  Checksum:  */
 	net_ip_tcp_checksum(lp->data + 34, 16, tcp_length,
@@ -342,15 +646,316 @@ void net_ip_tcp_connectionreply(struct net *net, void *extra,
 #if 0
 	{
 		int i;
-		fatal("[ net_ip_tcp_connectionreply(%i): ", connecting);
+		fatal("[ net_ip_tcp_connectionreply(0x%02x): ", flags);
 		for (i=0; i<ip_len+14; i++)
 			fatal("%02x", lp->data[i]);
 		fatal(" ]\n");
 	}
 #endif
 
-	if (connecting)
-		net->tcp_connections[con_id].outside_seqnr ++;
+	con->outside_seqnr += datalen;
+	if (flags & NET_TCP_SYN)
+		con->outside_seqnr ++;
+	if (flags & NET_TCP_FIN)
+		con->outside_seqnr ++;
+
+	return 1;
+}
+
+
+/*
+ *  tcp_output():
+ *
+ *  Sends as much of the send buffer to the guest OS as its receive window
+ *  allows, in segments of at most the guest's MSS, followed by a FIN once
+ *  the outside has closed the connection and everything has been sent. If
+ *  probe is set, at least one byte is sent even if the window is closed.
+ */
+static void tcp_output(struct net *net, void *extra,
+	struct tcp_connection *con, int probe)
+{
+	int mss = con->inside_mss;
+
+	if (mss > TCP_MSS)
+		mss = TCP_MSS;
+	if (con->use_timestamps)
+		mss -= 12;
+
+	while (con->state == TCP_OUTSIDE_CONNECTED && con->syn_acked &&
+	    !con->fin_sent) {
+		int sent = con->outside_seqnr - con->inside_acknr;
+		int unsent = con->send_len - sent;
+		int64_t room = (int64_t)con->inside_window - sent;
+		int n, flags = NET_TCP_ACK;
+
+		if (unsent <= 0) {
+			if (con->outside_eof && net_ip_tcp_connectionreply(net,
+			    extra, con, NET_TCP_FIN | NET_TCP_ACK, NULL, 0))
+				con->fin_sent = 1;
+			break;
+		}
+
+		if (room <= 0) {
+			if (!probe)
+				break;
+			room = 1;
+		}
+
+		n = unsent;
+		if (n > room)
+			n = room;
+		if (n > mss)
+			n = mss;
+		if (n == unsent)
+			flags |= NET_TCP_PSH;
+
+		if (!net_ip_tcp_connectionreply(net, extra, con, flags,
+		    con->send_buf + con->send_ofs + sent, n))
+			break;
+
+		probe = 0;
+	}
+
+	tcp_check_pending(net, con);
+}
+
+
+/*
+ *  tcp_timeout():
+ *
+ *  Called when a connection's retransmit timer has run out. Everything is
+ *  sent again, from the oldest unacknowledged byte (or just one byte, to
+ *  probe the guest OS' window if it is closed).
+ */
+static void tcp_timeout(struct net *net, void *extra,
+	struct tcp_connection *con)
+{
+	con->rto_deadline = 0;
+
+	if (++ con->n_retransmits > TCP_MAX_RETRANSMITS) {
+		debug("[ net: TCP: no response from the guest OS, resetting "
+		    "connection %i ]\n", con->socket);
+		tcp_reset(net, extra, con);
+		return;
+	}
+
+	con->rto *= 2;
+	if (con->rto > TCP_RTO_MAX)
+		con->rto = TCP_RTO_MAX;
+
+	debug("[ net: TCP: at seqnr %u but backing back to %u ]\n",
+	    con->outside_seqnr, con->inside_acknr);
+
+	con->outside_seqnr = con->inside_acknr;
+	con->fin_sent = 0;
+
+	if (!con->syn_acked) {
+		net_ip_tcp_connectionreply(net, extra, con,
+		    con->state == TCP_INSIDE_TRYINGTOCONNECT? NET_TCP_SYN :
+		    NET_TCP_SYN | NET_TCP_ACK, NULL, 0);
+		tcp_check_pending(net, con);
+		return;
+	}
+
+	tcp_output(net, extra, con, 1);
+}
+
+
+/*
+ *  tcp_ack():
+ *
+ *  Handles an acknowledgement (and window update) from the guest OS.
+ *  Acknowledged data is removed from the send buffer.
+ */
+static void tcp_ack(struct tcp_connection *con, uint32_t acknr, int window)
+{
+	int32_t acked = acknr - con->inside_acknr;
+
+	if (acked > 0 && (int32_t)(acknr - con->outside_seqnr) <= 0) {
+		if (!con->syn_acked) {
+			con->syn_acked = 1;
+			acked --;
+		}
+		if (con->fin_sent && acknr == con->outside_seqnr) {
+			con->fin_acked = 1;
+			acked --;
+		}
+		if (acked > con->send_len)
+			acked = con->send_len;
+
+		con->send_ofs += acked;
+		con->send_len -= acked;
+		if (con->send_len == 0)
+			con->send_ofs = 0;
+
+		con->inside_acknr = acknr;
+		con->rto = TCP_RTO_INITIAL;
+		con->rto_deadline = 0;
+	}
+
+	/*  The guest OS is alive, so start counting from zero again:  */
+	con->n_retransmits = 0;
+
+	con->inside_window = (uint32_t)window <<
+	    (con->inside_wscale > 0? con->inside_wscale : 0);
+}
+
+
+/*
+ *  tcp_write():
+ *
+ *  Writes data from the guest OS to the outside socket. Whatever doesn't fit
+ *  in the host's socket buffer is kept in the receive buffer, and written
+ *  when the socket becomes writable. (The caller makes sure that there is
+ *  room.) Returns -1 on error.
+ */
+static int tcp_write(struct tcp_connection *con, unsigned char *data,
+	int len)
+{
+	ssize_t res = 0;
+
+	if (con->recv_len == 0) {
+		res = write(con->socket, data, len);
+		if (res < 0) {
+			if (errno != EAGAIN && errno != EINTR)
+				return -1;
+			res = 0;
+		}
+	}
+
+	memcpy(con->recv_buf + con->recv_len, data + res, len - res);
+	con->recv_len += len - res;
+	return 0;
+}
+
+
+/*
+ *  tcp_flush():
+ *
+ *  Writes as much of the receive buffer to the outside socket as possible.
+ *  When everything has been written after the guest OS has closed its side
+ *  of the connection, the outside socket is shut down for writing too.
+ *  Returns -1 on error.
+ */
+static int tcp_flush(struct tcp_connection *con)
+{
+	ssize_t res;
+
+	if (con->recv_len > 0) {
+		res = write(con->socket, con->recv_buf, con->recv_len);
+		if (res < 0)
+			return (errno == EAGAIN || errno == EINTR)? 0 : -1;
+
+		memmove(con->recv_buf, con->recv_buf + res,
+		    con->recv_len - res);
+		con->recv_len -= res;
+	}
+
+	if (con->recv_len == 0 && con->inside_fin)
+		shutdown(con->socket, SHUT_WR);
+
+	return 0;
+}
+
+
+/*
+ *  tcp_parse_options():
+ *
+ *  Picks up the guest OS' timestamp, and (from SYN packets) its MSS and
+ *  window scale.
+ */
+static void tcp_parse_options(struct tcp_connection *con,
+	unsigned char *packet, int data_offset, int syn)
+{
+	int i = 34 + 20;
+
+	if (syn) {
+		con->inside_mss = TCP_DEFAULT_MSS;
+		con->inside_wscale = -1;
+		con->use_timestamps = 0;
+	}
+
+	while (i < data_offset) {
+		int kind = packet[i], optlen;
+
+		if (kind == 0)		/*  end of options  */
+			break;
+		if (kind == 1) {	/*  NOP  */
+			i ++;
+			continue;
+		}
+
+		if (i + 1 >= data_offset)
+			break;
+		optlen = packet[i + 1];
+		if (optlen < 2 || i + optlen > data_offset)
+			break;
+
+		switch (kind) {
+		case 2:	/*  MSS  */
+			if (syn && optlen == 4)
+				con->inside_mss = (packet[i+2] << 8) +
+				    packet[i+3];
+			break;
+		case 3:	/*  window scale  */
+			if (syn && optlen == 3)
+				con->inside_wscale = packet[i+2] > 14?
+				    14 : packet[i+2];
+			break;
+		case 8:	/*  timestamps  */
+			if (optlen != 10)
+				break;
+			con->inside_timestamp = (packet[i+2] << 24) +
+			    (packet[i+3] << 16) + (packet[i+4] << 8) +
+			    packet[i+5];
+			if (syn)
+				con->use_timestamps = 1;
+			break;
+		}
+
+		i += optlen;
+	}
+
+	if (con->inside_mss < 64)
+		con->inside_mss = TCP_DEFAULT_MSS;
+}
+
+
+/*
+ *  tcp_reset_unknown():
+ *
+ *  Answers a TCP packet which doesn't belong to any known connection with
+ *  an RST, so that the guest OS doesn't keep trying.
+ */
+static void tcp_reset_unknown(struct net *net, void *extra,
+	unsigned char *packet, int len, int data_offset)
+{
+	struct tcp_connection tmp;
+	uint32_t seqnr, acknr;
+
+	seqnr = (packet[38] << 24) + (packet[39] << 16)
+	    + (packet[40] << 8) + packet[41];
+	acknr = (packet[42] << 24) + (packet[43] << 16)
+	    + (packet[44] << 8) + packet[45];
+
+	memset(&tmp, 0, sizeof(tmp));
+	memcpy(tmp.ethernet_address, packet + 6, 6);
+	memcpy(tmp.inside_ip_address, packet + 26, 4);
+	tmp.inside_tcp_port = (packet[34] << 8) + packet[35];
+	memcpy(tmp.outside_ip_address, packet + 30, 4);
+	tmp.outside_tcp_port = (packet[36] << 8) + packet[37];
+	tmp.inside_wscale = -1;
+
+	if (packet[47] & NET_TCP_ACK) {
+		tmp.outside_seqnr = acknr;
+		net_ip_tcp_connectionreply(net, extra, &tmp, NET_TCP_RST,
+		    NULL, 0);
+	} else {
+		tmp.outside_acknr = seqnr + len - data_offset +
+		    (packet[47] & NET_TCP_FIN? 1 : 0);
+		net_ip_tcp_connectionreply(net, extra, &tmp,
+		    NET_TCP_RST | NET_TCP_ACK, NULL, 0);
+	}
 }
 
 
@@ -379,14 +984,12 @@ void net_ip_tcp_connectionreply(struct net *net, void *extra,
 static void net_ip_tcp(struct net *net, void *extra,
 	unsigned char *packet, int len)
 {
-	int con_id, free_con_id, i, res;
+	struct tcp_connection *con;
+	int res, s, datalen;
 	int srcport, dstport, data_offset, window, checksum, urgptr;
 	int syn, ack, psh, rst, urg, fin;
 	uint32_t seqnr, acknr;
 	struct sockaddr_in remote_ip;
-	fd_set rfds;
-	struct timeval tv;
-	int send_ofs;
 
 #if 0
 	fatal("[ net: TCP: ");
@@ -412,6 +1015,9 @@ static void net_ip_tcp(struct net *net, void *extra,
 
 	data_offset = (packet[46] >> 4) * 4 + 34;
 	/*  data_offset is now data offset within packet :-)  */
+	if (data_offset < 34 + 20 || data_offset > len)
+		return;
+	datalen = len - data_offset;
 
 	urg = packet[47] & 32;
 	ack = packet[47] & 16;
@@ -456,57 +1062,36 @@ static void net_ip_tcp(struct net *net, void *extra,
 	}
 
 	/*  Does this packet belong to a current connection?  */
-	con_id = free_con_id = -1;
-	for (i=0; i<MAX_TCP_CONNECTIONS; i++) {
-		if (!net->tcp_connections[i].in_use)
-			free_con_id = i;
-		if (net->tcp_connections[i].in_use &&
-		    net->tcp_connections[i].inside_tcp_port == srcport &&
-		    net->tcp_connections[i].outside_tcp_port == dstport &&
-		    memcmp(net->tcp_connections[i].inside_ip_address,
-			packet + 26, 4) == 0 &&
-		    memcmp(net->tcp_connections[i].outside_ip_address,
-			packet + 30, 4) == 0) {
-			con_id = i;
-			break;
-		}
-	}
+	con = tcp_findconnection(net, packet + 26, srcport, packet + 30,
+	    dstport);
 
-	/*
-	 *  Unknown connection, and not SYN? Then drop the packet.
-	 *  TODO:  Send back RST?
-	 */
-	if (con_id < 0 && !syn) {
+	/*  Unknown connection, and not SYN? Then answer with an RST.  */
+	if (con == NULL && !syn) {
 		debug("[ net: TCP: dropping packet from unknown connection,"
 		    " %i.%i.%i.%i:%i -> %i.%i.%i.%i:%i %s%s%s%s%s]\n",
 		    packet[26], packet[27], packet[28], packet[29], srcport,
 		    packet[30], packet[31], packet[32], packet[33], dstport,
 		    fin? "FIN ": "", syn? "SYN ": "", ack? "ACK ": "",
 		    psh? "PSH ": "", rst? "RST ": "");
-		return;
-	}
-
-	/*  Known connection, and SYN? Then ignore the packet.  */
-	if (con_id >= 0 && syn) {
-		debug("[ net: TCP: ignoring redundant SYN packet from known"
-		    " connection, %i.%i.%i.%i:%i -> %i.%i.%i.%i:%i ]\n",
-		    packet[26], packet[27], packet[28], packet[29], srcport,
-		    packet[30], packet[31], packet[32], packet[33], dstport);
+		if (!rst)
+			tcp_reset_unknown(net, extra, packet, len,
+			    data_offset);
 		return;
 	}
 
 	/*
 	 *  A new outgoing connection?
 	 */
-	if (con_id < 0 && syn) {
+	if (con == NULL) {
+		if (ack || rst)
+			return;
+
 		debug("[ net: TCP: new outgoing connection, %i.%i.%i.%i:%i"
 		    " -> %i.%i.%i.%i:%i ]\n",
 		    packet[26], packet[27], packet[28], packet[29], srcport,
 		    packet[30], packet[31], packet[32], packet[33], dstport);
 
-		/*  Find a free connection id to use:  */
-		if (free_con_id < 0) {
-#if 1
+		if (net->n_tcp_connections >= MAX_TCP_CONNECTIONS) {
 			/*
 			 *  TODO:  Reuse the oldest one currently in use, or
 			 *  just drop the new connection attempt? Drop for now.
@@ -514,218 +1099,147 @@ static void net_ip_tcp(struct net *net, void *extra,
 			fatal("[ TOO MANY TCP CONNECTIONS IN USE! "
 			    "Increase MAX_TCP_CONNECTIONS! ]\n");
 			return;
-#else
-			int i;
-			int64_t oldest = net->
-			    tcp_connections[0].last_used_timestamp;
-			free_con_id = 0;
-
-			fatal("[ NO FREE TCP SLOTS, REUSING OLDEST ONE ]\n");
-			for (i=0; i<MAX_TCP_CONNECTIONS; i++)
-				if (net->tcp_connections[i].
-				    last_used_timestamp < oldest) {
-					oldest = net->tcp_connections[i].
-					    last_used_timestamp;
-					free_con_id = i;
-				}
-			tcp_closeconnection(net, free_con_id);
-#endif
 		}
 
-		con_id = free_con_id;
-		memset(&net->tcp_connections[con_id], 0,
-		    sizeof(struct tcp_connection));
-
-		memcpy(net->tcp_connections[con_id].ethernet_address,
-		    packet + 6, 6);
-		memcpy(net->tcp_connections[con_id].inside_ip_address,
-		    packet + 26, 4);
-		net->tcp_connections[con_id].inside_tcp_port = srcport;
-		memcpy(net->tcp_connections[con_id].outside_ip_address,
-		    packet + 30, 4);
-		net->tcp_connections[con_id].outside_tcp_port = dstport;
-
-		net->tcp_connections[con_id].socket =
-		    socket(AF_INET, SOCK_STREAM, 0);
-		if (net->tcp_connections[con_id].socket < 0) {
-			fatal("[ net: TCP: socket() returned %i ]\n",
-			    net->tcp_connections[con_id].socket);
+		s = socket(AF_INET, SOCK_STREAM, 0);
+		if (s < 0) {
+			fatal("[ net: TCP: socket() returned %i ]\n", s);
 			return;
 		}
 
-		debug("[ new tcp outgoing socket=%i ]\n",
-		    net->tcp_connections[con_id].socket);
+		debug("[ new tcp outgoing socket=%i ]\n", s);
 
-		net->tcp_connections[con_id].in_use = 1;
+		con = tcp_newconnection(net, s, packet + 6, packet + 26,
+		    srcport, packet + 30, dstport);
 
-		/*  Set the socket to non-blocking:  */
-		res = fcntl(net->tcp_connections[con_id].socket, F_GETFL);
-		fcntl(net->tcp_connections[con_id].socket, F_SETFL,
-		    res | O_NONBLOCK);
+		con->inside_seqnr = seqnr;
+		con->outside_acknr = seqnr + 1;
+		con->inside_window = window;
+		tcp_parse_options(con, packet, data_offset, 1);
 
 		remote_ip.sin_family = AF_INET;
 		memcpy((unsigned char *)&remote_ip.sin_addr,
-		    net->tcp_connections[con_id].outside_ip_address, 4);
-		remote_ip.sin_port = htons(
-		    net->tcp_connections[con_id].outside_tcp_port);
+		    con->outside_ip_address, 4);
+		remote_ip.sin_port = htons(con->outside_tcp_port);
 
-		res = connect(net->tcp_connections[con_id].socket,
+		res = connect(con->socket,
 		    (struct sockaddr *)&remote_ip, sizeof(remote_ip));
 
 		/*  connect can return -1, and errno = EINPROGRESS
 		    as we might not have connected right away.  */
+		if (res < 0 && errno != EINPROGRESS) {
+			debug("[ net: TCP: connect() failed: %s ]\n",
+			    strerror(errno));
+			tcp_reset(net, extra, con);
+			return;
+		}
 
-		net->tcp_connections[con_id].state =
-		    TCP_OUTSIDE_TRYINGTOCONNECT;
+		con->state = TCP_OUTSIDE_TRYINGTOCONNECT;
 
-		net->tcp_connections[con_id].outside_acknr = 0;
-		net->tcp_connections[con_id].outside_seqnr =
-		    ((random() & 0xffff) << 16) + (random() & 0xffff);
+		/*  Wait for the outcome of connect():  */
+		tcp_rearm(net, con);
+		return;
 	}
 
 	if (rst) {
-		debug("[ 'rst': disconnecting TCP connection %i ]\n", con_id);
-		net_ip_tcp_connectionreply(net, extra, con_id, 0, NULL, 0, 1);
-		tcp_closeconnection(net, con_id);
+		debug("[ 'rst': disconnecting TCP connection %i ]\n",
+		    con->socket);
+		tcp_closeconnection(net, con);
 		return;
 	}
 
-	if (ack && net->tcp_connections[con_id].state
-	    == TCP_OUTSIDE_DISCONNECTED2) {
-		debug("[ 'ack': guestOS's final termination of TCP "
-		    "connection %i ]\n", con_id);
-
-		/*  Send an RST?  (TODO, this is wrong...)  */
-		net_ip_tcp_connectionreply(net, extra, con_id, 0, NULL, 0, 1);
+	tcp_parse_options(con, packet, data_offset, syn);
 
-		/*  ... and forget about this connection:  */
-		tcp_closeconnection(net, con_id);
-		return;
-	}
+	net->timestamp ++;
+	con->last_used_timestamp = net->timestamp;
+
+	if (syn) {
+		/*  The guest OS accepting an incoming connection?  */
+		if (con->state == TCP_INSIDE_TRYINGTOCONNECT && ack &&
+		    acknr == con->inside_acknr + 1) {
+			debug("[ net: TCP: incoming connection %i accepted"
+			    " by the guest OS ]\n", con->socket);
+			con->state = TCP_OUTSIDE_CONNECTED;
+			con->inside_seqnr = seqnr;
+			con->outside_acknr = seqnr + 1;
+			tcp_ack(con, acknr, 0);
+			con->inside_window = window;
+
+			net_ip_tcp_connectionreply(net, extra, con,
+			    NET_TCP_ACK, NULL, 0);
+			tcp_output(net, extra, con, 0);
+			tcp_rearm(net, con);
+			return;
+		}
 
-	if (fin && net->tcp_connections[con_id].state
-	    == TCP_OUTSIDE_DISCONNECTED) {
-		debug("[ 'fin': response to outside's disconnection of "
-		    "TCP connection %i ]\n", con_id);
+		/*  A resent SYN means that our SYN+ACK was lost:  */
+		if (con->state == TCP_OUTSIDE_CONNECTED && !con->syn_acked) {
+			con->outside_seqnr = con->inside_acknr;
+			net_ip_tcp_connectionreply(net, extra, con,
+			    NET_TCP_SYN | NET_TCP_ACK, NULL, 0);
+			tcp_check_pending(net, con);
+			return;
+		}
 
-		/*  Send an ACK:  */
-		net->tcp_connections[con_id].state = TCP_OUTSIDE_CONNECTED;
-		net_ip_tcp_connectionreply(net, extra, con_id, 0, NULL, 0, 0);
-		net->tcp_connections[con_id].state = TCP_OUTSIDE_DISCONNECTED2;
+		debug("[ net: TCP: ignoring redundant SYN packet from known"
+		    " connection, %i.%i.%i.%i:%i -> %i.%i.%i.%i:%i ]\n",
+		    packet[26], packet[27], packet[28], packet[29], srcport,
+		    packet[30], packet[31], packet[32], packet[33], dstport);
 		return;
 	}
 
-	if (fin) {
-		debug("[ 'fin': guestOS disconnecting TCP connection %i ]\n",
-		    con_id);
-
-		/*  Send ACK:  */
-		net_ip_tcp_connectionreply(net, extra, con_id, 0, NULL, 0, 0);
-		net->tcp_connections[con_id].state = TCP_OUTSIDE_DISCONNECTED2;
-
-		/*  Return and send FIN:  */
-		goto ret;
-	}
-
-	if (ack) {
-debug("ACK %i bytes, inside_acknr=%u outside_seqnr=%u\n",
- net->tcp_connections[con_id].incoming_buf_len,
- net->tcp_connections[con_id].inside_acknr,
- net->tcp_connections[con_id].outside_seqnr);
-		net->tcp_connections[con_id].inside_acknr = acknr;
-		if (net->tcp_connections[con_id].inside_acknr ==
-		    net->tcp_connections[con_id].outside_seqnr &&
-		    net->tcp_connections[con_id].incoming_buf_len != 0) {
-debug("  all acked\n");
-			net->tcp_connections[con_id].incoming_buf_len = 0;
-		}
-	}
-
-	net->tcp_connections[con_id].inside_seqnr = seqnr;
-
-	/*  TODO: This is hardcoded for a specific NetBSD packet:  */
-	if (packet[34 + 30] == 0x08 && packet[34 + 31] == 0x0a)
-		net->tcp_connections[con_id].inside_timestamp =
-		    (packet[34 + 32 + 0] << 24) +
-		    (packet[34 + 32 + 1] << 16) +
-		    (packet[34 + 32 + 2] <<  8) +
-		    (packet[34 + 32 + 3] <<  0);
-
-
-	net->timestamp ++;
-	net->tcp_connections[con_id].last_used_timestamp = net->timestamp;
-
-
-	if (net->tcp_connections[con_id].state != TCP_OUTSIDE_CONNECTED) {
+	if (con->state != TCP_OUTSIDE_CONNECTED) {
 		debug("[ not connected to outside ]\n");
 		return;
 	}
 
-
-	if (data_offset >= len)
-		return;
-
+	if (ack)
+		tcp_ack(con, acknr, window);
 
 	/*
-	 *  We are here if this is a known connection, and data is to be
-	 *  transmitted to the outside world.
+	 *  Data (and/or FIN) to be sent to the outside world. Only data which
+	 *  continues where the previous data ended is accepted, as much as
+	 *  there is room for in the receive buffer. Everything else is
+	 *  answered with a (duplicate) ACK, and the guest OS resends it.
 	 */
+	if (datalen > 0 || fin) {
+		int32_t skip = con->outside_acknr - seqnr;
+		int n;
+
+		if (!con->inside_fin && skip >= 0 && skip <= datalen) {
+			n = datalen - skip;
+			if (n > TCP_RECV_BUF_LEN - con->recv_len)
+				n = TCP_RECV_BUF_LEN - con->recv_len;
+
+			if (n > 0 && tcp_write(con, packet + data_offset +
+			    skip, n) < 0) {
+				debug("[ error writing %i bytes to TCP "
+				    "connection %i: errno = %i ]\n", n,
+				    con->socket, errno);
+				tcp_reset(net, extra, con);
+				return;
+			}
 
-	send_ofs = data_offset;
-	send_ofs += ((int32_t)net->tcp_connections[con_id].outside_acknr
-	    - (int32_t)seqnr);
-#if 1
-	debug("[ %i bytes of tcp data to be sent, beginning at seqnr %u, ",
-	    len - data_offset, seqnr);
-	debug("outside is at acknr %u ==> %i actual bytes to be sent ]\n",
-	    net->tcp_connections[con_id].outside_acknr, len - send_ofs);
-#endif
-
-	/*  Drop outgoing packet if the guest OS' seqnr is not
-	    the same as we have acked. (We have missed something, perhaps.)  */
-	if (seqnr != net->tcp_connections[con_id].outside_acknr) {
-		debug("!! outgoing TCP packet dropped (seqnr = %u, "
-		    "outside_acknr = %u)\n", seqnr,
-		    net->tcp_connections[con_id].outside_acknr);
-		goto ret;
-	}
+			con->outside_acknr += n;
 
-	if (len - send_ofs > 0) {
-		/*  Is the socket available for output?  */
-		FD_ZERO(&rfds);		/*  write  */
-		FD_SET(net->tcp_connections[con_id].socket, &rfds);
-		tv.tv_sec = tv.tv_usec = 0;
-		errno = 0;
-		res = select(net->tcp_connections[con_id].socket+1,
-		    NULL, &rfds, NULL, &tv);
-		if (res < 1) {
-			net->tcp_connections[con_id].state =
-			    TCP_OUTSIDE_DISCONNECTED;
-			debug("[ TCP: disconnect on select for writing ]\n");
-			goto ret;
+			if (fin && skip + n == datalen) {
+				debug("[ 'fin': guestOS disconnecting TCP "
+				    "connection %i ]\n", con->socket);
+				con->inside_fin = 1;
+				con->outside_acknr ++;
+				if (con->recv_len == 0)
+					shutdown(con->socket, SHUT_WR);
+			}
 		}
 
-		res = write(net->tcp_connections[con_id].socket,
-		    packet + send_ofs, len - send_ofs);
-
-		if (res > 0) {
-			net->tcp_connections[con_id].outside_acknr += res;
-		} else if (errno == EAGAIN) {
-			/*  Just ignore this attempt.  */
-			return;
-		} else {
-			debug("[ error writing %i bytes to TCP connection %i:"
-			    " errno = %i ]\n", len - send_ofs, con_id, errno);
-			net->tcp_connections[con_id].state =
-			    TCP_OUTSIDE_DISCONNECTED;
-			debug("[ TCP: disconnect on write() ]\n");
-			goto ret;
-		}
+		net_ip_tcp_connectionreply(net, extra, con, NET_TCP_ACK,
+		    NULL, 0);
 	}
 
-ret:
-	/*  Send an ACK (or FIN) to the guest OS:  */
-	net_ip_tcp_connectionreply(net, extra, con_id, 0, NULL, 0, 0);
+	/*  The guest OS may be ready for more data now:  */
+	tcp_output(net, extra, con, 0);
+	tcp_rearm(net, con);
+	tcp_finished(net, con);
 }
 
 
@@ -749,7 +1263,8 @@ ret:
 static void net_ip_udp(struct net *net, void *extra,
 	unsigned char *packet, int len)
 {
-	int con_id, free_con_id, i, srcport, dstport, udp_len;
+	struct udp_connection *con;
+	int h, i, s, srcport, dstport, udp_len;
 	ssize_t res;
 	struct sockaddr_in remote_ip;
 
@@ -775,80 +1290,61 @@ static void net_ip_udp(struct net *net, void *extra,
 	debug(" ]\n");
 
 	/*  Is this "connection" new, or a currently ongoing one?  */
-	con_id = free_con_id = -1;
-	for (i=0; i<MAX_UDP_CONNECTIONS; i++) {
-		if (!net->udp_connections[i].in_use)
-			free_con_id = i;
-		if (net->udp_connections[i].in_use &&
-		    net->udp_connections[i].inside_udp_port == srcport &&
-		    net->udp_connections[i].outside_udp_port == dstport &&
-		    memcmp(net->udp_connections[i].inside_ip_address,
-			packet + 26, 4) == 0 &&
-		    memcmp(net->udp_connections[i].outside_ip_address,
-			packet + 30, 4) == 0) {
-			con_id = i;
-			break;
-		}
-	}
+	con = udp_findconnection(net, packet + 26, srcport, packet + 30,
+	    dstport);
 
 	debug("&& UDP connection is ");
-	if (con_id >= 0)
+	if (con != NULL)
 		debug("ONGOING");
 	else {
 		debug("NEW");
-		if (free_con_id < 0) {
-			int64_t oldest = net->
-			    udp_connections[0].last_used_timestamp;
-			free_con_id = 0;
-
-			debug(", NO FREE SLOTS, REUSING OLDEST ONE");
-			for (int j=0; j<MAX_UDP_CONNECTIONS; j++)
-				if (net->udp_connections[j].last_used_timestamp < oldest) {
-					oldest = net->udp_connections[j].last_used_timestamp;
-					free_con_id = j;
-				}
-
-			close(net->udp_connections[free_con_id].socket);
+		if (net->n_udp_connections >= MAX_UDP_CONNECTIONS) {
+			debug(", TOO MANY, REUSING OLDEST ONE");
+			udp_closeconnection(net, net->udp_lru_first);
 		}
-		con_id = free_con_id;
-		memset(&net->udp_connections[con_id], 0,
-		    sizeof(struct udp_connection));
-
-		memcpy(net->udp_connections[con_id].ethernet_address,
-		    packet + 6, 6);
-		memcpy(net->udp_connections[con_id].inside_ip_address,
-		    packet + 26, 4);
-		net->udp_connections[con_id].inside_udp_port = srcport;
-		memcpy(net->udp_connections[con_id].outside_ip_address,
-		    packet + 30, 4);
-		net->udp_connections[con_id].outside_udp_port = dstport;
-
-		net->udp_connections[con_id].socket = socket(AF_INET,
-		    SOCK_DGRAM, 0);
-		if (net->udp_connections[con_id].socket < 0) {
-			fatal("[ net: UDP: socket() returned %i ]\n",
-			    net->udp_connections[con_id].socket);
+
+		s = socket(AF_INET, SOCK_DGRAM, 0);
+		if (s < 0) {
+			fatal("[ net: UDP: socket() returned %i ]\n", s);
 			return;
 		}
 
-		debug(" {socket=%i}", net->udp_connections[con_id].socket);
+		debug(" {socket=%i}", s);
+
+		CHECK_ALLOCATION(con = (struct udp_connection *)
+		    malloc(sizeof(struct udp_connection)));
+		memset(con, 0, sizeof(struct udp_connection));
+
+		memcpy(con->ethernet_address, packet + 6, 6);
+		memcpy(con->inside_ip_address, packet + 26, 4);
+		con->inside_udp_port = srcport;
+		memcpy(con->outside_ip_address, packet + 30, 4);
+		con->outside_udp_port = dstport;
+		con->socket = s;
 
-		net->udp_connections[con_id].in_use = 1;
+		h = net_conn_hash(con->inside_ip_address, srcport,
+		    con->outside_ip_address, dstport);
+		con->hash_next = net->udp_hash[h];
+		net->udp_hash[h] = con;
+		net->n_udp_connections ++;
 
 		/*  Set the socket to non-blocking:  */
-		res = fcntl(net->udp_connections[con_id].socket, F_GETFL);
-		fcntl(net->udp_connections[con_id].socket, F_SETFL,
-		    res | O_NONBLOCK);
+		res = fcntl(con->socket, F_GETFL);
+		fcntl(con->socket, F_SETFL, res | O_NONBLOCK);
+
+		/*  Incoming datagrams: see net_udp_socket_ready()  */
+		con->source = net_reactor_add(net, con->socket,
+		    net_udp_socket_ready, con);
+		net_reactor_arm(net, con->source, NET_REACTOR_READ);
 	}
 
-	debug(", connection id %i\n", con_id);
+	debug(", socket %i\n", con->socket);
 
-	net->timestamp ++;
-	net->udp_connections[con_id].last_used_timestamp = net->timestamp;
+	udp_touch(net, con);
 
 	remote_ip.sin_family = AF_INET;
 	memcpy((unsigned char *)&remote_ip.sin_addr,
-	    net->udp_connections[con_id].outside_ip_address, 4);
+	    con->outside_ip_address, 4);
 
 	/*
 	 *  Special case for the nameserver:  If a UDP packet is sent to
@@ -856,17 +1352,16 @@ static void net_ip_udp(struct net *net, void *extra,
 	 *  known.
 	 */
 	if (net->nameserver_known &&
-	    memcmp(net->udp_connections[con_id].outside_ip_address,
+	    memcmp(con->outside_ip_address,
 	    &net->gateway_ipv4_addr[0], 4) == 0) {
 		memcpy((unsigned char *)&remote_ip.sin_addr,
 		    &net->nameserver_ipv4, 4);
-		net->udp_connections[con_id].fake_ns = 1;
+		con->fake_ns = 1;
 	}
 
-	remote_ip.sin_port = htons(
-	    net->udp_connections[con_id].outside_udp_port);
+	remote_ip.sin_port = htons(con->outside_udp_port);
 
-	res = sendto(net->udp_connections[con_id].socket, packet + 42,
+	res = sendto(con->socket, packet + 42,
 	    len - 42, 0, (const struct sockaddr *)&remote_ip,
 	    sizeof(remote_ip));
 
@@ -911,6 +1406,9 @@ void net_ip(struct net *net, void *extra, unsigned char *packet, int len)
 
 	if (packet[14] == 0x45) {
 		/*  IPv4:  */
+		if (net->tcp_forwards != NULL)
+			net_tcp_forward_learn(net, packet + 26, packet + 6);
+
 		switch (packet[23]) {
 		case 1:	/*  ICMP  */
 			net_ip_icmp(net, extra, packet, len);
@@ -946,7 +1444,7 @@ static void net_ip_broadcast_dhcp(struct net *net, void *extra,
 	 *  TODO
 	 */
 #if 1
-	struct ethernet_packet_link *lp;
+	struct net_packet *lp;
         int i, reply_len;
 
 	fatal("[ net: IPv4 DHCP: ");
@@ -1008,7 +1506,9 @@ static void net_ip_broadcast_dhcp(struct net *net, void *extra,
 	fatal(" ]\n");
 
         reply_len = 307;
-        lp = net_allocate_ethernet_packet_link(net, extra, reply_len);
+        lp = net_ethernet_rx_alloc(net, extra, reply_len);
+	if (lp == NULL)
+		return;
 
         /*  From old packet, copy everything before options field:  */
         memcpy(lp->data, packet, 278);
@@ -1218,60 +1718,46 @@ void net_ip_broadcast(struct net *net, void *extra,
 
 
 /*
- *  net_udp_rx_avail():
+ *  net_udp_socket_ready():
  *
- *  Receive any available UDP packets (from the outside world).
+ *  Receive incoming UDP packets (from the outside world) on a connection
+ *  whose socket has become readable. (Called by the reactor.)
  */
-void net_udp_rx_avail(struct net *net, void *extra)
+static void net_udp_socket_ready(struct net *net, void *extra, void *owner)
 {
-	int received_packets_this_tick = 0;
-	int max_packets_this_tick = 200;
-	int con_id;
+	struct udp_connection *con = (struct udp_connection *) owner;
+	int n;
 
-	for (con_id=0; con_id<MAX_UDP_CONNECTIONS; con_id++) {
+	for (n=0; n<NET_UDP_MAX_PER_WAKEUP; n++) {
 		ssize_t res;
 		unsigned char buf[66000];
 		unsigned char udp_data[66008];
 		struct sockaddr_in from;
 		socklen_t from_len = sizeof(from);
 		int ip_len, udp_len;
-		struct ethernet_packet_link *lp;
+		struct net_packet *lp;
 		int max_per_packet;
 		int bytes_converted = 0;
 		int this_packets_data_length;
 		int fragment_ofs = 0;
 
-		if (received_packets_this_tick > max_packets_this_tick)
-			break;
-
-		if (!net->udp_connections[con_id].in_use)
-			continue;
-
-		if (net->udp_connections[con_id].socket < 0) {
-			fatal("INTERNAL ERROR in net.c, udp socket < 0 "
-			    "but in use?\n");
-			continue;
-		}
-
-		res = recvfrom(net->udp_connections[con_id].socket, buf,
-		    sizeof(buf), 0, (struct sockaddr *)&from, &from_len);
+		res = recvfrom(con->socket, buf, sizeof(buf), 0,
+		    (struct sockaddr *)&from, &from_len);
 
 		/*  No more incoming UDP on this connection?  */
 		if (res < 0)
-			continue;
+			break;
 
-		net->timestamp ++;
-		net->udp_connections[con_id].last_used_timestamp =
-		    net->timestamp;
+		udp_touch(net, con);
 
-		net->udp_connections[con_id].udp_id ++;
+		con->udp_id ++;
 
 		/*
 		 *  Special case for the nameserver:  If a UDP packet is
 		 *  received from the nameserver (if the nameserver's IP is
 		 *  known), fake it so that it comes from the gateway instead.
 		 */
-		if (net->udp_connections[con_id].fake_ns)
+		if (con->fake_ns)
 			memcpy(((unsigned char *)(&from))+4,
 			    &net->gateway_ipv4_addr[0], 4);
 
@@ -1298,10 +1784,8 @@ void net_udp_rx_avail(struct net *net, void *extra)
 		/*  from[2..3] = outside_udp_port  */
 		udp_data[0] = ((unsigned char *)&from)[2];
 		udp_data[1] = ((unsigned char *)&from)[3];
-		udp_data[2] = (net->udp_connections[con_id].
-		    inside_udp_port >> 8) & 0xff;
-		udp_data[3] = net->udp_connections[con_id].
-		    inside_udp_port & 0xff;
+		udp_data[2] = (con->inside_udp_port >> 8) & 0xff;
+		udp_data[3] = con->inside_udp_port & 0xff;
 		udp_data[4] = udp_len >> 8;
 		udp_data[5] = udp_len & 0xff;
 		udp_data[6] = 0;
@@ -1326,12 +1810,13 @@ void net_udp_rx_avail(struct net *net, void *extra)
 
 			ip_len = 20 + this_packets_data_length;
 
-			lp = net_allocate_ethernet_packet_link(net, extra,
+			lp = net_ethernet_rx_alloc(net, extra,
 			    14 + 20 + this_packets_data_length);
+			if (lp == NULL)
+				break;
 
 			/*  Ethernet header:  */
-			memcpy(lp->data + 0, net->udp_connections[con_id].
-			    ethernet_address, 6);
+			memcpy(lp->data + 0, con->ethernet_address, 6);
 			memcpy(lp->data + 6, net->gateway_ethernet_addr, 6);
 			lp->data[12] = 0x08;	/*  IP = 0x0800  */
 			lp->data[13] = 0x00;
@@ -1341,9 +1826,8 @@ void net_udp_rx_avail(struct net *net, void *extra)
 			lp->data[15] = 0x00;	/*  tos  */
 			lp->data[16] = ip_len >> 8;
 			lp->data[17] = ip_len & 0xff;
-			lp->data[18] = net->udp_connections[con_id].udp_id >> 8;
-			lp->data[19] = net->udp_connections[con_id].udp_id
-			    & 0xff;
+			lp->data[18] = con->udp_id >> 8;
+			lp->data[19] = con->udp_id & 0xff;
 			lp->data[20] = (fragment_ofs >> 8);
 			if (bytes_converted + this_packets_data_length
 			    < udp_len)
@@ -1355,8 +1839,7 @@ void net_udp_rx_avail(struct net *net, void *extra)
 			lp->data[27] = ((unsigned char *)&from)[5];
 			lp->data[28] = ((unsigned char *)&from)[6];
 			lp->data[29] = ((unsigned char *)&from)[7];
-			memcpy(lp->data + 30, net->udp_connections[con_id].
-			    inside_ip_address, 4);
+			memcpy(lp->data + 30, con->inside_ip_address, 4);
 			net_ip_checksum(lp->data + 14, 10, 20);
 
 			memcpy(lp->data+34, udp_data + bytes_converted,
@@ -1364,183 +1847,297 @@ void net_udp_rx_avail(struct net *net, void *extra)
 
 			bytes_converted += this_packets_data_length;
 			fragment_ofs = bytes_converted / 8;
-
-			received_packets_this_tick ++;
 		}
-
-		/*  This makes sure we check this connection AGAIN
-		    for more incoming UDP packets, before moving to the
-		    next connection:  */
-		con_id --;
 	}
+
+	/*  Wait for more:  */
+	net_reactor_arm(net, con->source, NET_REACTOR_READ);
 }
 
 
 /*
- *  net_tcp_rx_avail():
+ *  net_tcp_socket_ready():
  *
- *  Receive any available TCP packets (from the outside world).
+ *  Called by the reactor when a TCP connection's socket has become writable
+ *  (i.e. connect() has finished, or there is room for more data from the
+ *  guest OS) or readable.
  */
-void net_tcp_rx_avail(struct net *net, void *extra)
+static void net_tcp_socket_ready(struct net *net, void *extra, void *owner)
 {
-	int received_packets_this_tick = 0;
-	int max_packets_this_tick = 200;
-	int con_id;
+	struct tcp_connection *con = (struct tcp_connection *) owner;
+	int room, old_recv_len;
+	ssize_t res;
 
-	for (con_id=0; con_id<MAX_TCP_CONNECTIONS; con_id++) {
-		unsigned char buf[66000];
-		ssize_t res, res2;
-		fd_set rfds;
-		struct timeval tv;
+	if (con->state == TCP_OUTSIDE_TRYINGTOCONNECT) {
+		int err = 0;
+		socklen_t err_len = sizeof(err);
 
-		if (received_packets_this_tick > max_packets_this_tick)
-			break;
+		if (getsockopt(con->socket, SOL_SOCKET, SO_ERROR, &err,
+		    &err_len) < 0)
+			err = errno;
 
-		if (!net->tcp_connections[con_id].in_use)
-			continue;
+		if (err == EINPROGRESS || err == EALREADY) {
+			/*  Not yet.  */
+			tcp_rearm(net, con);
+			return;
+		}
 
-		if (net->tcp_connections[con_id].socket < 0) {
-			fatal("INTERNAL ERROR in net.c, tcp socket < 0"
-			    " but in use?\n");
-			continue;
+		if (err != 0) {
+			/*  E.g. connection refused. Tell the guest OS:  */
+			debug("[ net: TCP: connect: %s ]\n", strerror(err));
+			tcp_reset(net, extra, con);
+			return;
 		}
 
-		if (net->tcp_connections[con_id].incoming_buf == NULL)
-			CHECK_ALLOCATION(net->tcp_connections[con_id].
-			    incoming_buf = (unsigned char *) malloc(TCP_INCOMING_BUF_LEN));
+		con->state = TCP_OUTSIDE_CONNECTED;
+		debug("CHANGING TO TCP_OUTSIDE_CONNECTED\n");
+		net_ip_tcp_connectionreply(net, extra, con,
+		    NET_TCP_SYN | NET_TCP_ACK, NULL, 0);
 
-		if (net->tcp_connections[con_id].state >=
-		    TCP_OUTSIDE_DISCONNECTED)
-			continue;
+		tcp_check_pending(net, con);
+		tcp_rearm(net, con);
+		return;
+	}
 
-		/*  Is the socket available for output?  */
-		FD_ZERO(&rfds);		/*  write  */
-		FD_SET(net->tcp_connections[con_id].socket, &rfds);
-		tv.tv_sec = tv.tv_usec = 0;
-		errno = 0;
-		res = select(net->tcp_connections[con_id].socket+1,
-		    NULL, &rfds, NULL, &tv);
-
-		if (errno == ECONNREFUSED) {
-			fatal("[ ECONNREFUSED: TODO ]\n");
-			net->tcp_connections[con_id].state =
-			    TCP_OUTSIDE_DISCONNECTED;
-			fatal("CHANGING TO TCP_OUTSIDE_DISCONNECTED "
-			    "(refused connection)\n");
-			continue;
-		}
+	if (con->state != TCP_OUTSIDE_CONNECTED)
+		return;
 
-		if (errno == ETIMEDOUT) {
-			fatal("[ ETIMEDOUT: TODO ]\n");
-			/*  TODO  */
-			net->tcp_connections[con_id].state =
-			    TCP_OUTSIDE_DISCONNECTED;
-			fatal("CHANGING TO TCP_OUTSIDE_DISCONNECTED "
-			    "(timeout)\n");
-			continue;
-		}
+	net->timestamp ++;
+	con->last_used_timestamp = net->timestamp;
+
+	/*  Write buffered data from the guest OS:  */
+	old_recv_len = con->recv_len;
+	if (tcp_flush(con) < 0) {
+		debug("[ error writing to TCP connection %i: errno = %i ]\n",
+		    con->socket, errno);
+		tcp_reset(net, extra, con);
+		return;
+	}
 
-		if (net->tcp_connections[con_id].state ==
-		    TCP_OUTSIDE_TRYINGTOCONNECT && res > 0) {
-			net->tcp_connections[con_id].state =
-			    TCP_OUTSIDE_CONNECTED;
-			debug("CHANGING TO TCP_OUTSIDE_CONNECTED\n");
-			net_ip_tcp_connectionreply(net, extra, con_id, 1,
-			    NULL, 0, 0);
+	/*  Tell the guest OS if its window was closing, but has opened:  */
+	if (old_recv_len > TCP_RECV_BUF_LEN / 2 &&
+	    con->recv_len <= TCP_RECV_BUF_LEN / 2)
+		net_ip_tcp_connectionreply(net, extra, con, NET_TCP_ACK,
+		    NULL, 0);
+
+	/*  Read as much as there is room for in the send buffer:  */
+	if (!con->outside_eof && con->send_len < TCP_SEND_BUF_LEN) {
+		room = TCP_SEND_BUF_LEN - con->send_ofs - con->send_len;
+		if (room < TCP_SEND_BUF_LEN / 4 && con->send_ofs > 0) {
+			memmove(con->send_buf, con->send_buf + con->send_ofs,
+			    con->send_len);
+			con->send_ofs = 0;
+			room = TCP_SEND_BUF_LEN - con->send_len;
 		}
 
-		if (net->tcp_connections[con_id].state ==
-		    TCP_OUTSIDE_CONNECTED && res < 1) {
-			continue;
+		res = read(con->socket, con->send_buf + con->send_ofs +
+		    con->send_len, room);
+		if (res > 0) {
+			con->send_len += res;
+		} else if (res == 0) {
+			debug("[ net: TCP: outside closed connection %i ]\n",
+			    con->socket);
+			con->outside_eof = 1;
+		} else if (errno != EAGAIN && errno != EINTR) {
+			debug("[ net: TCP: error reading from connection %i:"
+			    " errno = %i ]\n", con->socket, errno);
+			tcp_reset(net, extra, con);
+			return;
 		}
+	}
+
+	tcp_output(net, extra, con, 0);
+	tcp_rearm(net, con);
+	tcp_finished(net, con);
+}
+
+
+/*
+ *  net_tcp_rx_avail():
+ *
+ *  Goes through the connections which have data that the guest OS has not
+ *  acknowledged yet (or which has not been sent at all, e.g. because the
+ *  NIC's receive ring was full, or the guest's window was closed). More
+ *  data is sent if the window allows it, and everything is sent again if
+ *  the retransmit timer has run out. (Incoming data is handled by
+ *  net_tcp_socket_ready(), when the reactor sees it.)
+ */
+void net_tcp_rx_avail(struct net *net, void *extra)
+{
+	struct tcp_connection *con = net->tcp_unacked_first;
+	int64_t now = tcp_now();
+
+	while (con != NULL) {
+		struct tcp_connection *next = con->unacked_next;
+
+		if (con->rto_deadline != 0 && now >= con->rto_deadline)
+			tcp_timeout(net, extra, con);
+		else
+			tcp_output(net, extra, con, 0);
+
+		con = next;
+	}
+}
+
+
+/*
+ *  net_tcp_accept_ready():
+ *
+ *  Called by the reactor when there is an incoming connection on a forwarded
+ *  port. A SYN is sent to the guest OS, and once it has answered, the
+ *  connection is handled just like one which the guest OS opened itself.
+ */
+static void net_tcp_accept_ready(struct net *net, void *extra, void *owner)
+{
+	struct tcp_forward *fwd = (struct tcp_forward *) owner;
+	struct tcp_connection *con;
+	struct sockaddr_in remote_ip;
+	socklen_t remote_len;
+	unsigned char *outside_ip;
+	int s, outside_port;
+
+	for (;;) {
+		remote_len = sizeof(remote_ip);
+		s = accept(fwd->socket, (struct sockaddr *)&remote_ip,
+		    &remote_len);
+		if (s < 0)
+			break;
 
 		/*
-		 *  Does this connection have unacknowledged data?  Then, if
-		 *  enough number of rounds have passed, try to resend it using
-		 *  the old value of seqnr.
+		 *  The guest OS would consider packets from 127.x.x.x to be
+		 *  its own, so connections from the host itself appear to
+		 *  come from the gateway.
 		 */
-		if (net->tcp_connections[con_id].incoming_buf_len != 0) {
-			net->tcp_connections[con_id].incoming_buf_rounds ++;
-			if (net->tcp_connections[con_id].incoming_buf_rounds >
-			    10000) {
-				debug("  at seqnr %u but backing back to %u,"
-				    " resending %i bytes\n",
-				    net->tcp_connections[con_id].outside_seqnr,
-				    net->tcp_connections[con_id].
-				    incoming_buf_seqnr,
-				    net->tcp_connections[con_id].
-				    incoming_buf_len);
-
-				net->tcp_connections[con_id].
-				    incoming_buf_rounds = 0;
-				net->tcp_connections[con_id].outside_seqnr =
-				    net->tcp_connections[con_id].
-				    incoming_buf_seqnr;
-
-				net_ip_tcp_connectionreply(net, extra, con_id,
-				    0, net->tcp_connections[con_id].
-				    incoming_buf,
-				    net->tcp_connections[con_id].
-				    incoming_buf_len, 0);
-			}
+		outside_ip = (unsigned char *) &remote_ip.sin_addr;
+		if (outside_ip[0] == 127)
+			outside_ip = net->gateway_ipv4_addr;
+		outside_port = ntohs(remote_ip.sin_port);
+
+		if (!fwd->ethernet_address_known ||
+		    net->n_tcp_connections >= MAX_TCP_CONNECTIONS ||
+		    tcp_findconnection(net, fwd->inside_ip_address,
+		    fwd->inside_tcp_port, outside_ip, outside_port) != NULL) {
+			fatal("[ net: TCP: incoming connection to port %i "
+			    "dropped: %s ]\n", fwd->host_port,
+			    !fwd->ethernet_address_known? "the guest OS has "
+			    "not been seen on the network yet" :
+			    "too many connections");
+			close(s);
 			continue;
 		}
 
-		/*  Don't receive unless the guest OS is ready!  */
-		if (((int32_t)net->tcp_connections[con_id].outside_seqnr -
-		    (int32_t)net->tcp_connections[con_id].inside_acknr) > 0) {
-/*			fatal("YOYO 1! outside_seqnr - inside_acknr = %i\n",
-			    net->tcp_connections[con_id].outside_seqnr -
-			    net->tcp_connections[con_id].inside_acknr);  */
-			continue;
-		}
+		debug("[ net: TCP: incoming connection to port %i, "
+		    "socket=%i ]\n", fwd->host_port, s);
 
-		/*  Is there incoming data available on the socket?  */
-		FD_ZERO(&rfds);		/*  read  */
-		FD_SET(net->tcp_connections[con_id].socket, &rfds);
-		tv.tv_sec = tv.tv_usec = 0;
-		res2 = select(net->tcp_connections[con_id].socket+1, &rfds,
-		    NULL, NULL, &tv);
+		con = tcp_newconnection(net, s, fwd->ethernet_address,
+		    fwd->inside_ip_address, fwd->inside_tcp_port,
+		    outside_ip, outside_port);
+		con->state = TCP_INSIDE_TRYINGTOCONNECT;
 
-		/*  No more incoming TCP data on this connection?  */
-		if (res2 < 1)
-			continue;
+		/*  Offer window scaling and timestamps. The guest's SYN+ACK
+		    tells whether they are used.  */
+		con->inside_wscale = 0;
+		con->use_timestamps = 1;
+
+		net_ip_tcp_connectionreply(net, extra, con, NET_TCP_SYN,
+		    NULL, 0);
+		tcp_check_pending(net, con);
+		tcp_rearm(net, con);
+	}
+
+	net_reactor_arm(net, fwd->source, NET_REACTOR_READ);
+}
 
-		res = read(net->tcp_connections[con_id].socket, buf, 1400);
-		if (res > 0) {
-			/*  debug("\n -{- %lli -}-\n", (long long)res);  */
-			net->tcp_connections[con_id].incoming_buf_len = res;
-			net->tcp_connections[con_id].incoming_buf_rounds = 0;
-			net->tcp_connections[con_id].incoming_buf_seqnr = 
-			    net->tcp_connections[con_id].outside_seqnr;
-			debug("  putting %i bytes (seqnr %u) in the incoming "
-			    "buf\n", res, net->tcp_connections[con_id].
-			    incoming_buf_seqnr);
-			memcpy(net->tcp_connections[con_id].incoming_buf,
-			    buf, res);
-
-			net_ip_tcp_connectionreply(net, extra, con_id, 0,
-			    buf, res, 0);
-		} else if (res == 0) {
-			net->tcp_connections[con_id].state =
-			    TCP_OUTSIDE_DISCONNECTED;
-			debug("CHANGING TO TCP_OUTSIDE_DISCONNECTED, read"
-			    " res=0\n");
-			net_ip_tcp_connectionreply(net, extra, con_id, 0,
-			    NULL, 0, 0);
-		} else {
-			net->tcp_connections[con_id].state =
-			    TCP_OUTSIDE_DISCONNECTED;
-			fatal("CHANGING TO TCP_OUTSIDE_DISCONNECTED, "
-			    "read res<=0, errno = %i\n", errno);
-			net_ip_tcp_connectionreply(net, extra, con_id, 0,
-			    NULL, 0, 0);
-		}
 
-		net->timestamp ++;
-		net->tcp_connections[con_id].last_used_timestamp =
-		    net->timestamp;
+/*
+ *  net_tcp_forward_add():
+ *
+ *  Forwards incoming TCP connections on a host port to the guest OS. spec
+ *  should be "hostport:guestaddr:guestport", for example "2323:10.0.0.1:23".
+ *
+ *  On failure, exit() is called.
+ */
+void net_tcp_forward_add(struct net *net, const char *spec)
+{
+	struct tcp_forward *fwd;
+	struct sockaddr_in si_self;
+	struct in_addr addr;
+	char addr_str[50];
+	int host_port, inside_port, res, one = 1;
+
+	if (sscanf(spec, "%i:%49[0-9.]:%i", &host_port, addr_str,
+	    &inside_port) != 3 || host_port < 1 || host_port > 65535 ||
+	    inside_port < 1 || inside_port > 65535) {
+		fprintf(stderr, "TCP port forwarding '%s' is not "
+		    "'hostport:guestaddr:guestport'?\n", spec);
+		exit(1);
+	}
+
+#ifdef HAVE_INET_PTON
+	res = inet_pton(AF_INET, addr_str, &addr);
+#else
+	res = inet_aton(addr_str, &addr);
+#endif
+	if (res < 1) {
+		fprintf(stderr, "net_tcp_forward_add(): could not parse IPv4 "
+		    "address '%s'\n", addr_str);
+		exit(1);
+	}
+
+	CHECK_ALLOCATION(fwd = (struct tcp_forward *)
+	    malloc(sizeof(struct tcp_forward)));
+	memset(fwd, 0, sizeof(struct tcp_forward));
+
+	fwd->host_port = host_port;
+	memcpy(fwd->inside_ip_address, &addr, 4);
+	fwd->inside_tcp_port = inside_port;
+
+	fwd->socket = socket(AF_INET, SOCK_STREAM, 0);
+	if (fwd->socket < 0) {
+		perror("socket");
+		exit(1);
 	}
+
+	setsockopt(fwd->socket, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+	memset((char *)&si_self, 0, sizeof(si_self));
+	si_self.sin_family = AF_INET;
+	si_self.sin_port = htons(host_port);
+	si_self.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(fwd->socket, (struct sockaddr *)&si_self,
+	    sizeof(si_self)) < 0 || listen(fwd->socket, 16) < 0) {
+		perror("bind");
+		exit(1);
+	}
+
+	/*  Set the socket to non-blocking:  */
+	res = fcntl(fwd->socket, F_GETFL);
+	fcntl(fwd->socket, F_SETFL, res | O_NONBLOCK);
+
+	fwd->next = net->tcp_forwards;
+	net->tcp_forwards = fwd;
+
+	fwd->source = net_reactor_add(net, fwd->socket, net_tcp_accept_ready,
+	    fwd);
+	net_reactor_arm(net, fwd->source, NET_REACTOR_READ);
 }
 
 
+/*
+ *  net_tcp_forward_learn():
+ *
+ *  Remembers the ethernet address of a guest OS which incoming connections
+ *  are forwarded to. This is called for the IP packets and ARP requests
+ *  which the guest OS sends.
+ */
+void net_tcp_forward_learn(struct net *net, unsigned char *ipv4_addr,
+	unsigned char *ethernet_addr)
+{
+	struct tcp_forward *fwd;
+
+	for (fwd = net->tcp_forwards; fwd != NULL; fwd = fwd->next)
+		if (memcmp(fwd->inside_ip_address, ipv4_addr, 4) == 0) {
+			memcpy(fwd->ethernet_address, ethernet_addr, 6);
+			fwd->ethernet_address_known = 1;
+		}
+}
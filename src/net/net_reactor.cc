@@ -0,0 +1,496 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright  
+ *     notice, this list of conditions and the following disclaimer in the 
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE   
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *  The NAT gateway's socket reactor.
+ *
+ *  All outside sockets (the NAT gateway's UDP and TCP connections, and the
+ *  socket used by a distributed network) are registered here. A reactor
+ *  thread waits for them to become ready, using epoll where available and
+ *  poll() otherwise, and puts the ready sockets on a list. When an emulated
+ *  NIC polls for incoming packets, only the sockets on that list are
+ *  serviced, by calling their handlers; if nothing has arrived, no system
+ *  calls are made at all.
+ *
+ *  A socket is reported once each time it is armed (with NET_REACTOR_READ
+ *  and/or NET_REACTOR_WRITE), so a handler which wants to hear about the
+ *  socket again has to arm it again. Handlers may also be called when
+ *  nothing is actually ready, and must cope with that.
+ *
+ *  Sources are only freed by the reactor thread, once they are dead and not
+ *  on the ready list, so that neither thread ever sees a freed source.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "misc.h"
+#include "net.h"
+
+#ifdef HAVE_EPOLL
+#include <sys/epoll.h>
+#else
+#include <poll.h>
+#endif
+
+
+#define	NET_REACTOR_MAX_EVENTS		64
+
+struct net_reactor_source {
+	struct net_reactor_source *next;	/*  all sources, or graveyard  */
+	struct net_reactor_source *next_ready;
+
+	int		fd;
+	int		events;		/*  armed events, 0 if not armed  */
+	int		ready;		/*  on the ready list  */
+	int		dead;
+
+	void		(*handler)(struct net *, void *extra, void *owner);
+	void		*owner;
+};
+
+struct net_reactor {
+	pthread_mutex_t	lock;
+
+#ifdef HAVE_EPOLL
+	int		epoll_fd;
+#else
+	int		wake_pipe[2];
+	struct net_reactor_source *sources;
+#endif
+
+	struct net_reactor_source *graveyard;
+
+	struct net_reactor_source *first_ready;
+	struct net_reactor_source *last_ready;
+	volatile int	pending;
+};
+
+
+/*
+ *  net_reactor_make_ready():
+ *
+ *  Puts a source on the ready list. Called by the reactor thread, with the
+ *  reactor's lock held.
+ */
+static void net_reactor_make_ready(struct net_reactor *r,
+	struct net_reactor_source *src)
+{
+	/*  Reported once per arming:  */
+	src->events = 0;
+
+	if (src->dead || src->ready)
+		return;
+
+	src->ready = 1;
+	src->next_ready = NULL;
+	if (r->last_ready == NULL)
+		r->first_ready = src;
+	else
+		r->last_ready->next_ready = src;
+	r->last_ready = src;
+
+	r->pending = 1;
+}
+
+
+/*
+ *  net_reactor_bury():
+ *
+ *  Frees dead sources which are no longer on the ready list. Called by the
+ *  reactor thread, with the reactor's lock held.
+ */
+static void net_reactor_bury(struct net_reactor *r)
+{
+	struct net_reactor_source **srcp = &r->graveyard;
+
+	while (*srcp != NULL) {
+		struct net_reactor_source *src = *srcp;
+
+		if (src->ready) {
+			srcp = &src->next;
+			continue;
+		}
+
+		*srcp = src->next;
+		free(src);
+	}
+}
+
+
+/*
+ *  net_reactor_thread():
+ *
+ *  Waits for armed sockets to become ready.
+ */
+static void *net_reactor_thread(void *arg)
+{
+	struct net_reactor *r = (struct net_reactor *) arg;
+	sigset_t sigs;
+#ifdef HAVE_EPOLL
+	struct epoll_event ev[NET_REACTOR_MAX_EVENTS];
+#else
+	struct pollfd *fds = NULL;
+	struct net_reactor_source **srcs = NULL;
+	int max_fds = 0;
+#endif
+	int i, n;
+
+	/*  Signals (CTRL-C) are handled by the main thread:  */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGCONT);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	for (;;) {
+#ifdef HAVE_EPOLL
+		n = epoll_wait(r->epoll_fd, ev, NET_REACTOR_MAX_EVENTS, -1);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("epoll_wait");
+			break;
+		}
+
+		pthread_mutex_lock(&r->lock);
+		for (i=0; i<n; i++)
+			net_reactor_make_ready(r,
+			    (struct net_reactor_source *) ev[i].data.ptr);
+		net_reactor_bury(r);
+		pthread_mutex_unlock(&r->lock);
+#else
+		struct net_reactor_source *src;
+
+		pthread_mutex_lock(&r->lock);
+		net_reactor_bury(r);
+
+		n = 1;
+		for (src = r->sources; src != NULL; src = src->next)
+			n ++;
+		if (n > max_fds) {
+			max_fds = n * 2;
+			CHECK_ALLOCATION(fds = (struct pollfd *) realloc(fds,
+			    sizeof(struct pollfd) * max_fds));
+			CHECK_ALLOCATION(srcs = (struct net_reactor_source **)
+			    realloc(srcs, sizeof(struct net_reactor_source *)
+			    * max_fds));
+		}
+
+		fds[0].fd = r->wake_pipe[0];
+		fds[0].events = POLLIN;
+		n = 1;
+		for (src = r->sources; src != NULL; src = src->next) {
+			if (src->events == 0 || src->ready)
+				continue;
+			fds[n].fd = src->fd;
+			fds[n].events =
+			    (src->events & NET_REACTOR_READ? POLLIN : 0) |
+			    (src->events & NET_REACTOR_WRITE? POLLOUT : 0);
+			srcs[n++] = src;
+		}
+		pthread_mutex_unlock(&r->lock);
+
+		if (poll(fds, n, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		if (fds[0].revents) {
+			unsigned char buf[64];
+			while (read(r->wake_pipe[0], buf, sizeof(buf)) > 0)
+				;
+		}
+
+		/*  Sources are only freed by this thread, so srcs[] is safe:  */
+		pthread_mutex_lock(&r->lock);
+		for (i=1; i<n; i++)
+			if (fds[i].revents && srcs[i]->events != 0)
+				net_reactor_make_ready(r, srcs[i]);
+		pthread_mutex_unlock(&r->lock);
+#endif
+	}
+
+	return NULL;
+}
+
+
+/*
+ *  net_reactor_wake():
+ *
+ *  Makes the reactor thread notice that the set of armed sockets has
+ *  changed. (Only needed when using poll().)
+ */
+static void net_reactor_wake(struct net_reactor *r)
+{
+#ifndef HAVE_EPOLL
+	unsigned char b = 0;
+
+	if (write(r->wake_pipe[1], &b, 1) < 0) {
+		/*  The pipe is full, so the thread will wake up anyway.  */
+	}
+#endif
+}
+
+
+/*
+ *  net_reactor_get():
+ *
+ *  Returns a net's reactor, creating it (and starting its thread) the first
+ *  time it is needed.
+ */
+static struct net_reactor *net_reactor_get(struct net *net)
+{
+	struct net_reactor *r = net->reactor;
+	pthread_t thread;
+
+	if (r != NULL)
+		return r;
+
+	CHECK_ALLOCATION(r = (struct net_reactor *)
+	    malloc(sizeof(struct net_reactor)));
+	memset(r, 0, sizeof(struct net_reactor));
+
+	pthread_mutex_init(&r->lock, NULL);
+
+#ifdef HAVE_EPOLL
+	r->epoll_fd = epoll_create(NET_REACTOR_MAX_EVENTS);
+	if (r->epoll_fd < 0) {
+		perror("epoll_create");
+		exit(1);
+	}
+#else
+	if (pipe(r->wake_pipe) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+	fcntl(r->wake_pipe[0], F_SETFL,
+	    fcntl(r->wake_pipe[0], F_GETFL) | O_NONBLOCK);
+	fcntl(r->wake_pipe[1], F_SETFL,
+	    fcntl(r->wake_pipe[1], F_GETFL) | O_NONBLOCK);
+#endif
+
+	if (pthread_create(&thread, NULL, net_reactor_thread, r) != 0) {
+		perror("pthread_create");
+		exit(1);
+	}
+
+	pthread_detach(thread);
+
+	net->reactor = r;
+	return r;
+}
+
+
+/*
+ *  net_reactor_add():
+ *
+ *  Registers a socket with the reactor. The socket is not armed; use
+ *  net_reactor_arm() to start waiting for it. handler is called (with the
+ *  NIC which polled, and the owner pointer) when the socket is ready.
+ */
+struct net_reactor_source *net_reactor_add(struct net *net, int fd,
+	void (*handler)(struct net *, void *extra, void *owner), void *owner)
+{
+	struct net_reactor *r = net_reactor_get(net);
+	struct net_reactor_source *src;
+
+	CHECK_ALLOCATION(src = (struct net_reactor_source *)
+	    malloc(sizeof(struct net_reactor_source)));
+	memset(src, 0, sizeof(struct net_reactor_source));
+
+	src->fd = fd;
+	src->handler = handler;
+	src->owner = owner;
+
+	pthread_mutex_lock(&r->lock);
+
+#ifdef HAVE_EPOLL
+	{
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLONESHOT;
+		ev.data.ptr = src;
+		if (epoll_ctl(r->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+			perror("epoll_ctl");
+			exit(1);
+		}
+	}
+#else
+	src->next = r->sources;
+	r->sources = src;
+#endif
+
+	pthread_mutex_unlock(&r->lock);
+
+	return src;
+}
+
+
+/*
+ *  net_reactor_arm():
+ *
+ *  Starts waiting for a socket to become readable (NET_REACTOR_READ) and/or
+ *  writable (NET_REACTOR_WRITE). Once it is, the source's handler is called
+ *  (once). events = 0 stops waiting.
+ */
+void net_reactor_arm(struct net *net, struct net_reactor_source *src,
+	int events)
+{
+	struct net_reactor *r = net->reactor;
+
+	pthread_mutex_lock(&r->lock);
+
+	if (src->dead || src->events == events) {
+		pthread_mutex_unlock(&r->lock);
+		return;
+	}
+
+	src->events = events;
+
+#ifdef HAVE_EPOLL
+	{
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLONESHOT;
+		if (events & NET_REACTOR_READ)
+			ev.events |= EPOLLIN;
+		if (events & NET_REACTOR_WRITE)
+			ev.events |= EPOLLOUT;
+		ev.data.ptr = src;
+		epoll_ctl(r->epoll_fd, EPOLL_CTL_MOD, src->fd, &ev);
+	}
+#endif
+
+	pthread_mutex_unlock(&r->lock);
+
+	net_reactor_wake(r);
+}
+
+
+/*
+ *  net_reactor_remove():
+ *
+ *  Unregisters a socket. This must be called before the socket is closed.
+ *  The handler is never called for the source after this.
+ */
+void net_reactor_remove(struct net *net, struct net_reactor_source *src)
+{
+	struct net_reactor *r = net->reactor;
+
+	pthread_mutex_lock(&r->lock);
+
+	src->dead = 1;
+	src->owner = NULL;
+
+#ifdef HAVE_EPOLL
+	{
+		struct epoll_event ev;
+
+		memset(&ev, 0, sizeof(ev));
+		epoll_ctl(r->epoll_fd, EPOLL_CTL_DEL, src->fd, &ev);
+	}
+#else
+	{
+		struct net_reactor_source **srcp = &r->sources;
+
+		while (*srcp != src)
+			srcp = &(*srcp)->next;
+		*srcp = src->next;
+	}
+#endif
+
+	src->next = r->graveyard;
+	r->graveyard = src;
+
+	pthread_mutex_unlock(&r->lock);
+
+	net_reactor_wake(r);
+}
+
+
+/*
+ *  net_reactor_pending():
+ *
+ *  Returns 1 if there may be sockets on the ready list. (This doesn't take
+ *  the lock, so it is cheap enough to call every time a NIC polls.)
+ */
+int net_reactor_pending(struct net *net)
+{
+	return net->reactor != NULL && net->reactor->pending;
+}
+
+
+/*
+ *  net_reactor_dispatch():
+ *
+ *  Calls the handlers of all ready sockets. 'extra' is the NIC which
+ *  polled. Called with net->lock held.
+ */
+void net_reactor_dispatch(struct net *net, void *extra)
+{
+	struct net_reactor *r = net->reactor;
+	struct net_reactor_source *src;
+
+	if (!net_reactor_pending(net))
+		return;
+
+	pthread_mutex_lock(&r->lock);
+	src = r->first_ready;
+	r->first_ready = r->last_ready = NULL;
+	r->pending = 0;
+	pthread_mutex_unlock(&r->lock);
+
+	while (src != NULL) {
+		struct net_reactor_source *next;
+		void (*handler)(struct net *, void *, void *);
+		void *owner;
+		int dead;
+
+		pthread_mutex_lock(&r->lock);
+		next = src->next_ready;
+		src->ready = 0;
+		dead = src->dead;
+		handler = src->handler;
+		owner = src->owner;
+		pthread_mutex_unlock(&r->lock);
+
+		/*  Note: src may be freed from here on, if it is dead.  */
+		if (!dead)
+			handler(net, extra, owner);
+
+		src = next;
+	}
+}
+
@@ -0,0 +1,443 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright  
+ *     notice, this list of conditions and the following disclaimer in the 
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE   
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *  Shared memory transport for distributed networks.
+ *
+ *  When emulator processes on the same host are connected to each other
+ *  (using local_port() and add_remote("localhost:port")), ethernet frames
+ *  are passed through shared memory instead of as one UDP datagram each.
+ *
+ *  Each emulator with a local port creates a ring of frame slots, named
+ *  after the port. Any number of other emulators map the ring and add
+ *  frames to it, but only the owner takes frames out. A producer reserves a
+ *  slot by advancing enqueue_pos with compare-and-swap, and hands it over
+ *  by updating the slot's sequence number, so producers never wait for
+ *  each other or for the owner.
+ *
+ *  When the owner has emptied its ring, it sets the ring's sleeping flag.
+ *  The first producer to add a frame after that clears the flag and wakes
+ *  the owner up, by sending an empty datagram to the owner's UDP port
+ *  (which the owner's reactor is waiting on anyway). While the owner is
+ *  busy, frames are passed without any system calls.
+ *
+ *  Frames for a full ring are dropped and counted, like a switch does when
+ *  a port's queue is full. Remotes which do not have a ring (for example
+ *  emulators on other hosts, or experiments/udp_snoop) are sent to using
+ *  UDP as before.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "misc.h"
+#include "net.h"
+
+#ifdef HAVE_SHM_OPEN
+#include <sys/mman.h>
+#endif
+
+
+#define	NET_SHM_NAME_FORMAT	"/gxemul-net-%i"
+#define	NET_SHM_MAGIC		0x47584e53
+#define	NET_SHM_VERSION		1
+
+#define	NET_SHM_SLOTS		512	/*  must be a power of two  */
+#define	NET_SHM_FRAME_MAX	1524
+#define	NET_SHM_CACHE_LINE	64
+
+struct net_shm_slot {
+	uint32_t	seq;
+	uint16_t	len;
+	uint16_t	sender_port;	/*  the producer's local port, or 0  */
+	unsigned char	data[NET_SHM_FRAME_MAX];
+};
+
+/*
+ *  The fields which are written by different processes are kept in
+ *  separate cache lines.
+ */
+struct net_shm_ring {
+	uint32_t	magic;
+	uint32_t	version;
+	uint32_t	n_slots;
+	int32_t		owner_pid;
+	int32_t		alive;		/*  cleared when the owner exits  */
+	unsigned char	pad0[NET_SHM_CACHE_LINE - 5 * sizeof(uint32_t)];
+
+	uint32_t	enqueue_pos;	/*  producers  */
+	unsigned char	pad1[NET_SHM_CACHE_LINE - sizeof(uint32_t)];
+
+	uint32_t	dequeue_pos;	/*  owner  */
+	unsigned char	pad2[NET_SHM_CACHE_LINE - sizeof(uint32_t)];
+
+	uint32_t	sleeping;	/*  owner, cleared by producers  */
+	unsigned char	pad3[NET_SHM_CACHE_LINE - sizeof(uint32_t)];
+
+	struct net_shm_slot slots[NET_SHM_SLOTS];
+};
+
+
+#ifdef HAVE_SHM_OPEN
+
+/*  Rings owned by this process, removed at exit:  */
+struct net_shm_owned {
+	struct net_shm_owned *next;
+	struct net_shm_ring *ring;
+	char		name[32];
+};
+
+static struct net_shm_owned *net_shm_owned_rings = NULL;
+
+
+/*
+ *  net_shm_atexit():
+ *
+ *  Tells the producers that the rings owned by this process are gone, and
+ *  removes their names.
+ */
+static void net_shm_atexit(void)
+{
+	struct net_shm_owned *o;
+
+	for (o = net_shm_owned_rings; o != NULL; o = o->next) {
+		__atomic_store_n(&o->ring->alive, 0, __ATOMIC_RELEASE);
+		shm_unlink(o->name);
+	}
+}
+
+
+/*
+ *  net_shm_detach():
+ *
+ *  Forgets a remote's ring, e.g. because its owner has exited. (It is
+ *  looked for again later, in case the remote is restarted.)
+ */
+static void net_shm_detach(struct remote_net *rnp)
+{
+	munmap(rnp->shm_ring, sizeof(struct net_shm_ring));
+	rnp->shm_ring = NULL;
+}
+
+
+/*
+ *  net_shm_attach():
+ *
+ *  Maps a remote's ring, if the remote has created one. Returns 1 on
+ *  success, 0 if the remote should be sent to using UDP.
+ */
+static int net_shm_attach(struct remote_net *rnp)
+{
+	struct net_shm_ring *ring;
+	struct stat st;
+	char name[32];
+	int fd;
+
+	snprintf(name, sizeof(name), NET_SHM_NAME_FORMAT, rnp->portnr);
+	fd = shm_open(name, O_RDWR, 0);
+	if (fd < 0)
+		return 0;
+
+	if (fstat(fd, &st) < 0 ||
+	    st.st_size != (off_t) sizeof(struct net_shm_ring)) {
+		close(fd);
+		return 0;
+	}
+
+	ring = (struct net_shm_ring *) mmap(NULL, sizeof(struct net_shm_ring),
+	    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ring == MAP_FAILED)
+		return 0;
+
+	if (ring->magic != NET_SHM_MAGIC || ring->version != NET_SHM_VERSION
+	    || ring->n_slots != NET_SHM_SLOTS ||
+	    !__atomic_load_n(&ring->alive, __ATOMIC_ACQUIRE)) {
+		munmap(ring, sizeof(struct net_shm_ring));
+		return 0;
+	}
+
+	rnp->shm_ring = ring;
+	return 1;
+}
+
+#endif	/*  HAVE_SHM_OPEN  */
+
+
+/*
+ *  net_shm_init():
+ *
+ *  Creates the ring which other emulators on this host use to send frames
+ *  to this network. (If that fails, they will use UDP instead.)
+ */
+void net_shm_init(struct net *net)
+{
+#ifdef HAVE_SHM_OPEN
+	struct net_shm_owned *o;
+	struct net_shm_ring *ring;
+	struct remote_net *rnp;
+	int fd, i;
+
+	CHECK_ALLOCATION(o = (struct net_shm_owned *)
+	    malloc(sizeof(struct net_shm_owned)));
+	memset(o, 0, sizeof(struct net_shm_owned));
+	snprintf(o->name, sizeof(o->name), NET_SHM_NAME_FORMAT,
+	    net->local_port);
+
+	/*
+	 *  A ring with the same name can only be left over from an emulator
+	 *  which crashed, since the local port is already bound by this
+	 *  process.
+	 */
+	shm_unlink(o->name);
+
+	fd = shm_open(o->name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) {
+		debug("[ net: could not create shared memory ring %s: %s ]\n",
+		    o->name, strerror(errno));
+		free(o);
+		return;
+	}
+
+	if (ftruncate(fd, sizeof(struct net_shm_ring)) < 0) {
+		perror("net_shm_init(): ftruncate");
+		close(fd);
+		shm_unlink(o->name);
+		free(o);
+		return;
+	}
+
+	ring = (struct net_shm_ring *) mmap(NULL, sizeof(struct net_shm_ring),
+	    PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (ring == MAP_FAILED) {
+		perror("net_shm_init(): mmap");
+		shm_unlink(o->name);
+		free(o);
+		return;
+	}
+
+	ring->magic = NET_SHM_MAGIC;
+	ring->version = NET_SHM_VERSION;
+	ring->n_slots = NET_SHM_SLOTS;
+	ring->owner_pid = getpid();
+	ring->enqueue_pos = ring->dequeue_pos = 0;
+	ring->sleeping = 1;
+	for (i=0; i<NET_SHM_SLOTS; i++)
+		ring->slots[i].seq = i;
+	__atomic_store_n(&ring->alive, 1, __ATOMIC_RELEASE);
+
+	if (net_shm_owned_rings == NULL)
+		atexit(net_shm_atexit);
+	o->ring = ring;
+	o->next = net_shm_owned_rings;
+	net_shm_owned_rings = o;
+
+	net->shm_ring = ring;
+
+	/*  Only remotes on this host can have a ring:  */
+	for (rnp = net->remote_nets; rnp != NULL; rnp = rnp->next)
+		if ((ntohl(rnp->ipv4_addr.s_addr) >> 24) == 127 &&
+		    rnp->portnr != net->local_port)
+			rnp->shm_possible = 1;
+#else
+	(void) net;
+#endif
+}
+
+
+/*
+ *  net_shm_send():
+ *
+ *  Adds a frame to a remote's ring. Returns NET_SHM_NOT_SENT if the remote
+ *  does not have a ring (then UDP should be used), NET_SHM_SENT if the
+ *  frame was added (or dropped, since the ring was full), and
+ *  NET_SHM_SENT_WAKEUP if the remote has to be woken up by sending it an
+ *  empty datagram.
+ */
+int net_shm_send(struct net *net, struct remote_net *rnp,
+	unsigned char *packet, int len)
+{
+#ifdef HAVE_SHM_OPEN
+	struct net_shm_ring *ring = rnp->shm_ring;
+	struct net_shm_slot *slot;
+	uint32_t pos, seq;
+
+	if (ring == NULL) {
+		/*  Look for the remote's ring at most once per second:  */
+		int64_t now = time(NULL);
+
+		if (!rnp->shm_possible || now == rnp->shm_last_attempt)
+			return NET_SHM_NOT_SENT;
+		rnp->shm_last_attempt = now;
+
+		if (!net_shm_attach(rnp))
+			return NET_SHM_NOT_SENT;
+		ring = rnp->shm_ring;
+	}
+
+	if (!__atomic_load_n(&ring->alive, __ATOMIC_ACQUIRE)) {
+		net_shm_detach(rnp);
+		return NET_SHM_NOT_SENT;
+	}
+
+	if (len > NET_SHM_FRAME_MAX)
+		return NET_SHM_NOT_SENT;
+
+	pos = __atomic_load_n(&ring->enqueue_pos, __ATOMIC_RELAXED);
+	for (;;) {
+		int32_t diff;
+
+		slot = &ring->slots[pos & (NET_SHM_SLOTS - 1)];
+		seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		diff = (int32_t) (seq - pos);
+
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&ring->enqueue_pos,
+			    &pos, pos + 1, 1, __ATOMIC_RELAXED,
+			    __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			/*  Full. Has the owner died without cleaning up?  */
+			rnp->shm_dropped ++;
+			if (kill(ring->owner_pid, 0) < 0 && errno == ESRCH)
+				net_shm_detach(rnp);
+			return NET_SHM_SENT;
+		} else
+			pos = __atomic_load_n(&ring->enqueue_pos,
+			    __ATOMIC_RELAXED);
+	}
+
+	memcpy(slot->data, packet, len);
+	slot->len = len;
+	slot->sender_port = net->local_port;
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_RELEASE);
+	rnp->shm_sent ++;
+
+	/*  Pairs with the fence in net_shm_rx():  */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&ring->sleeping, __ATOMIC_RELAXED) &&
+	    __atomic_exchange_n(&ring->sleeping, 0, __ATOMIC_ACQ_REL))
+		return NET_SHM_SENT_WAKEUP;
+
+	return NET_SHM_SENT;
+#else
+	(void) net; (void) rnp; (void) packet; (void) len;
+	return NET_SHM_NOT_SENT;
+#endif
+}
+
+
+/*
+ *  net_shm_rx():
+ *
+ *  Takes frames from this network's ring, and passes them on to the NICs.
+ *  At most NET_RX_RING_RESERVE frames are taken at a time; if there are
+ *  more, net->shm_rx_more is set, and net_shm_rx() should be called again
+ *  when there is room for them. Called with net->lock held.
+ */
+void net_shm_rx(struct net *net)
+{
+	struct net_shm_ring *ring = net->shm_ring;
+	struct in_addr loopback;
+	int n = 0;
+
+	net->shm_rx_more = 0;
+	if (ring == NULL)
+		return;
+
+	loopback.s_addr = htonl(INADDR_LOOPBACK);
+
+	for (;;) {
+		for (;;) {
+			uint32_t pos = ring->dequeue_pos;
+			struct net_shm_slot *slot =
+			    &ring->slots[pos & (NET_SHM_SLOTS - 1)];
+
+			if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)
+			    != pos + 1)
+				break;
+
+			if (n >= NET_RX_RING_RESERVE) {
+				net->shm_rx_more = 1;
+				return;
+			}
+
+			if (slot->len <= NET_SHM_FRAME_MAX)
+				net_distributed_deliver(net, &loopback,
+				    slot->sender_port, slot->data, slot->len);
+			n ++;
+
+			__atomic_store_n(&slot->seq, pos + NET_SHM_SLOTS,
+			    __ATOMIC_RELEASE);
+			ring->dequeue_pos = pos + 1;
+		}
+
+		/*
+		 *  The ring is empty, so ask to be woken up. (A frame may have
+		 *  been added just before the flag was set, so look again.)
+		 */
+		__atomic_store_n(&ring->sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		{
+			uint32_t pos = ring->dequeue_pos;
+			if (__atomic_load_n(&ring->slots[pos &
+			    (NET_SHM_SLOTS - 1)].seq, __ATOMIC_ACQUIRE)
+			    != pos + 1)
+				return;
+		}
+		__atomic_store_n(&ring->sleeping, 0, __ATOMIC_RELAXED);
+	}
+}
+
+
+/*
+ *  net_shm_dumpinfo():
+ *
+ *  Prints the shared memory statistics of a remote network (or, if rnp is
+ *  NULL, of the network's own ring).
+ */
+void net_shm_dumpinfo(struct net *net, struct remote_net *rnp)
+{
+	if (rnp == NULL) {
+		if (net->shm_ring != NULL)
+			debug("shared memory ring: " NET_SHM_NAME_FORMAT "\n",
+			    net->local_port);
+		return;
+	}
+
+	if (rnp->shm_ring != NULL || rnp->shm_sent != 0)
+		debug("shared memory: %llu frames sent, %llu dropped\n",
+		    (unsigned long long) rnp->shm_sent,
+		    (unsigned long long) rnp->shm_dropped);
+}
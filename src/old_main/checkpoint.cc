@@ -0,0 +1,600 @@
+/*
+ *  Copyright (C) 2026  Anders Gavare.  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or without
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  1. Redistributions of source code must retain the above copyright
+ *     notice, this list of conditions and the following disclaimer.
+ *  2. Redistributions in binary form must reproduce the above copyright
+ *     notice, this list of conditions and the following disclaimer in the
+ *     documentation and/or other materials provided with the distribution.
+ *  3. The name of the author may not be used to endorse or promote products
+ *     derived from this software without specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ *  ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ *  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ *  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ *  OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ *  HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ *  LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ *  OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ *  SUCH DAMAGE.
+ *
+ *
+ *  Checkpoints: Saving and restoring the state of a legacy emulation.
+ *
+ *  A checkpoint file starts with CHECKPOINT_MAGIC and a version number,
+ *  followed by the state of each machine:
+ *
+ *	o)  the machine type, number of CPUs and amount of RAM (these are not
+ *	    restored, only checked; the machine has to be set up with the same
+ *	    command line options or configuration file as when the checkpoint
+ *	    was saved),
+ *	o)  the registers of each CPU,
+ *	o)  the contents of RAM, leaving out pages which are all zeroes,
+ *	o)  the state of each memory mapped device, through its checkpoint
+ *	    function (see memory_device_set_checkpoint()), and the contents of
+ *	    device memory which is accessed directly by dyntrans. Machines
+ *	    with devices that have neither are not supported,
+ *	o)  the event queue, i.e. when each device's tick function or other
+ *	    event is due next, and which events are cancelled,
+ *	o)  the state of each disk image, including the blocks of its writable
+ *	    overlay (see diskimage_checkpoint()).
+ *
+ *  All numbers are stored as 64-bit little-endian values, and named sections
+ *  are preceded by tags, so that a mismatch between the checkpoint and the
+ *  machine it is restored into is detected early.
+ *
+ *  Translated code and cached address translations are not part of the
+ *  checkpoint; they are thrown away after a restore, and rebuilt as the
+ *  emulation runs.
+ */
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "checkpoint.h"
+#include "cpu.h"
+#include "diskimage.h"
+#include "emul.h"
+#include "machine.h"
+#include "memory.h"
+#include "misc.h"
+
+
+#define	CHECKPOINT_PAGE_SIZE	4096
+#define	CHECKPOINT_MAX_TAG_LEN	256
+
+
+/*
+ *  checkpoint_error():
+ *
+ *  Prints an error message, and marks the checkpoint as failed. (Only the
+ *  first error is printed; anything after that is probably a consequence
+ *  of the first error.)
+ */
+void checkpoint_error(struct checkpoint *ckpt, const char *fmt, ...)
+{
+	va_list argp;
+
+	if (ckpt->failed)
+		return;
+
+	ckpt->failed = 1;
+
+	fprintf(stderr, "%s: ", ckpt->filename);
+	va_start(argp, fmt);
+	vfprintf(stderr, fmt, argp);
+	va_end(argp);
+	fprintf(stderr, "\n");
+}
+
+
+/*
+ *  checkpoint_data():
+ *
+ *  Saves or restores len bytes of raw data.
+ */
+void checkpoint_data(struct checkpoint *ckpt, void *data, size_t len)
+{
+	if (ckpt->failed || len == 0)
+		return;
+
+	if (ckpt->restoring) {
+		if (fread(data, 1, len, ckpt->f) != len)
+			checkpoint_error(ckpt, "unexpected end of file");
+	} else {
+		if (fwrite(data, 1, len, ckpt->f) != len)
+			checkpoint_error(ckpt, "write error");
+	}
+}
+
+
+/*
+ *  checkpoint_uint64():
+ *
+ *  Saves or restores a 64-bit value. (See also CHECKPOINT_VAR in
+ *  checkpoint.h.)
+ */
+void checkpoint_uint64(struct checkpoint *ckpt, uint64_t *valuep)
+{
+	unsigned char buf[8];
+	int i;
+
+	if (!ckpt->restoring)
+		for (i=0; i<8; i++)
+			buf[i] = *valuep >> (i * 8);
+
+	checkpoint_data(ckpt, buf, sizeof(buf));
+
+	if (ckpt->restoring && !ckpt->failed) {
+		*valuep = 0;
+		for (i=0; i<8; i++)
+			*valuep |= (uint64_t) buf[i] << (i * 8);
+	}
+}
+
+
+/*
+ *  checkpoint_tag():
+ *
+ *  Saves a tag (a string), or when restoring, checks that the same tag is
+ *  next in the file.
+ */
+void checkpoint_tag(struct checkpoint *ckpt, const char *tag)
+{
+	char buf[CHECKPOINT_MAX_TAG_LEN + 1];
+	uint64_t len = strlen(tag);
+
+	if (len > CHECKPOINT_MAX_TAG_LEN)
+		len = CHECKPOINT_MAX_TAG_LEN;
+
+	if (!ckpt->restoring) {
+		CHECKPOINT_VAR(ckpt, len);
+		checkpoint_data(ckpt, (void *) tag, len);
+		return;
+	}
+
+	CHECKPOINT_VAR(ckpt, len);
+	if (len > CHECKPOINT_MAX_TAG_LEN) {
+		checkpoint_error(ckpt, "bad tag length, when expecting '%s'",
+		    tag);
+		return;
+	}
+
+	checkpoint_data(ckpt, buf, len);
+	buf[len] = '\0';
+
+	if (!ckpt->failed && strncmp(buf, tag, CHECKPOINT_MAX_TAG_LEN) != 0)
+		checkpoint_error(ckpt, "expected '%s', found '%s'", tag, buf);
+}
+
+
+/*
+ *  checkpoint_verify():
+ *
+ *  Saves a value which must be the same when the checkpoint is restored,
+ *  such as the amount of RAM.
+ */
+static void checkpoint_verify(struct checkpoint *ckpt, uint64_t value,
+	const char *what)
+{
+	uint64_t saved = value;
+
+	CHECKPOINT_VAR(ckpt, saved);
+
+	if (!ckpt->failed && saved != value)
+		checkpoint_error(ckpt, "%s does not match (it is %" PRIi64
+		    " in the checkpoint, but %" PRIi64 " now)", what,
+		    (int64_t) saved, (int64_t) value);
+}
+
+
+/*  The length of the page at offset ofs (only the last one may be short):  */
+static uint64_t page_len(uint64_t buflen, uint64_t ofs)
+{
+	return buflen - ofs < CHECKPOINT_PAGE_SIZE?
+	    buflen - ofs : CHECKPOINT_PAGE_SIZE;
+}
+
+
+static int is_zero(const unsigned char *p, size_t len)
+{
+	size_t i;
+
+	for (i=0; i + sizeof(uint64_t) <= len; i += sizeof(uint64_t))
+		if (*(const uint64_t *) (p + i) != 0)
+			return 0;
+
+	for (; i<len; i++)
+		if (p[i] != 0)
+			return 0;
+
+	return 1;
+}
+
+
+/*
+ *  Clears a buffer, but only the pages which are not already zero, so that
+ *  untouched (e.g. mmapped) host pages do not have to be allocated.
+ */
+static void clear_pages(unsigned char *buf, uint64_t buflen)
+{
+	uint64_t ofs;
+
+	for (ofs = 0; ofs < buflen; ofs += page_len(buflen, ofs))
+		if (!is_zero(buf + ofs, page_len(buflen, ofs)))
+			memset(buf + ofs, 0, page_len(buflen, ofs));
+}
+
+
+/*
+ *  checkpoint_sparse_data():
+ *
+ *  Saves or restores a buffer, as runs of pages which are not all zeroes.
+ *  Each run is stored as offset, length and data, and a zero length ends
+ *  the list. When restoring, the rest of the buffer is cleared.
+ */
+static void checkpoint_sparse_data(struct checkpoint *ckpt,
+	unsigned char *buf, uint64_t buflen)
+{
+	uint64_t ofs = 0, len = 0;
+
+	if (ckpt->restoring) {
+		clear_pages(buf, buflen);
+
+		for (;;) {
+			CHECKPOINT_VAR(ckpt, ofs);
+			CHECKPOINT_VAR(ckpt, len);
+			if (ckpt->failed || len == 0)
+				break;
+
+			if (ofs > buflen || len > buflen - ofs) {
+				checkpoint_error(ckpt, "bad data run (offset"
+				    " 0x%" PRIx64", length 0x%" PRIx64")",
+				    ofs, len);
+				break;
+			}
+
+			checkpoint_data(ckpt, buf + ofs, len);
+		}
+
+		return;
+	}
+
+	for (ofs = 0; ofs < buflen; ofs += len) {
+		uint64_t run_ofs = ofs;
+
+		len = page_len(buflen, ofs);
+		if (is_zero(buf + ofs, len))
+			continue;
+
+		while (ofs + len < buflen && !is_zero(buf + ofs + len,
+		    page_len(buflen, ofs + len)))
+			len += page_len(buflen, ofs + len);
+
+		CHECKPOINT_VAR(ckpt, run_ofs);
+		CHECKPOINT_VAR(ckpt, len);
+		checkpoint_data(ckpt, buf + ofs, len);
+	}
+
+	/*  End of list:  */
+	ofs = len = 0;
+	CHECKPOINT_VAR(ckpt, ofs);
+	CHECKPOINT_VAR(ckpt, len);
+}
+
+
+/*
+ *  checkpoint_memory():
+ *
+ *  RAM is saved one memory block at a time (see memory_paddr_to_hostaddr()).
+ *  Blocks which have never been written to are not in the checkpoint, and
+ *  a physical address of 1 << MAX_BITS ends the list of blocks.
+ *
+ *  When restoring, all memory which is not in the checkpoint is cleared.
+ */
+static void checkpoint_memory(struct checkpoint *ckpt, struct memory *mem)
+{
+	const uint64_t blocksize = (uint64_t) 1 << BITS_PER_MEMBLOCK;
+	const uint64_t max_paddr = (uint64_t) 1 << MAX_BITS;
+	uint64_t paddr = 0;
+	unsigned char *p;
+
+	if (ckpt->restoring) {
+		for (paddr = 0; paddr < max_paddr; paddr += blocksize) {
+			p = memory_paddr_to_hostaddr(mem, paddr, MEM_READ);
+			if (p != NULL)
+				clear_pages(p, blocksize);
+		}
+
+		for (;;) {
+			CHECKPOINT_VAR(ckpt, paddr);
+			if (ckpt->failed || paddr == max_paddr)
+				break;
+
+			if (paddr > max_paddr || (paddr & (blocksize - 1))) {
+				checkpoint_error(ckpt, "bad memory block"
+				    " address 0x%" PRIx64, paddr);
+				break;
+			}
+
+			p = memory_paddr_to_hostaddr(mem, paddr, MEM_WRITE);
+			checkpoint_sparse_data(ckpt, p, blocksize);
+		}
+
+		return;
+	}
+
+	for (paddr = 0; paddr < max_paddr && !ckpt->failed;
+	    paddr += blocksize) {
+		uint64_t block_paddr = paddr;
+
+		p = memory_paddr_to_hostaddr(mem, paddr, MEM_READ);
+		if (p == NULL)
+			continue;
+
+		CHECKPOINT_VAR(ckpt, block_paddr);
+		checkpoint_sparse_data(ckpt, p, blocksize);
+	}
+
+	paddr = max_paddr;
+	CHECKPOINT_VAR(ckpt, paddr);
+}
+
+
+/*
+ *  checkpoint_devices():
+ *
+ *  The devices are identified by their names and addresses, which must be
+ *  the same as when the checkpoint was saved. A device's checkpoint function
+ *  is called once per extra pointer, even if the device has registered more
+ *  than one memory range.
+ */
+static void checkpoint_devices(struct checkpoint *ckpt, struct memory *mem)
+{
+	int i, j;
+
+	checkpoint_verify(ckpt, mem->n_mmapped_devices, "number of devices");
+
+	for (i=0; i<mem->n_mmapped_devices && !ckpt->failed; i++) {
+		struct memory_device *dev = &mem->devices[i];
+		int already_done = 0;
+
+		checkpoint_tag(ckpt, dev->name);
+		checkpoint_verify(ckpt, dev->baseaddr, "device base address");
+		checkpoint_verify(ckpt, dev->length, "device length");
+
+		if (dev->dyntrans_data != NULL &&
+		    !(dev->flags & DM_EMULATED_RAM))
+			checkpoint_sparse_data(ckpt, dev->dyntrans_data,
+			    dev->length);
+
+		/*  (Other devices are refused by checkpoint_is_supported.)  */
+		if (dev->checkpoint == NULL)
+			continue;
+
+		for (j=0; j<i; j++)
+			if (mem->devices[j].extra == dev->extra &&
+			    mem->devices[j].checkpoint == dev->checkpoint)
+				already_done = 1;
+
+		if (!already_done)
+			dev->checkpoint(ckpt, dev->extra);
+	}
+}
+
+
+/*
+ *  checkpoint_cpu():
+ *
+ *  Registers which are common to all CPU families are handled here, the
+ *  rest by the CPU family's checkpoint function.
+ */
+static void checkpoint_cpu(struct checkpoint *ckpt, struct cpu *cpu)
+{
+	checkpoint_tag(ckpt, cpu->name);
+
+	CHECKPOINT_VAR(ckpt, cpu->pc);
+	CHECKPOINT_VAR(ckpt, cpu->delay_slot);
+	CHECKPOINT_VAR(ckpt, cpu->running);
+	CHECKPOINT_VAR(ckpt, cpu->is_halted);
+	CHECKPOINT_VAR(ckpt, cpu->ninstrs);
+
+	cpu->checkpoint(cpu, ckpt);
+}
+
+
+static void checkpoint_machine(struct checkpoint *ckpt,
+	struct machine *machine)
+{
+	struct diskimage *d;
+	int i, n_disks = 0;
+
+	checkpoint_tag(ckpt, "machine");
+	checkpoint_verify(ckpt, machine->arch, "architecture");
+	checkpoint_verify(ckpt, machine->machine_type, "machine type");
+	checkpoint_verify(ckpt, machine->machine_subtype, "machine subtype");
+	checkpoint_verify(ckpt, machine->ncpus, "number of CPUs");
+	checkpoint_verify(ckpt, machine->physical_ram_in_mb, "amount of RAM");
+
+	for (i=0; i<machine->ncpus; i++)
+		checkpoint_cpu(ckpt, machine->cpus[i]);
+
+	checkpoint_tag(ckpt, "memory");
+	checkpoint_memory(ckpt, machine->memory);
+
+	checkpoint_tag(ckpt, "devices");
+	checkpoint_devices(ckpt, machine->memory);
+
+	checkpoint_tag(ckpt, "events");
+	machine_events_checkpoint(machine, ckpt);
+
+	checkpoint_tag(ckpt, "disks");
+	for (d = machine->first_diskimage; d != NULL; d = d->next)
+		n_disks ++;
+	checkpoint_verify(ckpt, n_disks, "number of disk images");
+
+	for (d = machine->first_diskimage; d != NULL && !ckpt->failed;
+	    d = d->next)
+		diskimage_checkpoint(d, ckpt);
+
+	if (!ckpt->restoring)
+		return;
+
+	/*  Translations are rebuilt from the restored state, when needed:  */
+	for (i=0; i<machine->ncpus; i++) {
+		struct cpu *cpu = machine->cpus[i];
+
+		if (cpu->translation_cache != NULL) {
+			cpu_create_or_reset_tc(cpu);
+			cpu->invalidate_translation_caches(cpu, 0,
+			    INVALIDATE_ALL);
+		}
+	}
+}
+
+
+static void checkpoint_emul(struct checkpoint *ckpt, struct emul *emul)
+{
+	char magic[sizeof(CHECKPOINT_MAGIC)];
+	int i;
+
+	memcpy(magic, CHECKPOINT_MAGIC, sizeof(magic));
+	checkpoint_data(ckpt, magic, sizeof(magic) - 1);
+	if (!ckpt->failed && memcmp(magic, CHECKPOINT_MAGIC,
+	    sizeof(magic) - 1) != 0) {
+		checkpoint_error(ckpt, "not a GXemul checkpoint file");
+		return;
+	}
+
+	checkpoint_verify(ckpt, CHECKPOINT_VERSION, "checkpoint version");
+	checkpoint_verify(ckpt, emul->n_machines, "number of machines");
+
+	for (i=0; i<emul->n_machines && !ckpt->failed; i++)
+		checkpoint_machine(ckpt, emul->machines[i]);
+
+	checkpoint_tag(ckpt, "end");
+}
+
+
+/*
+ *  checkpoint_is_supported():
+ *
+ *  Returns 1 if the whole state of the emulation can be saved, 0 (after
+ *  printing why) otherwise. Every CPU needs a checkpoint function, and so
+ *  does every device, unless all of its state is in memory which dyntrans
+ *  accesses directly. Resuming only part of a machine's state would let the
+ *  guest continue with stale device state, so that is refused too.
+ */
+static int checkpoint_is_supported(struct emul *emul)
+{
+	int i, j, supported = 1;
+
+	for (i=0; i<emul->n_machines; i++) {
+		struct machine *machine = emul->machines[i];
+		struct memory *mem = machine->memory;
+
+		for (j=0; j<machine->ncpus; j++)
+			if (machine->cpus[j]->checkpoint == NULL) {
+				fprintf(stderr, "Checkpoints are not supported"
+				    " for %s CPUs yet.\n",
+				    machine->cpus[j]->name);
+				return 0;
+			}
+
+		for (j=0; j<mem->n_mmapped_devices; j++) {
+			struct memory_device *dev = &mem->devices[j];
+
+			if (dev->checkpoint != NULL ||
+			    dev->dyntrans_data != NULL)
+				continue;
+
+			fprintf(stderr, "Checkpoints are not supported for"
+			    " the '%s' device yet.\n", dev->name);
+			supported = 0;
+		}
+	}
+
+	return supported;
+}
+
+
+/*
+ *  checkpoint_save():
+ *
+ *  Saves the state of all machines in an emulation to a file. Returns 1 on
+ *  success, 0 on failure (in which case the file is removed).
+ */
+int checkpoint_save(struct emul *emul, const char *filename)
+{
+	struct checkpoint ckpt;
+
+	if (!checkpoint_is_supported(emul))
+		return 0;
+
+	/*  Writes which are still in progress must be part of the disks:  */
+	diskimage_async_drain();
+
+	memset(&ckpt, 0, sizeof(ckpt));
+	ckpt.filename = filename;
+	ckpt.f = fopen(filename, "wb");
+	if (ckpt.f == NULL) {
+		perror(filename);
+		return 0;
+	}
+
+	checkpoint_emul(&ckpt, emul);
+
+	if (fclose(ckpt.f) != 0)
+		checkpoint_error(&ckpt, "write error");
+
+	if (ckpt.failed) {
+		unlink(filename);
+		return 0;
+	}
+
+	return 1;
+}
+
+
+/*
+ *  checkpoint_restore():
+ *
+ *  Restores the state of all machines in an emulation from a checkpoint
+ *  file. The emulation must have been set up in the same way as the one
+ *  which the checkpoint was saved from. Returns 1 on success, 0 on failure
+ *  (in which case the state of the emulation is undefined).
+ */
+int checkpoint_restore(struct emul *emul, const char *filename)
+{
+	struct checkpoint ckpt;
+
+	if (!checkpoint_is_supported(emul))
+		return 0;
+
+	diskimage_async_drain();
+
+	memset(&ckpt, 0, sizeof(ckpt));
+	ckpt.filename = filename;
+	ckpt.restoring = 1;
+	ckpt.f = fopen(filename, "rb");
+	if (ckpt.f == NULL) {
+		perror(filename);
+		return 0;
+	}
+
+	checkpoint_emul(&ckpt, emul);
+
+	fclose(ckpt.f);
+
+	return !ckpt.failed;
+}
+
@@ -28,6 +28,7 @@
  *  LEGACY emulation startup and misc. routines.
  */
 
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -35,6 +36,7 @@
 #include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #include "arcbios.h"
 #include "cpu.h"
@@ -152,6 +154,9 @@ struct emul *emul_new(char *name)
 	settings_add(e->settings, "n_machines", 0,
 	    SETTINGS_TYPE_INT, SETTINGS_FORMAT_DECIMAL,
 	    (void *) &e->n_machines);
+	settings_add(e->settings, "parallel_machines", 0,
+	    SETTINGS_TYPE_INT, SETTINGS_FORMAT_YESNO,
+	    (void *) &e->parallel_machines);
 
 	/*  TODO: More settings?  */
 
@@ -355,7 +360,7 @@ void emul_machine_setup(struct machine *m, int n_load, char **load_names,
 	int n_devices, char **device_names)
 {
 	struct cpu *cpu;
-	int i, iadd = DEBUG_INDENTATION;
+	int i, iadd = DEBUG_INDENTATION, ram_size_from_file = 0;
 	uint64_t memory_amount, entrypoint = 0, gp = 0, toc = 0;
 	int byte_order;
 
@@ -376,8 +381,21 @@ void emul_machine_setup(struct machine *m, int n_load, char **load_names,
 	if (m->arch == ARCH_ALPHA)
 		m->arch_pagesize = 8192;
 
+	/*  RAM backed by an existing file: default to the file's size.  */
+	if (m->ram_filename != NULL && m->physical_ram_in_mb == 0) {
+		struct stat st;
+		if (stat(m->ram_filename, &st) == 0 && st.st_size > 0)
+			ram_size_from_file = (st.st_size + 1048575) / 1048576;
+		m->physical_ram_in_mb = ram_size_from_file;
+	}
+
 	machine_memsize_fix(m);
 
+	/*  (The file also contains the memory offset, see below.)  */
+	if (ram_size_from_file > m->memory_offset_in_mb &&
+	    m->memory_offset_in_mb > 0)
+		m->physical_ram_in_mb -= m->memory_offset_in_mb;
+
 	/*
 	 *  Create the system's memory:
 	 */
@@ -393,6 +411,14 @@ void emul_machine_setup(struct machine *m, int n_load, char **load_names,
 		memory_amount += 1048576 * m->memory_offset_in_mb;
 	}
 	m->memory = memory_new(memory_amount, m->arch);
+	if (m->ram_filename != NULL || m->ram_hugepages) {
+		debug(", %s%s", m->ram_hugepages? "huge pages" : "contiguous",
+		    m->ram_filename != NULL? ", file: " : "");
+		if (m->ram_filename != NULL)
+			debug("%s", m->ram_filename);
+		memory_map_ram(m->memory, memory_amount, m->ram_filename,
+		    m->ram_hugepages);
+	}
 	debug("\n");
 
 	/*  Create CPUs:  */
@@ -773,6 +799,179 @@ struct emul *emul_create_from_configfile(char *fname)
 }
 
 
+/*
+ *  Parallel machines:
+ *
+ *  When emul->parallel_machines is set, each machine runs on its own host
+ *  thread. The main thread and the workers take turns: the workers run a
+ *  slice of EMUL_PARALLEL_SLICE quanta (or less, if the debugger is about
+ *  to be entered), and then park while the main thread handles X11 events,
+ *  console flushing, and the debugger. Machines only interact with each
+ *  other through the (locked) net and console subsystems during a slice.
+ */
+#define	EMUL_PARALLEL_SLICE	64
+
+struct emul_parallel_worker {
+	struct emul_parallel	*ep;
+	struct machine		*machine;
+	pthread_t		thread;
+	int			anything;	/*  still running?  */
+};
+
+struct emul_parallel {
+	pthread_mutex_t		mutex;
+	pthread_cond_t		start_cond;
+	pthread_cond_t		done_cond;
+	uint64_t		generation;
+	int			n_busy;
+	int			shutdown;
+
+	int			n_workers;
+	struct emul_parallel_worker *workers;
+};
+
+
+/*
+ *  emul_parallel_worker_thread():
+ *
+ *  Host thread main loop for one machine.
+ */
+static void *emul_parallel_worker_thread(void *arg)
+{
+	struct emul_parallel_worker *w = (struct emul_parallel_worker *) arg;
+	struct emul_parallel *ep = w->ep;
+	uint64_t generation = 0;
+	sigset_t sigs;
+	int q;
+
+	/*  Signals (CTRL-C) are handled by the main thread:  */
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGINT);
+	sigaddset(&sigs, SIGCONT);
+	pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+
+	for (;;) {
+		pthread_mutex_lock(&ep->mutex);
+		while (ep->generation == generation && !ep->shutdown)
+			pthread_cond_wait(&ep->start_cond, &ep->mutex);
+		if (ep->shutdown) {
+			pthread_mutex_unlock(&ep->mutex);
+			break;
+		}
+		generation = ep->generation;
+		pthread_mutex_unlock(&ep->mutex);
+
+		for (q=0; q<EMUL_PARALLEL_SLICE; q++) {
+			w->anything = machine_run(w->machine);
+			if (!w->anything || single_step)
+				break;
+		}
+
+		pthread_mutex_lock(&ep->mutex);
+		if (--ep->n_busy == 0)
+			pthread_cond_signal(&ep->done_cond);
+		pthread_mutex_unlock(&ep->mutex);
+	}
+
+	return NULL;
+}
+
+
+/*
+ *  emul_parallel_start():
+ *
+ *  Start one host thread per machine.
+ */
+static struct emul_parallel *emul_parallel_start(struct emul *emul)
+{
+	struct emul_parallel *ep;
+	int j;
+
+	CHECK_ALLOCATION(ep = (struct emul_parallel *)
+	    malloc(sizeof(struct emul_parallel)));
+	memset(ep, 0, sizeof(struct emul_parallel));
+
+	pthread_mutex_init(&ep->mutex, NULL);
+	pthread_cond_init(&ep->start_cond, NULL);
+	pthread_cond_init(&ep->done_cond, NULL);
+
+	ep->n_workers = emul->n_machines;
+	CHECK_ALLOCATION(ep->workers = (struct emul_parallel_worker *)
+	    malloc(sizeof(struct emul_parallel_worker) * ep->n_workers));
+	memset(ep->workers, 0, sizeof(struct emul_parallel_worker)
+	    * ep->n_workers);
+
+	for (j=0; j<ep->n_workers; j++) {
+		struct emul_parallel_worker *w = &ep->workers[j];
+
+		w->ep = ep;
+		w->machine = emul->machines[j];
+		w->anything = 1;
+
+		if (pthread_create(&w->thread, NULL,
+		    emul_parallel_worker_thread, w) != 0) {
+			perror("pthread_create");
+			exit(1);
+		}
+	}
+
+	debug("[ running %i machines on separate host threads ]\n",
+	    ep->n_workers);
+
+	return ep;
+}
+
+
+/*
+ *  emul_parallel_run_slice():
+ *
+ *  Let all machines run one slice in parallel, and wait for them to finish.
+ *  Returns 1 if any machine is still running, 0 otherwise.
+ */
+static int emul_parallel_run_slice(struct emul_parallel *ep)
+{
+	int j, anything = 0;
+
+	pthread_mutex_lock(&ep->mutex);
+	ep->n_busy = ep->n_workers;
+	ep->generation ++;
+	pthread_cond_broadcast(&ep->start_cond);
+
+	while (ep->n_busy > 0)
+		pthread_cond_wait(&ep->done_cond, &ep->mutex);
+	pthread_mutex_unlock(&ep->mutex);
+
+	for (j=0; j<ep->n_workers; j++)
+		if (ep->workers[j].anything)
+			anything = 1;
+
+	return anything;
+}
+
+
+/*
+ *  emul_parallel_stop():
+ */
+static void emul_parallel_stop(struct emul_parallel *ep)
+{
+	int j;
+
+	pthread_mutex_lock(&ep->mutex);
+	ep->shutdown = 1;
+	pthread_cond_broadcast(&ep->start_cond);
+	pthread_mutex_unlock(&ep->mutex);
+
+	for (j=0; j<ep->n_workers; j++)
+		pthread_join(ep->workers[j].thread, NULL);
+
+	pthread_cond_destroy(&ep->done_cond);
+	pthread_cond_destroy(&ep->start_cond);
+	pthread_mutex_destroy(&ep->mutex);
+	free(ep->workers);
+	free(ep);
+}
+
+
 /*
  *  emul_run():
  *
@@ -784,6 +983,7 @@ struct emul *emul_create_from_configfile(char *fname)
  */
 void emul_run(struct emul *emul)
 {
+	struct emul_parallel *ep = NULL;
 	int i = 0, j, go = 1, n, anything;
 
 	atexit(fix_console);
@@ -861,6 +1061,12 @@ void emul_run(struct emul *emul)
 
 		go = 0;
 
+		/*  Deliver emulated clock ticks which are due:  */
+		timer_poll();
+
+		/*  Notify controllers of completed asynchronous disk I/O:  */
+		diskimage_async_poll();
+
 		/*  Flush X11 and serial console output every now and then:  */
 		if (bootcpu->ninstrs > bootcpu->ninstrs_flush + (1<<19)) {
 			x11_check_event(emul);
@@ -891,6 +1097,16 @@ void emul_run(struct emul *emul)
 		if (single_step == SINGLE_STEPPING)
 			debugger();
 
+		/*  Single-stepping is always done on the main thread.  */
+		if (emul->parallel_machines && emul->n_machines > 1 &&
+		    !single_step) {
+			if (ep == NULL)
+				ep = emul_parallel_start(emul);
+
+			go = emul_parallel_run_slice(ep);
+			continue;
+		}
+
 		for (j=0; j<emul->n_machines; j++) {
 			anything = machine_run(emul->machines[j]);
 			if (anything)
@@ -898,9 +1114,16 @@ void emul_run(struct emul *emul)
 		}
 	}
 
+	if (ep != NULL)
+		emul_parallel_stop(ep);
+
 	/*  Stop any running timers:  */
 	timer_stop();
 
+	/*  Let outstanding disk transfers finish:  */
+	diskimage_async_drain();
+	diskimage_cache_flush_all();
+
 	/*  Deinitialize all CPUs in all machines:  */
 	for (j=0; j<emul->n_machines; j++)
 		cpu_run_deinit(emul->machines[j]);
@@ -204,6 +204,9 @@ static char cur_net_local_port[10];
 #define	MAX_REMOTE_LEN		100
 static char *cur_net_remote[MAX_N_REMOTE];
 static int cur_net_n_remote;
+#define	MAX_N_TCP_FORWARD	20
+static char *cur_net_tcp_forward[MAX_N_TCP_FORWARD];
+static int cur_net_n_tcp_forward;
 
 static char cur_machine_name[50];
 static char cur_machine_cpu[50];
@@ -221,6 +224,7 @@ static char cur_machine_random_cpu[10];
 static char cur_machine_force_netboot[10];
 static char cur_machine_start_paused[10];
 static char cur_machine_ncpus[10];
+static char cur_machine_threaded_smp[10];
 static char cur_machine_n_gfx_cards[10];
 static char cur_machine_serial_nr[10];
 static char cur_machine_emulated_hz[10];
@@ -283,7 +287,7 @@ int parse_on_off(char *s)
 /*
  *  parse__emul():
  *
- *  name, net, machine
+ *  name, parallel_machines, net, machine
  */
 static void parse__emul(struct emul *e, FILE *f, int *in_emul, int *line,
 	int *parsestate, char *word, size_t maxbuflen)
@@ -309,6 +313,19 @@ static void parse__emul(struct emul *e, FILE *f, int *in_emul, int *line,
 		return;
 	}
 
+	if (strcmp(word, "parallel_machines") == 0) {
+		char tmp[10];
+		read_one_word(f, word, maxbuflen,
+		    line, EXPECT_LEFT_PARENTHESIS);
+		read_one_word(f, tmp, sizeof(tmp), line, EXPECT_WORD);
+		read_one_word(f, word, maxbuflen,
+		    line, EXPECT_RIGHT_PARENTHESIS);
+		e->parallel_machines = parse_on_off(tmp);
+		debug("parallel_machines: %s\n",
+		    e->parallel_machines? "yes" : "no");
+		return;
+	}
+
 	if (strcmp(word, "net") == 0) {
 		*parsestate = PARSESTATE_NET;
 		read_one_word(f, word, maxbuflen,
@@ -321,6 +338,7 @@ static void parse__emul(struct emul *e, FILE *f, int *in_emul, int *line,
 		    NET_DEFAULT_IPV4_LEN);
 		strlcpy(cur_net_local_port, "", sizeof(cur_net_local_port));
 		cur_net_n_remote = 0;
+		cur_net_n_tcp_forward = 0;
 		return;
 	}
 
@@ -350,6 +368,7 @@ static void parse__emul(struct emul *e, FILE *f, int *in_emul, int *line,
 		cur_machine_force_netboot[0] = '\0';
 		cur_machine_start_paused[0] = '\0';
 		cur_machine_ncpus[0] = '\0';
+		cur_machine_threaded_smp[0] = '\0';
 		cur_machine_n_gfx_cards[0] = '\0';
 		cur_machine_serial_nr[0] = '\0';
 		cur_machine_emulated_hz[0] = '\0';
@@ -368,7 +387,7 @@ static void parse__emul(struct emul *e, FILE *f, int *in_emul, int *line,
  *
  *  Simple words: ipv4net, ipv4len, local_port
  *
- *  Complex: add_remote
+ *  Complex: add_remote, forward_tcp
  *
  *  TODO: more words? for example an option to disable the gateway? that would
  *  have to be implemented correctly in src/net.c first.
@@ -406,6 +425,12 @@ static void parse__net(struct emul *e, FILE *f, int *in_emul, int *line,
 			cur_net_remote[i] = NULL;
 		}
 
+		for (i=0; i<cur_net_n_tcp_forward; i++) {
+			net_tcp_forward_add(e->net, cur_net_tcp_forward[i]);
+			free(cur_net_tcp_forward[i]);
+			cur_net_tcp_forward[i] = NULL;
+		}
+
 		*parsestate = PARSESTATE_EMUL;
 		return;
 	}
@@ -432,6 +457,24 @@ static void parse__net(struct emul *e, FILE *f, int *in_emul, int *line,
 		return;
 	}
 
+	if (strcmp(word, "forward_tcp") == 0) {
+		read_one_word(f, word, maxbuflen,
+		    line, EXPECT_LEFT_PARENTHESIS);
+		if (cur_net_n_tcp_forward >= MAX_N_TCP_FORWARD) {
+			fprintf(stderr, "too many forwarded TCP ports\n");
+			exit(1);
+		}
+
+		CHECK_ALLOCATION(cur_net_tcp_forward[cur_net_n_tcp_forward] =
+		    (char *) malloc(MAX_REMOTE_LEN));
+		read_one_word(f, cur_net_tcp_forward[cur_net_n_tcp_forward],
+		    MAX_REMOTE_LEN, line, EXPECT_WORD);
+		cur_net_n_tcp_forward ++;
+		read_one_word(f, word, maxbuflen, line,
+		    EXPECT_RIGHT_PARENTHESIS);
+		return;
+	}
+
 	fatal("line %i: not expecting '%s' in a 'net' section\n", *line, word);
 	exit(1);
 }
@@ -521,6 +564,11 @@ static void parse__machine(struct emul *e, FILE *f, int *in_emul, int *line,
 			    sizeof(cur_machine_ncpus));
 		m->ncpus = atoi(cur_machine_ncpus);
 
+		if (!cur_machine_threaded_smp[0])
+			strlcpy(cur_machine_threaded_smp, "no",
+			    sizeof(cur_machine_threaded_smp));
+		m->threaded_smp = parse_on_off(cur_machine_threaded_smp);
+
 		if (cur_machine_n_gfx_cards[0])
 			m->n_gfx_cards = atoi(cur_machine_n_gfx_cards);
 
@@ -611,6 +659,7 @@ static void parse__machine(struct emul *e, FILE *f, int *in_emul, int *line,
 	WORD("use_random_bootstrap_cpu", cur_machine_random_cpu);
 	WORD("force_netboot", cur_machine_force_netboot);
 	WORD("ncpus", cur_machine_ncpus);
+	WORD("threaded_smp", cur_machine_threaded_smp);
 	WORD("serial_nr", cur_machine_serial_nr);
 	WORD("n_gfx_cards", cur_machine_n_gfx_cards);
 	WORD("emulated_hz", cur_machine_emulated_hz);
@@ -35,6 +35,7 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "checkpoint.h"
 #include "ComponentFactory.h"
 #include "console.h"
 #include "cpu.h"
@@ -45,6 +46,7 @@
 #include "GXemul.h"
 #include "machine.h"
 #include "misc.h"
+#include "net.h"
 #include "settings.h"
 #include "timer.h"
 #include "UnitTest.h"
@@ -64,6 +66,9 @@ char *progname;
 
 size_t dyntrans_cache_size = DEFAULT_DYNTRANS_CACHE_SIZE;
 static int skip_srandom_call = 0;
+static char *checkpoint_to_restore = NULL;
+static char **tcp_forwards = NULL;
+static int n_tcp_forwards = 0;
 
 
 /*****************************************************************************
@@ -275,9 +280,13 @@ static void usage(int longusage)
 	printf("  -d fname  add fname as a disk image. You can add \"xxx:\""
 	    " as a prefix\n");
 	printf("            where xxx is one or more of the following:\n");
+	printf("                a      asynchronous I/O (for controllers"
+	    " which support it)\n");
 	printf("                b      specifies that this is the boot"
 	    " device\n");
 	printf("                c      CD-ROM\n");
+	printf("                CKB;   block cache size in KB (default %i,"
+	    " 0 = no cache)\n", DISKIMAGE_CACHE_DEFAULT_KB);
 	printf("                d      DISK\n");
 	printf("                f      FLOPPY\n");
 	printf("                gH;S;  set geometry to H heads and S"
@@ -290,6 +299,7 @@ static void usage(int longusage)
 	printf("                s      SCSI\n");
 	printf("                t      tape\n");
 	printf("                V      add an overlay\n");
+	printf("                W      write-back block cache\n");
 	printf("                0-7    force a specific ID\n");
 	printf("  -I hz     set the main cpu frequency to hz (not used by "
 	    "all combinations\n            of machines and guest OSes)\n");
@@ -306,6 +316,10 @@ static void usage(int longusage)
 	    " ISO9660\n            filesystem, -j sets the name of the"
 	    " kernel to load.\n");
 	printf("  -M m      emulate m MBs of physical RAM\n");
+	printf("  -M huge   use one contiguous host mapping for RAM, with"
+	    " huge pages\n");
+	printf("  -M file:path   back RAM with a (shared) file; the default"
+	    " RAM size is\n            the size of the file\n");
 	printf("  -N        display nr of instructions/second average, at"
 	    " regular intervals\n");
 	printf("  -n nr     set nr of CPUs (for SMP experiments)\n");
@@ -315,6 +329,7 @@ static void usage(int longusage)
 	printf("  -o arg    set the boot argument, for DEC, ARC, or SGI"
 	    " emulation\n");
 	printf("            (default arg for DEC is -a, for ARC/SGI -aN)\n");
+	printf("  -P        run each emulated CPU on its own host thread (SMP)\n");
 	printf("  -p pc     add a breakpoint (remember to use the '0x' "
 	    "prefix for hex!)\n");
 	printf("  -Q        no built-in PROM emulation  (use this for "
@@ -353,6 +368,9 @@ static void usage(int longusage)
 	printf("  -c cmd    add cmd as a command to run before starting "
 	    "the simulation\n");
 	printf("  -D        skip the srandom call at startup\n");
+	printf("  -F p:a:q  forward incoming TCP connections on host port p"
+	    " to port q of\n            the guest OS at address a (e.g."
+	    " -F 2323:10.0.0.1:23)\n");
 	printf("  -H        display a list of possible CPU and "
 	    "machine types\n");
 	printf("  -h        display this help message\n");
@@ -360,6 +378,9 @@ static void usage(int longusage)
 	    " size is %i MB)\n", DEFAULT_DYNTRANS_CACHE_SIZE / 1048576);
 	printf("  -K        force the debugger to be entered at the end "
 	    "of a simulation\n");
+	printf("  -L file   resume from a checkpoint file (saved with the "
+	    "debugger command\n            'writecheckpoint', using the same"
+	    " machine setup)\n");
 	printf("  -q        quiet mode (don't print startup messages)\n");
 	printf("  -V        start up in the single-step debugger, paused\n");
 	printf("  -v        increase debug message verbosity\n");
@@ -399,7 +420,7 @@ int get_cmd_args(int argc, char *argv[], struct emul *emul,
 	struct machine *m = emul_add_machine(emul, NULL);
 
 	const char *opts =
-	    "BC:c:Dd:E:e:HhI:iJj:k:KM:Nn:Oo:p:QqRrSs:TtUVvW:"
+	    "BC:c:Dd:E:e:F:HhI:iJj:k:KL:M:Nn:Oo:Pp:QqRrSs:TtUVvW:"
 #ifdef WITH_X11
 	    "XxY:"
 #endif
@@ -452,6 +473,12 @@ int get_cmd_args(int argc, char *argv[], struct emul *emul,
 			subtype = optarg;
 			msopts = 1;
 			break;
+		case 'F':
+			CHECK_ALLOCATION(tcp_forwards = (char **) realloc(
+			    tcp_forwards, sizeof(char *) * (n_tcp_forwards+1)));
+			CHECK_ALLOCATION(tcp_forwards[n_tcp_forwards ++] =
+			    strdup(optarg));
+			break;
 		case 'H':
 			GXemul::ListTemplates();
 			printf("--------------------------------------------------------------------------\n\n");
@@ -489,8 +516,20 @@ int get_cmd_args(int argc, char *argv[], struct emul *emul,
 		case 'K':
 			force_debugger_at_exit = 1;
 			break;
+		case 'L':
+			CHECK_ALLOCATION(checkpoint_to_restore =
+			    strdup(optarg));
+			break;
 		case 'M':
-			m->physical_ram_in_mb = atoi(optarg);
+			if (strncmp(optarg, "file:", 5) == 0) {
+				if (m->ram_filename != NULL)
+					free(m->ram_filename);
+				CHECK_ALLOCATION(m->ram_filename =
+				    strdup(optarg + 5));
+			} else if (strcmp(optarg, "huge") == 0)
+				m->ram_hugepages = 1;
+			else
+				m->physical_ram_in_mb = atoi(optarg);
 			msopts = 1;
 			break;
 		case 'N':
@@ -511,6 +550,10 @@ int get_cmd_args(int argc, char *argv[], struct emul *emul,
 			    strdup(optarg));
 			msopts = 1;
 			break;
+		case 'P':
+			m->threaded_smp = 1;
+			msopts = 1;
+			break;
 		case 'p':
 			machine_add_breakpoint_string(m, optarg);
 			msopts = 1;
@@ -911,6 +954,25 @@ int main(int argc, char *argv[])
 		exit(1);
 	}
 
+	for (i=0; i<n_tcp_forwards; i++) {
+		if (emul->net == NULL) {
+			fprintf(stderr, "-F can only be used when there is"
+			    " a network.\n");
+			exit(1);
+		}
+		net_tcp_forward_add(emul->net, tcp_forwards[i]);
+	}
+
+	if (checkpoint_to_restore != NULL) {
+		if (!checkpoint_restore(emul, checkpoint_to_restore)) {
+			fprintf(stderr, "Could not resume from checkpoint"
+			    " %s.\n", checkpoint_to_restore);
+			exit(1);
+		}
+
+		debug("resuming from checkpoint %s\n", checkpoint_to_restore);
+	}
+
 	device_set_exit_on_error(0);
 	console_warn_if_slaves_are_needed(1);
 
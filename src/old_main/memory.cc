@@ -28,11 +28,15 @@
  *  Functions for handling the memory of an emulated machine.
  */
 
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "cpu.h"
 #include "machine.h"
@@ -43,6 +47,9 @@
 extern int verbose;
 extern int quiet_mode;
 
+/*  Protects memblock allocation, when CPUs run on several host threads:  */
+static pthread_mutex_t memblock_alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+
 
 /*
  *  memory_readmax64():
@@ -137,6 +144,101 @@ void *zeroed_alloc(size_t s)
 }
 
 
+/*
+ *  memory_device_index_clear():
+ *
+ *  Invalidates all entries in the device page index. Must be called whenever
+ *  the devices array changes.
+ */
+static void memory_device_index_clear(struct memory *mem)
+{
+	int i;
+
+	for (i=0; i<N_MEMORY_DEVICE_INDEX_ENTRIES; i++) {
+		mem->device_index[i].page = (uint64_t) -1;
+		mem->device_index[i].device = MEMORY_DEVICE_INDEX_NONE;
+		mem->device_index[i].partial = 0;
+	}
+}
+
+
+/*
+ *  memory_device_find_first():
+ *
+ *  Binary search for the first device which ends after addr. (The devices
+ *  array is sorted and non-overlapping, so endaddr is sorted too.) Returns
+ *  n_mmapped_devices if there is no such device.
+ */
+static int memory_device_find_first(struct memory *mem, uint64_t addr)
+{
+	int start = 0, end = mem->n_mmapped_devices;
+
+	while (start < end) {
+		int i = (start + end) >> 1;
+		if (mem->devices[i].endaddr <= addr)
+			start = i + 1;
+		else
+			end = i;
+	}
+
+	return start;
+}
+
+
+/*
+ *  memory_device_lookup():
+ *
+ *  Returns the index of the device at physical address paddr, or -1 if there
+ *  is no device there. *page_is_mixed is set to 1 if the page containing
+ *  paddr is only partially covered by devices (i.e. it also contains RAM, or
+ *  more than one device), otherwise it is set to 0.
+ */
+int memory_device_lookup(struct memory *mem, uint64_t paddr,
+	int *page_is_mixed)
+{
+	uint64_t page = paddr >> mem->device_index_shift;
+	struct memory_device_index_entry *e = &mem->device_index[
+	    page & (N_MEMORY_DEVICE_INDEX_ENTRIES - 1)];
+	int i;
+
+	if (e->page != page) {
+		uint64_t first = page << mem->device_index_shift;
+		uint64_t last = first | ((1 << mem->device_index_shift) - 1);
+
+		i = memory_device_find_first(mem, first);
+
+		e->page = page;
+		if (i >= mem->n_mmapped_devices ||
+		    mem->devices[i].baseaddr > last) {
+			e->device = MEMORY_DEVICE_INDEX_NONE;
+			e->partial = 0;
+		} else if (i + 1 < mem->n_mmapped_devices &&
+		    mem->devices[i+1].baseaddr <= last) {
+			e->device = MEMORY_DEVICE_INDEX_MULTIPLE;
+			e->partial = 1;
+		} else {
+			e->device = i;
+			e->partial = mem->devices[i].baseaddr > first ||
+			    mem->devices[i].endaddr - 1 < last;
+		}
+	}
+
+	*page_is_mixed = e->partial;
+	i = e->device;
+
+	if (i == MEMORY_DEVICE_INDEX_MULTIPLE) {
+		i = memory_device_find_first(mem, paddr);
+		if (i >= mem->n_mmapped_devices ||
+		    paddr < mem->devices[i].baseaddr)
+			i = -1;
+	} else if (i >= 0 && e->partial && (paddr < mem->devices[i].baseaddr
+	    || paddr >= mem->devices[i].endaddr))
+		i = -1;
+
+	return i;
+}
+
+
 /*
  *  memory_new():
  *
@@ -177,10 +279,124 @@ struct memory *memory_new(uint64_t physical_max, int arch)
 	mem->mmap_dev_minaddr = 0xffffffffffffffffULL;
 	mem->mmap_dev_maxaddr = 0;
 
+	/*  The device index uses the same page size as dyntrans:  */
+	mem->device_index_shift = arch == ARCH_ALPHA? 13 : 12;
+	CHECK_ALLOCATION(mem->device_index = (struct memory_device_index_entry *)
+	    malloc(sizeof(struct memory_device_index_entry) *
+	    N_MEMORY_DEVICE_INDEX_ENTRIES));
+	memory_device_index_clear(mem);
+
 	return mem;
 }
 
 
+/*
+ *  memory_map_ram():
+ *
+ *  Backs the first len bytes of the physical address space with one
+ *  contiguous host mapping, instead of memblocks allocated on demand.
+ *  Translating a physical address in this range is then just an addition
+ *  (see memory_paddr_to_hostaddr()).
+ *
+ *  If filename is non-NULL, the file is mapped shared, so that the RAM
+ *  contents are read from the file and written back to it. The file is
+ *  created, or extended with zeroes, if it is smaller than len. Otherwise,
+ *  anonymous memory is used, aligned for huge pages if hugepages is set.
+ *  With hugepages set, the host kernel is also asked to use huge pages for
+ *  the mapping (where supported), which reduces host TLB misses.
+ *
+ *  Must be called before anything has been written to the memory.
+ */
+void memory_map_ram(struct memory *mem, uint64_t len, const char *filename,
+	int hugepages)
+{
+	const uint64_t blocksize = (uint64_t) 1 << BITS_PER_MEMBLOCK;
+	const int shrcount = MAX_BITS - BITS_PER_PAGETABLE;
+	const size_t hugepage_align = 2 * 1048576;
+	void **table = (void **) mem->pagetable;
+	unsigned char *p;
+	uint64_t i;
+
+	/*  Whole memblocks, so that the pagetable can point into the RAM:  */
+	len = (len + blocksize - 1) & ~(blocksize - 1);
+	if (len == 0 || len > ((uint64_t) 1 << MAX_BITS) ||
+	    len != (size_t) len) {
+		fatal("memory_map_ram(): bad RAM size 0x%" PRIx64"\n", len);
+		exit(1);
+	}
+
+	if (filename != NULL) {
+		struct stat st;
+		int fd = open(filename, O_RDWR | O_CREAT, 0666);
+
+		if (fd < 0 || fstat(fd, &st) != 0) {
+			perror(filename);
+			exit(1);
+		}
+
+		if ((uint64_t) st.st_size < len && ftruncate(fd, len) != 0) {
+			perror(filename);
+			exit(1);
+		}
+
+		p = (unsigned char *) mmap(NULL, len, PROT_READ | PROT_WRITE,
+		    MAP_SHARED, fd, 0);
+
+		/*  The mapping stays valid after the file is closed.  */
+		close(fd);
+	} else {
+		size_t extra = hugepages? hugepage_align : 0;
+
+		p = (unsigned char *) mmap(NULL, len + extra, PROT_READ |
+		    PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+
+		/*  Trim the mapping, so that it starts on a huge page:  */
+		if (p != MAP_FAILED && extra > 0) {
+			size_t skip = (hugepage_align - ((size_t) p &
+			    (hugepage_align - 1))) & (hugepage_align - 1);
+			if (skip > 0)
+				munmap(p, skip);
+			if (extra - skip > 0)
+				munmap(p + skip + len, extra - skip);
+			p += skip;
+		}
+	}
+
+	if (p == MAP_FAILED || p == NULL) {
+		fatal("memory_map_ram(): could not map %" PRIu64" MB of RAM",
+		    len >> 20);
+		if (filename != NULL)
+			fatal(" from %s", filename);
+		fatal("\n");
+		exit(1);
+	}
+
+	if (hugepages) {
+#ifdef MADV_HUGEPAGE
+		if (madvise(p, len, MADV_HUGEPAGE) != 0)
+			debug("[ memory_map_ram(): huge pages not"
+			    " available ]\n");
+#else
+		debug("[ memory_map_ram(): huge pages are not supported"
+		    " on this host ]\n");
+#endif
+	}
+
+	for (i = 0; i < len; i += blocksize) {
+		if (table[i >> shrcount] != NULL) {
+			fatal("memory_map_ram(): memory has already been"
+			    " written to\n");
+			exit(1);
+		}
+
+		table[i >> shrcount] = p + i;
+	}
+
+	mem->ram_base = p;
+	mem->ram_len = len;
+}
+
+
 /*
  *  memory_points_to_string():
  *
@@ -443,6 +659,7 @@ void memory_device_register(struct memory *mem, const char *device_name,
 	mem->devices[newi].dyntrans_write_high = 0;
 	mem->devices[newi].f = f;
 	mem->devices[newi].extra = extra;
+	mem->devices[newi].checkpoint = NULL;
 
 	if (baseaddr < mem->mmap_dev_minaddr)
 		mem->mmap_dev_minaddr = baseaddr & ~mem->dev_dyntrans_alignment;
@@ -450,8 +667,7 @@ void memory_device_register(struct memory *mem, const char *device_name,
 		mem->mmap_dev_maxaddr = (((baseaddr + len) - 1) |
 		    mem->dev_dyntrans_alignment) + 1;
 
-	if (newi < mem->last_accessed_device)
-		mem->last_accessed_device ++;
+	memory_device_index_clear(mem);
 }
 
 
@@ -469,16 +685,30 @@ void memory_device_remove(struct memory *mem, int i)
 
 	mem->n_mmapped_devices --;
 
-	if (i == mem->n_mmapped_devices)
-		return;
+	if (i != mem->n_mmapped_devices)
+		memmove(&mem->devices[i], &mem->devices[i+1],
+		    sizeof(struct memory_device) * (mem->n_mmapped_devices-i));
+
+	memory_device_index_clear(mem);
+}
 
-	memmove(&mem->devices[i], &mem->devices[i+1],
-	    sizeof(struct memory_device) * (mem->n_mmapped_devices - i));
 
-	if (i <= mem->last_accessed_device)
-		mem->last_accessed_device --;
-	if (mem->last_accessed_device < 0)
-		mem->last_accessed_device = 0;
+/*
+ *  memory_device_set_checkpoint():
+ *
+ *  Sets the function which saves and restores the state of all devices
+ *  registered with a specific extra pointer. Unless all of a device's state
+ *  is in dyntrans memory, checkpoints are refused if it has no such function
+ *  (see checkpoint.cc).
+ */
+void memory_device_set_checkpoint(struct memory *mem, void *extra,
+	void (*checkpoint)(struct checkpoint *, void *))
+{
+	int i;
+
+	for (i=0; i<mem->n_mmapped_devices; i++)
+		if (mem->devices[i].extra == extra)
+			mem->devices[i].checkpoint = checkpoint;
 }
 
 
@@ -501,6 +731,10 @@ unsigned char *memory_paddr_to_hostaddr(struct memory *mem,
 	const int shrcount = MAX_BITS - BITS_PER_PAGETABLE;
 	unsigned char *hostptr;
 
+	/*  Contiguous RAM (see memory_map_ram()) needs no table lookup:  */
+	if (paddr < mem->ram_len)
+		return mem->ram_base + paddr;
+
 	table = (void **) mem->pagetable;
 	entry = (paddr >> shrcount) & mask;
 
@@ -525,14 +759,23 @@ unsigned char *memory_paddr_to_hostaddr(struct memory *mem,
 		/*  printf("  allocating for entry %i, len=%i\n",
 		    entry, alloclen);  */
 
-		/*  Anonymous mmap() should return zero-filled memory,
-		    try malloc + memset if mmap failed.  */
-		table[entry] = (void *) mmap(NULL, alloclen,
-		    PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+		pthread_mutex_lock(&memblock_alloc_lock);
+
+		/*  Another thread may have allocated it meanwhile.  */
 		if (table[entry] == NULL) {
-			CHECK_ALLOCATION(table[entry] = malloc(alloclen));
-			memset(table[entry], 0, alloclen);
+			/*  Anonymous mmap() should return zero-filled memory,
+			    try malloc + memset if mmap failed.  */
+			void *p = (void *) mmap(NULL, alloclen, PROT_READ |
+			    PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+			if (p == NULL || p == MAP_FAILED) {
+				CHECK_ALLOCATION(p = malloc(alloclen));
+				memset(p, 0, alloclen);
+			}
+
+			table[entry] = p;
 		}
+
+		pthread_mutex_unlock(&memblock_alloc_lock);
 	}
 
 	hostptr = (unsigned char *) table[entry];
@@ -544,6 +787,451 @@ unsigned char *memory_paddr_to_hostaddr(struct memory *mem,
 }
 
 
+/*
+ *  memory_dma_map():
+ *
+ *  Translates a range of emulated physical memory into a scatter/gather list
+ *  of host memory segments, so that a device can transfer data directly
+ *  to or from emulated memory (for example using pread() on a disk image),
+ *  instead of through a temporary buffer and memory_rw(). The range may
+ *  consist of normal RAM, and of devices which allow dyntrans access to
+ *  their data (such as dev_ram, and RAM mirrors).
+ *
+ *  Returns the number of segments, or -1 if a part of the range is neither,
+ *  or if more than max_segs segments would be needed. The device must then
+ *  fall back to using memory_rw(), e.g. with memory_dma_copy().
+ *
+ *  After writing to emulated memory, memory_dma_written() must be called.
+ */
+int memory_dma_map(struct memory *mem, uint64_t paddr, size_t len,
+	int writeflag, struct memory_dma_seg *segs, int max_segs)
+{
+	const uint64_t memblock_mask = (1 << BITS_PER_MEMBLOCK) - 1;
+	int n = 0;
+
+	while (len > 0) {
+		int i = memory_device_find_first(mem, paddr);
+		unsigned char *host;
+		uint64_t chunk;
+
+		if (i < mem->n_mmapped_devices &&
+		    mem->devices[i].baseaddr <= paddr) {
+			struct memory_device *dev = &mem->devices[i];
+			uint64_t ofs = paddr - dev->baseaddr;
+
+			if (!(dev->flags & (writeflag == MEM_WRITE?
+			    DM_DYNTRANS_WRITE_OK : DM_DYNTRANS_OK)) ||
+			    dev->dyntrans_data == NULL)
+				return -1;
+
+			chunk = dev->endaddr - paddr;
+			if (chunk > len)
+				chunk = len;
+
+			if (dev->flags & DM_EMULATED_RAM) {
+				/*  A mirror of RAM at a different address:  */
+				uint64_t p = paddr -
+				    *(uint64_t *) dev->dyntrans_data;
+				if (chunk > memblock_mask + 1 -
+				    (p & memblock_mask))
+					chunk = memblock_mask + 1 -
+					    (p & memblock_mask);
+				host = memory_paddr_to_hostaddr(mem, p,
+				    MEM_WRITE);
+				if (writeflag == MEM_WRITE)
+					memory_mark_dirty(mem, p, chunk);
+			} else
+				host = dev->dyntrans_data + ofs;
+
+			/*  Let e.g. framebuffers know what was changed:  */
+			if (writeflag == MEM_WRITE) {
+				if (ofs < dev->dyntrans_write_low)
+					dev->dyntrans_write_low = ofs;
+				if (ofs + chunk - 1 > dev->dyntrans_write_high)
+					dev->dyntrans_write_high = ofs +
+					    chunk - 1;
+			}
+		} else {
+			if (paddr >= mem->physical_max)
+				return -1;
+
+			/*  RAM, up to the next memblock or device:  */
+			chunk = memblock_mask + 1 - (paddr & memblock_mask);
+			if (i < mem->n_mmapped_devices &&
+			    mem->devices[i].baseaddr - paddr < chunk)
+				chunk = mem->devices[i].baseaddr - paddr;
+			if (mem->physical_max - paddr < chunk)
+				chunk = mem->physical_max - paddr;
+			if (chunk > len)
+				chunk = len;
+
+			host = memory_paddr_to_hostaddr(mem, paddr, MEM_WRITE);
+			if (writeflag == MEM_WRITE)
+				memory_mark_dirty(mem, paddr, chunk);
+		}
+
+		if (n > 0 && segs[n-1].host + segs[n-1].len == host) {
+			segs[n-1].len += chunk;
+		} else {
+			if (n >= max_segs)
+				return -1;
+			segs[n].host = host;
+			segs[n].len = chunk;
+			n ++;
+		}
+
+		paddr += chunk;
+		len -= chunk;
+	}
+
+	return n;
+}
+
+
+/*
+ *  memory_dma_written():
+ *
+ *  Must be called after a device has written to emulated memory without
+ *  going through memory_rw(). Code translations for the written pages are
+ *  invalidated in all CPUs of the machine.
+ */
+void memory_dma_written(struct cpu *cpu, uint64_t paddr, size_t len)
+{
+	/*  4 KB is the smallest dyntrans page size of any architecture.  */
+	const uint64_t pagesize = 4096;
+	struct machine *machine = cpu->machine;
+	uint64_t page, end = paddr + len;
+	int i;
+
+	if (len == 0)
+		return;
+
+	for (page = paddr & ~(pagesize - 1); page < end; page += pagesize) {
+		if (cpu->invalidate_code_translation != NULL)
+			cpu->invalidate_code_translation(cpu, page,
+			    INVALIDATE_PADDR);
+
+		/*  Other CPUs running in parallel are notified, and
+		    invalidate their own translations:  */
+		if (machine->smp != NULL) {
+			machine_smp_note_paddr(cpu, page, SMP_NOTE_CODE_WRITE);
+			continue;
+		}
+
+		for (i=0; i<machine->ncpus; i++) {
+			struct cpu *other = machine->cpus[i];
+			if (other != cpu &&
+			    other->invalidate_code_translation != NULL)
+				other->invalidate_code_translation(other,
+				    page, INVALIDATE_PADDR);
+		}
+	}
+}
+
+
+/*
+ *  memory_dma_copy():
+ *
+ *  Copies data between a buffer and emulated physical memory, as a DMA
+ *  capable device would. If the range cannot be accessed directly (see
+ *  memory_dma_map()), memory_rw() is used instead, one memblock at a time.
+ */
+void memory_dma_copy(struct cpu *cpu, uint64_t paddr, unsigned char *buf,
+	size_t len, int writeflag)
+{
+	struct memory_dma_seg segs[MEMORY_DMA_MAX_SEGS];
+	int i, n = memory_dma_map(cpu->mem, paddr, len, writeflag, segs,
+	    MEMORY_DMA_MAX_SEGS);
+
+	if (n >= 0) {
+		for (i=0; i<n; i++) {
+			if (writeflag == MEM_WRITE)
+				memcpy(segs[i].host, buf, segs[i].len);
+			else
+				memcpy(buf, segs[i].host, segs[i].len);
+			buf += segs[i].len;
+		}
+	} else {
+		const uint64_t memblock_mask = (1 << BITS_PER_MEMBLOCK) - 1;
+		uint64_t p = paddr;
+		size_t left = len;
+
+		while (left > 0) {
+			size_t chunk = memblock_mask + 1 - (p & memblock_mask);
+			if (chunk > left)
+				chunk = left;
+
+			cpu->memory_rw(cpu, cpu->mem, p, buf, chunk,
+			    writeflag, PHYSICAL);
+
+			p += chunk;
+			buf += chunk;
+			left -= chunk;
+		}
+
+		/*  (memory_rw has already invalidated translations.)  */
+		return;
+	}
+
+	if (writeflag == MEM_WRITE)
+		memory_dma_written(cpu, paddr, len);
+}
+
+
+/*
+ *  memory_dirty_rearm():
+ *
+ *  Helper for memory_dirty_tracking_start() and
+ *  memory_dirty_fetch_and_clear(). Makes sure that no CPU has a writable
+ *  translation of the (now clean) page at paddr, so that the next store to
+ *  the page goes through memory_rw() and marks it as dirty again. RAM
+ *  mirrors (DM_EMULATED_RAM devices) are write protected as well.
+ */
+static void memory_dirty_rearm(struct machine *machine, uint64_t paddr)
+{
+	struct memory *mem = machine->memory;
+	int i, j;
+
+	for (i=0; i<machine->ncpus; i++) {
+		struct cpu *cpu = machine->cpus[i];
+		if (cpu->invalidate_translation_caches != NULL)
+			cpu->invalidate_translation_caches(cpu, paddr,
+			    JUST_MARK_AS_NON_WRITABLE | INVALIDATE_PADDR);
+	}
+
+	for (j=0; j<mem->n_mmapped_devices; j++) {
+		struct memory_device *dev = &mem->devices[j];
+		uint64_t ofs, mirror;
+
+		if (!(dev->flags & DM_EMULATED_RAM))
+			continue;
+
+		ofs = *(uint64_t *) dev->dyntrans_data;
+		mirror = paddr + ofs;
+		if (mirror < dev->baseaddr || mirror >= dev->endaddr)
+			continue;
+
+		for (i=0; i<machine->ncpus; i++) {
+			struct cpu *cpu = machine->cpus[i];
+			if (cpu->invalidate_translation_caches != NULL)
+				cpu->invalidate_translation_caches(cpu, mirror,
+				    JUST_MARK_AS_NON_WRITABLE |
+				    INVALIDATE_PADDR);
+		}
+	}
+}
+
+
+/*
+ *  memory_dirty_tracking_start():
+ *
+ *  Starts tracking which pages of the machine's RAM are written to. All
+ *  pages start out as clean. Any writable translations which the CPUs
+ *  already have are removed.
+ *
+ *  This (and memory_dirty_fetch_and_clear()) must not be called while the
+ *  machine's CPUs are running on other host threads.
+ */
+void memory_dirty_tracking_start(struct machine *machine)
+{
+	struct memory *mem = machine->memory;
+	int i;
+
+	if (mem->dirty_tracking)
+		memory_dirty_tracking_stop(machine);
+
+	mem->dirty_table = (struct memory_dirty_block **) zeroed_alloc(
+	    sizeof(struct memory_dirty_block *) << BITS_PER_PAGETABLE);
+	mem->n_dirty_list = 0;
+	mem->dirty_tracking = 1;
+
+	for (i=0; i<machine->ncpus; i++) {
+		struct cpu *cpu = machine->cpus[i];
+		if (cpu->invalidate_translation_caches != NULL)
+			cpu->invalidate_translation_caches(cpu, 0,
+			    INVALIDATE_ALL);
+	}
+}
+
+
+/*
+ *  memory_dirty_tracking_stop():
+ *
+ *  Stops dirty page tracking, and frees the bitmaps. (Pages which were
+ *  write protected become writable again the next time they are written to.)
+ */
+void memory_dirty_tracking_stop(struct machine *machine)
+{
+	struct memory *mem = machine->memory;
+	int i;
+
+	if (!mem->dirty_tracking)
+		return;
+
+	mem->dirty_tracking = 0;
+
+	for (i=0; i<(1 << BITS_PER_PAGETABLE); i++)
+		if (mem->dirty_table[i] != NULL)
+			free(mem->dirty_table[i]);
+
+	munmap(mem->dirty_table,
+	    sizeof(struct memory_dirty_block *) << BITS_PER_PAGETABLE);
+	mem->dirty_table = NULL;
+
+	free(mem->dirty_list);
+	mem->dirty_list = NULL;
+	mem->n_dirty_list = mem->max_dirty_list = 0;
+}
+
+
+/*
+ *  memory_mark_dirty():
+ *
+ *  Marks the pages in a range of physical memory as dirty. This is done by
+ *  memory_rw() and the DMA functions, but must also be done by any other
+ *  code which writes directly to RAM using memory_paddr_to_hostaddr().
+ *
+ *  Does nothing if dirty page tracking is not enabled.
+ */
+void memory_mark_dirty(struct memory *mem, uint64_t paddr, size_t len)
+{
+	const int mask = (1 << BITS_PER_PAGETABLE) - 1;
+	const int shrcount = MAX_BITS - BITS_PER_PAGETABLE;
+	uint64_t page, end = paddr + len;
+
+	if (!mem->dirty_tracking || len == 0)
+		return;
+
+	for (page = paddr & ~(uint64_t)(MEMORY_DIRTY_PAGE_SIZE - 1);
+	    page < end; page += MEMORY_DIRTY_PAGE_SIZE) {
+		int entry = (page >> shrcount) & mask;
+		int nr = (page >> MEMORY_DIRTY_PAGE_SHIFT) &
+		    ((1 << (BITS_PER_MEMBLOCK - MEMORY_DIRTY_PAGE_SHIFT)) - 1);
+		uint64_t bit = (uint64_t)1 << (nr & 63);
+		struct memory_dirty_block *b = mem->dirty_table[entry];
+
+		/*  Already dirty? Then there is nothing to do.  */
+		if (b != NULL && b->bits[nr >> 6] & bit)
+			continue;
+
+		pthread_mutex_lock(&memblock_alloc_lock);
+
+		if (b == NULL && (b = mem->dirty_table[entry]) == NULL) {
+			CHECK_ALLOCATION(b = (struct memory_dirty_block *)
+			    malloc(sizeof(struct memory_dirty_block)));
+			memset(b, 0, sizeof(struct memory_dirty_block));
+			mem->dirty_table[entry] = b;
+		}
+
+		if (!b->listed) {
+			if (mem->n_dirty_list >= mem->max_dirty_list) {
+				mem->max_dirty_list = mem->max_dirty_list == 0?
+				    64 : mem->max_dirty_list * 2;
+				CHECK_ALLOCATION(mem->dirty_list = (int *)
+				    realloc(mem->dirty_list, sizeof(int) *
+				    mem->max_dirty_list));
+			}
+
+			mem->dirty_list[mem->n_dirty_list ++] = entry;
+			b->listed = 1;
+		}
+
+		b->bits[nr >> 6] |= bit;
+
+		pthread_mutex_unlock(&memblock_alloc_lock);
+	}
+}
+
+
+/*
+ *  memory_dirty_write_ok():
+ *
+ *  Returns 1 if a range of physical memory may be mapped as writable in the
+ *  dyntrans translation tables, i.e. if dirty page tracking is not enabled,
+ *  or if all pages in the range are already dirty. Otherwise 0 is returned,
+ *  and the range must be mapped read-only.
+ */
+int memory_dirty_write_ok(struct memory *mem, uint64_t paddr, size_t len)
+{
+	const int mask = (1 << BITS_PER_PAGETABLE) - 1;
+	const int shrcount = MAX_BITS - BITS_PER_PAGETABLE;
+	uint64_t page, end = paddr + len;
+
+	if (!mem->dirty_tracking)
+		return 1;
+
+	for (page = paddr & ~(uint64_t)(MEMORY_DIRTY_PAGE_SIZE - 1);
+	    page < end; page += MEMORY_DIRTY_PAGE_SIZE) {
+		struct memory_dirty_block *b =
+		    mem->dirty_table[(page >> shrcount) & mask];
+		int nr = (page >> MEMORY_DIRTY_PAGE_SHIFT) &
+		    ((1 << (BITS_PER_MEMBLOCK - MEMORY_DIRTY_PAGE_SHIFT)) - 1);
+
+		if (b == NULL || !(b->bits[nr >> 6] & ((uint64_t)1 << (nr&63))))
+			return 0;
+	}
+
+	return 1;
+}
+
+
+/*
+ *  memory_dirty_fetch_and_clear():
+ *
+ *  Calls func once for each page (MEMORY_DIRTY_PAGE_SIZE bytes) of RAM which
+ *  has been written to since dirty page tracking was started, or since the
+ *  last call to this function, in increasing address order within each
+ *  memblock. The pages are then marked as clean again, and write protected
+ *  in the CPUs' translation caches. func may be NULL.
+ *
+ *  The time taken is proportional to the number of dirty pages.
+ *
+ *  Returns the number of dirty pages.
+ */
+size_t memory_dirty_fetch_and_clear(struct machine *machine,
+	void (*func)(uint64_t paddr, void *extra), void *extra)
+{
+	const int shrcount = MAX_BITS - BITS_PER_PAGETABLE;
+	struct memory *mem = machine->memory;
+	size_t n = 0;
+	int i, w, nr;
+
+	if (!mem->dirty_tracking)
+		return 0;
+
+	for (i=0; i<mem->n_dirty_list; i++) {
+		int entry = mem->dirty_list[i];
+		struct memory_dirty_block *b = mem->dirty_table[entry];
+
+		for (w=0; w<MEMORY_DIRTY_WORDS_PER_BLOCK; w++) {
+			uint64_t bits = b->bits[w];
+			b->bits[w] = 0;
+
+			for (nr = w*64; bits != 0; nr++, bits >>= 1) {
+				uint64_t paddr;
+
+				if (!(bits & 1))
+					continue;
+
+				paddr = ((uint64_t)entry << shrcount) +
+				    ((uint64_t)nr << MEMORY_DIRTY_PAGE_SHIFT);
+
+				memory_dirty_rearm(machine, paddr);
+				if (func != NULL)
+					func(paddr, extra);
+				n ++;
+			}
+		}
+
+		b->listed = 0;
+	}
+
+	mem->n_dirty_list = 0;
+
+	return n;
+}
+
+
 #define	UPDATE_CHECKSUM(value) {					\
 		internal_state -= 0x118c7771c0c0a77fULL;		\
 		internal_state = ((internal_state + (value)) << 7) ^	\
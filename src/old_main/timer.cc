@@ -26,14 +26,20 @@
  *
  *
  *  Timer framework. This is used by emulated clocks.
+ *
+ *  Timers are kept in a timer wheel: an array of TIMER_WHEEL_SLOTS lists,
+ *  where each slot covers TIMER_WHEEL_RESOLUTION_NS nanoseconds of host
+ *  time. The main loop calls timer_poll() between quanta, which reads the
+ *  monotonic host clock and runs the tick functions of all timers which
+ *  are due. No signals are used, so tick functions always run on the main
+ *  thread, and never in the middle of an instruction or a system call.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <signal.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
-#include <sys/time.h>
 
 #include "misc.h"
 #include "timer.h"
@@ -43,26 +49,103 @@
 
 
 struct timer {
-	struct timer	*next;
+	struct timer	*next;		/*  next timer in the same slot  */
+	int		slot;		/*  -1 if not in the wheel  */
 
 	double		freq;
 	void		(*timer_tick)(struct timer *timer, void *extra);
 	void		*extra;
 
-	double		interval;
-	double		next_tick_at;
+	int64_t		interval;	/*  in nanoseconds  */
+	int64_t		next_tick_at;	/*  nanoseconds since timer_start()  */
 };
 
-static struct timer *first_timer = NULL;
-struct timeval timer_start_tv;
-static double timer_freq;
-static int timer_countdown_to_next_gettimeofday;
-static double timer_current_time;
-static double timer_current_time_step;
+#define	TIMER_WHEEL_SLOTS		256
+#define	TIMER_WHEEL_RESOLUTION_NS	1000000
+
+/*  Ticks which are more than this late are skipped instead of delivered:  */
+#define	TIMER_MAX_LAG_NS		1000000000
+
+static struct timer *timer_wheel[TIMER_WHEEL_SLOTS];
+static struct timespec timer_start_ts;
+static int64_t timer_last_polled_slot;
 
 static int timer_is_running;
 
-#define	SECONDS_BETWEEN_GETTIMEOFDAY_SYNCH	1.65
+
+/*
+ *  timer_now():
+ *
+ *  Returns the number of nanoseconds since timer_start(), or 0 if the timers
+ *  are not running.
+ */
+static int64_t timer_now(void)
+{
+	struct timespec ts;
+
+	if (!timer_is_running)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t) (ts.tv_sec - timer_start_ts.tv_sec) * 1000000000
+	    + (ts.tv_nsec - timer_start_ts.tv_nsec);
+}
+
+
+/*
+ *  timer_link(), timer_unlink():
+ *
+ *  Insert a timer into (or remove it from) the wheel slot which corresponds
+ *  to its next_tick_at.
+ */
+static void timer_link(struct timer *t)
+{
+	int slot = (t->next_tick_at / TIMER_WHEEL_RESOLUTION_NS)
+	    & (TIMER_WHEEL_SLOTS - 1);
+
+	t->slot = slot;
+	t->next = timer_wheel[slot];
+	timer_wheel[slot] = t;
+}
+
+static void timer_unlink(struct timer *t)
+{
+	struct timer **pp = &timer_wheel[t->slot];
+
+	while (*pp != NULL && *pp != t)
+		pp = &(*pp)->next;
+
+	if (*pp == NULL) {
+		fprintf(stderr, "timer_unlink(): timer %p not in slot %i."
+		    " aborting\n", t, t->slot);
+		exit(1);
+	}
+
+	*pp = t->next;
+	t->slot = -1;
+}
+
+
+/*
+ *  timer_set_freq():
+ *
+ *  Sets the frequency of a timer which is not in the wheel, and schedules
+ *  its next tick one interval from now.
+ */
+static void timer_set_freq(struct timer *t, double freq)
+{
+	t->freq = freq;
+
+	if (freq <= 0.00000001)
+		freq = 0.00000001;
+
+	t->interval = (int64_t) (1000000000.0 / freq);
+	if (t->interval < 1)
+		t->interval = 1;
+
+	t->next_tick_at = timer_now() + t->interval;
+}
 
 
 /*
@@ -78,19 +161,13 @@ struct timer *timer_add(double freq, void (*timer_tick)(struct timer *timer,
 	struct timer *newtimer;
 
 	CHECK_ALLOCATION(newtimer = (struct timer *) malloc(sizeof(struct timer)));
+	memset(newtimer, 0, sizeof(struct timer));
 
-	if (freq <= 0.00000001)
-		freq = 0.00000001;
-
-	newtimer->freq = freq;
 	newtimer->timer_tick = timer_tick;
 	newtimer->extra = extra;
 
-	newtimer->interval = 1.0 / freq;
-	newtimer->next_tick_at = timer_current_time + newtimer->interval;
-
-	newtimer->next = first_timer;
-	first_timer = newtimer;
+	timer_set_freq(newtimer, freq);
+	timer_link(newtimer);
 
 	return newtimer;
 }
@@ -103,24 +180,8 @@ struct timer *timer_add(double freq, void (*timer_tick)(struct timer *timer,
  */
 void timer_remove(struct timer *t)
 {
-	struct timer *prev = NULL, *cur = first_timer;
-
-	while (cur != NULL && cur != t) {
-		prev = cur;
-		cur = cur->next;
-	}
-
-	if (cur == t) {
-		if (prev == NULL)
-			first_timer = cur->next;
-		else
-			prev->next = cur->next;
-		free(cur);
-	} else {
-		fprintf(stderr, "attempt to remove timer %p which "
-		    "doesn't exist. aborting\n", t);
-		exit(1);
-	}
+	timer_unlink(t);
+	free(t);
 }
 
 
@@ -134,142 +195,224 @@ void timer_update_frequency(struct timer *t, double new_freq)
 	if (t->freq == new_freq)
 		return;
 
-	t->freq = new_freq;
+	timer_unlink(t);
+	timer_set_freq(t, new_freq);
+	timer_link(t);
+}
 
-	if (new_freq <= 0.00000001)
-		new_freq = 0.00000001;
 
-	t->interval = 1.0 / new_freq;
-	t->next_tick_at = timer_current_time + t->interval;
+/*
+ *  timer_get_frequency():
+ *
+ *  Returns the frequency of a timer, in Hz.
+ */
+double timer_get_frequency(struct timer *t)
+{
+	return t->freq;
 }
 
 
 /*
- *  timer_tick():
+ *  timer_poll():
+ *
+ *  Runs the tick function of every timer which is due. A timer which has
+ *  fallen behind gets one call per missed tick, except for ticks which are
+ *  more than TIMER_MAX_LAG_NS late; those are skipped.
  *
- *  Timer tick handler. This is where the interesting stuff happens.
+ *  This should be called from the main loop, at least every millisecond or
+ *  so for accurate emulated clocks. It is cheap to call when nothing is due.
+ *  Tick functions must not add, remove or change the frequency of timers.
  */
-static void timer_tick(int signal_nr)
+void timer_poll(void)
 {
-	struct timer *timer = first_timer;
-	struct timeval tv;
-
-	timer_current_time += timer_current_time_step;
-
-	if ((--timer_countdown_to_next_gettimeofday) < 0) {
-		gettimeofday(&tv, NULL);
-		tv.tv_sec -= timer_start_tv.tv_sec;
-		tv.tv_usec -= timer_start_tv.tv_usec;
-		if (tv.tv_usec < 0) {
-			tv.tv_usec += 1000000;
-			tv.tv_sec --;
-		}
+	struct timer *due = NULL, *t;
+	int64_t now, now_slot, slot_nr;
+
+	if (!timer_is_running)
+		return;
 
-#ifdef TIMER_DEBUG
-		/*  For debugging/testing:  */
-		{
-			double diff = tv.tv_usec * 0.000001 + tv.tv_sec
-			    - timer_current_time;
-			printf("timer: lagging behind %f seconds\n", diff);
+	now = timer_now();
+	now_slot = now / TIMER_WHEEL_RESOLUTION_NS;
+
+	/*
+	 *  Each slot only needs to be visited once per poll. The slot which
+	 *  was current at the last poll is visited again, since timers in it
+	 *  may have become due since then.
+	 */
+	slot_nr = timer_last_polled_slot;
+	if (now_slot - slot_nr >= TIMER_WHEEL_SLOTS)
+		slot_nr = now_slot - TIMER_WHEEL_SLOTS + 1;
+
+	timer_last_polled_slot = now_slot;
+
+	/*
+	 *  Take the timers which are due out of their slots. (Timers which
+	 *  are not due yet, e.g. because they are one or more laps around
+	 *  the wheel away, are left where they are.)
+	 */
+	for (; slot_nr <= now_slot; slot_nr ++) {
+		struct timer **pp =
+		    &timer_wheel[slot_nr & (TIMER_WHEEL_SLOTS - 1)];
+
+		while ((t = *pp) != NULL) {
+			if (t->next_tick_at > now) {
+				pp = &t->next;
+				continue;
+			}
+
+			*pp = t->next;
+			t->next = due;
+			due = t;
 		}
-#endif
+	}
 
-		/*  Get exponentially closer to the real time, instead of
-		    just changing to it directly:  */
-		timer_current_time = ( (tv.tv_usec * 0.000001 + tv.tv_sec) +
-		    timer_current_time ) / 2;
+	while ((t = due) != NULL) {
+		due = t->next;
 
-		timer_countdown_to_next_gettimeofday = (int64_t) (timer_freq *
-		    SECONDS_BETWEEN_GETTIMEOFDAY_SYNCH);
-	}
+		if (now - t->next_tick_at > TIMER_MAX_LAG_NS)
+			t->next_tick_at += (now - t->next_tick_at)
+			    / t->interval * t->interval;
 
-	while (timer != NULL) {
-		while (timer_current_time >= timer->next_tick_at) {
-			timer->timer_tick(timer, timer->extra);
-			timer->next_tick_at += timer->interval;
+		while (t->next_tick_at <= now) {
+			t->timer_tick(t, t->extra);
+			t->next_tick_at += t->interval;
 		}
 
-		timer = timer->next;
+		timer_link(t);
 	}
-
-#ifdef TEST
-	printf("T"); fflush(stdout);
-#endif
 }
 
 
 /*
  *  timer_start():
  *
- *  Set the interval timer to timer_freq Hz, and install the signal handler.
+ *  Start (or restart) the host clock which all timers are based on. Each
+ *  timer's next tick is one interval from now.
  */
 void timer_start(void)
 {
-	struct timer *timer = first_timer;
-	struct itimerval val;
-	struct sigaction saction;
+	struct timer *all = NULL, *t;
+	int i;
 
 	if (timer_is_running)
 		return;
 
+	clock_gettime(CLOCK_MONOTONIC, &timer_start_ts);
 	timer_is_running = 1;
-
-	gettimeofday(&timer_start_tv, NULL);
-	timer_current_time = 0.0;
+	timer_last_polled_slot = 0;
 
 	/*  Reset all timers:  */
-	while (timer != NULL) {
-		timer->next_tick_at = timer->interval;
-		timer = timer->next;
+	for (i=0; i<TIMER_WHEEL_SLOTS; i++) {
+		while ((t = timer_wheel[i]) != NULL) {
+			timer_wheel[i] = t->next;
+			t->next = all;
+			all = t;
+		}
 	}
-	val.it_interval.tv_sec = 0;
-	val.it_interval.tv_usec = (int) (1000000.0 / timer_freq);
-	val.it_value.tv_sec = 0;
-	val.it_value.tv_usec = (int) (1000000.0 / timer_freq);
 
-	memset(&saction, 0, sizeof(saction));
-	saction.sa_handler = timer_tick;
-	saction.sa_flags = SA_RESTART;
-
-	sigaction(SIGALRM, &saction, NULL);
-
-	setitimer(ITIMER_REAL, &val, NULL);
+	while ((t = all) != NULL) {
+		all = t->next;
+		t->next_tick_at = t->interval;
+		timer_link(t);
+	}
 }
 
 
 /*
  *  timer_stop():
  *
- *  Deinstall the signal handler, and disable the interval timer.
+ *  Stop delivering ticks. (Used e.g. while the debugger is waiting for
+ *  user input.)
  */
 void timer_stop(void)
 {
-	struct itimerval val;
-	struct sigaction saction;
-
-	if (!timer_is_running)
-		return;
-
 	timer_is_running = 0;
+}
 
-	val.it_interval.tv_sec = 0;
-	val.it_interval.tv_usec = 0;
-	val.it_value.tv_sec = 0;
-	val.it_value.tv_usec = 0;
 
-	setitimer(ITIMER_REAL, &val, NULL);
+#ifdef TEST
+/*
+ *  Jitter test: Timers at TEST_HZ and at a few other frequencies are polled
+ *  from a loop which also keeps the host CPU busy, like the main loop does
+ *  when running emulated code. The delay between when each tick was due
+ *  and when it was delivered is measured, and the number of ticks and the
+ *  longest gap between two ticks of each timer are checked.
+ */
+#define	TEST_HZ		1000
+#define	TEST_SECONDS	2
 
-	memset(&saction, 0, sizeof(saction));
-	saction.sa_handler = NULL;
+/*  Allowed gap between two ticks, beyond one interval (host scheduling):  */
+#define	TEST_MAX_EXTRA_GAP_NS	20000000
 
-	sigaction(SIGALRM, &saction, NULL);
-}
+static const double test_freqs[] = { TEST_HZ, 64, 256, 1024, 0 };
 
+struct timer_test {
+	double		freq;
+	int		n_ticks;
+	int64_t		last_tick;
+	int64_t		max_gap;
+	int64_t		max_late, sum_late;
+	int		n_late_1ms;
+};
 
-#ifdef TEST
 static void timer_tick_test(struct timer *t, void *extra)
 {
-	printf((char *) extra); fflush(stdout);
+	struct timer_test *tt = (struct timer_test *) extra;
+	int64_t now = timer_now(), late = now - t->next_tick_at;
+
+	if (late > tt->max_late)
+		tt->max_late = late;
+	if (late > 1000000)
+		tt->n_late_1ms ++;
+	if (now - tt->last_tick > tt->max_gap)
+		tt->max_gap = now - tt->last_tick;
+
+	tt->last_tick = now;
+	tt->sum_late += late;
+	tt->n_ticks ++;
+}
+
+static void timer_test(void)
+{
+	struct timer_test tests[sizeof(test_freqs) / sizeof(double)];
+	volatile uint64_t x = 1;
+	int i, n, failed = 0;
+
+	memset(tests, 0, sizeof(tests));
+	for (n=0; test_freqs[n] != 0; n++) {
+		tests[n].freq = test_freqs[n];
+		timer_add(test_freqs[n], timer_tick_test, &tests[n]);
+	}
+
+	timer_start();
+
+	while (timer_now() < (int64_t) TEST_SECONDS * 1000000000) {
+		/*  "Load": roughly what one dyntrans quantum costs.  */
+		for (i=0; i<20000; i++)
+			x = x * 6364136223846793005ULL + 1;
+
+		timer_poll();
+	}
+
+	for (i=0; i<n; i++) {
+		struct timer_test *tt = &tests[i];
+		int expected = (int) (tt->freq * TEST_SECONDS);
+		int ok = tt->n_ticks >= expected - 1 &&
+		    tt->n_ticks <= expected &&
+		    tt->max_gap < 1000000000 / tt->freq + TEST_MAX_EXTRA_GAP_NS;
+
+		printf("%5.0f Hz: %i ticks (expected %i), max gap %.1f ms, "
+		    "mean late %.1f us, max late %.1f us, %i more than 1 ms "
+		    "late: %s\n", tt->freq, tt->n_ticks, expected,
+		    tt->max_gap / 1000000.0, tt->n_ticks?
+		    tt->sum_late / 1000.0 / tt->n_ticks : 0.0,
+		    tt->max_late / 1000.0, tt->n_late_1ms, ok? "ok" : "FAILED");
+
+		if (!ok)
+			failed = 1;
+	}
+
+	exit(failed);
 }
 #endif
 
@@ -281,21 +424,11 @@ static void timer_tick_test(struct timer *t, void *extra)
  */
 void timer_init(void)
 {
-	first_timer = NULL;
-	timer_current_time = 0.0;
+	memset(timer_wheel, 0, sizeof(timer_wheel));
 	timer_is_running = 0;
-	timer_countdown_to_next_gettimeofday = 0;
-
-	timer_freq = TIMER_BASE_FREQUENCY;
-	timer_current_time_step = 1.0 / timer_freq;
+	timer_last_polled_slot = 0;
 
 #ifdef TEST
-	timer_add(0.5, timer_tick_test, "X");
-	timer_add(10.0, timer_tick_test, ".");
-	timer_add(200.0, timer_tick_test, " ");
-	timer_start();
-	while (1)
-		sleep(999999);
+	timer_test();
 #endif
 }
-
@@ -1546,9 +1546,7 @@ int arcbios_emul(struct cpu *cpu)
 			fflush(stdin);
 			fflush(stdout);
 			/*  NOTE/TODO: This gives a tick to _everything_  */
-			for (j2=0; j2<machine->tick_functions.n_entries; j2++)
-				machine->tick_functions.f[j2](cpu,
-				    machine->tick_functions.extra[j2]);
+			machine_events_tick_all(machine, cpu);
 
 			a2 = cpu->cd.mips.gpr[MIPS_GPR_A2];
 			for (j2=0; j2<a2; j2++) {